@@ -6,4 +6,12 @@ return {
   eval_keyup = true,
   eval_repeat = true,
   disabled = false,
+  gc_slice_us = 250,
+  gc_ceiling_kb = 4096,
+  script_memory_limit_kb = 0,
+  notify_burst = 4,
+  notify_rate_per_min = 12,
+  notify_dedup_ms = 10000,
+  script_pool_size = 2,
+  profile_sample_us = 0,
 }
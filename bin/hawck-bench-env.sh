@@ -0,0 +1,54 @@
+## Sourced by the benchmark scripts: sets up a throwaway home directory with
+## the Hawck runtime from the source tree, and starts MacroD in it.
+##
+## Expects MACROD and SRC to be set, bench scripts are written to
+## $XDG_CONFIG_HOME/hawck/scripts before calling start_macrod.
+
+TMP="$(mktemp -d)"
+SOCK="$TMP/kbd.sock"
+MACROD_PID=""
+cleanup() {
+    [ -n "$MACROD_PID" ] && kill "$MACROD_PID" 2>/dev/null
+    rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+export HOME="$TMP/home"
+export XDG_CONFIG_HOME="$HOME/.config"
+export XDG_DATA_HOME="$HOME/.local/share"
+export XDG_CACHE_HOME="$HOME/.cache"
+export XDG_RUNTIME_DIR="$TMP/run"
+mkdir -p "$XDG_CONFIG_HOME/hawck/scripts" "$XDG_DATA_HOME/hawck/scripts" "$XDG_RUNTIME_DIR"
+chmod 0700 "$XDG_RUNTIME_DIR"
+
+ln -s "$SRC/src/Lua" "$XDG_DATA_HOME/hawck/scripts/LLib"
+ln -s "$SRC/keymaps" "$XDG_DATA_HOME/hawck/scripts/keymaps"
+ln -s "$SRC/src/Lua/init.lua" "$XDG_DATA_HOME/hawck/scripts/init.lua"
+cp "$SRC/bin/cfg.lua" "$XDG_DATA_HOME/hawck/cfg.lua"
+## Notifications would only get in the way of the measurements.
+sed -i 's/notify_on_err = true/notify_on_err = false/' "$XDG_DATA_HOME/hawck/cfg.lua"
+
+## The clients retry their connection forever, so fail instead of hanging
+## when MacroD has died or never got as far as creating its socket.
+check_macrod() {
+    if ! kill -0 "$MACROD_PID" 2>/dev/null || [ ! -S "$SOCK" ]; then
+        echo "hawck-macrod is not running, its output was:" >&2
+        cat "$TMP/macrod.log" >&2
+        exit 1
+    fi
+}
+
+## Start MacroD on $SOCK, and wait up to 10 seconds for it to listen.
+## MacroD only loads scripts that are executable, and not writable by
+## anyone else.
+start_macrod() {
+    chmod 0755 "$XDG_CONFIG_HOME"/hawck/scripts/*
+    "$MACROD" --no-fork --socket "$SOCK" > "$TMP/macrod.log" 2>&1 &
+    MACROD_PID=$!
+    i=0
+    while [ ! -S "$SOCK" ] && [ "$i" -lt 100 ] && kill -0 "$MACROD_PID" 2>/dev/null; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+    check_macrod
+}
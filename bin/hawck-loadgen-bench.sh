@@ -0,0 +1,28 @@
+#!/bin/sh
+## Saturation benchmark: starts MacroD in a throwaway home directory, and
+## runs hawck-loadgen against it at increasing rates until it can't keep up,
+## then presses a key bound to a macro that types 500 key events.
+##
+## Usage: hawck-loadgen-bench.sh <hawck-macrod> <hawck-loadgen> <source dir> [<seconds>]
+
+set -e
+
+MACROD="$1"
+LOADGEN="$2"
+SRC="$3"
+DURATION="${4:-2}"
+
+. "$SRC/bin/hawck-bench-env.sh"
+
+## 250 letters, 500 key events on each press, the release passes through.
+cat > "$XDG_CONFIG_HOME/hawck/scripts/bench.hwk" <<'HWK'
+down + key "F12" => write "abcdefghijklmnopqrstuvwxyabcdefghijklmnopqrstuvwxyabcdefghijklmnopqrstuvwxyabcdefghijklmnopqrstuvwxyabcdefghijklmnopqrstuvwxyabcdefghijklmnopqrstuvwxyabcdefghijklmnopqrstuvwxyabcdefghijklmnopqrstuvwxyabcdefghijklmnopqrstuvwxyabcdefghijklmnopqrstuvwxy"
+HWK
+
+start_macrod
+
+"$LOADGEN" --socket "$SOCK" --sweep --duration "$DURATION"
+check_macrod
+"$LOADGEN" --socket "$SOCK" --pattern chords --devices 4 --sweep --rates 20,50,100 --duration "$DURATION"
+check_macrod
+"$LOADGEN" --socket "$SOCK" --pattern macro --macro-events 500 --rate 1 --duration 4
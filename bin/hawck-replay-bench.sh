@@ -0,0 +1,26 @@
+#!/bin/sh
+## End-to-end latency benchmark: starts MacroD in a throwaway home directory,
+## and replays a generated trace against it with hawck-replay.
+##
+## Usage: hawck-replay-bench.sh <hawck-macrod> <hawck-replay> <source dir> [<n>]
+
+set -e
+
+MACROD="$1"
+REPLAY="$2"
+SRC="$3"
+N="${4:-40}"
+
+. "$SRC/bin/hawck-bench-env.sh"
+
+cat > "$XDG_CONFIG_HOME/hawck/scripts/bench.hwk" <<'HWK'
+key "a" => insert "b"
+down + key "c" => {
+  key "d" => insert "e"
+}
+HWK
+
+start_macrod
+
+"$REPLAY" --generate "$N" "$TMP/trace"
+"$REPLAY" --socket "$SOCK" "$TMP/trace"
@@ -0,0 +1,108 @@
+/** @file BoundedQueue.hpp
+ *
+ * @brief Bounded lock-free multi-producer multi-consumer queue.
+ *
+ * This is Dmitry Vyukov's bounded MPMC queue. Every slot carries a sequence
+ * number that tells producers and consumers whose turn it is to use the slot,
+ * so pushing and popping only take a compare-and-swap on the position, and
+ * never block or allocate.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+template <class T>
+class BoundedQueue {
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T val;
+    };
+
+    /** Keep the positions on separate cache lines, producers and consumers
+     *  would otherwise contend on the same line. */
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(CACHE_LINE) std::atomic<size_t> head{0};
+    alignas(CACHE_LINE) std::atomic<size_t> tail{0};
+
+public:
+    /**
+     * @param capacity Maximum number of elements, rounded up to a power
+     *                 of two.
+     */
+    explicit BoundedQueue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity)
+            n <<= 1;
+        slots.reset(new Slot[n]);
+        for (size_t i = 0; i < n; i++)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        mask = n - 1;
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    /** Push an element.
+     *
+     * @return False if the queue was full, in which case val is left as it
+     *         was.
+     */
+    bool push(T &&val) noexcept {
+        Slot *slot;
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->val = std::move(val);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Pop an element.
+     *
+     * @return False if the queue was empty.
+     */
+    bool pop(T &out) noexcept {
+        Slot *slot;
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        out = std::move(slot->val);
+        slot->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline size_t capacity() const noexcept {
+        return mask + 1;
+    }
+};
@@ -0,0 +1,181 @@
+/** @file EpochPtr.hpp
+ *
+ * @brief Pointer to an immutable object that can be replaced while it is
+ *        being read.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * Holds the current version of an object, readers get the current version
+ * without taking a lock, and writers replace it with a new version.
+ *
+ * Replaced versions are freed once no reader can be using them. Every
+ * reader has a slot that holds the epoch that it started reading in, and a
+ * version that was replaced in epoch e is freed when no reader has been
+ * reading since epoch e or earlier. Old versions are only freed by
+ * reclaim(), so the owner decides which thread runs their destructors.
+ */
+template <class T>
+class EpochPtr {
+private:
+    struct Slot {
+        /** Epoch the reader started reading in, 0 when it isn't reading. */
+        std::atomic<uint64_t> epoch{0};
+        /** Protected by mtx. */
+        bool taken = false;
+    };
+
+    std::atomic<T *> ptr;
+    std::atomic<uint64_t> epoch{1};
+    /** Protects the slot list and the retired versions. */
+    std::mutex mtx;
+    /** A list, so that slots keep their address. */
+    std::list<Slot> slots;
+    /** Versions that have been replaced, and the epoch they were replaced
+     *  in. */
+    std::vector<std::pair<T *, uint64_t>> retired;
+
+public:
+    /** A read of the current version, the version stays alive until the
+     *  guard is destroyed. */
+    class Guard {
+    private:
+        Slot *slot;
+        const T *obj;
+
+    public:
+        inline Guard(Slot *slot, const T *obj) noexcept : slot(slot), obj(obj) {}
+        inline Guard(Guard &&other) noexcept : slot(other.slot), obj(other.obj) {
+            other.slot = nullptr;
+        }
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+        inline ~Guard() noexcept {
+            if (slot)
+                slot->epoch.store(0, std::memory_order_release);
+        }
+
+        inline const T &operator*() const noexcept { return *obj; }
+        inline const T *operator->() const noexcept { return obj; }
+    };
+
+    /** A reader, each thread that reads needs its own. */
+    class Reader {
+    private:
+        EpochPtr *owner;
+        Slot *slot;
+
+    public:
+        inline Reader(EpochPtr *owner, Slot *slot) noexcept : owner(owner), slot(slot) {}
+        inline Reader(Reader &&other) noexcept : owner(other.owner), slot(other.slot) {
+            other.slot = nullptr;
+        }
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        inline ~Reader() noexcept {
+            if (!slot)
+                return;
+            std::lock_guard<std::mutex> lock(owner->mtx);
+            slot->taken = false;
+        }
+
+        /** Get the current version, a reader can only hold one guard at a
+         *  time. */
+        inline Guard lock() noexcept {
+            // The epoch is announced before the pointer is loaded, so a
+            // writer that has not seen the announcement has already
+            // replaced the pointer.
+            slot->epoch.store(owner->epoch.load());
+            return Guard(slot, owner->ptr.load());
+        }
+    };
+
+    explicit EpochPtr(std::unique_ptr<T> init)
+        : ptr(init.release())
+    {}
+
+    ~EpochPtr() {
+        delete ptr.load();
+        for (auto &[obj, _] : retired) {
+            (void) _;
+            delete obj;
+        }
+    }
+
+    EpochPtr(const EpochPtr &) = delete;
+    EpochPtr &operator=(const EpochPtr &) = delete;
+
+    /** Register a reader. */
+    Reader reader() {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto &slot : slots) {
+            if (!slot.taken) {
+                slot.taken = true;
+                return Reader(this, &slot);
+            }
+        }
+        slots.emplace_back();
+        slots.back().taken = true;
+        return Reader(this, &slots.back());
+    }
+
+    /** The current version, for writers. It is only safe to use until the
+     *  next call to publish(), so writers have to be serialized. */
+    inline const T *current() const noexcept {
+        return ptr.load();
+    }
+
+    /** Replace the current version, the old version is kept until a
+     *  call to reclaim() finds that it is no longer being read. */
+    void publish(std::unique_ptr<T> next) {
+        T *old = ptr.exchange(next.release());
+        uint64_t replaced_in = epoch.fetch_add(1);
+        std::lock_guard<std::mutex> lock(mtx);
+        retired.emplace_back(old, replaced_in);
+    }
+
+    /** Free old versions that are no longer being read. */
+    void reclaim() {
+        std::vector<T *> dead;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (retired.empty())
+                return;
+            uint64_t oldest = std::numeric_limits<uint64_t>::max();
+            for (auto &slot : slots) {
+                uint64_t e = slot.epoch.load();
+                if (e != 0 && e < oldest)
+                    oldest = e;
+            }
+            for (auto it = retired.begin(); it != retired.end();) {
+                if (it->second < oldest) {
+                    dead.push_back(it->first);
+                    it = retired.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        // Destructors may be slow, so they are run without the lock.
+        for (T *obj : dead)
+            delete obj;
+    }
+
+    /** Number of replaced versions that have not been freed yet. */
+    inline size_t pending() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return retired.size();
+    }
+};
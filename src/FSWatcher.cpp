@@ -42,6 +42,7 @@ extern "C" {
 
 #include "FSWatcher.hpp"
 #include "SystemError.hpp"
+#include "Probes.hpp"
 
 using namespace std;
 
@@ -242,6 +243,7 @@ void FSWatcher::watch(const function<bool(FSEvent &ev)> &callback) {
                         ev = (struct inotify_event *) p;
                         FSEvent *fs_ev = handleEvent(ev);
                         if (fs_ev != nullptr) {
+                            HAWCK_PROBE(fs_event, fs_ev->path.c_str(), fs_ev->mask);
                             if (!callback(*fs_ev))
                                 running = RunState::STOPPING;
                             delete fs_ev;
@@ -0,0 +1,217 @@
+/** @file FlightRecorder.cpp
+ *
+ * @brief Ring of what happened to the last few thousand events.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+extern "C" {
+    #include <fcntl.h>
+    #include <linux/input-event-codes.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <syslog.h>
+    #include <time.h>
+    #include <unistd.h>
+}
+
+#include "FlightRecorder.hpp"
+#include "Permissions.hpp"
+#include "SystemError.hpp"
+
+using namespace std;
+
+static constexpr char MAGIC[8] = {'H', 'W', 'K', 'F', 'L', 'I', 'G', 'H'};
+static constexpr uint32_t VERSION = 1;
+/** The slots start at this offset. */
+static constexpr size_t HEADER_SIZE = 128;
+
+static_assert(sizeof(FlightHeader) <= HEADER_SIZE, "FlightHeader does not fit");
+static_assert(sizeof(FlightSlot) == 64, "FlightSlot should fill a cache line");
+static_assert(atomic<uint64_t>::is_always_lock_free,
+              "The ring is shared between processes");
+
+static uint64_t clockNS(clockid_t clock) noexcept {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool isModifier(int code) noexcept {
+    switch (code) {
+        case KEY_LEFTCTRL: case KEY_RIGHTCTRL:
+        case KEY_LEFTSHIFT: case KEY_RIGHTSHIFT:
+        case KEY_LEFTALT: case KEY_RIGHTALT:
+        case KEY_LEFTMETA: case KEY_RIGHTMETA:
+        case KEY_CAPSLOCK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+const char *FlightRecord::kindName(Kind kind) noexcept {
+    static const char *names[] = {
+        "input", "to_macrod", "passthrough", "from_macrod", "written",
+        "timeout", "reconnect", "release_all", "recv", "match", "passed",
+        "script_error", "gc_forced", "loaded", "unloaded",
+    };
+    if (kind < sizeof(names) / sizeof(names[0]))
+        return names[kind];
+    return "unknown";
+}
+
+FlightRecorder::FlightRecorder() noexcept {}
+
+FlightRecorder::~FlightRecorder() {
+    if (hdr)
+        munmap(hdr, map_size);
+}
+
+FlightRecorder &FlightRecorder::get() noexcept {
+    // Never destroyed, threads may record during static destruction.
+    static FlightRecorder *rec = new FlightRecorder();
+    return *rec;
+}
+
+void FlightRecorder::open(const string &path, const string &daemon, bool keys,
+                          mode_t mode, const string &group, size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity)
+        cap *= 2;
+
+    // Keep the ring of the last run, it is the interesting one after a
+    // crash.
+    string prev = path + ".prev";
+    if (rename(path.c_str(), prev.c_str()) == -1 && errno != ENOENT)
+        syslog(LOG_WARNING, "Unable to move %s to %s: %s", path.c_str(),
+               prev.c_str(), strerror(errno));
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode);
+    if (fd == -1)
+        throw SystemError("Unable to create " + path + ": ", errno);
+    size_t size = HEADER_SIZE + cap * sizeof(FlightSlot);
+    void *map = MAP_FAILED;
+    try {
+        // The mode given to open() is subject to the umask.
+        if (fchmod(fd, mode) == -1)
+            throw SystemError("Unable to chmod " + path + ": ", errno);
+        if (!group.empty()) {
+            auto [grp, grpbuf] = Permissions::getgroup(group);
+            (void) grpbuf;
+            if (fchown(fd, -1, grp->gr_gid) == -1)
+                throw SystemError("Unable to chown " + path + ": ", errno);
+        }
+        if (ftruncate(fd, size) == -1)
+            throw SystemError("Unable to resize " + path + ": ", errno);
+        map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+            throw SystemError("Unable to map " + path + ": ", errno);
+    } catch (...) {
+        ::close(fd);
+        unlink(path.c_str());
+        throw;
+    }
+    ::close(fd);
+
+    if (hdr)
+        munmap(hdr, map_size);
+    hdr = (FlightHeader *) map;
+    slots = (FlightSlot *) ((char *) map + HEADER_SIZE);
+    map_size = size;
+    this->keys = keys;
+
+    // The file starts out zeroed, which is an empty ring.
+    memcpy(hdr->magic, MAGIC, sizeof(MAGIC));
+    hdr->version = VERSION;
+    hdr->slot_size = sizeof(FlightSlot);
+    hdr->capacity = cap;
+    hdr->pid = getpid();
+    hdr->flags = keys ? FlightHeader::KEYS : 0;
+    hdr->realtime_ns = clockNS(CLOCK_REALTIME);
+    hdr->monotonic_ns = clockNS(CLOCK_MONOTONIC);
+    strncpy(hdr->daemon, daemon.c_str(), sizeof(hdr->daemon) - 1);
+}
+
+void FlightRecorder::record(FlightRecord::Kind kind, uint64_t event, int code, int value,
+                            uint32_t arg, const char *name) noexcept
+{
+    if (!hdr)
+        return;
+    uint64_t idx = hdr->head.fetch_add(1, memory_order_relaxed);
+    FlightSlot &slot = slots[idx & (hdr->capacity - 1)];
+    slot.seq.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    FlightRecord &rec = slot.rec;
+    rec.time_ns = clockNS(CLOCK_MONOTONIC);
+    rec.event = event;
+    rec.arg = arg;
+    rec.kind = kind;
+    rec.code = (keys || isModifier(code)) ? code : 0;
+    rec.value = value;
+    if (name)
+        strncpy(rec.name, name, sizeof(rec.name) - 1);
+    rec.name[name ? sizeof(rec.name) - 1 : 0] = '\0';
+
+    slot.seq.store(idx + 1, memory_order_release);
+}
+
+FlightReader::FlightReader(const string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw SystemError("Unable to open " + path + ": ", errno);
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int err = errno;
+        ::close(fd);
+        throw SystemError("Unable to stat " + path + ": ", err);
+    }
+    if ((size_t) st.st_size < HEADER_SIZE) {
+        ::close(fd);
+        throw runtime_error("Not a flight recorder ring: " + path);
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (map == MAP_FAILED)
+        throw SystemError("Unable to map " + path + ": ", err);
+
+    const FlightHeader *hdr = (const FlightHeader *) map;
+    uint64_t cap = hdr->capacity;
+    bool valid = memcmp(hdr->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                 hdr->version == VERSION &&
+                 hdr->slot_size == sizeof(FlightSlot) &&
+                 cap > 0 && (cap & (cap - 1)) == 0 &&
+                 HEADER_SIZE + cap * sizeof(FlightSlot) <= (uint64_t) st.st_size;
+    if (!valid) {
+        munmap(map, st.st_size);
+        throw runtime_error("Not a flight recorder ring, or from another version of Hawck: " + path);
+    }
+
+    info.daemon = string(hdr->daemon, strnlen(hdr->daemon, sizeof(hdr->daemon)));
+    info.pid = hdr->pid;
+    info.keys = hdr->flags & FlightHeader::KEYS;
+    info.capacity = cap;
+    info.realtime_ns = hdr->realtime_ns;
+    info.monotonic_ns = hdr->monotonic_ns;
+    info.written = hdr->head.load(memory_order_acquire);
+
+    // Records that are overwritten while they are copied are skipped.
+    const FlightSlot *slots = (const FlightSlot *) ((const char *) map + HEADER_SIZE);
+    uint64_t start = info.written > cap ? info.written - cap : 0;
+    for (uint64_t idx = start; idx < info.written; idx++) {
+        const FlightSlot &slot = slots[idx & (cap - 1)];
+        uint64_t seq = slot.seq.load(memory_order_acquire);
+        FlightRecord rec = slot.rec;
+        atomic_thread_fence(memory_order_acquire);
+        if (seq != idx + 1 || slot.seq.load(memory_order_relaxed) != seq)
+            continue;
+        rec.name[sizeof(rec.name) - 1] = '\0';
+        recs.push_back(rec);
+    }
+    munmap(map, st.st_size);
+}
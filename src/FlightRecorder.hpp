@@ -0,0 +1,209 @@
+/** @file FlightRecorder.hpp
+ *
+ * @brief Ring of what happened to the last few thousand events, kept in a
+ *        shared file so that it survives a crash.
+ *
+ * Each daemon maps a file of fixed size, a header followed by a ring of 64
+ * byte slots, and writes a FlightRecord for every step that an event goes
+ * through: when it was read, where it was routed, which script matched it,
+ * timeouts and reconnects. Writing a record is a fetch_add on the head and
+ * a copy into the slot, so recording is always on. The file is read with
+ * hawck-flight, while the daemon runs or after it has died, and is kept as
+ * PATH.prev when the daemon is restarted.
+ *
+ * Key codes are left out unless recording them was asked for, except for
+ * modifiers, which don't give away what was typed and are needed to make
+ * sense of stuck modifiers.
+ *
+ * The file is in native byte order and only meant to be read on the machine
+ * that wrote it. Each slot has a sequence number which is 0 while the slot
+ * is being written, and the index of the record + 1 after, readers skip
+ * slots where it changed while they were copying.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include <sys/types.h>
+}
+
+struct FlightRecord {
+    enum Kind : uint16_t {
+        /** InputD read an event, arg is the keyboard handle. */
+        INPUT = 0,
+        /** InputD sent the event to MacroD. */
+        TO_MACROD = 1,
+        /** InputD wrote the event straight to the virtual keyboard, because
+         *  it isn't a key or the key is not listed for MacroD. */
+        PASSTHROUGH = 2,
+        /** InputD got the reply from MacroD, arg is the number of events it
+         *  contained. */
+        FROM_MACROD = 3,
+        /** The output of an event was written, arg is the time it took to
+         *  handle the event in microseconds. */
+        WRITTEN = 4,
+        /** MacroD did not reply in time. */
+        TIMEOUT = 5,
+        /** The connection between the daemons was reset. */
+        RECONNECT = 6,
+        /** All keys on the virtual keyboard were released. */
+        RELEASE_ALL = 7,
+        /** MacroD received an event, arg is the keyboard handle. */
+        RECV = 8,
+        /** A script matched the event, the name is the script. */
+        MATCH = 9,
+        /** No script matched, the event was passed on unchanged. */
+        PASSED = 10,
+        /** A script raised an error, the name is the script. */
+        SCRIPT_ERROR = 11,
+        /** Garbage was collected before the next event, arg is the time it
+         *  took in microseconds. */
+        GC_FORCED = 12,
+        /** A script was loaded, the name is the script. */
+        LOADED = 13,
+        /** A script was unloaded, the name is the script. */
+        UNLOADED = 14,
+    };
+
+    /** CLOCK_MONOTONIC, comparable between the daemons. */
+    uint64_t time_ns = 0;
+    /** Number of the event within the daemon, 0 for records that don't
+     *  belong to an event. */
+    uint64_t event = 0;
+    uint32_t arg = 0;
+    Kind kind = INPUT;
+    /** Key code, 0 if it wasn't recorded. */
+    uint16_t code = 0;
+    int32_t value = 0;
+    /** Script name, truncated and nul-terminated. */
+    char name[28] = {0};
+
+    /** Name of a kind, e.g. "to_macrod". */
+    static const char *kindName(Kind kind) noexcept;
+};
+
+/** Fixed part of a ring file. */
+struct FlightHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t capacity;
+    int32_t pid;
+    uint32_t flags;
+    /** CLOCK_REALTIME and CLOCK_MONOTONIC at the same moment, to turn the
+     *  times of records into wall clock times. */
+    uint64_t realtime_ns;
+    uint64_t monotonic_ns;
+    /** Name of the daemon that writes the ring. */
+    char daemon[16];
+    /** Index of the next record. */
+    alignas(64) std::atomic<uint64_t> head;
+
+    /** Set in flags when key codes are recorded. */
+    static constexpr uint32_t KEYS = 1;
+};
+
+struct FlightSlot {
+    std::atomic<uint64_t> seq;
+    FlightRecord rec;
+};
+
+class FlightRecorder {
+private:
+    FlightHeader *hdr = nullptr;
+    FlightSlot *slots = nullptr;
+    size_t map_size = 0;
+    bool keys = false;
+
+public:
+    /** 256 KiB, a few thousand events. */
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+    FlightRecorder() noexcept;
+    FlightRecorder(const FlightRecorder &) = delete;
+    FlightRecorder &operator=(const FlightRecorder &) = delete;
+    ~FlightRecorder();
+
+    /** Get the recorder of this process, which does nothing until it has
+     *  been opened. */
+    static FlightRecorder &get() noexcept;
+
+    /**
+     * Start recording to a new ring, must be done before other threads
+     * record anything. A ring that already exists at path is renamed to
+     * path.prev.
+     *
+     * @param path The ring file.
+     * @param daemon Name of the daemon, shown by hawck-flight.
+     * @param keys Record the codes of all keys, not just modifiers.
+     * @param mode Permissions of the file.
+     * @param group Group of the file, empty to keep the default.
+     * @param capacity Number of records, rounded up to a power of two.
+     */
+    void open(const std::string &path, const std::string &daemon, bool keys,
+              mode_t mode = 0600, const std::string &group = "",
+              size_t capacity = DEFAULT_CAPACITY);
+
+    /** Whether records are being kept. */
+    inline bool enabled() const noexcept {
+        return hdr != nullptr;
+    }
+
+    /** Record a step, may be called from any thread.
+     *
+     * @param kind What happened.
+     * @param event Number of the event, or 0.
+     * @param code Key code, only kept if it is a modifier or keys are
+     *             recorded.
+     * @param value Event value.
+     * @param arg See FlightRecord::Kind.
+     * @param name Script name, or nullptr.
+     */
+    void record(FlightRecord::Kind kind, uint64_t event, int code = 0, int value = 0,
+                uint32_t arg = 0, const char *name = nullptr) noexcept;
+};
+
+/** What the header of a ring says about it. */
+struct FlightInfo {
+    std::string daemon;
+    pid_t pid = 0;
+    /** Whether all key codes were recorded. */
+    bool keys = false;
+    uint64_t capacity = 0;
+    /** Records written since the ring was created. */
+    uint64_t written = 0;
+    uint64_t realtime_ns = 0;
+    uint64_t monotonic_ns = 0;
+};
+
+/** Reads a ring written by a FlightRecorder. */
+class FlightReader {
+private:
+    FlightInfo info;
+    std::vector<FlightRecord> recs;
+
+public:
+    /** Read the ring at path, throws a SystemError if it can't be read and
+     *  a std::runtime_error if it isn't a ring. */
+    explicit FlightReader(const std::string &path);
+
+    inline const FlightInfo &getInfo() const noexcept {
+        return info;
+    }
+
+    /** The records that were complete when the ring was read, oldest
+     *  first. */
+    inline const std::vector<FlightRecord> &records() const noexcept {
+        return recs;
+    }
+
+    /** Convert a record time to nanoseconds since the epoch. */
+    inline uint64_t realtimeNS(const FlightRecord &rec) const noexcept {
+        return info.realtime_ns + (rec.time_ns - info.monotonic_ns);
+    }
+};
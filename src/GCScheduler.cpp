@@ -0,0 +1,141 @@
+/** @file GCScheduler.cpp
+ *
+ * @brief Garbage collection of script states while MacroD is idle.
+ */
+
+#include <chrono>
+#include <sstream>
+
+extern "C" {
+    #include <syslog.h>
+}
+
+#include "GCScheduler.hpp"
+#include "MacroScript.hpp"
+#include "Stats.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+constexpr array<uint64_t, 7> GCStats::BUCKETS_US;
+
+void GCStats::record(uint64_t us) noexcept {
+    size_t i = 0;
+    while (i < BUCKETS_US.size() && us > BUCKETS_US[i])
+        i++;
+    pauses[i]++;
+    total_us += us;
+    if (us > max_us)
+        max_us = us;
+}
+
+string GCStats::format() const {
+    stringstream ss;
+    uint64_t slices = idle_slices + forced_slices;
+    ss << idle_slices << " idle slices, "
+       << forced_slices << " forced slices, "
+       << cycles << " cycles, "
+       << "max pause " << max_us << "us, "
+       << "mean pause " << (slices ? total_us / slices : 0) << "us, pauses:";
+    for (size_t i = 0; i < BUCKETS_US.size(); i++)
+        ss << " <=" << BUCKETS_US[i] << "us:" << pauses[i];
+    ss << " >" << BUCKETS_US.back() << "us:" << pauses.back();
+    return ss.str();
+}
+
+/** Run minimal steps until the cycle is done or the time is up, finalizers
+ *  may raise errors so this is called in protected mode. */
+static int gcSlice(lua_State *L) {
+    microseconds budget(lua_tointeger(L, 1));
+    auto start = steady_clock::now();
+    bool done;
+    do {
+        done = lua_gc(L, LUA_GCSTEP, 0);
+    } while (!done && steady_clock::now() - start < budget);
+    lua_pushboolean(L, done);
+    return 1;
+}
+
+GCScheduler::GCScheduler(int slice_us, int ceiling_kb) noexcept
+    : slice_us(slice_us),
+      ceiling_kb(ceiling_kb)
+{}
+
+void GCScheduler::adopt(MacroScript *sc) noexcept {
+    lua_State *L = sc->getL();
+    // Start from a finished cycle, a cycle that was in progress would
+    // otherwise be taken to have collected everything allocated so far.
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_gc(L, LUA_GCSTOP, 0);
+    sc->gc = GCAccount();
+    sc->gc.settled_kb = lua_gc(L, LUA_GCCOUNT, 0);
+}
+
+bool GCScheduler::needsWork(MacroScript *sc) const noexcept {
+    size_t count_kb = lua_gc(sc->getL(), LUA_GCCOUNT, 0);
+    return sc->gc.in_cycle || count_kb > sc->gc.settled_kb + MIN_GROWTH_KB;
+}
+
+bool GCScheduler::slice(MacroScript *sc, bool forced) noexcept {
+    lua_State *L = sc->getL();
+
+    auto start = steady_clock::now();
+    lua_pushcfunction(L, gcSlice);
+    lua_pushinteger(L, slice_us);
+    bool done = false;
+    if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+        syslog(LOG_ERR, "Error in finalizer: %s", lua_tostring(L, -1));
+    } else {
+        done = lua_toboolean(L, -1);
+    }
+    lua_pop(L, 1);
+    auto pause = steady_clock::now() - start;
+    stats.record(duration_cast<microseconds>(pause).count());
+    static Histogram &pause_hist = Stats::get().histogram("macrod.gc_slice");
+    pause_hist.record(duration_cast<nanoseconds>(pause).count());
+
+    if (forced)
+        stats.forced_slices++;
+    else
+        stats.idle_slices++;
+
+    if (done) {
+        stats.cycles++;
+        sc->gc.in_cycle = false;
+        sc->gc.settled_kb = lua_gc(L, LUA_GCCOUNT, 0);
+    } else {
+        sc->gc.in_cycle = true;
+    }
+
+    return done;
+}
+
+bool GCScheduler::idle(const ScriptSet &set) noexcept {
+    const auto &scripts = set.scripts;
+    if (scripts.empty())
+        return false;
+
+    size_t n = scripts.size();
+    auto it = scripts.begin();
+    advance(it, cursor % n);
+    for (size_t i = 0; i < n; i++) {
+        size_t idx = (cursor + i) % n;
+        if (idx == 0)
+            it = scripts.begin();
+        MacroScript *sc = it->second.get();
+        ++it;
+        if (needsWork(sc)) {
+            slice(sc, false);
+            cursor = (idx + 1) % n;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void GCScheduler::enforce(MacroScript *sc) noexcept {
+    size_t count_kb = lua_gc(sc->getL(), LUA_GCCOUNT, 0);
+    if (count_kb > sc->gc.settled_kb + size_t(ceiling_kb))
+        slice(sc, true);
+}
@@ -0,0 +1,105 @@
+/** @file GCScheduler.hpp
+ *
+ * @brief Garbage collection of script states while MacroD is idle.
+ *
+ * Automatic collection is stopped in every script, so the collector never
+ * runs in the middle of handling an event. MacroD instead runs short
+ * incremental slices across all scripts while it waits for the next event, and
+ * forces a slice after an event if a script has grown past a ceiling.
+ *
+ * Slices are bounded in time rather than in work, because the debt that Lua
+ * accumulates while collection is stopped would make a LUA_GCSTEP with a
+ * size argument run a whole cycle in one go.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+class MacroScript;
+struct ScriptSet;
+
+/** Collector bookkeeping for a single script. */
+struct GCAccount {
+    /** Memory in use after the last completed cycle, in KiB. */
+    size_t settled_kb = 0;
+    /** A cycle has been started but has not finished yet. */
+    bool in_cycle = false;
+};
+
+/** Statistics on the pauses caused by collection slices. */
+struct GCStats {
+    /** Upper bounds of the pause histogram buckets in microseconds, the
+     *  last bucket holds everything above. */
+    static constexpr std::array<uint64_t, 7> BUCKETS_US{{
+        50, 100, 250, 500, 1000, 2500, 5000
+    }};
+
+    /** Slices run while waiting for events. */
+    uint64_t idle_slices = 0;
+    /** Slices forced after an event because of the ceiling. */
+    uint64_t forced_slices = 0;
+    /** Completed collection cycles. */
+    uint64_t cycles = 0;
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+    std::array<uint64_t, BUCKETS_US.size() + 1> pauses{};
+
+    void record(uint64_t us) noexcept;
+
+    /** Single-line human readable summary. */
+    std::string format() const;
+};
+
+class GCScheduler {
+private:
+    std::atomic<int> slice_us;
+    std::atomic<int> ceiling_kb;
+    /** Position of the round-robin over scripts. */
+    size_t cursor = 0;
+    GCStats stats;
+
+    /** Run a single slice, returns true if it completed a cycle. */
+    bool slice(MacroScript *sc, bool forced) noexcept;
+
+    /** Check whether a script has allocated enough since its last cycle to
+     *  be worth collecting. */
+    bool needsWork(MacroScript *sc) const noexcept;
+
+public:
+    /** A script needs to have grown by this much since its last cycle
+     *  before a new one is started while idle. */
+    static constexpr size_t MIN_GROWTH_KB = 64;
+
+    /**
+     * @param slice_us Maximum duration of a slice, a slice always does at
+     *                 least one LUA_GCSTEP.
+     * @param ceiling_kb How much a script may grow beyond what it used after
+     *                   its last cycle before slices are forced after events.
+     */
+    explicit GCScheduler(int slice_us = 250, int ceiling_kb = 4096) noexcept;
+
+    /** Take over collection of a script, stopping automatic collection.
+     *  This runs a full collection, so it should be done at load time. */
+    void adopt(MacroScript *sc) noexcept;
+
+    /** Run a single slice on the next script that needs it.
+     *
+     * @return False if no script needed work, there is no point in calling
+     *         this again until more events have been handled.
+     */
+    bool idle(const ScriptSet &set) noexcept;
+
+    /** Force a slice if a script has grown past the ceiling, called after
+     *  the script has handled an event. */
+    void enforce(MacroScript *sc) noexcept;
+
+    inline void setSliceDuration(int us) noexcept { slice_us = us; }
+
+    inline void setCeiling(int kb) noexcept { ceiling_kb = kb; }
+
+    inline const GCStats &getStats() const noexcept { return stats; }
+};
@@ -0,0 +1,296 @@
+/** @file HWK2Lua.cpp
+ *
+ * @brief Hwk to Lua transpiler.
+ *
+ * The Python version splits the code with this regular expression, in
+ * re.MULTILINE mode, keeping both the matches and the text between them:
+ *
+ *     (^|(--)?\[=*\[|(--)?\]=*\]|--|"(?:[^"\\]|\\.)*"|'(?:[^'\\]|\\.)*'|=>|{|})
+ *
+ * Python tries the alternatives in order, so the empty match at the start of
+ * a line comes first, and a non-empty match may then start at the same
+ * position. Every line start produces an empty token, which the transpiler
+ * uses as a line marker. The tokenizer below replicates this by hand.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "HWK2Lua.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+/** Characters that Python's str.isspace() and str.strip() consider to be
+ *  whitespace. */
+static bool isPySpace(uint32_t cp) noexcept {
+    switch (cp) {
+        case 0x09: case 0x0a: case 0x0b: case 0x0c: case 0x0d:
+        case 0x1c: case 0x1d: case 0x1e: case 0x1f: case 0x20:
+        case 0x85: case 0xa0: case 0x1680:
+        case 0x2028: case 0x2029: case 0x202f: case 0x205f: case 0x3000:
+            return true;
+        default:
+            return cp >= 0x2000 && cp <= 0x200a;
+    }
+}
+
+static constexpr uint32_t INVALID_CP = 0xffffffff;
+
+/** Decode the UTF-8 sequence at s[i], advancing i past it. */
+static uint32_t decode(const string &s, size_t &i) noexcept {
+    unsigned char c = s[i++];
+    if (c < 0x80)
+        return c;
+    int len = (c >= 0xf0) ? 3 : (c >= 0xe0) ? 2 : (c >= 0xc0) ? 1 : -1;
+    if (len < 0 || i + len > s.size())
+        return INVALID_CP;
+    uint32_t cp = c & (0x3f >> len);
+    for (int k = 0; k < len; k++, i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            return INVALID_CP;
+        cp = (cp << 6) | (s[i] & 0x3f);
+    }
+    return cp;
+}
+
+/** Equivalent of Python's str.isspace(). */
+static bool isSpace(const string &s) noexcept {
+    if (s.empty())
+        return false;
+    for (size_t i = 0; i < s.size();)
+        if (!isPySpace(decode(s, i)))
+            return false;
+    return true;
+}
+
+/** Equivalent of Python's str.strip(). */
+static string strip(const string &s) {
+    size_t begin = 0, end = s.size();
+    for (size_t i = 0; i < s.size(); begin = i)
+        if (!isPySpace(decode(s, i)))
+            break;
+    // Find the end of the last non-whitespace character.
+    for (size_t i = begin; i < s.size();)
+        if (!isPySpace(decode(s, i)))
+            end = i;
+    if (begin == s.size())
+        return "";
+    return s.substr(begin, end - begin);
+}
+
+/** Length of the leading run of tabs and spaces, as matched by ^[\t ]* */
+static size_t leadingBlanks(const string &s) noexcept {
+    size_t i = 0;
+    while (i < s.size() && (s[i] == '\t' || s[i] == ' '))
+        i++;
+    return i;
+}
+
+/** Length of the long bracket (--)?\[=*\[ or (--)?\]=*\] at p, or 0. */
+static size_t matchBracket(const string &s, size_t p, char br) noexcept {
+    // The optional group is greedy, so it is tried with the dashes first.
+    for (size_t q : {p + 2, p}) {
+        if (q == p + 2 && s.compare(p, 2, "--") != 0)
+            continue;
+        if (q >= s.size() || s[q] != br)
+            continue;
+        size_t r = q + 1;
+        while (r < s.size() && s[r] == '=')
+            r++;
+        if (r < s.size() && s[r] == br)
+            return r + 1 - p;
+    }
+    return 0;
+}
+
+/** Length of the quoted string at p, or 0. An escape can not be followed by
+ *  a newline, because '.' does not match it. */
+static size_t matchString(const string &s, size_t p, char quote) noexcept {
+    if (s[p] != quote)
+        return 0;
+    for (size_t r = p + 1; r < s.size();) {
+        if (s[r] == quote)
+            return r + 1 - p;
+        if (s[r] == '\\') {
+            if (r + 1 >= s.size() || s[r + 1] == '\n')
+                return 0;
+            r += 2;
+        } else {
+            r++;
+        }
+    }
+    return 0;
+}
+
+/** Length of the non-empty token at p, or 0 if there is none. */
+static size_t matchToken(const string &s, size_t p) noexcept {
+    size_t len;
+    if ((len = matchBracket(s, p, '[')) || (len = matchBracket(s, p, ']')))
+        return len;
+    if (s.compare(p, 2, "--") == 0 || s.compare(p, 2, "=>") == 0)
+        return 2;
+    if ((len = matchString(s, p, '"')) || (len = matchString(s, p, '\'')))
+        return len;
+    if (s[p] == '{' || s[p] == '}')
+        return 1;
+    return 0;
+}
+
+/** Split the code into tokens and the text between them, like re.finditer()
+ *  with the regular expression at the top of this file. */
+static vector<string> tokenize(const string &code) {
+    vector<string> segments;
+    size_t last = 0;
+    size_t pos = 0;
+    // Position of the last empty match, a non-empty match may start there
+    // but another empty match may not.
+    size_t empty_at = string::npos;
+    while (pos <= code.size()) {
+        size_t start, len = 0;
+        bool found = false;
+        for (start = pos; start <= code.size(); start++) {
+            bool line_start = start == 0 || code[start - 1] == '\n';
+            if (line_start && empty_at != start) {
+                found = true;
+                break;
+            }
+            if (start < code.size() && (len = matchToken(code, start))) {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            break;
+
+        if (start != last)
+            segments.push_back(code.substr(last, start - last));
+        segments.push_back(code.substr(start, len));
+        last = pos = start + len;
+        if (len == 0)
+            empty_at = start;
+    }
+    segments.push_back(code.substr(last));
+    return segments;
+}
+
+/** Read like Python reads a file in text mode, with universal newlines. */
+static string translateNewlines(const string &code) {
+    if (code.find('\r') == string::npos)
+        return code;
+    string out;
+    out.reserve(code.size());
+    for (size_t i = 0; i < code.size(); i++) {
+        if (code[i] == '\r') {
+            out += '\n';
+            if (i + 1 < code.size() && code[i + 1] == '\n')
+                i++;
+        } else {
+            out += code[i];
+        }
+    }
+    return out;
+}
+
+/** Whether the token opens a long bracket, and if so whether it is a comment
+ *  and its level. */
+static bool longBracket(const string &seg, char br, pair<bool, size_t> &kind) noexcept {
+    if (matchBracket(seg, 0, br) == 0)
+        return false;
+    kind = {stringStartsWith(seg, "--"), (size_t) count(seg.begin(), seg.end(), '=')};
+    return true;
+}
+
+string hwk2lua(const string &hwk_code) {
+    vector<string> segments = tokenize(translateNewlines(hwk_code));
+    vector<string> out;
+
+    string last;
+    vector<bool> scopes;
+    bool has_lcomment = false;
+    pair<bool, size_t> lcomment;
+    bool in_comment = false;
+    for (const string &seg : segments) {
+        bool code = !(in_comment || has_lcomment);
+        if (seg == "{" && code) {
+            scopes.push_back(last == "=>");
+            out.push_back(scopes.back() ? "MatchScope.new(function (__match)" : "{");
+        } else if (seg == "}" && code) {
+            if (scopes.empty())
+                throw HWKParseError("Unbalanced curly braces (too many: '}')");
+            out.push_back(scopes.back() ? "end)" : "}");
+            scopes.pop_back();
+        } else if (seg == "=>" && code) {
+            // Pop from the output until an empty string, which marks the
+            // start of a line, the marker itself is dropped.
+            string match;
+            while (!out.empty()) {
+                string s = std::move(out.back());
+                out.pop_back();
+                if (s.empty())
+                    break;
+                match.insert(0, s);
+            }
+            out.push_back(match.substr(0, leadingBlanks(match)) +
+                          "__match[" + strip(match) + "] =");
+        } else {
+            out.push_back(seg);
+        }
+
+        pair<bool, size_t> kind;
+        if (seg.empty()) {
+            in_comment = false;
+        } else if (seg == "--") {
+            in_comment = true;
+        } else if (!has_lcomment && longBracket(seg, '[', kind)) {
+            has_lcomment = true;
+            lcomment = kind;
+        } else if (longBracket(seg, ']', kind) && has_lcomment && kind == lcomment) {
+            has_lcomment = false;
+        }
+
+        if (!isSpace(seg))
+            last = seg;
+    }
+
+    if (!scopes.empty())
+        throw HWKParseError("Unbalanced curly braces (too many: '{')");
+
+    string lua;
+    for (const auto &s : out)
+        lua += s;
+    return lua;
+}
+
+HWK2LuaCache::HWK2LuaCache(size_t max_entries)
+    : max_entries(max_entries)
+{}
+
+string HWK2LuaCache::get(const string &hwk_code) {
+    uint64_t key = hashFNV1a(hwk_code);
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.source == hwk_code) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            return it->second.lua;
+        }
+    }
+
+    string lua = hwk2lua(hwk_code);
+
+    lock_guard<mutex> lock(mtx);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        // A collision, or another thread got here first.
+        lru.erase(it->second.lru);
+        entries.erase(it);
+    }
+    while (!lru.empty() && entries.size() >= max_entries) {
+        entries.erase(lru.back());
+        lru.pop_back();
+    }
+    lru.push_front(key);
+    entries[key] = Entry{hwk_code, lua, lru.begin()};
+    return lua;
+}
@@ -0,0 +1,79 @@
+/** @file HWK2Lua.hpp
+ *
+ * @brief Hwk to Lua transpiler.
+ *
+ * This is a port of src/hwk2lua/hwk2lua.py that runs inside MacroD, so that
+ * loading a .hwk script does not start a Python interpreter. It produces the
+ * same output as the Python version, byte for byte, including its quirks.
+ * Makes the following transformations:
+ *
+ *     <pattern> => <action>
+ *         -> __match[<pattern>] = <action>
+ *     <pattern> => { <code> }
+ *         -> __match[<pattern>] = MatchScope.new(function (__match)
+ *                <code>
+ *            end)
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+class HWKParseError : public std::runtime_error {
+public:
+    explicit inline HWKParseError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+/**
+ * Convert hwk code to Lua.
+ *
+ * Newlines are translated like Python does when reading a file in text mode,
+ * so "\r\n" and "\r" both become "\n".
+ *
+ * @throws HWKParseError If the curly braces are unbalanced.
+ */
+std::string hwk2lua(const std::string &hwk_code);
+
+/**
+ * Transpiled scripts, keyed on a hash of their hwk source, so that saving a
+ * script without changing it, or switching back and forth between versions
+ * of it, does not transpile it again.
+ */
+class HWK2LuaCache {
+private:
+    struct Entry {
+        std::string source;
+        std::string lua;
+        std::list<uint64_t>::iterator lru;
+    };
+
+    std::mutex mtx;
+    std::unordered_map<uint64_t, Entry> entries;
+    /** Most recently used first. */
+    std::list<uint64_t> lru;
+    size_t max_entries;
+
+public:
+    /**
+     * @param max_entries Number of transpiled scripts to keep, the least
+     *                    recently used are evicted first.
+     */
+    explicit HWK2LuaCache(size_t max_entries = 32);
+
+    /** Get the transpiled version of hwk code, see hwk2lua().
+     *
+     * @throws HWKParseError If the code does not parse, failures are not
+     *         cached.
+     */
+    std::string get(const std::string &hwk_code);
+
+    inline size_t size() noexcept {
+        std::lock_guard<std::mutex> lock(mtx);
+        return entries.size();
+    }
+};
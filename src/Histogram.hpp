@@ -0,0 +1,110 @@
+/** @file Histogram.hpp
+ *
+ * @brief Lock-free histogram of durations.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+/**
+ * Histogram with buckets that grow with the value, like an HDR histogram.
+ *
+ * Every power of two is split into SUB_BUCKETS linear buckets, so the
+ * error in a reported percentile is at most 1/SUB_BUCKETS of the value,
+ * whatever its magnitude. Values below SUB_BUCKETS are exact.
+ *
+ * Recording is wait-free, apart from the compare-and-swap that keeps the
+ * maximum, so any thread can record while another reads. Reads taken while
+ * values are being recorded may be off by the values that are in flight.
+ */
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 3;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> n{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max_val{0};
+
+public:
+    inline Histogram() noexcept {
+        for (auto &b : buckets)
+            b.store(0, std::memory_order_relaxed);
+    }
+
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+    /** The bucket that a value is counted in. */
+    static inline int index(uint64_t v) noexcept {
+        if (v < SUB_BUCKETS)
+            return (int) v;
+        int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + (int) ((v >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    /** The largest value that is counted in a bucket. */
+    static inline uint64_t upperBound(int idx) noexcept {
+        if (idx < (int) SUB_BUCKETS)
+            return idx;
+        int shift = idx / SUB_BUCKETS - 1;
+        uint64_t lower = (SUB_BUCKETS + idx % SUB_BUCKETS) << shift;
+        return lower + ((uint64_t) 1 << shift) - 1;
+    }
+
+    inline void record(uint64_t v) noexcept {
+        buckets[index(v)].fetch_add(1, std::memory_order_relaxed);
+        n.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t m = max_val.load(std::memory_order_relaxed);
+        while (v > m && !max_val.compare_exchange_weak(m, v, std::memory_order_relaxed))
+            ;
+    }
+
+    inline uint64_t count() const noexcept {
+        return n.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t max() const noexcept {
+        return max_val.load(std::memory_order_relaxed);
+    }
+
+    inline double mean() const noexcept {
+        uint64_t c = count();
+        return c ? (double) sum.load(std::memory_order_relaxed) / c : 0;
+    }
+
+    /**
+     * @param q Quantile between 0 and 1.
+     * @return A value that at least q of the recorded values are below or
+     *         equal to, 0 if nothing has been recorded.
+     */
+    inline uint64_t percentile(double q) const noexcept {
+        uint64_t total = 0;
+        for (const auto &b : buckets)
+            total += b.load(std::memory_order_relaxed);
+        if (!total)
+            return 0;
+        // Nearest rank, the smallest value with at least q of the values
+        // at or below it. The slack keeps e.g. 0.7 * 10 from rounding up
+        // to 8.
+        uint64_t rank = (uint64_t) std::ceil(q * total - 1e-9);
+        if (rank < 1)
+            rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t ub = upperBound(i), m = max();
+                return ub < m ? ub : m;
+            }
+        }
+        return max();
+    }
+};
@@ -0,0 +1,39 @@
+/** @file IInputSource.hpp
+ *
+ * @brief Where InputD gets its events from.
+ */
+
+#pragma once
+
+#include "KBDAction.hpp"
+
+/**
+ * A source of input events for KBDDaemon. Normally this is the keyboards,
+ * but events can also come from a recording.
+ */
+class IInputSource {
+public:
+    /** Not noexcept, KBDManager owns an FSWatcher, which may throw when it
+     *  is destroyed. */
+    virtual ~IInputSource() noexcept(false) {}
+
+    /** Start listening, called once before the first call to getEvent(). */
+    virtual void start() = 0;
+
+    /**
+     * Wait a short while for an event.
+     *
+     * @param action Where the event and the keyboard it came from are
+     *               stored.
+     * @return True if an event was stored in action.
+     */
+    virtual bool getEvent(KBDAction *action) = 0;
+
+    /** Called when the last event has been handled, and its output has
+     *  been flushed. */
+    virtual void done() {}
+
+    /** Whether the source has run dry, KBDDaemon::run() returns once it
+     *  has. */
+    virtual bool finished() const noexcept { return false; }
+};
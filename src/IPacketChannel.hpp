@@ -0,0 +1,51 @@
+/** @file IPacketChannel.hpp
+ *
+ * @brief Connection between InputD and MacroD.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+/**
+ * A connection that carries fixed size packets in both directions. Between
+ * the daemons this is a UNIXSocket, when they run in the same process it is
+ * a LocalChannel.
+ *
+ * Errors are reported by throwing a SocketError, and timeouts by throwing a
+ * SocketTimeout.
+ */
+template <class Packet>
+class IPacketChannel {
+public:
+    virtual ~IPacketChannel() {}
+
+    /**
+     * Wait for a packet to arrive, without receiving it.
+     *
+     * @param timeout Maximum time to wait, negative to wait indefinitely.
+     * @return True if there is data to be read, or the connection was
+     *         closed. False on a timeout, or if the wait was interrupted.
+     */
+    virtual bool poll(std::chrono::milliseconds timeout) = 0;
+
+    /** Receive a packet, waiting for as long as it takes. */
+    virtual void recv(Packet *p) = 0;
+
+    /** Receive a packet, throws a SocketTimeout if none arrives in time. */
+    virtual void recv(Packet *p, std::chrono::milliseconds timeout) = 0;
+
+    /** Send a packet. */
+    virtual void send(const Packet *p) = 0;
+
+    /** Send several packets. */
+    virtual void send(const std::vector<Packet> &packets) = 0;
+
+    /** Drop the connection and establish a new one, anything that was sent
+     *  but not received is lost. */
+    virtual void recon() = 0;
+
+    /** Close the connection, the other end gets a SocketError. */
+    virtual void close() noexcept = 0;
+};
@@ -71,8 +71,44 @@ public:
      */
     virtual void emit(int type, int code, int val) = 0;
 
+    /** Size of a single event in the buffers taken by emitBatch. */
+    static constexpr size_t PACKED_EVENT_SIZE = 12;
+
+    /**
+     * Emit a batch of events in a single call.
+     *
+     * @param packed (type, code, value) triples, as produced by
+     *               string.pack("<i4i4i4", type, code, value) in Lua,
+     *               concatenated.
+     * @param syn Follow every event with a SYN_REPORT event.
+     * @return False if the buffer ends in a partial event, in which case
+     *         nothing is emitted.
+     */
+    virtual bool emitBatch(std::string packed, bool syn) {
+        if (packed.size() % PACKED_EVENT_SIZE != 0)
+            return false;
+        for (size_t i = 0; i < packed.size(); i += PACKED_EVENT_SIZE) {
+            int ev[3];
+            unpackEvent(&packed[i], ev);
+            emit(ev[0], ev[1], ev[2]);
+            if (syn)
+                emit(EV_SYN, SYN_REPORT, 0);
+        }
+        return true;
+    }
+
+    /** Decode a single event from an emitBatch buffer. */
+    static inline void unpackEvent(const char *src, int *ev) noexcept {
+        const unsigned char *p = (const unsigned char *) src;
+        for (int n = 0; n < 3; n++, p += 4)
+            ev[n] = (int32_t) (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+    }
+
     virtual void done() = 0;
 
+    /** Generate key up events for all held keys. */
+    virtual void upAll() {}
+
     /**
      * Flush buffered events to the virtual device.
      */
@@ -17,6 +17,13 @@ struct KBDAction {
     /** Whether this action signifies the end of a series of
      *  events. */
     uint8_t done : 1;
+    /** Whether ev.time was stamped on CLOCK_MONOTONIC, so that the age of
+     *  the event can be measured. */
+    uint8_t monotonic : 1;
+    /** Interned handle of the source keyboard, assigned by InputD
+     *  when the device is first added and kept across hotplug.
+     *  Zero means that the event did not come from a keyboard. */
+    uint16_t kbd_handle;
     /** The source keyboard for this event. */
     struct input_id dev_id;
     /** The event that was emitted, or should be emitted
@@ -3,8 +3,13 @@
 
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 
+extern "C" {
+    #include <syslog.h>
+}
+
 using namespace std;
 namespace fs = std::filesystem;
 
@@ -22,44 +27,47 @@ static_assert(is_same<decltype(((struct input_id *)nullptr)->product),
  * we can pull all the data from there.
  */
 KBDInfo::KBDInfo(const struct input_id *id) : id(*id) {
-    for (auto d : fs::directory_iterator("/sys/class/input")) {
-        string path = d.path();
-        string name = pathBasename(path);
-        if (d.is_directory() && stringStartsWith(name, "event")) {
-            auto id_path = pathJoin(path, "device", "id");
-            struct input_id cid;
-            typedef decltype(cid.vendor) id_t;
-            vector<pair<string, id_t *>> parts = {{"bustype", &cid.bustype},
-                                                  {"vendor", &cid.vendor},
-                                                  {"product", &cid.product},
-                                                  {"version", &cid.version}};
+    try {
+        for (auto d : fs::directory_iterator("/sys/class/input")) {
+            string path = d.path();
+            string name = pathBasename(path);
+            if (d.is_directory() && stringStartsWith(name, "event")) {
+                auto id_path = pathJoin(path, "device", "id");
+                struct input_id cid;
+                typedef decltype(cid.vendor) id_t;
+                vector<pair<string, id_t *>> parts = {{"bustype", &cid.bustype},
+                                                      {"vendor", &cid.vendor},
+                                                      {"product", &cid.product},
+                                                      {"version", &cid.version}};
 
-            // Read parts of the id
-            for (auto [part, ptr] : parts) {
-                ifstream idp(pathJoin(id_path, part));
-                if (!idp.is_open())
-                    throw SystemError("Unable to read: " + pathJoin(id_path, part));
-                idp >> hex >> *ptr;
-            }
+                // Read parts of the id
+                for (auto [part, ptr] : parts) {
+                    ifstream idp(pathJoin(id_path, part));
+                    if (!idp.is_open())
+                        throw SystemError("Unable to read: " + pathJoin(id_path, part));
+                    idp >> hex >> *ptr;
+                }
 
-            if (!::memcmp(&cid, id, sizeof(cid))) {
-                // Found match
-                initFrom(pathJoin(path, "device"));
+                if (!::memcmp(&cid, id, sizeof(cid))) {
+                    // Found match
+                    initFrom(pathJoin(path, "device"));
+                }
             }
         }
+    } catch (const exception &e) {
+        // The keyboard will still be usable through its numeric ID.
+        syslog(LOG_WARNING, "Unable to look up keyboard in sysfs: %s", e.what());
     }
-}
 
-std::string KBDInfo::getID() noexcept {
     std::stringstream ss;
-    ss << id.vendor << ":" << id.product << ":";
+    ss << this->id.vendor << ":" << this->id.product << ":";
     for (char c : name) {
         if (c == ' ')
             ss << '_';
         else
             ss << c;
     }
-    return ss.str();
+    hid = ss.str();
 }
 
 void KBDInfo::initFrom(const std::string &path) noexcept(false) {
@@ -77,4 +85,22 @@ void KBDInfo::initFrom(const std::string &path) noexcept(false) {
 }
 
 KBDB::KBDB() {}
-KBDB::~KBDB() {}
+
+KBDB::~KBDB() {
+    clear();
+}
+
+const KBDInfo *KBDB::add(uint16_t handle, const struct input_id *id) noexcept(false) {
+    auto kinfo = new KBDInfo(id);
+    if (handle >= info.size())
+        info.resize(handle + 1, nullptr);
+    delete info[handle];
+    info[handle] = kinfo;
+    return kinfo;
+}
+
+void KBDB::clear() noexcept {
+    for (auto kinfo : info)
+        delete kinfo;
+    info.clear();
+}
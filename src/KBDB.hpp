@@ -2,6 +2,7 @@
 
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 extern "C" {
     #include <linux/uinput.h>
@@ -34,6 +35,8 @@ private:
     std::string phys;
     std::string uevent;
     std::string dev_uevent;
+    /** Human-readable ID, computed once on construction. */
+    std::string hid;
     struct input_id id;
 
     void initFrom(const std::string& path) noexcept(false);
@@ -42,30 +45,60 @@ public:
     KBDInfo(const struct input_id *id) noexcept(false);
     inline KBDInfo() noexcept {}
 
-    std::string getID() noexcept;
+    /** Get the human-readable keyboard ID, on the form
+     *  vendor:product:Name_With_Underscores */
+    inline const std::string &getID() const noexcept { return hid; }
+    inline const std::string &getName() const noexcept { return name; }
+    inline const std::string &getPhys() const noexcept { return phys; }
+    inline const std::string &getDriver() const noexcept { return drv; }
+    inline const std::string &getUevent() const noexcept { return uevent; }
 };
 
 
 /**
- * Keyboard database, accepts `struct input_id` and retrieves the rest of the
- * information from scanning sysfs.
+ * Keyboard database, maps the interned keyboard handles assigned by InputD
+ * (see KBDAction::kbd_handle) to information retrieved from scanning sysfs.
  *
- * Currently its only used to manage human-readable keyboard IDs.
+ * Sysfs is only scanned the first time a handle is seen, after that lookups
+ * are a vector index.
  */
 class KBDB {
 private:
-    std::unordered_map<struct input_id, KBDInfo, InputIDHash> info;
+    /** Indexed by handle, null for handles that haven't been seen. */
+    std::vector<KBDInfo *> info;
 
 public:
     KBDB();
     ~KBDB();
 
-    std::string getID(const struct input_id *id) noexcept(false) {
-        if (info.count(*id) == 0) {
-            KBDInfo kinfo(id);
-            info[*id] = kinfo;
-            return kinfo.getID();
-        }
-        return info[*id].getID();
+    /**
+     * Get information about a keyboard.
+     *
+     * @return Pointer to the information, or nullptr if the handle hasn't
+     *         been added yet.
+     */
+    inline const KBDInfo *get(uint16_t handle) const noexcept {
+        return (handle < info.size()) ? info[handle] : nullptr;
     }
+
+    /**
+     * Add a keyboard handle, replacing any previous information about it.
+     *
+     * @param handle Handle assigned by InputD.
+     * @param id Numeric ID that was sent along with the handle.
+     * @return Information about the keyboard.
+     */
+    const KBDInfo *add(uint16_t handle, const struct input_id *id) noexcept(false);
+
+    /** Call f(handle, info) for every known keyboard. */
+    template <class F>
+    inline void forEach(F f) const {
+        for (size_t i = 0; i < info.size(); i++)
+            if (info[i])
+                f((uint16_t) i, *info[i]);
+    }
+
+    /** Forget all handles, this needs to be done when a new InputD
+     *  connection is made as handles are only unique per InputD process. */
+    void clear() noexcept;
 };
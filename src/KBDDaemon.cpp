@@ -43,6 +43,7 @@ extern "C" {
 #include "Daemon.hpp"
 #include "Permissions.hpp"
 #include "LuaUtils.hpp"
+#include "Probes.hpp"
 
 #if DANGER_DANGER_LOG_KEYS
     #warning "Currently logging keypresses"
@@ -54,11 +55,28 @@ using namespace Permissions;
 using namespace Lua;
 
 KBDDaemon::KBDDaemon() :
-    kbd_com("/var/lib/hawck-input/kbd.sock")
+    KBDDaemon(make_unique<UNIXSocket<KBDAction>>("/var/lib/hawck-input/kbd.sock"))
+{}
+
+KBDDaemon::KBDDaemon(unique_ptr<IPacketChannel<KBDAction>> channel) :
+    kbd_com(std::move(channel)),
+    own_udev(make_unique<UDevice>()),
+    udev(own_udev.get()),
+    source(&kbman)
 {
     initPassthrough();
 }
 
+KBDDaemon::KBDDaemon(IInputSource *source, IUDevice *sink, const std::string &socket_path) :
+    kbd_com(make_unique<UNIXSocket<KBDAction>>(socket_path)),
+    udev(sink),
+    source(source),
+    watch_passthrough(false)
+{
+    for (auto i = 0; i < KEY_MAX; i++)
+        key_visibility[i] = KEY_SHOW;
+}
+
 KBDDaemon::~KBDDaemon() {}
 
 void KBDDaemon::unloadPassthrough(std::string path) {
@@ -153,75 +171,143 @@ void KBDDaemon::startPassthroughWatcher() {
     });
 }
 
-void KBDDaemon::run() {
-    KBDAction action;
-    memset(&action, '\0', sizeof(action));
-    setup();
-    startPassthroughWatcher();
-    kbman.setup();
-    kbman.startHotplugWatcher();
-
-    for (;;) {
-        action.done = 0;
-        if (!kbman.getEvent(&action))
-            continue;
+template <class F>
+void KBDDaemon::record(F fn) noexcept {
+    if (!recorder)
+        return;
+    try {
+        fn(*recorder);
+    } catch (const exception &e) {
+        syslog(LOG_ERR, "Stopped recording: %s", e.what());
+        recorder = nullptr;
+    }
+}
 
-        if (action.ev.type != EV_KEY) {
-            udev.emit(&action.ev);
-            udev.flush();
-            continue;
-        }
+void KBDDaemon::emit(const struct input_event *ev) {
+    record([&](TraceWriter &rec) { rec.output(*ev); });
+    udev->emit(ev);
+}
 
-        // Check if the key is listed in the passthrough set.
-        KeyVisibility key_vis;
-        if (action.ev.code >= KEY_MAX) {
-            syslog(LOG_ERR, "Received key was out of range: %d", action.ev.code);
-            key_vis = KEY_HIDE;
-        } else {
-            key_vis = key_visibility[action.ev.code];
-            ks_combo.check(action);
-        }
+void KBDDaemon::flush() {
+    uint64_t start = monotonicNS();
+    udev->flush();
+    uinput_write.record(monotonicNS() - start);
+}
 
-        if (!ks_combo.active && key_vis == KEY_SHOW) {
-            input_event orig_ev = action.ev;
+void KBDDaemon::handle(KBDAction &action) {
+    if (action.ev.type != EV_KEY) {
+        HAWCK_PROBE(route, event_num, action.ev.type, action.ev.code, action.ev.value, 0);
+        emit(&action.ev);
+        flush();
+        return;
+    }
 
-            // Pass key to Lua executor
-            try {
-                kbd_com.send(&action);
-
-                // Receive keys to emit from the macro daemon.
-                for (;;) {
-                    kbd_com.recv(&action, timeout);
-                    if (action.done)
-                        break;
-                    udev.emit(&action.ev);
-                }
-                // Flush received keys and continue on.
-                udev.flush();
-                continue;
-            } catch (const SocketError &e) {
-                syslog(LOG_INFO, "Resetting connection to MacroD");
+    // Check if the key is listed in the passthrough set.
+    KeyVisibility key_vis;
+    if (action.ev.code >= KEY_MAX) {
+        syslog(LOG_ERR, "Received key was out of range: %d", action.ev.code);
+        key_vis = KEY_HIDE;
+    } else {
+        key_vis = key_visibility[action.ev.code];
+        ks_combo.check(action);
+    }
 
-                udev.emit(&orig_ev);
-                udev.upAll();
-                udev.flush();
+    if (!ks_combo.active && key_vis == KEY_SHOW) {
+        input_event orig_ev = action.ev;
+        shown.fetch_add(1, memory_order_relaxed);
 
-                auto unlock = kbman.unlockAll();
-                syslog(LOG_CRIT, "Unable to communicate with MacroD, reconnecting ...");
-                // Reconnect.
-                kbd_com.recon();
+        // Pass key to Lua executor
+        try {
+            uint64_t send_ns = monotonicNS();
+            read_to_send.record(send_ns - read_ns);
+            flight.record(FlightRecord::TO_MACROD, event_num, orig_ev.code, orig_ev.value);
+            HAWCK_PROBE(route, event_num, orig_ev.type, orig_ev.code, orig_ev.value, 1);
+            kbd_com->send(&action);
 
-                // Skip the received event
-                continue;
+            // Receive keys to emit from the macro daemon.
+            uint32_t replies = 0;
+            for (;;) {
+                kbd_com->recv(&action, timeout);
+                if (action.done)
+                    break;
+                emit(&action.ev);
+                replies++;
             }
+            macrod_roundtrip.record(monotonicNS() - send_ns);
+            flight.record(FlightRecord::FROM_MACROD, event_num, 0, 0, replies);
+            // Flush received keys and continue on.
+            flush();
+            return;
+        } catch (const SocketError &e) {
+            syslog(LOG_INFO, "Resetting connection to MacroD");
+            if (dynamic_cast<const SocketTimeout *>(&e)) {
+                timeouts.fetch_add(1, memory_order_relaxed);
+                flight.record(FlightRecord::TIMEOUT, event_num, orig_ev.code, orig_ev.value);
+            }
+            reconnects.fetch_add(1, memory_order_relaxed);
+            flight.record(FlightRecord::RECONNECT, event_num);
+
+            emit(&orig_ev);
+            udev->upAll();
+            flush();
+            flight.record(FlightRecord::RELEASE_ALL, event_num);
+
+            auto unlock = kbman.unlockAll();
+            syslog(LOG_CRIT, "Unable to communicate with MacroD, reconnecting ...");
+            // Reconnect.
+            kbd_com->recon();
+
+            // Skip the received event
+            return;
         }
+    }
+
+    hidden.fetch_add(1, memory_order_relaxed);
+    flight.record(FlightRecord::PASSTHROUGH, event_num, action.ev.code, action.ev.value);
+    HAWCK_PROBE(route, event_num, action.ev.type, action.ev.code, action.ev.value, 0);
+    emit(&action.ev);
+    flush();
+}
+
+void KBDDaemon::run() {
+    KBDAction action;
+    memset(&action, '\0', sizeof(action));
+    setup();
+    if (watch_passthrough)
+        startPassthroughWatcher();
+    source->start();
+
+    while (!source->finished()) {
+        action.done = 0;
+        if (!source->getEvent(&action))
+            continue;
+        read_ns = monotonicNS();
+        event_num = events.fetch_add(1, memory_order_relaxed) + 1;
+        // The action is overwritten by the reply from MacroD.
+        struct timeval stamp = action.ev.time;
+        bool monotonic = action.monotonic;
+        // Only keys are recorded, the rest would crowd them out of the
+        // ring.
+        bool is_key = action.ev.type == EV_KEY;
 
-        udev.emit(&action.ev);
-        udev.flush();
+        record([&](TraceWriter &rec) { rec.input(action); });
+        if (is_key)
+            flight.record(FlightRecord::INPUT, event_num, action.ev.code,
+                          action.ev.value, action.kbd_handle);
+        handle(action);
+        uint64_t written_ns = monotonicNS() - read_ns;
+        read_to_written.record(written_ns);
+        if (is_key)
+            flight.record(FlightRecord::WRITTEN, event_num, 0, 0, written_ns / 1000);
+        if (monotonic)
+            kernel_to_written.record(eventAgeNS(stamp));
+        record([&](TraceWriter &rec) { rec.flush(); });
+        source->done();
     }
 }
 
 void KBDDaemon::setEventDelay(int delay) {
-    udev.setEventDelay(delay);
+    if (own_udev)
+        own_udev->setEventDelay(delay);
 }
 
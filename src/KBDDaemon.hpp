@@ -29,6 +29,7 @@
 #pragma once
 
 #include <unordered_map>
+#include <memory>
 #include <set>
 #include <mutex>
 #include <thread>
@@ -44,6 +45,10 @@
 #include "SystemError.hpp"
 #include "FSWatcher.hpp"
 #include "KeyCombo.hpp"
+#include "IInputSource.hpp"
+#include "Trace.hpp"
+#include "FlightRecorder.hpp"
+#include "Stats.hpp"
 
 extern "C" {
     #include <fcntl.h>
@@ -77,8 +82,35 @@ class KBDDaemon {
     std::unordered_map<std::string, std::vector<int>*> key_sources;
     std::unordered_map<std::string, Lua::Script *> scripts;
     const std::string scripts_dir = "/var/lib/hawck-input/scripts";
-    UNIXSocket<KBDAction> kbd_com;
-    UDevice udev;
+    /** Connection to MacroD. */
+    std::unique_ptr<IPacketChannel<KBDAction>> kbd_com;
+    /** The virtual keyboard, unless events are written somewhere else. */
+    std::unique_ptr<UDevice> own_udev;
+    /** Where events are written to. */
+    IUDevice *udev;
+    /** Where events are read from, usually kbman. */
+    IInputSource *source;
+    /** Records the events that pass through, if set. */
+    TraceWriter *recorder = nullptr;
+    /** Whether passthrough keys are loaded from data_dirs["keys"]. */
+    bool watch_passthrough = true;
+    /** When the event that is being handled was read. */
+    uint64_t read_ns = 0;
+    /** Number of the event that is being handled, see FlightRecorder.hpp. */
+    uint64_t event_num = 0;
+    FlightRecorder &flight = FlightRecorder::get();
+
+    /** Time spent in each stage of handling an event, see Stats.hpp. */
+    Histogram &read_to_send = Stats::get().histogram("inputd.read_to_send");
+    Histogram &macrod_roundtrip = Stats::get().histogram("inputd.macrod_roundtrip");
+    Histogram &uinput_write = Stats::get().histogram("inputd.uinput_write");
+    Histogram &read_to_written = Stats::get().histogram("inputd.read_to_written");
+    Histogram &kernel_to_written = Stats::get().histogram("inputd.kernel_to_written");
+    std::atomic<uint64_t> &events = Stats::get().counter("inputd.events");
+    std::atomic<uint64_t> &shown = Stats::get().counter("inputd.keys_shown");
+    std::atomic<uint64_t> &hidden = Stats::get().counter("inputd.keys_hidden");
+    std::atomic<uint64_t> &timeouts = Stats::get().counter("inputd.timeouts");
+    std::atomic<uint64_t> &reconnects = Stats::get().counter("inputd.reconnects");
     /** Watcher for /var/lib/hawck/keys */
     FSWatcher keys_fsw;
     /** Controls whether or not /unseen/ keyboards may be added when they are
@@ -91,13 +123,52 @@ class KBDDaemon {
     void setup();
     void startPassthroughWatcher();
 
+    /** Handle a single event from the source. */
+    void handle(KBDAction &action);
+
+    /** Write an event to the virtual keyboard. */
+    void emit(const struct input_event *ev);
+
+    /** Flush the events written to the virtual keyboard. */
+    void flush();
+
+    /** Run fn on the recorder, recording stops if it fails. */
+    template <class F>
+    void record(F fn) noexcept;
+
   public:
     KBDManager kbman;
 
     explicit KBDDaemon(const char *device);
     KBDDaemon();
+
+    /**
+     * Daemon that talks to MacroD over another kind of channel, used when
+     * both run in the same process.
+     *
+     * @param channel Connection to MacroD.
+     */
+    explicit KBDDaemon(std::unique_ptr<IPacketChannel<KBDAction>> channel);
+
+    /**
+     * Daemon that reads events from somewhere other than the keyboards, and
+     * writes them somewhere other than a virtual keyboard. All keys are
+     * shown to MacroD.
+     *
+     * @param source Where events are read from.
+     * @param sink Where events are written to.
+     * @param socket_path The socket that MacroD listens on.
+     */
+    KBDDaemon(IInputSource *source, IUDevice *sink, const std::string &socket_path);
+
     ~KBDDaemon();
 
+    /** Record the events that pass through the daemon, the recorder must
+     *  outlive the daemon. */
+    inline void setRecorder(TraceWriter *rec) noexcept {
+        recorder = rec;
+    }
+
     /**
      * Load a Lua script to process inputs. These Lua scripts are far more
      * limited than their @{link MacroDaemon#loadScript()} counterparts.
@@ -129,7 +200,7 @@ class KBDDaemon {
     void unloadPassthrough(std::string path);
 
     /**
-     * Start running the daemon.
+     * Start running the daemon, returns when the source has run dry.
      */
     void run();
 
@@ -2,10 +2,13 @@
 #include "SystemError.hpp"
 #include "utils.hpp"
 #include "Permissions.hpp"
+#include "Probes.hpp"
 #include <sys/syslog.h>
+#include <filesystem>
 
 using namespace std;
 using namespace Permissions;
+namespace fs = std::filesystem;
 
 constexpr int FSW_MAX_WAIT_PERMISSIONS_US = 5 * 1000000;
 
@@ -24,6 +27,11 @@ void KBDManager::setup() {
     updateAvailableKBDs();
 }
 
+void KBDManager::start() {
+    setup();
+    startHotplugWatcher();
+}
+
 bool KBDManager::getEvent(KBDAction *action) {
     Keyboard *kbd = nullptr;
     bool had_key = false;
@@ -48,6 +56,7 @@ bool KBDManager::getEvent(KBDAction *action) {
         // Disable the keyboard,
         syslog(LOG_ERR, "Read error on keyboard, assumed to be removed: %s",
                kbd->getName().c_str());
+        HAWCK_PROBE(hotplug, kbd->getName().c_str(), 0);
         kbd->disable();
         {
             lock_guard<mutex> lock(available_kbds_mtx);
@@ -142,6 +151,7 @@ void KBDManager::startHotplugWatcher() {
                 auto kbd = *it;
                 if (kbd->isMe(ev.path.c_str())) {
                     syslog(LOG_INFO, "Keyboard was plugged back in: %s", kbd->getName().c_str());
+                    HAWCK_PROBE(hotplug, kbd->getName().c_str(), 1);
                     kbd->reset(ev.path.c_str());
                     kbd->lock();
                     {
@@ -165,8 +175,9 @@ void KBDManager::startHotplugWatcher() {
         {
             lock_guard<mutex> lock(kbds_mtx);
             Keyboard *kbd = new Keyboard(event_path.c_str());
-            kbds.push_back(kbd);
+            track(kbd);
             syslog(LOG_INFO, "New keyboard plugged in: %s", kbd->getID().c_str());
+            HAWCK_PROBE(hotplug, kbd->getName().c_str(), 1);
             kbd->lock();
         }
         updateAvailableKBDs();
@@ -214,7 +225,43 @@ void KBDManager::updateAvailableKBDs() {
             available_kbds.push_back(kbd);
 }
 
+void KBDManager::track(Keyboard *kbd) {
+    if (next_handle == 0)
+        throw KeyboardError("Ran out of keyboard handles");
+    kbd->setHandle(next_handle++);
+    kbds.push_back(kbd);
+}
+
+vector<string> KBDManager::findKeyboards() {
+    vector<string> kbd_devices;
+
+    // FIXME: All the "is this a keyboard" detection done in Hawck is very
+    //        brittle, and I should probably do a deep-dive into whatever
+    //        documentation I can find on this to develop a better method.
+
+    try {
+        for (auto d : fs::directory_iterator("/dev/input/by-id"))
+            if (KBDManager::byIDIsKeyboard(d.path()))
+                kbd_devices.push_back(realpath_safe(d.path()));
+    } catch (const system_error& err) {
+        syslog(LOG_ERR, "Unable to query by-id: %s", err.what());
+    }
+
+    try {
+        for (auto d : fs::directory_iterator("/dev/input/by-path")) {
+            string rpath = realpath_safe(d.path());
+            bool already_added = find(kbd_devices.begin(), kbd_devices.end(), rpath) != kbd_devices.end();
+            if (!already_added && stringStartsWith(pathBasename(d.path()), "platform-i8042") && stringEndsWith(d.path(), "-event-kbd"))
+                kbd_devices.push_back(rpath);
+        }
+    } catch (const system_error& err) {
+        syslog(LOG_ERR, "Unable to query by-path: %s", err.what());
+    }
+
+    return kbd_devices;
+}
+
 void KBDManager::addDevice(const std::string& device) {
     lock_guard<mutex> lock(kbds_mtx);
-    kbds.push_back(new Keyboard(device.c_str()));
+    track(new Keyboard(device.c_str()));
 }
@@ -5,6 +5,7 @@
 #include <regex>
 
 #include "Keyboard.hpp"
+#include "IInputSource.hpp"
 
 extern "C" {
     #include <syslog.h>
@@ -18,7 +19,7 @@ class KBDUnlock {
     ~KBDUnlock();
 };
 
-class KBDManager {
+class KBDManager : public IInputSource {
   private:
     /** Watcher for /dev/input/ hotplug */
     FSWatcher input_fsw;
@@ -35,6 +36,12 @@ class KBDManager {
      * plugged in. Keyboards that were added on startup with --kbd-device
      * arguments will always be reconnected on hotplug. */
     bool allow_hotplug = true;
+    /** Next keyboard handle to hand out, handles are never reused. */
+    uint16_t next_handle = 1;
+
+    /** Give a keyboard its handle and start tracking it, kbds_mtx
+     *  must be held. */
+    void track(Keyboard *kbd);
 
   public:
     inline KBDManager() {}
@@ -60,6 +67,13 @@ class KBDManager {
         return std::regex_match(path, event_kbd) && !std::regex_match(path, input_if_rx);
     }
 
+    /**
+     * Find the keyboards that are plugged in.
+     *
+     * @return Paths to the devices in /dev/input/
+     */
+    static std::vector<std::string> findKeyboards();
+
     /** Listen on a new device.
      *
      * @param device Full path to the device in /dev/input/
@@ -81,5 +95,8 @@ class KBDManager {
 
     void setup();
 
-    bool getEvent(KBDAction *action);
+    /** Lock the keyboards and start watching for hotplugged ones. */
+    virtual void start() override;
+
+    virtual bool getEvent(KBDAction *action) override;
 };
@@ -37,6 +37,8 @@ extern "C" {
 
 #include "Keyboard.hpp"
 #include "SystemError.hpp"
+#include "Stats.hpp"
+#include "Probes.hpp"
 #include "utils.hpp"
 
 using namespace std;
@@ -60,9 +62,18 @@ Keyboard::Keyboard(const char *path) {
         syslog(LOG_ERR, "Unable to get ID for keyboard: %s", name.c_str());
         memset(&dev_id, 0, sizeof(dev_id));
     }
+    setClock();
     syslog(LOG_INFO, "Initialized keyboard: %s", getID().c_str());
 }
 
+void Keyboard::setClock() noexcept {
+    int clk = CLOCK_MONOTONIC;
+    monotonic = ioctl(fd, EVIOCSCLOCKID, &clk) != -1;
+    if (!monotonic)
+        syslog(LOG_WARNING, "Unable to set event clock of %s, event latency will not be measured: %s",
+               name.c_str(), strerror(errno));
+}
+
 Keyboard::~Keyboard() {
     if (locked)
         unlock();
@@ -162,7 +173,14 @@ void Keyboard::get(KBDAction *action) {
         err << n << ": " << strerror(errno);
         throw KeyboardError(err.str());
     }
+    action->kbd_handle = handle;
     action->dev_id = this->dev_id;
+    action->monotonic = monotonic;
+    HAWCK_PROBE(kbd_read, handle, action->ev.type, action->ev.code, action->ev.value);
+    if (monotonic) {
+        static Histogram &read_hist = Stats::get().histogram("inputd.kernel_to_read");
+        read_hist.record(eventAgeNS(action->ev.time));
+    }
 }
 
 void Keyboard::disable() noexcept {
@@ -185,6 +203,7 @@ void Keyboard::reset(const char *path) {
     if (fd < 0)
         throw SystemError("Error in open(): ", errno);
     this->fd = fd;
+    setClock();
 }
 
 int kbdMultiplex(const std::vector<Keyboard*>& kbds, int timeout) {
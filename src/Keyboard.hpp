@@ -92,7 +92,7 @@ enum KBDState {
 class Keyboard {
 private:
     /** Whether or not we have an exclusive lock on the device. */
-    bool locked;
+    bool locked = false;
     /** Human-readable name of the device. */
     std::string name = "";
     /** Name of the device in /dev/input/by-id/ */
@@ -108,10 +108,18 @@ private:
     struct input_id dev_id;
     /** Unique id of the device. */
     std::string uniq_id = "";
+    /** Interned handle, see KBDAction::kbd_handle */
+    uint16_t handle = 0;
     /** Filed descriptor for keyboard device. */
     int fd = -1;
     /** State of the keyboard, used in locking. */
     KBDState state = KBDState::OPEN;
+    /** Whether events are stamped on CLOCK_MONOTONIC. */
+    bool monotonic = false;
+
+    /** Have the kernel stamp events on CLOCK_MONOTONIC instead of the wall
+     *  clock, so that they can be compared with the time they are read. */
+    void setClock() noexcept;
 
 public:
     /** Keyboard constructor.
@@ -208,6 +216,16 @@ public:
     inline const std::string& getPhys() const noexcept {
         return phys;
     }
+
+    /** Set the interned handle that is sent along with every event
+     *  from this keyboard, assigned by KBDManager. */
+    inline void setHandle(uint16_t handle) noexcept {
+        this->handle = handle;
+    }
+
+    inline uint16_t getHandle() const noexcept {
+        return handle;
+    }
 };
 
 /**
@@ -0,0 +1,333 @@
+/** @file LoadGen.cpp
+ *
+ * @brief Synthetic load for driving KBDDaemon and MacroD at a given rate.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+extern "C" {
+    #include <time.h>
+}
+
+#include "LoadGen.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+/** Keys typed by the patterns, divided between the devices. */
+static const int load_keys[] = {
+    KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J,
+    KEY_K, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T,
+    KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z, KEY_1, KEY_2, KEY_3, KEY_4,
+    KEY_5, KEY_6, KEY_7, KEY_8, KEY_9, KEY_0,
+};
+static constexpr int MAX_DEVICES = 8;
+/** Time between the events of a chord. */
+static constexpr uint64_t CHORD_SPACING_NS = 150000;
+
+const vector<string> &LoadPattern::names() {
+    static const vector<string> names = {"typing", "chords", "holds", "macro"};
+    return names;
+}
+
+vector<ScheduledEvent> generateLoad(const LoadPattern &pattern) {
+    if (find(LoadPattern::names().begin(), LoadPattern::names().end(), pattern.name) ==
+        LoadPattern::names().end())
+        throw invalid_argument("No such pattern: " + pattern.name);
+    if (!(pattern.rate > 0) || !(pattern.duration_s > 0))
+        throw invalid_argument("The rate and duration must be positive");
+    if (pattern.devices < 1 || pattern.devices > MAX_DEVICES)
+        throw invalid_argument("The number of devices must be between 1 and " +
+                               to_string(MAX_DEVICES));
+    if (pattern.hold_ms <= 0)
+        throw invalid_argument("The hold time must be positive");
+    if (pattern.macro_events < 0)
+        throw invalid_argument("The number of macro events can't be negative");
+
+    vector<ScheduledEvent> out;
+    auto push = [&](uint64_t at_ns, uint16_t handle, int code, int value) {
+        ScheduledEvent ev;
+        memset(&ev.action, '\0', sizeof(ev.action));
+        ev.at_ns = at_ns;
+        ev.action.kbd_handle = handle;
+        ev.action.dev_id = {BUS_USB, 0x1, handle, 0x1};
+        ev.action.ev.type = EV_KEY;
+        ev.action.ev.code = code;
+        ev.action.ev.value = value;
+        out.push_back(ev);
+        ev.action.ev.type = EV_SYN;
+        ev.action.ev.code = SYN_REPORT;
+        ev.action.ev.value = 0;
+        out.push_back(ev);
+    };
+    const uint64_t total_ns = pattern.duration_s * 1e9;
+
+    if (pattern.name == "macro") {
+        const double interval_ns = 1e9 / pattern.rate;
+        for (uint64_t n = 0; n * interval_ns < total_ns; n += 2) {
+            push(n * interval_ns, 1, pattern.trigger, 1);
+            push((n + 1) * interval_ns, 1, pattern.trigger, 0);
+        }
+        return out;
+    }
+
+    const size_t num_keys = sizeof(load_keys) / sizeof(load_keys[0]);
+    for (int dev = 0; dev < pattern.devices; dev++) {
+        vector<int> keys;
+        for (size_t i = dev; i < num_keys; i += pattern.devices)
+            keys.push_back(load_keys[i]);
+        uint16_t handle = dev + 1;
+        const double interval_ns = 1e9 * pattern.devices / pattern.rate;
+        // Spread the devices out, so that they don't all type at once.
+        double at = interval_ns * dev / pattern.devices;
+
+        for (size_t n = 0; at < total_ns; n++) {
+            int key = keys[n % keys.size()];
+            if (pattern.name == "typing") {
+                push(at, handle, key, 1);
+                push(at + interval_ns, handle, key, 0);
+                at += 2 * interval_ns;
+            } else if (pattern.name == "chords") {
+                int seq[][2] = {{KEY_LEFTCTRL, 1}, {KEY_LEFTSHIFT, 1}, {key, 1},
+                                {key, 0}, {KEY_LEFTSHIFT, 0}, {KEY_LEFTCTRL, 0}};
+                for (size_t i = 0; i < 6; i++)
+                    push(at + i * CHORD_SPACING_NS, handle, seq[i][0], seq[i][1]);
+                at += 6 * interval_ns;
+            } else if (pattern.name == "holds") {
+                const double hold_ns = pattern.hold_ms * 1e6;
+                push(at, handle, key, 1);
+                double t = interval_ns;
+                for (; t < hold_ns; t += interval_ns)
+                    push(at + t, handle, key, 2);
+                push(at + t, handle, key, 0);
+                at += t + interval_ns;
+            }
+        }
+    }
+
+    stable_sort(out.begin(), out.end(), [](const ScheduledEvent &a, const ScheduledEvent &b) {
+        return a.at_ns < b.at_ns;
+    });
+    return out;
+}
+
+LoadInputSource::LoadInputSource(vector<ScheduledEvent> schedule, size_t queue_size)
+    : queue_size(queue_size)
+{
+    events.reserve(schedule.size());
+    for (auto &sched : schedule) {
+        Event ev;
+        ev.sched = sched;
+        events.push_back(ev);
+    }
+}
+
+uint64_t LoadInputSource::elapsedNS() const {
+    return duration_cast<nanoseconds>(Clock::now() - started).count();
+}
+
+void LoadInputSource::start() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    started_monotonic_ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    started = Clock::now();
+}
+
+void LoadInputSource::arrive(uint64_t now_ns) {
+    for (; arrived < events.size() && events[arrived].sched.at_ns <= now_ns; arrived++) {
+        auto &queue = queued[events[arrived].sched.action.kbd_handle];
+        queue.push_back(arrived);
+        // The kernel empties the buffer of a client that can't keep up,
+        // leaving only the newest event.
+        if (queue_size && queue.size() > queue_size) {
+            for (size_t i = 0; i + 1 < queue.size(); i++)
+                events[queue[i]].dropped = true;
+            dropped += queue.size() - 1;
+            queue.erase(queue.begin(), queue.end() - 1);
+        }
+    }
+}
+
+bool LoadInputSource::getEvent(KBDAction *action) {
+    while (pos < events.size() && events[pos].dropped)
+        pos++;
+    if (pos >= events.size())
+        return false;
+
+    if (arrived <= pos)
+        this_thread::sleep_until(started + nanoseconds(events[pos].sched.at_ns));
+    uint64_t now = elapsedNS();
+    arrive(now);
+    // The newest event is never dropped, so there is one to hand out.
+    while (events[pos].dropped)
+        pos++;
+
+    Event &ev = events[pos];
+    auto &queue = queued[ev.sched.action.kbd_handle];
+    queue.erase(find(queue.begin(), queue.end(), pos));
+    current = pos++;
+    ev.handed = true;
+    ev.handed_ns = now;
+
+    *action = ev.sched.action;
+    // Stamped with the time it arrived, like the kernel does.
+    uint64_t stamp = started_monotonic_ns + ev.sched.at_ns;
+    action->ev.time.tv_sec = stamp / 1000000000;
+    action->ev.time.tv_usec = stamp % 1000000000 / 1000;
+    action->monotonic = 1;
+    return true;
+}
+
+void LoadInputSource::done() {
+    events[current].done_ns = elapsedNS();
+}
+
+bool LoadInputSource::finished() const noexcept {
+    size_t i = pos;
+    while (i < events.size() && events[i].dropped)
+        i++;
+    return i >= events.size();
+}
+
+LoadUDevice::LoadUDevice(int ev_delay_us) : ev_delay_us(ev_delay_us) {
+    start();
+}
+
+void LoadUDevice::start() {
+    started = LoadInputSource::Clock::now();
+}
+
+void LoadUDevice::emit(const input_event *send_event) {
+    buffered.push_back(*send_event);
+}
+
+void LoadUDevice::emit(int type, int code, int val) {
+    input_event ev;
+    memset(&ev, '\0', sizeof(ev));
+    ev.type = type;
+    ev.code = code;
+    ev.value = val;
+    buffered.push_back(ev);
+}
+
+void LoadUDevice::done() {
+    flush();
+}
+
+void LoadUDevice::flush() {
+    for (const auto &ev : buffered) {
+        uint64_t now = duration_cast<nanoseconds>(LoadInputSource::Clock::now() - started).count();
+        written.push_back({now, ev.type, ev.code, ev.value});
+        if (ev.type == EV_KEY)
+            down[ev.code] = ev.value != 0;
+        if (ev_delay_us)
+            this_thread::sleep_for(microseconds(ev_delay_us));
+    }
+    buffered.clear();
+}
+
+void LoadUDevice::upAll() {
+    for (const auto &[code, is_down] : down) {
+        if (!is_down)
+            continue;
+        emit(EV_KEY, code, 0);
+        emit(EV_SYN, SYN_REPORT, 0);
+    }
+}
+
+uint64_t LoadResult::quantile(const vector<uint64_t> &sorted, double q) noexcept {
+    if (sorted.empty())
+        return 0;
+    return sorted[min(sorted.size() - 1, (size_t) (q * sorted.size()))];
+}
+
+bool LoadResult::keptUp() const noexcept {
+    return dropped == 0 && achieved_rate >= 0.9 * offered_rate &&
+           quantile(queue_us, 0.99) < 100000;
+}
+
+LoadResult analyzeLoad(const LoadInputSource &src, const LoadUDevice &sink,
+                       const LoadPattern &pattern)
+{
+    LoadResult res;
+    const auto &events = src.getEvents();
+
+    // Events that should come out the other end unchanged, in the order
+    // they were handed out, by key and value.
+    map<pair<int, int>, deque<size_t>> expected;
+    bool macro = pattern.name == "macro";
+    uint64_t first_handed = UINT64_MAX, last_done = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        const auto &ev = events[i];
+        const auto &iev = ev.sched.action.ev;
+        if (iev.type != EV_KEY)
+            continue;
+        res.key_events++;
+        if (ev.dropped) {
+            res.dropped++;
+            continue;
+        }
+        if (!ev.handed)
+            continue;
+        res.handled++;
+        res.queue_us.push_back((ev.handed_ns - ev.sched.at_ns) / 1000);
+        res.service_us.push_back((ev.done_ns - ev.handed_ns) / 1000);
+        res.latency_us.push_back((ev.done_ns - ev.sched.at_ns) / 1000);
+        first_handed = min(first_handed, ev.handed_ns);
+        last_done = max(last_done, ev.done_ns);
+        // The script eats the trigger, and writes macro_events for each
+        // press.
+        if (macro && iev.code == pattern.trigger) {
+            if (iev.value == 1)
+                res.macro_expected += pattern.macro_events;
+            continue;
+        }
+        expected[{iev.code, iev.value}].push_back(i);
+    }
+
+    map<int, bool> down;
+    size_t latest = 0, macro_written = 0;
+    bool any = false;
+    for (const auto &out : sink.getWritten()) {
+        if (out.type != EV_KEY)
+            continue;
+        res.written++;
+        down[out.code] = out.value != 0;
+        auto it = expected.find({out.code, out.value});
+        if (it == expected.end() || it->second.empty()) {
+            // Written by the script, a trigger that it let through isn't.
+            if (macro && out.code != pattern.trigger)
+                macro_written++;
+            continue;
+        }
+        size_t idx = it->second.front();
+        it->second.pop_front();
+        if (any && idx < latest) {
+            res.reordered++;
+        } else {
+            latest = idx;
+            any = true;
+        }
+    }
+    for (const auto &[_, left] : expected) {
+        (void) _;
+        res.lost += left.size();
+    }
+    if (macro_written < res.macro_expected)
+        res.macro_missing = res.macro_expected - macro_written;
+    res.lost += res.macro_missing;
+    for (const auto &[code, is_down] : down)
+        if (is_down)
+            res.stuck.push_back(code);
+
+    res.offered_rate = res.key_events / pattern.duration_s;
+    if (last_done > first_handed)
+        res.achieved_rate = res.handled / ((last_done - first_handed) / 1e9);
+    for (auto *samples : {&res.queue_us, &res.service_us, &res.latency_us})
+        sort(samples->begin(), samples->end());
+    return res;
+}
@@ -0,0 +1,220 @@
+/** @file LoadGen.hpp
+ *
+ * @brief Synthetic load for driving KBDDaemon and MacroD at a given rate.
+ *
+ * A load is a schedule of events, generated from a pattern and a rate. The
+ * LoadInputSource hands the events to KBDDaemon when they are due, and
+ * keeps the ones that are due while KBDDaemon is busy in a queue of the same
+ * size as the evdev buffer of a keyboard, which is emptied when it overflows,
+ * like the kernel does. Output is collected by a LoadUDevice, which sleeps
+ * between the events it writes like UDevice does. analyzeLoad() then works
+ * out the queueing delay, what was dropped, lost or reordered, and which
+ * keys were left down.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "IInputSource.hpp"
+#include "IUDevice.hpp"
+#include "KBDAction.hpp"
+
+/** An event and when it should arrive. */
+struct ScheduledEvent {
+    /** Nanoseconds since the start of the load. */
+    uint64_t at_ns;
+    KBDAction action;
+};
+
+struct LoadPattern {
+    /**
+     * What the load looks like:
+     *
+     *  - "typing": Letters pressed and released one after another.
+     *  - "chords": Bursts of ctrl + shift + letter, all six events within a
+     *    millisecond.
+     *  - "holds": Letters held down for hold_ms, repeating at the rate.
+     *  - "macro": The trigger key pressed and released, for a script that
+     *    emits a lot of events when it is pressed.
+     */
+    std::string name = "typing";
+    /** Key events per second, SYN events are not counted. */
+    double rate = 100;
+    double duration_s = 5;
+    /** Keyboards typing at the same time, each at rate / devices and on
+     *  its own set of keys. Not used by "macro". */
+    int devices = 1;
+    int hold_ms = 500;
+    int trigger = KEY_F12;
+    /** Key events that the script is expected to write for each press of
+     *  the trigger, 0 to not check. */
+    int macro_events = 0;
+
+    /** Names of the patterns. */
+    static const std::vector<std::string> &names();
+};
+
+/**
+ * Generate the events of a pattern, every key event is followed by a
+ * SYN_REPORT and every key that is pressed is released.
+ *
+ * @throws std::invalid_argument If the pattern doesn't exist or the numbers
+ *         don't make sense.
+ */
+std::vector<ScheduledEvent> generateLoad(const LoadPattern &pattern);
+
+/** Input source that replays a schedule in real time. */
+class LoadInputSource : public IInputSource {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        ScheduledEvent sched;
+        bool dropped = false;
+        bool handed = false;
+        /** Nanoseconds since the start, when the event was handed to
+         *  KBDDaemon and when its output had been written. */
+        uint64_t handed_ns = 0;
+        uint64_t done_ns = 0;
+    };
+
+private:
+    std::vector<Event> events;
+    /** Next event to hand out, and next event to arrive. */
+    size_t pos = 0;
+    size_t arrived = 0;
+    size_t current = 0;
+    size_t queue_size;
+    size_t dropped = 0;
+    /** Events that have arrived but not been handed out, per keyboard. */
+    std::unordered_map<uint16_t, std::deque<size_t>> queued;
+    Clock::time_point started;
+    /** CLOCK_MONOTONIC at the start, for the timestamps of the events. */
+    uint64_t started_monotonic_ns = 0;
+
+    uint64_t elapsedNS() const;
+
+    /** Queue the events that are due, emptying queues that overflow. */
+    void arrive(uint64_t now_ns);
+
+public:
+    /** The evdev buffer of a keyboard holds 64 events. */
+    static constexpr size_t DEFAULT_QUEUE_SIZE = 64;
+
+    /**
+     * @param schedule The events.
+     * @param queue_size Events that can wait for KBDDaemon on each keyboard
+     *                   before the queue overflows, 0 for no limit.
+     */
+    explicit LoadInputSource(std::vector<ScheduledEvent> schedule,
+                             size_t queue_size = DEFAULT_QUEUE_SIZE);
+
+    virtual void start() override;
+    virtual bool getEvent(KBDAction *action) override;
+    virtual void done() override;
+    virtual bool finished() const noexcept override;
+
+    inline const std::vector<Event> &getEvents() const noexcept {
+        return events;
+    }
+
+    /** Events thrown away because a queue overflowed. */
+    inline size_t getDropped() const noexcept {
+        return dropped;
+    }
+};
+
+/** Virtual device that keeps what is written to it, and when. */
+class LoadUDevice : public IUDevice {
+public:
+    struct Output {
+        uint64_t time_ns;
+        uint16_t type;
+        uint16_t code;
+        int32_t value;
+    };
+
+private:
+    std::vector<input_event> buffered;
+    std::vector<Output> written;
+    std::unordered_map<int, bool> down;
+    int ev_delay_us;
+    LoadInputSource::Clock::time_point started;
+
+public:
+    /**
+     * @param ev_delay_us Time to sleep after writing each event, like
+     *                    UDevice::setEventDelay.
+     */
+    explicit LoadUDevice(int ev_delay_us = 0);
+
+    /** Start the clock that output is timed by, call along with
+     *  LoadInputSource::start. */
+    void start();
+
+    virtual void emit(const input_event *send_event) override;
+    virtual void emit(int type, int code, int val) override;
+    virtual void done() override;
+    virtual void flush() override;
+    virtual void upAll() override;
+
+    inline const std::vector<Output> &getWritten() const noexcept {
+        return written;
+    }
+};
+
+/** What happened to a load, key events only. */
+struct LoadResult {
+    /** Key events in the schedule. */
+    size_t key_events = 0;
+    /** Key events per second in the schedule, and the rate at which
+     *  KBDDaemon got through them. */
+    double offered_rate = 0;
+    double achieved_rate = 0;
+    /** Key events handed to KBDDaemon. */
+    size_t handled = 0;
+    /** Key events thrown away because a queue overflowed. */
+    size_t dropped = 0;
+    /** Key events that were handed out and passed through, but never
+     *  written. */
+    size_t lost = 0;
+    /** Key events written before one that was handed out before them. */
+    size_t reordered = 0;
+    /** Key events written, including the output of scripts. */
+    size_t written = 0;
+    /** Key events that the macro pattern expected from the script, and
+     *  how many of them never came, these are also counted as lost. */
+    size_t macro_expected = 0;
+    size_t macro_missing = 0;
+    /** Microseconds from when an event was due until it was handed out
+     *  (queueing), until its output was written (latency), and from being
+     *  handed out until written (service), sorted. */
+    std::vector<uint64_t> queue_us;
+    std::vector<uint64_t> service_us;
+    std::vector<uint64_t> latency_us;
+    /** Keys that were down on the virtual keyboard at the end. */
+    std::vector<int> stuck;
+
+    /** The q quantile of sorted samples, 0 if there are none. */
+    static uint64_t quantile(const std::vector<uint64_t> &sorted, double q) noexcept;
+
+    /** Whether the pipeline kept up: nothing dropped, at least 90% of the
+     *  offered rate achieved, and a 99th percentile queueing delay below
+     *  100ms. */
+    bool keptUp() const noexcept;
+};
+
+/**
+ * Work out what happened to a load.
+ *
+ * @param src The source that the load was run from.
+ * @param sink Where the output went.
+ * @param pattern The pattern that the load was generated from.
+ */
+LoadResult analyzeLoad(const LoadInputSource &src, const LoadUDevice &sink,
+                       const LoadPattern &pattern);
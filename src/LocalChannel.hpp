@@ -0,0 +1,243 @@
+/** @file LocalChannel.hpp
+ *
+ * @brief Connection between InputD and MacroD when they run in the same
+ *        process.
+ *
+ * A pair of LocalChannels share two single producer, single consumer rings,
+ * one for each direction. Sending copies the packet into a slot and bumps
+ * the tail, receiving copies it out and bumps the head, so a round trip is a
+ * handful of atomic operations instead of two system calls on each side and
+ * two context switches. A thread that finds nothing to receive, or no room
+ * to send, spins for a short while and then sleeps on a condition variable,
+ * the other side only takes the mutex to wake it when someone is asleep.
+ *
+ * Each ring has exactly one producer and one consumer, i.e. each end is
+ * used by a single thread, like a socket between the daemons would be.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "IPacketChannel.hpp"
+#include "UNIXSocket.hpp"
+#include "Probes.hpp"
+
+template <class Packet>
+class LocalChannel : public IPacketChannel<Packet> {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    /** Times to check for a packet before going to sleep, a few
+     *  microseconds. There is no point in spinning on a single CPU, the
+     *  other side can't run until we sleep. */
+    static constexpr int SPIN = 2000;
+
+    /** Packets going in one direction. */
+    struct Ring {
+        std::vector<Packet> slots;
+        size_t mask;
+        /** Next slot to read, only written by the consumer. */
+        alignas(64) std::atomic<size_t> head{0};
+        /** Next slot to write, only written by the producer. */
+        alignas(64) std::atomic<size_t> tail{0};
+        /** Threads asleep in wait() until the ring changes, either the
+         *  consumer because it is empty or the producer because it is
+         *  full. */
+        std::atomic<int> sleepers{0};
+
+        explicit Ring(size_t capacity) : slots(capacity), mask(capacity - 1) {}
+    };
+
+    /** State shared by both ends. */
+    struct Shared {
+        Ring a, b;
+        std::atomic<bool> closed{false};
+        std::mutex mtx;
+        std::condition_variable cv;
+        /** Ends that are waiting in recon(), protected by mtx. */
+        int reconnecting = 0;
+        /** Bumped every time the channel is reset, protected by mtx. */
+        uint64_t generation = 0;
+
+        explicit Shared(size_t capacity) : a(capacity), b(capacity) {}
+    };
+
+    std::shared_ptr<Shared> shared;
+    Ring *in;
+    Ring *out;
+
+    LocalChannel(std::shared_ptr<Shared> shared, Ring *in, Ring *out) noexcept
+        : shared(std::move(shared)), in(in), out(out) {}
+
+    /** Wait until ready() returns true, or until the deadline if there is
+     *  one, returns the last result of ready(). Woken by wake() on the same
+     *  ring. */
+    template <class F>
+    bool wait(Ring *ring, F ready, const Clock::time_point *deadline) {
+        static const int spin = std::thread::hardware_concurrency() > 1 ? SPIN : 0;
+        for (int i = 0; i < spin; i++)
+            if (ready())
+                return true;
+        std::unique_lock<std::mutex> lock(shared->mtx);
+        ring->sleepers.fetch_add(1);
+        // Pairs with the fence in wake(), either we see the change or the
+        // other side sees that we are asleep.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ok;
+        while (!(ok = ready())) {
+            if (!deadline) {
+                shared->cv.wait(lock);
+            } else if (shared->cv.wait_until(lock, *deadline) == std::cv_status::timeout) {
+                ok = ready();
+                break;
+            }
+        }
+        ring->sleepers.fetch_sub(1);
+        return ok;
+    }
+
+    /** Wake the other side if it is asleep waiting for the ring. */
+    void wake(Ring *ring) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring->sleepers.load()) {
+            // Once we have had the mutex the sleeper is waiting on cv, and
+            // can take the mutex as soon as it wakes up.
+            { std::lock_guard<std::mutex> lock(shared->mtx); }
+            shared->cv.notify_all();
+        }
+    }
+
+    bool readable() const noexcept {
+        return in->tail.load(std::memory_order_acquire) !=
+               in->head.load(std::memory_order_relaxed) ||
+               shared->closed.load(std::memory_order_acquire);
+    }
+
+    void take(Packet *p, const Clock::time_point *deadline) {
+        if (!wait(in, [this]() { return readable(); }, deadline))
+            throw SocketTimeout("Timed out waiting for a packet");
+        size_t head = in->head.load(std::memory_order_relaxed);
+        if (in->tail.load(std::memory_order_acquire) == head)
+            throw SocketError("Connection closed");
+        *p = in->slots[head & in->mask];
+        in->head.store(head + 1, std::memory_order_release);
+        // The other side may be waiting for room.
+        wake(in);
+        HAWCK_PROBE(socket_recv, -1, sizeof(*p));
+    }
+
+    void put(const Packet &p) {
+        size_t tail = out->tail.load(std::memory_order_relaxed);
+        auto ready = [&]() {
+            return tail - out->head.load(std::memory_order_acquire) < out->slots.size() ||
+                   shared->closed.load(std::memory_order_acquire);
+        };
+        if (!ready()) {
+            // The other side has to be awake to make room.
+            wake(out);
+            wait(out, ready, nullptr);
+        }
+        if (shared->closed.load(std::memory_order_acquire))
+            throw SocketError("Connection closed");
+        out->slots[tail & out->mask] = p;
+        out->tail.store(tail + 1, std::memory_order_release);
+    }
+
+public:
+    /** Packets that can be in flight in each direction. */
+    static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+    /**
+     * Create both ends of a channel.
+     *
+     * @param capacity Packets that can be sent before the sender has to
+     *                 wait, rounded up to a power of two.
+     */
+    static std::pair<std::unique_ptr<LocalChannel>, std::unique_ptr<LocalChannel>>
+    pair(size_t capacity = DEFAULT_CAPACITY) {
+        size_t cap = 2;
+        while (cap < capacity)
+            cap *= 2;
+        auto shared = std::make_shared<Shared>(cap);
+        Ring *a = &shared->a, *b = &shared->b;
+        return {std::unique_ptr<LocalChannel>(new LocalChannel(shared, a, b)),
+                std::unique_ptr<LocalChannel>(new LocalChannel(shared, b, a))};
+    }
+
+    LocalChannel(const LocalChannel &) = delete;
+    LocalChannel &operator=(const LocalChannel &) = delete;
+
+    ~LocalChannel() noexcept override {
+        close();
+    }
+
+    bool poll(std::chrono::milliseconds timeout) override {
+        if (timeout.count() == 0)
+            return readable();
+        auto deadline = Clock::now() + timeout;
+        return wait(in, [this]() { return readable(); },
+                    timeout.count() < 0 ? nullptr : &deadline);
+    }
+
+    void recv(Packet *p) override {
+        take(p, nullptr);
+    }
+
+    void recv(Packet *p, std::chrono::milliseconds timeout) override {
+        auto deadline = Clock::now() + timeout;
+        take(p, &deadline);
+    }
+
+    void send(const Packet *p) override {
+        put(*p);
+        wake(out);
+        HAWCK_PROBE(socket_send, -1, sizeof(*p));
+    }
+
+    void send(const std::vector<Packet> &packets) override {
+        for (const auto &p : packets)
+            put(p);
+        wake(out);
+        HAWCK_PROBE(socket_send, -1, sizeof(Packet) * packets.size());
+    }
+
+    /**
+     * Close the channel and wait for the other end to call recon() as well,
+     * which it does once it gets a SocketError. Both rings are emptied
+     * before the channel is opened again.
+     */
+    void recon() override {
+        std::unique_lock<std::mutex> lock(shared->mtx);
+        shared->closed.store(true);
+        shared->cv.notify_all();
+        if (++shared->reconnecting < 2) {
+            uint64_t gen = shared->generation;
+            shared->cv.wait(lock, [&]() { return shared->generation != gen; });
+            return;
+        }
+
+        // Both ends are in here, so neither is using the rings.
+        for (Ring *r : {&shared->a, &shared->b}) {
+            r->head.store(0);
+            r->tail.store(0);
+        }
+        shared->reconnecting = 0;
+        shared->generation++;
+        shared->closed.store(false);
+        shared->cv.notify_all();
+    }
+
+    void close() noexcept override {
+        std::lock_guard<std::mutex> lock(shared->mtx);
+        shared->closed.store(true);
+        shared->cv.notify_all();
+    }
+};
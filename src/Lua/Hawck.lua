@@ -49,15 +49,15 @@ cont = ConcatF.new(function ()
     return FALLTHROUGH
 end)
 
-any = Cond.new(function ()
+any = Cond.pure(function ()
     return true
 end)
 always = any
 all = any
 
-never = Cond.new(function ()
+never = Cond.pure(function ()
     return false
-end)
+end, {codes = {}})
 
 noop = function () end
 nothing = noop
@@ -67,25 +67,31 @@ off = noop
 key = function (key_name)
   __keys[key_name] = true
   local key_code = kbd:getKeysym(key_name)
-  return LazyCondF.new(function (key_code)
-      return kbd:hadKey(key_code)
-  end)(key_code)
+  return Cond.pure(function ()
+      return kbd.event_code == key_code
+  end, {codes = {[key_code] = true}})
 end
 
 press = LazyF.new(function (key)
     kbd:press(key)
 end)
 
+-- Characters that udev:type() can produce, set up on first use.
+local typable = nil
+
+--- Send the typing table for the current keymap to udev.
+local function setupTyping()
+  local packed
+  packed, typable = kbd.map:typingTable()
+  udev:setTypingTable(packed)
+end
+
 write = LazyF.new(function (text)
+  if not typable then
+    setupTyping()
+  end
   kbd:withCleanMods(function ()
-    for p, c in utf8.codes(text) do
-      local succ, _ = pcall(function ()
-        getEntryFunction(utf8.char(c))()
-      end)
-      if not succ then
-        print("No such key: " .. utf8.char(c))
-      end
-    end
+    udev:type(text)
   end)
 end)
 
@@ -111,7 +117,16 @@ function getEntryFunction(sym)
 end
 
 insert = LazyF.new(function (str)
-    kbd:withCleanMods(getEntryFunction(str))
+    if not typable then
+      setupTyping()
+    end
+    if typable[str] then
+      kbd:withCleanMods(function ()
+          udev:type(str)
+      end)
+    else
+      kbd:withCleanMods(getEntryFunction(str))
+    end
 end)
 
 replace = LazyF.new(function (key)
@@ -127,21 +142,33 @@ echo = ConcatF.new(function ()
     kbd:echo()
 end)
 
-held = LazyCondF.new(function (key_name)
-    return kbd:keyIsDown(key_name)
-end)
+-- The key code is resolved on first use and then kept, modifier conditions
+-- like ctrl are evaluated once per event.
+held = function (key_name)
+  local key_code
+  return Cond.pure(function ()
+      if not key_code then
+        key_code = kbd:getKeysym(key_name)
+      end
+      return kbd.keys_held[key_code]
+  end, {memo = true})
+end
 
-down = Cond.new(function ()
+down = Cond.pure(function ()
     return kbd:hadKeyDown()
-end)
+end, {values = {[kbd.KeyMode.DOWN] = true}})
 
-up = Cond.new(function ()
+up = Cond.pure(function ()
     return kbd:hadKeyUp()
-end)
+end, {values = {[kbd.KeyMode.UP] = true}})
 
-fromkbd = LazyCondF.new(function (kbd_hid)
-    return kbd:from(kbd_hid)
-end)
+-- The handle set is looked up once, so matching is a single integer index.
+fromkbd = function (kbd_hid)
+  local handles = kbd:handlesOf(kbd_hid)
+  return Cond.pure(function ()
+      return handles[kbd.event_kbd] == true
+  end)
+end
 
 modkeys = {
   shift_r = "Shift_R",
@@ -171,20 +198,72 @@ for i, key in pairs(fn_keys) do
   fn_keycodes[kbd:getKeysym(key)] = true
 end
 
+local ctrl_alt = ctrl + alt
+
 function __match.prepare(...)
     kbd:prepare(...)
 
     -- Don't act on Ctrl+Alt+F(n) keys
-    if (ctrl + alt)() and fn_keycodes[kbd.event_code] then
+    if ctrl_alt() and fn_keycodes[kbd.event_code] then
       return false
     end
 
     return true
 end
 
+-- Callbacks for processes whose output is being captured, by process id.
+local spawn_callbacks = {}
+
+--- Run a shell command without waiting for it to finish.
+--
+-- @param cmd The shell command.
+-- @param callback Optional, called as callback(output, status) with the
+--                 standard output and exit status of the command once it
+--                 has finished. This happens on a later turn of the MacroD
+--                 main loop, not from within spawn. Keys sent from the
+--                 callback are discarded, since no key is being handled.
+-- @return True if the command was started.
+function spawn(cmd, callback)
+  local spawner = rawget(_G, "__spawner")
+  if not spawner then
+    -- Outside of MacroD, fall back to running the command synchronously.
+    local p = io.popen(cmd)
+    local out = p:read("a")
+    local _, _, status = p:close()
+    if callback then
+      callback(out, status)
+    end
+    return true
+  end
+
+  local id = spawner:spawn(cmd, callback ~= nil)
+  if id == 0 then
+    return false
+  end
+  if callback then
+    spawn_callbacks[id] = callback
+  end
+  return true
+end
+
+function __spawn_done(id, out, status)
+  local callback = spawn_callbacks[id]
+  spawn_callbacks[id] = nil
+  if callback then
+    callback(out, status)
+  end
+end
+
 notify = LazyF.new(function (title, message)
-    local p = io.popen(("notify-send -a '%s' -u normal -i hawck -t 3000 '%s'"):format(title, message))
-    p:close()
+    -- MacroD queues notifications and sends them from another thread, fall
+    -- back to notify-send when running outside of it.
+    local notifier = rawget(_G, "__notifier")
+    if notifier then
+      notifier:notify(title, message)
+      return
+    end
+    spawn(("notify-send -a %s -u normal -i hawck -t 3000 %s"):format(u.shescape(title),
+                                                                      u.shescape(message)))
 end)
 
 say = LazyF.new(function (message)
@@ -231,5 +310,31 @@ end
 
 function __setup() end
 
+function __compile()
+  MatchScope.compile(__match)
+end
+
+function __set_profiling(enabled)
+  MatchScope.setProfiling(enabled)
+end
+
+function __pattern_stats()
+  return MatchScope.patternStats(__match)
+end
+
+function __reset_keyboards()
+  kbd:resetKeyboards()
+end
+
+function __register_keyboard(handle, id, name, phys, driver, uevent)
+  kbd:register(handle, {
+    id = id,
+    name = name,
+    phys = phys,
+    driver = driver,
+    uevent = uevent,
+  })
+end
+
 setmetatable(_G, ProtectedMeta)
 
@@ -314,6 +314,41 @@ function kbmap:getKeysym(key)
   return self.keymap[key] or error(("No such key: %s. Available keys: %s"):format(key, table.concatkeys(self.keymap, " ")))
 end
 
+--- Build the table used by udev:type(), mapping characters to keystrokes.
+--
+-- Characters are resolved like getEntryFunction in Hawck.lua does it, first
+-- as a plain key and then as a modifier+key combo.
+--
+-- @return The table packed for udev:setTypingTable(), and a set of the
+--         characters in it.
+function kbmap:typingTable()
+  local entries = {}
+  local typable = {}
+
+  local function add(sym)
+    if type(sym) ~= "string" or typable[sym] or utf8.len(sym) ~= 1 then
+      return
+    end
+    local name = (ALIASES and ALIASES[sym]) or sym
+    local code, mod = self.keymap[name], 0
+    if not code then
+      local combo = self.combo_map[name]
+      if not combo or #combo ~= 2 then
+        return
+      end
+      mod, code = combo[1], combo[2]
+    end
+    typable[sym] = true
+    table.insert(entries, string.pack("<I4I2I2", utf8.codepoint(sym), code, mod))
+  end
+
+  for sym, _ in pairs(ALIASES or {}) do add(sym) end
+  for sym, _ in pairs(self.keymap) do add(sym) end
+  for sym, _ in pairs(self.combo_map) do add(sym) end
+
+  return table.concat(entries), typable
+end
+
 --- Check if a key is a modifier, i.e one of Control/Control_R/Shift/Shift_R/Alt/AltGr
 -- @param key Key code/symbol.
 function kbmap:isModifier(key)
@@ -108,7 +108,7 @@ function AppMetaMethods.__index(t, key)
       else
         cmd = exec:gsub("%%u", u.shescape(arg or ""))
       end
-      io.popen(cmd)
+      spawn(cmd)
   end)
 end
 
@@ -1,4 +1,9 @@
-package.path = "./LLib/?.lua;" .. package.path
+-- MacroD puts LLib in package.path itself, so that scripts do not depend on
+-- the working directory, otherwise this has to be run from the scripts
+-- directory.
+if not package.path:find("/LLib/?.lua", 1, true) then
+  package.path = "./LLib/?.lua;" .. package.path
+end
 require "Hawck"
 u = require "utils"
 app = require "app"
@@ -34,6 +34,10 @@ local cfg = require "cfg"
 local kbd = {
   keys_held = {},
   map = kbmap.new(cfg.keymap),
+  -- Keyboard information pushed from MacroD, indexed by keyboard handle.
+  keyboards = {},
+  -- Sets of keyboard handles, indexed by human-readable keyboard ID.
+  handles = {},
 }
 
 local meta = {}
@@ -61,6 +65,13 @@ local KeyMode = {
   REPEAT = 2,
 }
 
+kbd.Event = Event
+kbd.KeyMode = KeyMode
+
+-- Format of a single event in the buffers passed to udev:emitBatch
+local EVENT_FMT = "<i4i4i4"
+local pack = string.pack
+
 function kbd:init(keymap)
 end
 
@@ -82,13 +93,29 @@ function kbd:emit(event_type, event_code, event_value)
   udev:emit(Event.SYN, 0, 0)
 end
 
-function kbd:pressN(event_code)
-  for i = 1, 100 do
-    udev:emit(Event.KEY, event_code, KeyMode.DOWN)
-    udev:emit(Event.SYN, 0, 0)
-    udev:emit(Event.KEY, event_code, KeyMode.UP)
-    udev:emit(Event.SYN, 0, 0)
+--- Emit a batch of events with a single call into MacroD, implicitly
+--  generates a SYN event after each of them.
+--
+-- @param events Flat array of events, {type, code, value, type, code, value, ...}
+function kbd:emitBatch(events)
+  local n = #events // 3
+  if n * 3 ~= #events then
+    error("Expected a multiple of 3 values in event batch, got " .. #events)
+  end
+  -- Packed in chunks so that large batches do not overflow the Lua stack.
+  local chunk, parts = 64, {}
+  for i = 1, n, chunk do
+    local m = math.min(chunk, n - i + 1)
+    parts[#parts + 1] = pack(EVENT_FMT:rep(m), table.unpack(events, 3*i - 2, 3*(i + m - 1)))
   end
+  udev:emitBatch(table.concat(parts), true)
+end
+
+function kbd:pressN(event_code)
+  local press = pack(EVENT_FMT .. EVENT_FMT,
+                     Event.KEY, event_code, KeyMode.DOWN,
+                     Event.KEY, event_code, KeyMode.UP)
+  udev:emitBatch(press:rep(100), true)
   udev:flush()
 end
 
@@ -110,21 +137,69 @@ end
 -- 
 -- @param code The key to press.
 function kbd:press(code)
-  self:down(code)
-  self:up(code)
+  code = self:getKeysym(code)
+  udev:emitBatch(pack(EVENT_FMT .. EVENT_FMT,
+                      Event.KEY, code, KeyMode.DOWN,
+                      Event.KEY, code, KeyMode.UP), true)
   udev:flush()
 end
 
+--- Get the set of keyboard handles that belong to a human-readable keyboard
+--  ID. The same table is returned on every call and is filled in as
+--  keyboards are registered, so it can be held on to.
+--
+-- @param kbd_hid Human-readable keyboard ID.
+function kbd:handlesOf(kbd_hid)
+  local hs = self.handles[kbd_hid]
+  if not hs then
+    hs = {}
+    self.handles[kbd_hid] = hs
+  end
+  return hs
+end
+
+--- Register a keyboard, called by MacroD the first time it sees a keyboard
+--  handle.
+--
+-- @param handle Integer keyboard handle.
+-- @param info Table with id, name, phys, driver and uevent fields.
+function kbd:register(handle, info)
+  local old = self.keyboards[handle]
+  if old then
+    self:handlesOf(old.id)[handle] = nil
+  end
+  self.keyboards[handle] = info
+  self:handlesOf(info.id)[handle] = true
+end
+
+--- Forget all keyboards, called by MacroD when handles are handed out
+--  anew. The handle sets are emptied in place, as they may be held on to.
+function kbd:resetKeyboards()
+  self.keyboards = {}
+  for _, hs in pairs(self.handles) do
+    for handle in pairs(hs) do
+      hs[handle] = nil
+    end
+  end
+end
+
+--- Get information about the keyboard that the current event came from.
+function kbd:keyboard()
+  return self.keyboards[self.event_kbd]
+end
+
 function kbd:from(kbd_hid)
-  return self.event_kbd == kbd_hid
+  return self:handlesOf(kbd_hid)[self.event_kbd] == true
 end
 
 --- Prepare the keyboard by retrieving values from MacroD
-function kbd:prepare(ev_value, ev_code, ev_type, kbd_hid)
+function kbd:prepare(ev_value, ev_code, ev_type, kbd_handle)
   self.event_value = math.floor(ev_value)
   self.event_code = math.floor(ev_code)
   self.event_type = math.floor(ev_type)
-  self.event_kbd = kbd_hid
+  self.event_kbd = kbd_handle
+  MatchScope.setEvent(self.event_code, self.event_value,
+                      self.event_type == Event.KEY)
 
   if self.event_type ~= Event.KEY then
     return
@@ -180,6 +255,7 @@ function kbd:withCleanMods(f)
   -- Clear all modifiers by sending key-up events for them
   local keys_held = self.keys_held
   self.keys_held = {}
+  MatchScope.invalidate()
   for code, _ in pairs(keys_held) do
     if self.map:isModifier(code) then
       self:up(code)
@@ -198,6 +274,7 @@ function kbd:withCleanMods(f)
   end
 
   self.keys_held = keys_held
+  MatchScope.invalidate()
 
   udev:flush()
 end
@@ -29,6 +29,136 @@ local u = require "utils"
 
 local unpack = table.unpack
 
+-- The event that is currently being matched, see MatchScope.setEvent.
+-- A serial of 0 means that no event information is available, in which
+-- case patterns are tried in order without using the dispatch tables.
+local event = {
+  serial = 0,
+  code = nil,
+  value = nil,
+  is_key = false,
+}
+
+-- Whether patterns count how often they are tested and how often they
+-- match, see MatchScope.setProfiling.
+local profile = {
+  enabled = false,
+}
+
+--- Location of the code that called the function calling this, as
+--  "<file>:<line>".
+local function callerWhere()
+  local info = debug.getinfo(3, "Sl")
+  if not info then
+    return "?"
+  end
+  local src = info.short_src
+  if info.source:sub(1, 1) == "@" then
+    src = info.source:match("[^/]*$")
+  end
+  return ("%s:%d"):format(src, info.currentline)
+end
+
+--- Intersection of two sets, nil stands for the set of everything.
+local function intersect(a, b)
+  if not a then return b end
+  if not b then return a end
+  local r = {}
+  for k in pairs(a) do
+    if b[k] then r[k] = true end
+  end
+  return r
+end
+
+--- Union of two sets, nil stands for the set of everything.
+local function union(a, b)
+  if not a or not b then return nil end
+  local r = {}
+  for k in pairs(a) do r[k] = true end
+  for k in pairs(b) do r[k] = true end
+  return r
+end
+
+--- Work out which events a condition can be true for.
+--
+-- Returns a set of event codes and a set of key event values, nil meaning
+-- any. For events outside of codes x values the condition is guaranteed to
+-- be false, and evaluating it is guaranteed to have no side effects, so it
+-- can be skipped. The third return value says whether evaluating the
+-- condition is free of side effects for all events.
+local function analyze(c)
+  if getmetatable(c) ~= CondMeta then
+    return nil, nil, false
+  end
+  if c.op == "and" then
+    local ac, av, ap = analyze(c.args[1])
+    local bc, bv, bp = analyze(c.args[2])
+    -- The right hand side only runs if the left hand side was true, so it
+    -- can only narrow the filter if the left hand side is pure.
+    if ap then
+      return intersect(ac, bc), intersect(av, bv), bp
+    end
+    return ac, av, false
+  elseif c.op == "or" then
+    local ac, av, ap = analyze(c.args[1])
+    local bc, bv, bp = analyze(c.args[2])
+    local codes, values = union(ac, bc), union(av, bv)
+    -- Both sides need a filter for the union to mean anything.
+    if (not ac and not av) or (not bc and not bv) then
+      codes, values = nil, nil
+    end
+    return codes, values, ap and bp
+  elseif c.op == "not" then
+    local _, _, ap = analyze(c.args[1])
+    return nil, nil, ap
+  end
+  return c.codes, c.values, c.pure == true
+end
+
+--- Build the dispatch tables for a scope.
+--
+-- For every event code mentioned in a pattern there is an entry holding the
+-- patterns that can match it, in their original order, both for any event
+-- and split by key event value. Codes that are not mentioned use the
+-- wildcard entry.
+local function compile(t)
+  local filters = {}
+  local mentioned = {}
+  for i, patt in ipairs(t.patterns) do
+    local codes, values = analyze(patt.pattern)
+    filters[i] = {codes = codes, values = values}
+    for code in pairs(codes or {}) do
+      mentioned[code] = true
+    end
+  end
+
+  local function build(code)
+    local entry = {any = {}, [0] = {}, [1] = {}, [2] = {}}
+    for i, patt in ipairs(t.patterns) do
+      local codes, values = filters[i].codes, filters[i].values
+      if not codes or (code and codes[code]) then
+        table.insert(entry.any, patt)
+        for v = 0, 2 do
+          if not values or values[v] then
+            table.insert(entry[v], patt)
+          end
+        end
+      end
+    end
+    return entry
+  end
+
+  local dispatch = {
+    wild = build(nil),
+    by_code = {},
+  }
+  for code in pairs(mentioned) do
+    dispatch.by_code[code] = build(code)
+  end
+  rawset(t, "dispatch", dispatch)
+  return dispatch
+end
+
 PatternScopeMeta = {
   __call = function (t, ...)
     if rawget(t, "prepare") then
@@ -37,8 +167,15 @@ PatternScopeMeta = {
       end
     end
 
-    for u, patt in ipairs(t.patterns) do
-      local result = patt()
+    local patterns = t.patterns
+    if event.serial ~= 0 then
+      local dispatch = rawget(t, "dispatch") or compile(t)
+      local entry = dispatch.by_code[event.code] or dispatch.wild
+      patterns = (event.is_key and entry[event.value]) or entry.any
+    end
+
+    for i = 1, #patterns do
+      local result = patterns[i]()
       if result == FALLTHROUGH then
         ;
       elseif result then
@@ -52,7 +189,9 @@ PatternScopeMeta = {
     if pattern == "prepare" then
       rawset(t, "prepare", action)
     else
-      u.append(t.patterns, Pattern.new(pattern, action))
+      u.append(t.patterns, Pattern.new(pattern, action, callerWhere()))
+      -- Rebuilt on the next call.
+      rawset(t, "dispatch", nil)
     end
   end,
 
@@ -71,7 +210,61 @@ MatchScope = {
       fn(scope)
     end
     return scope
-  end
+  end,
+
+  --- Build the dispatch tables of a scope and all of its sub-scopes ahead
+  --  of time, otherwise this happens on the first event a scope sees.
+  compile = function (scope)
+    compile(scope)
+    for _, patt in ipairs(scope.patterns) do
+      if getmetatable(patt.action) == PatternScopeMeta then
+        MatchScope.compile(patt.action)
+      end
+    end
+  end,
+
+  --- Set the event that is about to be matched, this enables the dispatch
+  --  tables and resets memoized conditions.
+  --
+  -- @param code Event code.
+  -- @param value Event value.
+  -- @param is_key Whether it is a key event, values are only used for
+  --               dispatch on key events.
+  setEvent = function (code, value, is_key)
+    event.serial = event.serial + 1
+    event.code = code
+    event.value = value
+    event.is_key = is_key
+  end,
+
+  --- Have patterns count how often they are tested and how often they
+  --  match, this is only checked when a pattern is tested so it can be
+  --  switched at any time.
+  setProfiling = function (enabled)
+    profile.enabled = enabled
+  end,
+
+  --- Statistics of the patterns in a scope and its sub-scopes, one line for
+  --  each pattern with its location, how often it was tested and how often
+  --  it matched, separated by tabs.
+  patternStats = function (scope, lines)
+    lines = lines or {}
+    for _, patt in ipairs(scope.patterns) do
+      table.insert(lines, ("%s\t%d\t%d"):format(patt.where, patt.tested, patt.fired))
+      if getmetatable(patt.action) == PatternScopeMeta then
+        MatchScope.patternStats(patt.action, lines)
+      end
+    end
+    return table.concat(lines, "\n")
+  end,
+
+  --- Reset memoized conditions, needs to be done when state that pure
+  --  conditions depend on changes in the middle of an event.
+  invalidate = function ()
+    if event.serial ~= 0 then
+      event.serial = event.serial + 1
+    end
+  end,
 }
 
 LazyFMeta = {
@@ -126,27 +319,56 @@ ConcatF = {
   end
 }
 
+--- Create a condition that combines other conditions.
+local function combine(op, fn, ...)
+  local args = {...}
+  local c = Cond.new(fn)
+  c.op = op
+  c.args = args
+  c.pure = true
+  for _, arg in ipairs(args) do
+    if getmetatable(arg) ~= CondMeta or not arg.pure then
+      c.pure = false
+    end
+  end
+  -- Memoizing is only worth it when it saves re-evaluating a memoized
+  -- condition further down.
+  for _, arg in ipairs(args) do
+    if c.pure and arg.memo then
+      c.memo = true
+    end
+  end
+  return c
+end
+
 CondMeta = {
   __call = function (t, ...)
+    if t.memo and event.serial ~= 0 then
+      if t.serial ~= event.serial then
+        t.value = t.cond()
+        t.serial = event.serial
+      end
+      return t.value
+    end
     return t.cond()
   end,
 
   __add = function (this, other)
-    return Cond.new(function ()
+    return combine("and", function ()
         return this() and other()
-    end)
+    end, this, other)
   end,
 
   __div = function (this, other)
-    return Cond.new(function ()
+    return combine("or", function ()
         return this() or other()
-    end)
+    end, this, other)
   end,
 
   __unm = function (this)
-    return Cond.new(function ()
+    return combine("not", function ()
         return not this()
-    end)
+    end, this)
   end,
 
   __le = function (this, other)
@@ -164,7 +386,26 @@ Cond = {
     local t = {cond = cond}
     setmetatable(t, CondMeta)
     return t
-  end
+  end,
+
+  --- Create a condition without side effects, which only depends on the
+  --  current event and keyboard state.
+  --
+  -- @param cond The condition function.
+  -- @param info Optional table with the fields:
+  --             codes: Set of event codes that the condition can be true for.
+  --             values: Set of key event values that the condition can be true for.
+  --             memo: Remember the result until the next event.
+  pure = function (cond, info)
+    local t = Cond.new(cond)
+    t.pure = true
+    if info then
+      t.codes = info.codes
+      t.values = info.values
+      t.memo = info.memo
+    end
+    return t
+  end,
 }
 
 LazyCondFMeta = {
@@ -186,7 +427,14 @@ LazyCondF = {
 
 PatternMeta = {
   __call = function (t)
-    if t.pattern() then
+    local matched = t.pattern()
+    if profile.enabled then
+      t.tested = t.tested + 1
+      if matched then
+        t.fired = t.fired + 1
+      end
+    end
+    if matched then
       -- If we've got a sub-scope
       if getmetatable(t.action) == PatternScopeMeta then
         return t.action()
@@ -199,10 +447,14 @@ PatternMeta = {
 }
 
 Pattern = {
-  new = function (pattern, action)
+  --- @param where Where the pattern was defined, shown by the profiler.
+  new = function (pattern, action, where)
     local t = {
       pattern = pattern,
-      action = action
+      action = action,
+      where = where or "?",
+      tested = 0,
+      fired = 0,
     }
     setmetatable(t, PatternMeta)
     return t
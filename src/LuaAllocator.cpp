@@ -0,0 +1,273 @@
+/** @file LuaAllocator.cpp
+ *
+ * @brief Pooled allocator for Lua states, with per-state accounting.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+    #include <syslog.h>
+}
+
+#include "LuaAllocator.hpp"
+
+using namespace std;
+
+namespace Lua {
+    /** Size classes are 16 bytes apart up to 256 bytes, and 64 bytes apart
+     *  from there up to MAX_POOLED. */
+    static constexpr size_t NUM_CLASSES = 16 + (MAX_POOLED - 256) / 64;
+    /** Size of the chunks that pooled blocks are carved out of. */
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+    /** Number of blocks moved between a thread and the shared pool at once. */
+    static constexpr size_t BATCH = 64;
+
+    static inline size_t sizeClass(size_t n) noexcept {
+        return (n <= 256) ? (n - 1) >> 4 : 16 + ((n - 257) >> 6);
+    }
+
+    static inline size_t classSize(size_t c) noexcept {
+        return (c < 16) ? (c + 1) << 4 : 256 + ((c - 15) << 6);
+    }
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    /** A list of free blocks of a single size class. */
+    struct FreeList {
+        FreeBlock *head = nullptr;
+        size_t len = 0;
+
+        inline void push(FreeBlock *b) noexcept {
+            b->next = head;
+            head = b;
+            len++;
+        }
+
+        inline FreeBlock *pop() noexcept {
+            FreeBlock *b = head;
+            head = b->next;
+            len--;
+            return b;
+        }
+
+        /** Detach up to n blocks from the front of the list. */
+        FreeList split(size_t n) noexcept {
+            FreeList out;
+            FreeBlock *last = nullptr;
+            for (out.head = head; out.len < n && head; out.len++)
+                head = (last = head)->next;
+            if (last)
+                last->next = nullptr;
+            len -= out.len;
+            return out;
+        }
+
+        /** Move all blocks from another list into this one. */
+        void splice(FreeList &other) noexcept {
+            if (!other.head)
+                return;
+            FreeBlock *tail = other.head;
+            while (tail->next)
+                tail = tail->next;
+            tail->next = head;
+            head = other.head;
+            len += other.len;
+            other.head = nullptr;
+            other.len = 0;
+        }
+    };
+
+    /** Blocks shared between threads, and the chunks they come from. */
+    struct SharedPool {
+        mutex mtx;
+        FreeList free[NUM_CLASSES];
+        vector<void *> chunks;
+
+        /** Fill a thread's list with a batch of blocks. */
+        bool refill(size_t c, FreeList &local) noexcept {
+            lock_guard<mutex> lock(mtx);
+            if (free[c].head) {
+                FreeList batch = free[c].split(BATCH);
+                local.splice(batch);
+                return true;
+            }
+
+            char *chunk = (char *) malloc(CHUNK_SIZE);
+            if (chunk == nullptr)
+                return false;
+            try {
+                chunks.push_back(chunk);
+            } catch (const bad_alloc &) {
+                ::free(chunk);
+                return false;
+            }
+            size_t sz = classSize(c);
+            for (size_t off = 0; off + sz <= CHUNK_SIZE; off += sz)
+                local.push((FreeBlock *) (chunk + off));
+            return true;
+        }
+
+        /** Take back a batch of blocks from a thread. */
+        void release(size_t c, FreeList &blocks) noexcept {
+            lock_guard<mutex> lock(mtx);
+            free[c].splice(blocks);
+        }
+    };
+
+    /** Never destroyed, blocks may be freed by threads that exit after
+     *  static destructors have run. */
+    static SharedPool &shared() noexcept {
+        static SharedPool *pool = new SharedPool();
+        return *pool;
+    }
+
+    /** Free lists of the calling thread. This is kept trivially
+     *  destructible so that accessing it needs no TLS initialization check. */
+    static thread_local FreeList local[NUM_CLASSES];
+
+    /** Gives the free lists of a thread back to the shared pool when the
+     *  thread exits. */
+    struct LocalPoolGuard {
+        ~LocalPoolGuard() noexcept {
+            for (size_t c = 0; c < NUM_CLASSES; c++)
+                shared().release(c, local[c]);
+        }
+    };
+
+    static thread_local LocalPoolGuard local_guard;
+
+    static inline void *poolAlloc(size_t n) noexcept {
+        size_t c = sizeClass(n);
+        FreeList &list = local[c];
+        if (!list.head) {
+            // A thread needs to refill before it has anything to give back.
+            (void) &local_guard;
+            if (!shared().refill(c, list))
+                return nullptr;
+        }
+        return list.pop();
+    }
+
+    static inline void poolFree(void *ptr, size_t n) noexcept {
+        size_t c = sizeClass(n);
+        FreeList &list = local[c];
+        list.push((FreeBlock *) ptr);
+        // Keep a thread that mostly frees, like the one running the
+        // collector, from hoarding blocks that others need.
+        if (list.len > 4 * BATCH) {
+            FreeList batch = list.split(2 * BATCH);
+            shared().release(c, batch);
+        }
+    }
+
+    /** Only ever written by the thread running the state. */
+    static inline void add(atomic<size_t> &v, size_t n) noexcept {
+        v.store(v.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+
+    static inline void add(atomic<uint64_t> &v) noexcept {
+        v.store(v.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+
+    static inline void sub(atomic<size_t> &v, size_t n) noexcept {
+        v.store(v.load(memory_order_relaxed) - n, memory_order_relaxed);
+    }
+
+    void *allocate(void *ud, void *ptr, size_t osize, size_t nsize) noexcept {
+        auto *acc = (MemoryAccount *) ud;
+        // When ptr is NULL, osize holds the type of the object.
+        if (ptr == nullptr)
+            osize = 0;
+
+        if (nsize == 0) {
+            if (ptr == nullptr)
+                return nullptr;
+            if (osize <= MAX_POOLED)
+                poolFree(ptr, osize);
+            else
+                free(ptr);
+            sub(acc->bytes, osize);
+            add(acc->frees);
+            return nullptr;
+        }
+
+        // Lua requires that shrinking never fails, so only growth is
+        // checked against the limit.
+        size_t bytes = acc->bytes.load(memory_order_relaxed);
+        size_t limit = acc->limit.load(memory_order_relaxed);
+        if (nsize > osize && limit && bytes + (nsize - osize) > limit) {
+            acc->exceeded.store(true, memory_order_relaxed);
+            return nullptr;
+        }
+
+        void *nptr;
+        if (ptr == nullptr) {
+            nptr = (nsize <= MAX_POOLED) ? poolAlloc(nsize) : malloc(nsize);
+            if (nptr == nullptr)
+                return nullptr;
+            add(acc->allocs);
+        } else if (osize > MAX_POOLED && nsize > MAX_POOLED) {
+            if ((nptr = realloc(ptr, nsize)) == nullptr) {
+                if (nsize > osize)
+                    return nullptr;
+                nptr = ptr;
+            }
+        } else if (osize <= MAX_POOLED && nsize <= MAX_POOLED
+                   && sizeClass(osize) == sizeClass(nsize)) {
+            nptr = ptr;
+        } else {
+            nptr = (nsize <= MAX_POOLED) ? poolAlloc(nsize) : malloc(nsize);
+            if (nptr == nullptr) {
+                if (nsize > osize)
+                    return nullptr;
+                // Lua does not handle failed shrinks. A pooled block can be
+                // kept and later freed into a smaller class, but a block
+                // from malloc() would end up in the pool.
+                if (osize > MAX_POOLED) {
+                    syslog(LOG_CRIT, "Out of memory while shrinking Lua object");
+                    abort();
+                }
+                nptr = ptr;
+            } else {
+                memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+                if (osize <= MAX_POOLED)
+                    poolFree(ptr, osize);
+                else
+                    free(ptr);
+            }
+        }
+
+        if (nsize > osize) {
+            add(acc->bytes, nsize - osize);
+            // Lua retries a refused allocation after an emergency
+            // collection, the limit only counts as exceeded if that failed.
+            if (acc->exceeded.load(memory_order_relaxed))
+                acc->exceeded.store(false, memory_order_relaxed);
+        } else {
+            sub(acc->bytes, osize - nsize);
+        }
+        bytes = acc->bytes.load(memory_order_relaxed);
+        if (bytes > acc->peak.load(memory_order_relaxed))
+            acc->peak.store(bytes, memory_order_relaxed);
+
+        return nptr;
+    }
+
+    static int panic(lua_State *L) {
+        const char *msg = lua_tostring(L, -1);
+        syslog(LOG_CRIT, "Unprotected error in Lua: %s", msg ? msg : "(error object is not a string)");
+        return 0;
+    }
+
+    lua_State *newState(MemoryAccount *account) noexcept {
+        lua_State *L = lua_newstate(allocate, account);
+        if (L)
+            lua_atpanic(L, panic);
+        return L;
+    }
+}
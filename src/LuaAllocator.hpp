@@ -0,0 +1,62 @@
+/** @file LuaAllocator.hpp
+ *
+ * @brief Pooled allocator for Lua states, with per-state accounting.
+ *
+ * Most of what Lua allocates is small and short-lived: closures, tables,
+ * upvalues and short strings. Requests up to MAX_POOLED bytes are served from
+ * size-class pools, which keep a free list per size class and thread, and
+ * refill those lists in batches from a shared set of chunks. Pooled memory is
+ * never returned to the system, it is reused by later allocations. Larger
+ * requests go through realloc().
+ *
+ * Every state has a MemoryAccount which is passed to the allocator as its
+ * userdata, it counts the bytes and allocations of the state and can put a
+ * cap on the number of bytes in use.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+    #include <lua.h>
+}
+
+namespace Lua {
+    /** Memory usage of a single Lua state.
+     *
+     * Written only by the thread running the state, and read from any
+     * thread, so the counters are relaxed atomics that are never
+     * read-modify-written.
+     */
+    struct MemoryAccount {
+        /** Bytes currently in use. */
+        std::atomic<size_t> bytes{0};
+        /** Highest value bytes has had. */
+        std::atomic<size_t> peak{0};
+        /** Number of allocations, not counting resizes. */
+        std::atomic<uint64_t> allocs{0};
+        /** Number of frees. */
+        std::atomic<uint64_t> frees{0};
+        /** Maximum number of bytes in use, 0 for no limit. */
+        std::atomic<size_t> limit{0};
+        /** Set when an allocation was refused because of the limit, cleared
+         *  again by the next allocation that succeeds. */
+        std::atomic<bool> exceeded{false};
+    };
+
+    /** Requests larger than this are not pooled. */
+    constexpr size_t MAX_POOLED = 512;
+
+    /** Allocation function for lua_newstate(), ud must be a MemoryAccount. */
+    void *allocate(void *ud, void *ptr, size_t osize, size_t nsize) noexcept;
+
+    /** Create a Lua state that allocates through Lua::allocate().
+     *
+     * @param account The account to charge, must outlive the state.
+     * @return The new state, or nullptr if it could not be allocated.
+     */
+    lua_State *newState(MemoryAccount *account) noexcept;
+}
@@ -0,0 +1,161 @@
+/** @file LuaBytecodeCache.cpp
+ *
+ * @brief On-disk cache of compiled Lua chunks.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+
+extern "C" {
+    #include <lauxlib.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <syslog.h>
+    #include <unistd.h>
+}
+
+#include <hawck_config.h>
+
+#include "LuaBytecodeCache.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+namespace Lua {
+    static constexpr char MAGIC[] = "HWKBC1";
+
+    BytecodeCache::BytecodeCache(const std::string &dir) : dir(dir) {}
+
+    std::string BytecodeCache::entryName(const std::string &chunkname) {
+        stringstream ss;
+        ss << hex << setw(16) << setfill('0') << hashFNV1a(chunkname) << ".luac";
+        return ss.str();
+    }
+
+    std::string BytecodeCache::entryPath(const std::string &chunkname) const {
+        return pathJoin(dir, entryName(chunkname));
+    }
+
+    /** Check that only the user running the scripts could have written to
+     *  a cache entry or the cache directory. */
+    static bool trusted(const struct stat &stbuf) noexcept {
+        return stbuf.st_uid == geteuid() && !(stbuf.st_mode & (S_IWGRP | S_IWOTH));
+    }
+
+    /** Read an entry from a cache directory, or return false if it doesn't
+     *  exist or can't be trusted. */
+    static bool readEntry(const string &dir, const string &name, string &data) {
+        int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd == -1)
+            return false;
+        struct stat stbuf;
+        if (fstat(dir_fd, &stbuf) == -1 || !trusted(stbuf)) {
+            syslog(LOG_WARNING, "Not using bytecode cache %s, it is writable by "
+                   "other users", dir.c_str());
+            close(dir_fd);
+            return false;
+        }
+        int fd = openat(dir_fd, name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        close(dir_fd);
+        if (fd == -1)
+            return false;
+        if (fstat(fd, &stbuf) == -1 || !S_ISREG(stbuf.st_mode) || !trusted(stbuf)) {
+            syslog(LOG_WARNING, "Ignoring bytecode cache entry %s/%s, it is writable "
+                   "by other users", dir.c_str(), name.c_str());
+            close(fd);
+            return false;
+        }
+
+        data.resize(stbuf.st_size);
+        size_t off = 0;
+        while (off < data.size()) {
+            ssize_t n = ::read(fd, &data[off], data.size() - off);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            off += n;
+        }
+        close(fd);
+        data.resize(off);
+        return true;
+    }
+
+    std::string BytecodeCache::header(const std::string &chunkname,
+                                      const std::string &source) {
+        stringstream ss;
+        ss << MAGIC << " " << LUA_RELEASE << " " << VERSION << " "
+           << source.size() << " " << hex << hashFNV1a(source) << "\n"
+           << chunkname << "\n";
+        return ss.str();
+    }
+
+    bool BytecodeCache::load(lua_State *L, const std::string &chunkname,
+                             const std::string &source) noexcept {
+        // Bytecode isn't verified by Lua, so it is only loaded from files
+        // that nobody else could have written.
+        string data;
+        if (!readEntry(dir, entryName(chunkname), data))
+            return false;
+
+        string hdr = header(chunkname, source);
+        if (data.compare(0, hdr.size(), hdr) != 0)
+            return false;
+
+        if (luaL_loadbufferx(L, data.data() + hdr.size(), data.size() - hdr.size(),
+                             chunkname.c_str(), "b") != LUA_OK)
+        {
+            // Truncated or otherwise broken, it will be overwritten.
+            syslog(LOG_WARNING, "Invalid bytecode cache entry for %s: %s",
+                   chunkname.c_str(), lua_tostring(L, -1));
+            lua_pop(L, 1);
+            return false;
+        }
+
+        return true;
+    }
+
+    static int writer(lua_State *, const void *p, size_t sz, void *ud) {
+        static_cast<string *>(ud)->append(static_cast<const char *>(p), sz);
+        return 0;
+    }
+
+    void BytecodeCache::store(lua_State *L, const std::string &chunkname,
+                              const std::string &source) noexcept {
+        try {
+            string data = header(chunkname, source);
+            // Debug information is kept for tracebacks.
+            if (lua_dump(L, writer, &data, 0) != 0)
+                throw SystemError("lua_dump() failed");
+
+            // Written to a temporary file first so that readers never see a
+            // partial entry, it is unique so that scripts that are loaded at
+            // the same time don't write to the same file.
+            string path = entryPath(chunkname);
+            string tmp_path = path + ".XXXXXX";
+            int fd = mkostemp(&tmp_path[0], O_CLOEXEC);
+            if (fd == -1)
+                throw SystemError("Unable to open " + tmp_path + ": ", errno);
+            size_t off = 0;
+            while (off < data.size()) {
+                ssize_t n = ::write(fd, data.data() + off, data.size() - off);
+                if (n == -1 && errno != EINTR) {
+                    close(fd);
+                    unlink(tmp_path.c_str());
+                    throw SystemError("Unable to write " + tmp_path + ": ", errno);
+                }
+                if (n > 0)
+                    off += n;
+            }
+            close(fd);
+            if (rename(tmp_path.c_str(), path.c_str()) == -1) {
+                unlink(tmp_path.c_str());
+                throw SystemError("Unable to rename " + tmp_path + ": ", errno);
+            }
+        } catch (const exception &e) {
+            syslog(LOG_WARNING, "Unable to cache bytecode for %s: %s",
+                   chunkname.c_str(), e.what());
+        }
+    }
+}
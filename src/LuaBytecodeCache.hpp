@@ -0,0 +1,67 @@
+/** @file LuaBytecodeCache.hpp
+ *
+ * @brief On-disk cache of compiled Lua chunks.
+ */
+
+#pragma once
+
+#include <string>
+
+extern "C" {
+    #include <lua.h>
+}
+
+namespace Lua {
+    /**
+     * Cache of precompiled Lua chunks.
+     *
+     * There is one cache file per chunk name. Every file starts with a header
+     * that holds a hash of the source text that the chunk was built from,
+     * along with the Lua and Hawck versions. If any of those differ the
+     * entry is treated as a miss and overwritten on the next store(), so
+     * stale entries never have to be removed by hand.
+     *
+     * The source text does not have to be Lua, for .hwk scripts it is the
+     * .hwk file, so that a hit skips both the transpiler and the Lua parser.
+     *
+     * Lua does not verify bytecode, and broken bytecode can crash the
+     * interpreter, so entries are only loaded if they and the directory are
+     * owned by the user and not writable by the group or others.
+     */
+    class BytecodeCache {
+    private:
+        std::string dir;
+
+        static std::string entryName(const std::string &chunkname);
+
+        std::string entryPath(const std::string &chunkname) const;
+
+        static std::string header(const std::string &chunkname,
+                                  const std::string &source);
+
+    public:
+        /**
+         * @param dir Directory to keep cache entries in, should only be
+         *            writable by the user running the scripts.
+         */
+        explicit BytecodeCache(const std::string &dir);
+
+        /**
+         * Push the cached chunk for `source` onto the stack.
+         *
+         * @param chunkname Chunk name, as given to lua_load.
+         * @param source Text that the entry is keyed on.
+         * @return True if the chunk was pushed, false on a cache miss or if
+         *         the entry can't be trusted.
+         */
+        bool load(lua_State *L, const std::string &chunkname,
+                  const std::string &source) noexcept;
+
+        /**
+         * Store the function on top of the stack, which must be a Lua
+         * chunk compiled from `source`. Failures are logged, not thrown.
+         */
+        void store(lua_State *L, const std::string &chunkname,
+                   const std::string &source) noexcept;
+    };
+}
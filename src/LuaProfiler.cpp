@@ -0,0 +1,197 @@
+/** @file LuaProfiler.cpp
+ *
+ * @brief Sampling profiler for Lua states.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+extern "C" {
+    #include <lauxlib.h>
+}
+
+#include "LuaProfiler.hpp"
+#include "LuaWatchdog.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Lua {
+    /** Registry keys of the strings that prepare() stores. */
+    static const char PATTERN_META_KEY = 0;
+    static const char WHERE_KEY = 0;
+
+    void Profile::prepare(lua_State *L) {
+        lua_pushliteral(L, "PatternMeta");
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &PATTERN_META_KEY);
+        lua_pushliteral(L, "where");
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &WHERE_KEY);
+    }
+
+    /** If the function at a stack level is PatternMeta.__call, write
+     *  "pattern@<where>" with the location that the pattern was defined at.
+     *  Only reads values that already exist with raw accesses, so that no
+     *  memory is allocated, no Lua code runs and no errors are raised inside
+     *  the hook. lua_getlocal() only copies a stack slot, and the hook is
+     *  called with LUA_MINSTACK free slots. */
+    static bool patternWhere(lua_State *L, lua_Debug *ar, char *buf, size_t size) noexcept {
+        if (!lua_checkstack(L, 5))
+            return false;
+        int top = lua_gettop(L);
+        bool found = false;
+        if (lua_getlocal(L, ar, 1) && lua_type(L, -1) == LUA_TTABLE &&
+            lua_getmetatable(L, -1) &&
+            lua_rawgetp(L, LUA_REGISTRYINDEX, &PATTERN_META_KEY) == LUA_TSTRING)
+        {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+            lua_insert(L, -2);
+            lua_rawget(L, -2);
+            if (lua_rawequal(L, -1, top + 2) &&
+                lua_rawgetp(L, LUA_REGISTRYINDEX, &WHERE_KEY) == LUA_TSTRING &&
+                lua_rawget(L, top + 1) == LUA_TSTRING)
+            {
+                snprintf(buf, size, "pattern@%s", lua_tostring(L, -1));
+                found = true;
+            }
+        }
+        lua_settop(L, top);
+        return found;
+    }
+
+    static void frameName(lua_State *L, lua_Debug *ar, char *buf, size_t size) noexcept {
+        if (patternWhere(L, ar, buf, size))
+            return;
+        if (ar->currentline < 0) {
+            snprintf(buf, size, "[C]");
+            return;
+        }
+        // Chunks loaded from files are named "@<path>", only the file name
+        // is of interest.
+        const char *src = ar->short_src;
+        if (ar->source[0] == '@') {
+            const char *slash = strrchr(ar->source, '/');
+            src = slash ? slash + 1 : ar->source + 1;
+        }
+        snprintf(buf, size, "%s:%d", src, ar->currentline);
+    }
+
+    void Profile::sample(lua_State *L) noexcept {
+        // Frames are visited innermost first, and written from the end of
+        // the buffer towards the start, so that the outermost one comes
+        // first.
+        char stack[MAX_STACK_LEN];
+        char frame[256];
+        size_t start = sizeof(stack);
+        lua_Debug ar;
+        for (int level = 0; lua_getstack(L, level, &ar); level++) {
+            if (!lua_getinfo(L, "Sl", &ar))
+                continue;
+            frameName(L, &ar, frame, sizeof(frame));
+            size_t len = strlen(frame), sep = start == sizeof(stack) ? 0 : 1;
+            if (len + sep > start)
+                break;
+            if (sep)
+                stack[--start] = ';';
+            start -= len;
+            memcpy(stack + start, frame, len);
+        }
+        string_view key(stack + start, sizeof(stack) - start);
+
+        lock_guard<mutex> lock(mtx);
+        auto it = stacks.find(key);
+        if (it != stacks.end()) {
+            it->second++;
+            return;
+        }
+        try {
+            if (stacks.size() < MAX_STACKS)
+                stacks.emplace(key, 1);
+            else
+                dropped++;
+        } catch (const exception &) {
+            // Out of memory, skip the sample.
+        }
+    }
+
+    void Profile::setPatterns(string stats) {
+        lock_guard<mutex> lock(mtx);
+        patterns = std::move(stats);
+    }
+
+    Profiler &Profiler::get() noexcept {
+        // Never destroyed, the thread may outlive static destructors.
+        static Profiler *prof = new Profiler();
+        return *prof;
+    }
+
+    Profile &Profiler::profile(const string &name) {
+        lock_guard<mutex> lock(mtx);
+        auto &prof = profiles[name];
+        if (!prof)
+            prof = make_unique<Profile>();
+        return *prof;
+    }
+
+    void Profiler::setInterval(microseconds interval) {
+        {
+            lock_guard<mutex> lock(mtx);
+            this->interval = interval;
+        }
+        if (interval.count() > 0)
+            call_once(started, [this]() {
+                thread([this]() { run(); }).detach();
+            });
+        cv.notify_all();
+    }
+
+    bool Profiler::enabled() {
+        lock_guard<mutex> lock(mtx);
+        return interval.count() > 0;
+    }
+
+    void Profiler::run() noexcept {
+        auto next = steady_clock::now();
+        for (;;) {
+            microseconds ival;
+            {
+                unique_lock<mutex> lock(mtx);
+                if (interval.count() <= 0) {
+                    cv.wait(lock, [this]() { return interval.count() > 0; });
+                    next = steady_clock::now();
+                }
+                ival = interval;
+            }
+            next += ival;
+            this_thread::sleep_until(next);
+            Watchdog::get().sampleRunning();
+        }
+    }
+
+    string Profiler::folded() {
+        stringstream out;
+        lock_guard<mutex> lock(mtx);
+        for (auto &[name, prof] : profiles) {
+            lock_guard<mutex> plock(prof->mtx);
+            for (const auto &[stack, n] : prof->stacks)
+                out << name << (stack.empty() ? "" : ";") << stack << " " << n << "\n";
+            if (prof->dropped)
+                out << name << ";[other] " << prof->dropped << "\n";
+        }
+        return out.str();
+    }
+
+    string Profiler::patterns() {
+        stringstream out;
+        lock_guard<mutex> lock(mtx);
+        for (auto &[name, prof] : profiles) {
+            lock_guard<mutex> plock(prof->mtx);
+            stringstream in(prof->patterns);
+            for (string line; getline(in, line);)
+                out << name << "\t" << line << "\n";
+        }
+        return out.str();
+    }
+}
@@ -0,0 +1,112 @@
+/** @file LuaProfiler.hpp
+ *
+ * @brief Sampling profiler for Lua states.
+ *
+ * A sampler thread wakes up at a fixed interval, and has every profiled state
+ * that is in the middle of a call take a sample, through the watchdog hook
+ * (see LuaWatchdog.hpp.) The sample is taken on the thread that runs the
+ * state, by walking its call stack. States that are idle cost nothing, and a
+ * call only pays for the samples that land in it, so the profiler can be left
+ * on.
+ *
+ * Samples are kept as folded stacks, one line for each distinct stack with
+ * the number of times that it was seen, which is what flamegraph.pl takes:
+ *
+ *     example.hwk;Hawck.lua:211;match.lua:160;pattern@example.hwk:12;example.hwk:12 17
+ *
+ * Frames that are testing a Pattern from match.lua are named after the line
+ * that the pattern was defined on.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+extern "C" {
+    #include <lua.h>
+}
+
+namespace Lua {
+    /** Samples of a single script, kept across reloads of the script. */
+    class Profile {
+    private:
+        std::mutex mtx;
+        /** Number of samples of each folded stack, looked up without
+         *  allocating a key. */
+        std::map<std::string, uint64_t, std::less<>> stacks;
+        /** Samples with a stack that didn't fit in the table. */
+        uint64_t dropped = 0;
+        /** Latest pattern statistics, see setPatterns(). */
+        std::string patterns;
+
+        friend class Profiler;
+
+    public:
+        /** Distinct stacks that are kept, the rest are counted as [other]. */
+        static constexpr size_t MAX_STACKS = 4096;
+        /** Length of a folded stack, outer frames that don't fit are left
+         *  out. */
+        static constexpr size_t MAX_STACK_LEN = 2048;
+
+        /** Record the current call stack of L, must be called from the thread
+         *  that runs L, with L in the middle of a call.
+         *
+         *  This runs inside the Lua hook, so it makes no Lua calls that
+         *  allocate or raise errors, and builds the stack in a buffer on the
+         *  C stack. Memory is only allocated the first time that a stack is
+         *  seen, after L has been left alone. */
+        void sample(lua_State *L) noexcept;
+
+        /** Store the strings that sample() looks up patterns with in the
+         *  registry of L, so that taking a sample doesn't create them. Call
+         *  before L is sampled, outside of the hook. */
+        static void prepare(lua_State *L);
+
+        /** Replace the pattern statistics, one line for each pattern with
+         *  its location, how often it was tested and how often it matched,
+         *  separated by tabs. */
+        void setPatterns(std::string stats);
+    };
+
+    class Profiler {
+    private:
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::map<std::string, std::unique_ptr<Profile>> profiles;
+        std::chrono::microseconds interval{0};
+        std::once_flag started;
+
+        inline Profiler() noexcept {}
+
+        void run() noexcept;
+
+    public:
+        /** Get the profiler, the sampler thread is started the first time
+         *  sampling is enabled and runs until the process exits. */
+        static Profiler &get() noexcept;
+
+        /** Get the profile of a script, creating it if it doesn't exist. It
+         *  is never freed. */
+        Profile &profile(const std::string &name);
+
+        /** Set the sampling interval, zero disables sampling. */
+        void setInterval(std::chrono::microseconds interval);
+
+        /** Whether sampling is enabled. */
+        bool enabled();
+
+        /** Samples of all the scripts as folded stacks, rooted at the name
+         *  of the script. */
+        std::string folded();
+
+        /** Pattern statistics of all the scripts, one line per pattern with
+         *  the script, location, tests and matches. */
+        std::string patterns();
+    };
+}
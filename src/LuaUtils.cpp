@@ -33,6 +33,7 @@ extern "C" {
 }
 
 #include "LuaUtils.hpp"
+#include "LuaProfiler.hpp"
 #include "utils.hpp"
 
 using namespace std;
@@ -85,11 +86,9 @@ namespace Lua {
 
         if (lua_isfunction(L, idx))
             return true;
-        lua_getmetatable(L, idx);
-        if (!lua_istable(L, -1)) {
-            lua_pop(L, 1);
+        // Nothing is pushed when there is no metatable.
+        if (!lua_getmetatable(L, idx))
             return false;
-        }
         lua_getfield(L, -1, "__call");
 
         // Nested __call metamethods are possible
@@ -114,19 +113,36 @@ namespace Lua {
         if (src.size() == 0)
             throw Lua::LuaError("No path given");
 
-        auto L = unique_ptr<lua_State, decltype(&lua_close)>(luaL_newstate(),
+        auto L = unique_ptr<lua_State, decltype(&lua_close)>(newState(&mem),
                                                              &lua_close);
+        if (!L)
+            throw Lua::LuaError("Unable to allocate Lua state");
         this->L = L.get();
         luaL_openlibs(L.get());
+        watch = Watchdog::get().add(this->L);
 
-        from(path);
+        try {
+            from(path);
+        } catch (...) {
+            Watchdog::get().remove(watch);
+            throw;
+        }
 
         L.release();
     }
 
     Script::Script() {
-        L = luaL_newstate();
+        if (!(L = newState(&mem)))
+            throw Lua::LuaError("Unable to allocate Lua state");
         luaL_openlibs(L);
+        watch = Watchdog::get().add(L);
+    }
+
+    void Script::setProfile(Profile *prof) {
+        if (prof)
+            Profile::prepare(L);
+        profile = prof;
+        watch->profile.store(prof, memory_order_relaxed);
     }
 
     void Script::from(const std::string& path) {
@@ -141,14 +157,24 @@ namespace Lua {
     }
 
     void Script::reset() {
+        Watchdog::get().remove(watch);
         lua_close(L);
-        auto L = unique_ptr<lua_State, decltype(&lua_close)>(luaL_newstate(), &lua_close);
+        auto L = unique_ptr<lua_State, decltype(&lua_close)>(newState(&mem), &lua_close);
+        if (!L)
+            throw Lua::LuaError("Unable to allocate Lua state");
         this->L = L.get();
         luaL_openlibs(L.get());
+        watch = Watchdog::get().add(this->L);
+        if (profile)
+            Profile::prepare(this->L);
+        watch->profile.store(profile, memory_order_relaxed);
         L.release();
+        errh_ref = LUA_NOREF;
+        gen++;
     }
 
     Script::~Script() noexcept {
+        Watchdog::get().remove(watch);
         lua_close(L);
     }
 
@@ -176,49 +202,6 @@ namespace Lua {
         }
     }
 
-    std::mutex TimeoutHook::script_end_times_mtx;
-    std::unordered_map<uintptr_t, milliseconds> TimeoutHook::script_end_times;
-
-    TimeoutHook::TimeoutHook(lua_State *L, milliseconds time)
-        : Hook(L, lua_timeout_hook, TimeoutHook::NUM_INST)
-    {
-        lock_guard<mutex> lock(script_end_times_mtx);
-        milliseconds ms = duration_cast<milliseconds>(
-            system_clock::now().time_since_epoch()
-        );
-        script_end_times[reinterpret_cast<uintptr_t>(L)] = ms + time;
-    }
-
-    TimeoutHook::~TimeoutHook() {
-        lock_guard<mutex> lock(script_end_times_mtx);
-        script_end_times.erase(reinterpret_cast<uintptr_t>(L));
-    }
-
-#define MK_LUA_ERROR_HOOK(_name, _msg)                                  \
-    static void lua_##_name##_error_hook(lua_State *L, lua_Debug *ar) { \
-        (void) ar;                                                      \
-        luaL_error(L, _msg);                                            \
-    }
-
-    extern "C" {
-        MK_LUA_ERROR_HOOK(timeout, "Timeout Error")
-    }
-#undef MK_LUA_ERROR_HOOK
-
-    extern "C" void lua_timeout_hook(lua_State *L, lua_Debug *ar) noexcept
-    {
-        (void) ar;
-        lock_guard<mutex> lock(TimeoutHook::script_end_times_mtx);
-        milliseconds end_time = TimeoutHook::script_end_times[reinterpret_cast<uintptr_t>(L)];
-        milliseconds now = duration_cast<milliseconds>(
-            system_clock::now().time_since_epoch()
-        );
-        if (now > end_time) {
-            lua_sethook(L, NULL, 0, 0);
-            lua_sethook(L, lua_timeout_error_hook, LUA_MASKCOUNT, 1);
-        }
-    }
-
     extern "C" int hwk_lua_error_handler_callback(lua_State *L) noexcept
     {
         lua_Debug ar;
@@ -234,6 +217,63 @@ namespace Lua {
         return 1;
     }
 
+    void Script::execCached(BytecodeCache &cache, const std::string &path,
+                            const std::string &source,
+                            const std::function<std::string()> &compile)
+    {
+        string chunkname = "@" + path;
+        if (!cache.load(L, chunkname, source)) {
+            string code = compile();
+            if (luaL_loadbuffer(L, code.data(), code.size(), chunkname.c_str()) != LUA_OK) {
+                string err(lua_tostring(L, -1));
+                lua_pop(L, 1);
+                throw Lua::LuaError(err);
+            }
+            cache.store(L, chunkname, source);
+        }
+        if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+            string err(lua_tostring(L, -1));
+            lua_pop(L, 1);
+            throw Lua::LuaError(err);
+        }
+    }
+
+    void Script::addRequirePath(const std::vector<std::string> &dirs) {
+        string path;
+        for (const auto &dir : dirs)
+            path += dir + "/?.lua;";
+        lua_getglobal(L, "package");
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            throw Lua::LuaError("The package library has not been opened");
+        }
+        lua_getfield(L, -1, "path");
+        if (const char *old = lua_tostring(L, -1))
+            path += old;
+        lua_pop(L, 1);
+        lua_pushlstring(L, path.data(), path.size());
+        lua_setfield(L, -2, "path");
+        lua_pop(L, 1);
+    }
+
+    int Script::boundErrorHandler(lua_State *L) noexcept {
+        auto sc = static_cast<Script *>(lua_touserdata(L, lua_upvalueindex(1)));
+        size_t errmsg_sz = 0;
+        const char *errmsg = lua_tolstring(L, -1, &errmsg_sz);
+        lua_Debug ar;
+        try {
+            sc->bound_err.assign(errmsg ? errmsg : "Unknown error", errmsg ? errmsg_sz : 13);
+            sc->bound_trace.clear();
+            for (int lv = 0; lua_getstack(L, lv, &ar); lv++) {
+                lua_getinfo(L, "Sunl", &ar);
+                sc->bound_trace.push_back(ar);
+            }
+        } catch (const std::bad_alloc &) {
+            // Report what we have.
+        }
+        return 1;
+    }
+
     /**
      * This __gc metamethod is used by LuaObject.
      * It is given two upvalues:
@@ -54,6 +54,9 @@
 #include <vector>
 
 #include "utils.hpp"
+#include "LuaWatchdog.hpp"
+#include "LuaBytecodeCache.hpp"
+#include "LuaAllocator.hpp"
 
 extern "C" {
     #include <lua.h>
@@ -282,6 +285,9 @@ namespace Lua {
 
     public:
         std::vector<lua_Debug> trace;
+        /** Status returned by lua_pcall(), LUA_ERRMEM if Lua ran out of
+         *  memory. */
+        int status = LUA_ERRRUN;
 
         explicit LuaError(const std::string& expl,
                           const std::vector<lua_Debug>& trace)
@@ -1072,28 +1078,75 @@ namespace Lua {
         }
     };
 
-    extern "C" void lua_timeout_hook(lua_State *L, lua_Debug *ar) noexcept;
+    class Script;
+
+    template <class Sig>
+    class Function;
+
+    /** Handle to a Lua function that has been resolved ahead of time, see
+     *  Script::bind.
+     *
+     * The handle stays valid for as long as the Script is alive and has not
+     * been reset().
+     */
+    template <class R, class... Arg>
+    class Function<R(Arg...)> {
+    private:
+        Script *sc = nullptr;
+        int ref = LUA_NOREF;
+        unsigned gen = 0;
 
-    class TimeoutHook : public Hook {
     public:
-        static std::mutex script_end_times_mtx;
-        static std::unordered_map<uintptr_t, milliseconds> script_end_times;
-        static const int NUM_INST = 16384;
+        inline Function() noexcept {}
+
+        inline Function(Script *sc, int ref, unsigned gen) noexcept
+            : sc(sc), ref(ref), gen(gen) {}
 
-        TimeoutHook(lua_State *L, milliseconds time);
+        inline bool isBound() const noexcept {
+            return sc != nullptr;
+        }
 
-        virtual ~TimeoutHook();
+        /** Call the function.
+         *
+         * @throws LuaError If the function raises an error, or if the return
+         *                  value has the wrong type.
+         */
+        inline R operator()(Arg... args);
     };
 
     /** C++ bindings to make the Lua API easier to deal with.
      */
     class Script {
     private:
+        /** Charged for all allocations made by L. */
+        MemoryAccount mem;
         lua_State *L;
+        WatchdogSlot *watch;
+        /** Where samples go, see setProfile(). */
+        Profile *profile = nullptr;
+        /** Incremented on reset(), invalidates bound functions. */
+        unsigned gen = 0;
+        /** Registry reference to the error handler used for bound functions. */
+        int errh_ref = LUA_NOREF;
+        /** Error message and traceback from the last failed bound call. */
+        std::string bound_err;
+        std::vector<lua_Debug> bound_trace;
+
+        /** Error handler for bound functions, records the error in the Script
+         *  given as an upvalue instead of allocating a LuaError. */
+        static int boundErrorHandler(lua_State *L) noexcept;
+
+        /** Restores the Lua stack top when it goes out of scope. */
+        struct StackReset {
+            lua_State *L;
+            int top;
+            inline ~StackReset() noexcept { lua_settop(L, top); }
+        };
         bool enabled = true;
         long max_run_time_ms = 2000;
         int max_instructions = 16384;
         milliseconds SCRIPT_TIMEOUT = 2000ms;
+        uint64_t timeout_ticks = Watchdog::ticks(SCRIPT_TIMEOUT);
 
     public:
         std::string src;
@@ -1113,6 +1166,43 @@ namespace Lua {
         /** Get the raw Lua state. */
         lua_State *getL() noexcept;
 
+        /** Memory usage of the Lua state. */
+        inline const MemoryAccount &memory() const noexcept {
+            return mem;
+        }
+
+        /** Limit the memory that the Lua state may use, allocations beyond
+         *  the limit fail with a Lua memory error.
+         *
+         * @param bytes The limit, 0 for no limit.
+         */
+        inline void setMemoryLimit(size_t bytes) noexcept {
+            mem.limit = bytes;
+        }
+
+        /** Have the profiler take samples of the Lua state, see
+         *  LuaProfiler.hpp.
+         *
+         * @param prof Where the samples go, null to stop profiling.
+         */
+        void setProfile(Profile *prof);
+
+        /** Where samples of the Lua state go, null if it isn't profiled. */
+        inline Profile *getProfile() const noexcept {
+            return profile;
+        }
+
+        /** Check whether err was raised because the memory limit was
+         *  exceeded, and not just because an allocation was refused before
+         *  garbage was collected.
+         *
+         * @param err An error raised by a call into this Script.
+         */
+        inline bool memoryLimitExceeded(const LuaError &err) noexcept {
+            bool exceeded = mem.exceeded.exchange(false);
+            return exceeded && err.status == LUA_ERRMEM;
+        }
+
         /** Load a script into the Lua state.
          *
          * @param path Path to the Lua script.
@@ -1167,7 +1257,7 @@ namespace Lua {
          */
         template <class... T, class... Arg>
         std::tuple<T...> call(std::string name, Arg... args) {
-            TimeoutHook hook(L, SCRIPT_TIMEOUT);
+            WatchdogGuard guard(watch, timeout_ticks);
 
             constexpr int nres = countT<T...>();
             constexpr int nargs = countT<Arg...>();
@@ -1182,13 +1272,21 @@ namespace Lua {
 
             // -n-nargs is the position of hwk_lua_error_handler_callback
             // on the Lua stack.
-            if (lua_pcall(L, nargs, nres, -2-nargs) != LUA_OK) {
+            int status = lua_pcall(L, nargs, nres, -2-nargs);
+            if (status != LUA_OK) {
+                // The message handler is not called for memory errors.
+                if (status == LUA_ERRMEM) {
+                    LuaError err("Not enough memory");
+                    err.status = status;
+                    throw err;
+                }
                 // Here be dragons
                 auto exc = std::unique_ptr<LuaError>(
                     static_cast<LuaError*>(lua_touserdata(L, -1)));
                 if (!exc)
                     throw LuaError("Unknown error");
                 LuaError err = *exc;
+                err.status = status;
                 throw err;
             }
 
@@ -1197,6 +1295,70 @@ namespace Lua {
             return tup;
         }
 
+        /** Resolve a global Lua function once, so that it can be called
+         *  repeatedly without looking it up by name.
+         *
+         * The function and the error handler are stored as registry
+         * references, and argument/return marshalling is generated from
+         * the signature, so calls do not allocate on the C++ side.
+         *
+         * Example:
+         *     auto match = sc.bind<bool(int, int, int, int)>("__match");
+         *     bool matched = match(value, code, type, kbd_handle);
+         *
+         * @tparam Sig Function signature, e.g bool(int, int).
+         * @param name Name of the global Lua function.
+         * @throws LuaError If the global is not callable.
+         */
+        template <class Sig>
+        Function<Sig> bind(const std::string &name) {
+            checkStack(L, 2);
+            if (errh_ref == LUA_NOREF) {
+                bound_trace.reserve(32);
+                lua_pushlightuserdata(L, this);
+                lua_pushcclosure(L, boundErrorHandler, 1);
+                errh_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+            }
+            lua_getglobal(L, name.c_str());
+            if (!isCallable(L, -1)) {
+                lua_pop(L, 1);
+                throw LuaError("Unable to bind " + name + ", it is not callable");
+            }
+            return Function<Sig>(this, luaL_ref(L, LUA_REGISTRYINDEX), gen);
+        }
+
+        /** Call a function bound with bind(), use Function::operator()
+         *  instead of calling this directly. */
+        template <class R, class... Arg>
+        R invoke(int ref, unsigned ref_gen, Arg... args) {
+            if (ref_gen != gen)
+                throw LuaError("Called a bound function after Script::reset()");
+
+            WatchdogGuard guard(watch, timeout_ticks);
+            constexpr int nargs = sizeof...(Arg);
+            constexpr int nres = std::is_void<R>::value ? 0 : 1;
+            checkStack(L, nargs + 2);
+
+            StackReset reset{L, lua_gettop(L)};
+            lua_rawgeti(L, LUA_REGISTRYINDEX, errh_ref);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+            (luaPush(L, args), ...);
+            int status = lua_pcall(L, nargs, nres, reset.top + 1);
+            if (status == LUA_ERRMEM) {
+                // The message handler is not called for memory errors.
+                LuaError err("Not enough memory");
+                err.status = status;
+                throw err;
+            } else if (status != LUA_OK) {
+                LuaError err(bound_err, bound_trace);
+                err.status = status;
+                throw err;
+            }
+
+            if constexpr (nres != 0)
+                return LuaValue<R>().get(L, -1);
+        }
+
         /** Retrieve a global Lua value. */
         template <class T>
         T get(std::string name);
@@ -1226,8 +1388,34 @@ namespace Lua {
          */
         void exec(const std::string &src, const std::string& str);
 
+        /** Run a chunk, going through a bytecode cache.
+         *
+         * @param cache The cache to use.
+         * @param path Path to the script, used as the chunk name.
+         * @param source Text that the cache entry is keyed on, e.g the
+         *               contents of a .hwk file.
+         * @param compile Returns the Lua code for `source`, this is only
+         *                called on a cache miss.
+         */
+        void execCached(BytecodeCache &cache, const std::string &path,
+                        const std::string &source,
+                        const std::function<std::string()> &compile);
+
+        /** Make `require` search the given directories before the default
+         *  package.path, so that modules are found without depending on
+         *  the working directory of the process.
+         *
+         * @param dirs Directories to search, in order.
+         */
+        void addRequirePath(const std::vector<std::string> &dirs);
+
         /** Reset the Lua state, will destroy all data currently
          *  held within it */
         void reset();
     };
+
+    template <class R, class... Arg>
+    inline R Function<R(Arg...)>::operator()(Arg... args) {
+        return sc->invoke<R, Arg...>(ref, gen, args...);
+    }
 }
@@ -0,0 +1,105 @@
+/** @file LuaWatchdog.cpp
+ *
+ * @brief Preemption of Lua calls that run for too long.
+ */
+
+#include <thread>
+
+extern "C" {
+    #include <lauxlib.h>
+    #include <syslog.h>
+}
+
+#include "LuaWatchdog.hpp"
+#include "LuaProfiler.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Lua {
+    static_assert(LUA_EXTRASPACE >= sizeof(WatchdogSlot *),
+                  "Watchdog slots are stored in the Lua extra space");
+
+    static inline WatchdogSlot *getSlot(lua_State *L) noexcept {
+        return *static_cast<WatchdogSlot **>(lua_getextraspace(L));
+    }
+
+    extern "C" void hwk_lua_watchdog_hook(lua_State *L, lua_Debug *ar) {
+        (void) ar;
+        WatchdogSlot *slot = getSlot(L);
+        if (slot->sample.exchange(false, memory_order_relaxed)) {
+            if (Profile *prof = slot->profile.load(memory_order_relaxed))
+                prof->sample(L);
+        }
+        uint64_t deadline = slot->deadline.load(memory_order_relaxed);
+        if (deadline != 0 && Watchdog::get().now() >= deadline)
+            luaL_error(L, "Timeout Error");
+        // Either a sample was taken, or the call that this hook was armed
+        // for has already returned. The hook is removed whatever the flags
+        // say, the watchdog may have installed it after disarm() looked at
+        // them, and a count hook of 1 would otherwise stay installed.
+        slot->preempt.store(false, memory_order_relaxed);
+        lua_sethook(L, NULL, 0, 0);
+    }
+
+    Watchdog &Watchdog::get() noexcept {
+        // Never destroyed, the thread may outlive static destructors.
+        static Watchdog *wd = new Watchdog();
+        return *wd;
+    }
+
+    WatchdogSlot *Watchdog::add(lua_State *L) {
+        call_once(started, [this]() {
+            thread([this]() { run(); }).detach();
+        });
+        auto slot = new WatchdogSlot(L);
+        *static_cast<WatchdogSlot **>(lua_getextraspace(L)) = slot;
+        lock_guard<mutex> lock(slots_mtx);
+        slots.push_back(slot);
+        return slot;
+    }
+
+    void Watchdog::remove(WatchdogSlot *slot) noexcept {
+        {
+            lock_guard<mutex> lock(slots_mtx);
+            for (auto it = slots.begin(); it != slots.end(); it++) {
+                if (*it == slot) {
+                    slots.erase(it);
+                    break;
+                }
+            }
+        }
+        delete slot;
+    }
+
+    void Watchdog::sampleRunning() noexcept {
+        lock_guard<mutex> lock(slots_mtx);
+        for (auto slot : slots) {
+            if (!slot->profile.load(memory_order_relaxed) ||
+                slot->deadline.load(memory_order_relaxed) == 0)
+                continue;
+            slot->sample.store(true, memory_order_relaxed);
+            lua_sethook(slot->L, hwk_lua_watchdog_hook, LUA_MASKCOUNT, 1);
+        }
+    }
+
+    void Watchdog::run() noexcept {
+        auto next = steady_clock::now();
+        for (;;) {
+            next += TICK;
+            this_thread::sleep_until(next);
+            uint64_t now = tick.fetch_add(1, memory_order_relaxed) + 1;
+
+            lock_guard<mutex> lock(slots_mtx);
+            for (auto slot : slots) {
+                uint64_t deadline = slot->deadline.load(memory_order_relaxed);
+                // Re-armed on every tick until the call returns, in case the
+                // hook was cleared by a racing disarm().
+                if (deadline != 0 && now >= deadline) {
+                    slot->preempt.store(true, memory_order_relaxed);
+                    lua_sethook(slot->L, hwk_lua_watchdog_hook, LUA_MASKCOUNT, 1);
+                }
+            }
+        }
+    }
+}
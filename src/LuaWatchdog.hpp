@@ -0,0 +1,128 @@
+/** @file LuaWatchdog.hpp
+ *
+ * @brief Preemption of Lua calls that run for too long.
+ *
+ * A single watchdog thread keeps a coarse tick counter and checks the
+ * deadlines of all registered Lua states once per tick. Starting and ending a
+ * call only stores a deadline into an atomic that belongs to the state, there
+ * are no locks, map lookups or clock reads on that path.
+ *
+ * When a deadline has passed the watchdog installs a count hook on the state,
+ * which raises a "Timeout Error" inside the state. lua_sethook is designed to
+ * be called asynchronously (see the comment on it in ldebug.c) so this is safe
+ * to do from the watchdog thread.
+ *
+ * The same hook takes samples for the profiler, see LuaProfiler.hpp.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+    #include <lua.h>
+}
+
+namespace Lua {
+    class Profile;
+
+    /** The count hook installed by the watchdog, raises a "Timeout Error"
+     *  if the deadline of the running call has passed, and otherwise
+     *  removes itself. */
+    extern "C" void hwk_lua_watchdog_hook(lua_State *L, lua_Debug *ar);
+
+    /** Watchdog state for a single lua_State. */
+    struct WatchdogSlot {
+        lua_State *L;
+        /** Tick at which the running call times out, zero when idle. */
+        std::atomic<uint64_t> deadline{0};
+        /** Set when the watchdog has installed its hook. */
+        std::atomic<bool> preempt{false};
+        /** Set when the profiler has installed the hook to take a sample. */
+        std::atomic<bool> sample{false};
+        /** Where samples go, null if the state isn't profiled. */
+        std::atomic<Profile *> profile{nullptr};
+
+        inline explicit WatchdogSlot(lua_State *L) noexcept : L(L) {}
+    };
+
+    class Watchdog {
+    private:
+        std::mutex slots_mtx;
+        std::vector<WatchdogSlot *> slots;
+        std::atomic<uint64_t> tick{1};
+        std::once_flag started;
+
+        inline Watchdog() noexcept {}
+
+        void run() noexcept;
+
+    public:
+        /** Resolution of deadlines. */
+        static constexpr std::chrono::milliseconds TICK{50};
+
+        /** Get the watchdog, the thread is started the first time a state
+         *  is added and runs until the process exits. */
+        static Watchdog &get() noexcept;
+
+        /** Start watching a Lua state. */
+        WatchdogSlot *add(lua_State *L);
+
+        /** Stop watching a Lua state, must be done before lua_close(). */
+        void remove(WatchdogSlot *slot) noexcept;
+
+        /** Have every profiled state that is in the middle of a call take a
+         *  sample, see LuaProfiler.hpp. */
+        void sampleRunning() noexcept;
+
+        /** Current tick. */
+        inline uint64_t now() const noexcept {
+            return tick.load(std::memory_order_relaxed);
+        }
+
+        /** Convert a timeout into a number of ticks, rounded up. */
+        static constexpr uint64_t ticks(std::chrono::milliseconds timeout) noexcept {
+            return (timeout.count() + TICK.count() - 1) / TICK.count();
+        }
+
+        /** Remove the hook installed by the watchdog, if any. Must be
+         *  called from the thread that runs the state. */
+        static inline void disarm(WatchdogSlot *slot) noexcept {
+            bool preempt = slot->preempt.exchange(false, std::memory_order_relaxed);
+            bool sample = slot->sample.exchange(false, std::memory_order_relaxed);
+            if (preempt || sample)
+                lua_sethook(slot->L, NULL, 0, 0);
+        }
+    };
+
+    /** Arm a watchdog slot for the duration of a call.
+     *
+     * Nested calls keep the deadline of the outermost call.
+     */
+    class WatchdogGuard {
+    private:
+        WatchdogSlot *slot;
+        bool outer;
+
+    public:
+        inline WatchdogGuard(WatchdogSlot *slot, uint64_t ticks) noexcept
+            : slot(slot),
+              outer(slot->deadline.load(std::memory_order_relaxed) == 0)
+        {
+            // The extra tick accounts for starting in the middle of one.
+            if (outer)
+                slot->deadline.store(Watchdog::get().now() + ticks + 1,
+                                     std::memory_order_relaxed);
+        }
+
+        inline ~WatchdogGuard() noexcept {
+            if (!outer)
+                return;
+            slot->deadline.store(0, std::memory_order_relaxed);
+            Watchdog::disarm(slot);
+        }
+    };
+}
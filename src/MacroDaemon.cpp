@@ -29,9 +29,12 @@
 #include <thread>
 #include <iostream>
 #include <filesystem>
+#include <algorithm>
+#include <future>
 
 extern "C" {
     #include <libnotify/notify.h>
+    #include <signal.h>
     #include <syslog.h>
 }
 
@@ -43,7 +46,8 @@ extern "C" {
 #include "LuaConfig.hpp"
 #include "XDG.hpp"
 #include "KBDB.hpp"
-#include "Popen.hpp"
+#include "ThreadPool.hpp"
+#include "Probes.hpp"
 
 using namespace Lua;
 using namespace Permissions;
@@ -52,9 +56,46 @@ namespace fs = std::filesystem;
 
 static bool macrod_main_loop_running = true;
 
-MacroDaemon::MacroDaemon()
-    : kbd_srv("/var/lib/hawck-input/kbd.sock"),
-      xdg("hawck")
+/** How long the main loop waits for events while the output of a process is
+ *  pending. */
+static constexpr milliseconds SPAWN_POLL{50};
+
+/** Show a notification through libnotify, runs on the notifier thread. */
+static bool showNotification(const Notification &n) {
+    NotifyNotification *nn = notify_notification_new(n.title.c_str(), n.msg.c_str(),
+                                                      n.icon.c_str());
+    notify_notification_set_timeout(nn, 12000);
+    notify_notification_set_urgency(nn, (NotifyUrgency) n.urgency);
+    notify_notification_set_app_name(nn, "Hawck");
+    bool ok = notify_notification_show(nn, nullptr);
+    g_object_unref(nn);
+    return ok;
+}
+
+MacroDaemon::MacroDaemon(const string &socket_path, const string &stats_path)
+    : MacroDaemon(unique_ptr<IPacketChannel<KBDAction>>(), stats_path)
+{
+    kbd_srv = make_unique<UNIXServer>(socket_path);
+    if (socket_path == "/var/lib/hawck-input/kbd.sock") {
+        auto [grp, grpbuf] = getgroup("hawck-input-share");
+        (void) grpbuf;
+        if (chown(socket_path.c_str(), getuid(), grp->gr_gid) == -1)
+            throw SystemError("Unable to chown kbd.sock: ", errno);
+        if (chmod(socket_path.c_str(), 0660) == -1)
+            throw SystemError("Unable to chmod kbd.sock: ", errno);
+    } else if (chmod(socket_path.c_str(), 0600) == -1) {
+        throw SystemError("Unable to chmod " + socket_path + ": ", errno);
+    }
+}
+
+MacroDaemon::MacroDaemon(unique_ptr<IPacketChannel<KBDAction>> channel,
+                         const string &stats_path)
+    : kbd_com(std::move(channel)),
+      xdg("hawck"),
+      scripts(make_unique<ScriptSet>()),
+      bytecode_cache(xdg.path(XDG_CACHE_HOME, "bytecode")),
+      notifier(showNotification),
+      script_pool([this]() { return prepareScript(); })
 {
     notify_on_err = true;
     stop_on_err = false;
@@ -62,29 +103,52 @@ MacroDaemon::MacroDaemon()
     eval_keyup = true;
     eval_repeat = true;
     disabled = false;
+    script_memory_limit_kb = 0;
 
-    auto [grp, grpbuf] = getgroup("hawck-input-share");
-    (void) grpbuf;
-    if (chown("/var/lib/hawck-input/kbd.sock", getuid(), grp->gr_gid) == -1)
-        throw SystemError("Unable to chown kbd.sock: ", errno);
-    if (chmod("/var/lib/hawck-input/kbd.sock", 0660) == -1)
-        throw SystemError("Unable to chmod kbd.sock: ", errno);
     notify_init("Hawck");
+    notifier.start();
+    xdg.mkpath(0700, XDG_CACHE_HOME, "bytecode");
     xdg.mkpath(0755, XDG_CONFIG_HOME, "scripts");
     initScriptDir(xdg.path(XDG_CONFIG_HOME, "scripts"));
+    script_pool.start();
+
+    Stats::get().addSource("macrod", [this](StatsReport &rep) { reportStats(rep); });
+    Stats::get().addDump("profile", []() { return Profiler::get().folded(); });
+    Stats::get().addDump("patterns", []() { return Profiler::get().patterns(); });
+    if (!stats_path.empty()) {
+        try {
+            stats_srv = make_unique<StatsServer>(stats_path, 0600);
+        } catch (const exception &e) {
+            syslog(LOG_ERR, "Unable to serve statistics on %s: %s", stats_path.c_str(), e.what());
+        }
+    }
 }
 
 void MacroDaemon::getConnection() {
-    if (kbd_com)
-        delete kbd_com;
+    // An InputD in the same process can't go away, the channel is reset
+    // once it has seen an error.
+    if (!kbd_srv) {
+        if (had_connection) {
+            syslog(LOG_INFO, "Resetting the connection to InputD ...");
+            kbd_com->recon();
+        }
+        had_connection = true;
+        remote_udev.setConnection(kbd_com.get());
+        return;
+    }
+
+    kbd_com.reset();
     syslog(LOG_INFO, "Listening for a connection ...");
 
     // Keep looping around until we get a connection.
     for (;;) {
         try {
-            int fd = kbd_srv.accept();
-            kbd_com = new UNIXSocket<KBDAction>(fd);
+            int fd = kbd_srv->accept();
+            kbd_com = make_unique<UNIXSocket<KBDAction>>(fd);
             syslog(LOG_INFO, "Got a connection");
+            // Handles are only unique for a single InputD process.
+            lock_guard<mutex> lock(publish_mtx);
+            clearKeyboards();
             break;
         } catch (SocketError &e) {
             syslog(LOG_ERR, "Error in accept(): %s", e.what());
@@ -93,67 +157,152 @@ void MacroDaemon::getConnection() {
         usleep(100000);
     }
 
-    remote_udev.setConnection(kbd_com);
+    remote_udev.setConnection(kbd_com.get());
 }
 
 MacroDaemon::~MacroDaemon() {
-    for (auto &[_, s] : scripts) {
-        (void) _;
-        delete s;
-    }
+    stats_srv.reset();
+    Stats::get().removeSource("macrod");
+    Stats::get().removeDump("profile");
+    Stats::get().removeDump("patterns");
+}
+
+/** Files in a script directory, in the order that the scripts run in. */
+static vector<string> scriptPaths(const std::string &dir_path) {
+    vector<string> paths;
+    for (auto entry : fs::directory_iterator(dir_path))
+        paths.push_back(entry.path());
+    sort(paths.begin(), paths.end(), [](const string &a, const string &b) {
+        return pathBasename(a) < pathBasename(b);
+    });
+    return paths;
 }
 
 void MacroDaemon::initScriptDir(const std::string &dir_path) {
-    for (auto entry : fs::directory_iterator(dir_path)) {
-        try {
-            loadScript(entry.path());
-        } catch (exception &e) {
-            notify("Hawck Script Error", e.what(), "hawck", NOTIFY_URGENCY_CRITICAL);
-            syslog(LOG_ERR, "Unable to load script '%s': %s", pathBasename(entry.path()).c_str(),
-                   e.what());
-        }
-    }
+    loadScripts(scriptPaths(dir_path));
     fsw.addFrom(dir_path);
 }
 
-void MacroDaemon::loadScript(const std::string &path) {
+unique_ptr<MacroScript> MacroDaemon::prepareScript() {
+    auto sc = make_unique<MacroScript>();
+    sc->loadRuntime(xdg.path(XDG_DATA_HOME, "scripts"));
+    sc->open(&remote_udev, "udev");
+    sc->open(&notifier, "__notifier");
+    sc->open(&sc->spawner, "__spawner");
+    return sc;
+}
+
+unique_ptr<MacroScript> MacroDaemon::buildScript(const std::string &path) {
     if (stringStartsWith(path, ".") || !(stringEndsWith(path, ".lua") ||
                                          stringEndsWith(path, ".hwk"))) {
         syslog(LOG_NOTICE,
                "Not loading: %s, filename must end in .lua or .hwk and may not start with a leading '.'",
                path.c_str());
-        return;
+        return nullptr;
     }
 
     auto rpath = realpath_safe(path);
     if (!checkFile(rpath, "frwxr-xr-x ~:*"))
-        return;
+        return nullptr;
+
+    // Usually a script with the runtime loaded is ready in the pool, so only
+    // the user's code has to run.
+    auto sc = script_pool.take();
+    if (!sc)
+        sc = prepareScript();
+    sc->name = pathBasename(path);
+    sc->run_time = &Stats::get().histogram("macrod.script." + sc->name + ".run");
+    sc->setMemoryLimit(size_t(script_memory_limit_kb) * 1024);
+    sc->loadUserCode(path, bytecode_cache, hwk_cache);
+    if (Profiler::get().enabled()) {
+        sc->setProfile(&Profiler::get().profile(pathBasename(path)));
+        sc->call("__set_profiling", true);
+    }
+    gc.adopt(sc.get());
+    return sc;
+}
 
-    auto sc = mkuniq(new Script());
-    auto chdir = xdg.cd(XDG_DATA_HOME, "scripts");
-    sc->call("require", "init");
-    sc->open(&remote_udev, "udev");
-    if (stringEndsWith(path, ".hwk")) {
-        sc->exec(pathBasename(path), (Popen("hwk2lua", path)).readOnce());
-    } else if (stringEndsWith(path, ".lua")) {
-        sc->from(path);
+void MacroDaemon::swapScripts(unique_ptr<ScriptSet> next) {
+    next->version = scripts.current()->version + 1;
+    syslog(LOG_INFO, "Publishing version %lu of the scripts",
+           (unsigned long) next->version);
+    scripts.publish(std::move(next));
+}
+
+void MacroDaemon::publish(vector<pair<string, unique_ptr<MacroScript>>> built) {
+    if (built.empty())
+        return;
+    auto next = make_unique<ScriptSet>(*scripts.current());
+    for (auto &[path, sc] : built) {
+        kbdb.forEach([&](uint16_t handle, const KBDInfo &info) {
+            registerKeyboard(sc.get(), handle, info);
+        });
+        auto name = pathBasename(path);
+        next->scripts[name] = std::move(sc);
+        flight.record(FlightRecord::LOADED, 0, 0, 0, 0, name.c_str());
+        HAWCK_PROBE(script_loaded, name.c_str());
+        syslog(LOG_INFO, "Loaded script: %s", path.c_str());
+        notify(name, "<i>Loaded</i> script");
     }
-    auto name = pathBasename(path);
-    if (scripts.find(name) != scripts.end()) {
-        delete scripts[name];
-        scripts.erase(name);
+    swapScripts(std::move(next));
+}
+
+void MacroDaemon::loadScript(const std::string &path) {
+    auto sc = buildScript(path);
+    if (!sc)
+        return;
+    vector<pair<string, unique_ptr<MacroScript>>> built;
+    built.emplace_back(path, std::move(sc));
+    lock_guard<mutex> lock(publish_mtx);
+    publish(std::move(built));
+}
+
+void MacroDaemon::loadScripts(vector<string> paths) {
+    // A pool of zero threads would get one per core.
+    if (paths.empty())
+        return;
+
+    vector<pair<string, unique_ptr<MacroScript>>> built;
+    {
+        ThreadPool pool(min(paths.size(), size_t(max(1u, thread::hardware_concurrency()))));
+        vector<future<unique_ptr<MacroScript>>> builds;
+        builds.reserve(paths.size());
+        for (const auto &path : paths)
+            builds.push_back(pool.submit([this, path]() { return buildScript(path); }));
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            try {
+                if (auto sc = builds[i].get())
+                    built.emplace_back(paths[i], std::move(sc));
+            } catch (exception &e) {
+                notify("Hawck Script Error", e.what(), "hawck", Urgency::CRITICAL);
+                syslog(LOG_ERR, "Unable to load script '%s': %s",
+                       pathBasename(paths[i]).c_str(), e.what());
+            }
+        }
     }
-    syslog(LOG_INFO, "Loaded script: %s", path.c_str());
-    notify(pathBasename(path), "<i>Loaded</i> script");
-    scripts[name] = sc.release();
+
+    // All of the scripts are swapped in at once, so events never see a mix
+    // of old and new scripts.
+    lock_guard<mutex> lock(publish_mtx);
+    publish(std::move(built));
 }
 
 void MacroDaemon::unloadScript(const std::string &rel_path) noexcept {
     string name = pathBasename(rel_path);
-    if (scripts.find(name) != scripts.end()) {
+    const ScriptSet *cur = scripts.current();
+    if (cur->scripts.find(name) != cur->scripts.end()) {
         syslog(LOG_INFO, "Deleting script: %s", name.c_str());
-        delete scripts[name];
-        scripts.erase(name);
+        try {
+            auto next = make_unique<ScriptSet>(*cur);
+            next->scripts.erase(name);
+            swapScripts(std::move(next));
+            flight.record(FlightRecord::UNLOADED, 0, 0, 0, 0, name.c_str());
+            HAWCK_PROBE(script_unloaded, name.c_str());
+        } catch (const exception &e) {
+            syslog(LOG_ERR, "Unable to delete script %s: %s", name.c_str(), e.what());
+            return;
+        }
         notify(name, "<i>Unloaded</i> script");
     } else {
         syslog(LOG_ERR, "Attempted to delete non-existent script: %s", name.c_str());
@@ -166,45 +315,73 @@ struct script_error_info {
 };
 
 void MacroDaemon::notify(string title, string msg) {
-    notify(title, msg, "hawck", NOTIFY_URGENCY_NORMAL);
+    notify(title, msg, "hawck", Urgency::NORMAL);
 }
 
-void MacroDaemon::notify(string title, string msg, string icon, NotifyUrgency urgency) {
-    // AFAIK you don't have to free the memory manually, but I could be wrong.
-    lock_guard<mutex> lock(last_notification_mtx);
-    tuple<string, string> notif(title, msg);
-    if (notif == last_notification)
-        return;
-    last_notification = notif;
-
-    NotifyNotification *n = notify_notification_new(title.c_str(), msg.c_str(), icon.c_str());
-    notify_notification_set_timeout(n, 12000);
-    notify_notification_set_urgency(n, urgency);
-    notify_notification_set_app_name(n, "Hawck");
-
-    if (!notify_notification_show(n, nullptr)) {
-        syslog(LOG_INFO, "Notifications cannot be shown.");
-    }
+void MacroDaemon::notify(string title, string msg, string icon, Urgency urgency) {
+    Notification n;
+    n.title = std::move(title);
+    n.msg = std::move(msg);
+    n.icon = std::move(icon);
+    n.urgency = urgency;
+    if (!notifier.push(std::move(n)))
+        syslog(LOG_WARNING, "Notification queue is full, dropped notification");
 }
 
 static void handleSigPipe(int) {}
 
+static atomic<bool> macrod_stats_requested(false);
+
+static void handleSigUsr1(int) {
+    macrod_stats_requested = true;
+}
+
 #if 0
 static void handleSigTerm(int) {
     macrod_main_loop_running = false;
 }
 #endif
 
-bool MacroDaemon::runScript(Lua::Script *sc, const struct input_event &ev, string kbd_hid) {
+void MacroDaemon::registerKeyboard(MacroScript *sc, uint16_t handle, const KBDInfo &info) noexcept {
+    try {
+        sc->call("__register_keyboard", (int)handle, info.getID(), info.getName(),
+                 info.getPhys(), info.getDriver(), info.getUevent());
+    } catch (const LuaError &e) {
+        syslog(LOG_ERR, "Unable to register keyboard %s: %s", info.getID().c_str(), e.what());
+    }
+}
+
+void MacroDaemon::clearKeyboards() noexcept {
+    kbdb.clear();
+    for (auto &[name, sc] : scripts.current()->scripts) {
+        try {
+            sc->call("__reset_keyboards");
+        } catch (const LuaError &e) {
+            syslog(LOG_ERR, "Unable to reset the keyboards of %s: %s", name.c_str(), e.what());
+        }
+    }
+}
+
+void MacroDaemon::addKeyboard(uint16_t handle, const struct input_id *id) {
+    const KBDInfo *info = kbdb.add(handle, id);
+    syslog(LOG_INFO, "Keyboard %s has handle %d", info->getID().c_str(), (int)handle);
+    // The newest set is used, it may have been published after the main
+    // loop started handling this event, publish() registers keyboards with
+    // the scripts it adds while holding publish_mtx.
+    for (auto &[_, sc] : scripts.current()->scripts) {
+        (void) _;
+        registerKeyboard(sc.get(), handle, *info);
+    }
+}
+
+bool MacroDaemon::runScript(MacroScript *sc, const struct input_event &ev, int kbd_handle) {
     static bool had_stack_leak_warning = false;
     bool repeat = true;
+    uint64_t start = monotonicNS();
+    HAWCK_PROBE(script_entry, sc->name.c_str(), ev.code, ev.value);
 
     try {
-        auto [succ] = sc->call<bool>("__match",
-                                     (int)ev.value,
-                                     (int)ev.code,
-                                     (int)ev.type,
-                                     kbd_hid);
+        bool succ = sc->match(ev.value, ev.code, ev.type, kbd_handle);
         if (lua_gettop(sc->getL()) != 0) {
             if (!had_stack_leak_warning) {
                 syslog(LOG_WARNING,
@@ -217,48 +394,43 @@ bool MacroDaemon::runScript(Lua::Script *sc, const struct input_event &ev, strin
         }
         repeat = !succ;
     } catch (const LuaError &e) {
+        script_errors.fetch_add(1, memory_order_relaxed);
+        flight.record(FlightRecord::SCRIPT_ERROR, event_num, ev.code, ev.value, 0, sc->name.c_str());
         if (stop_on_err)
             sc->setEnabled(false);
+        if (sc->memoryLimitExceeded(e)) {
+            sc->setEnabled(false);
+            notify("Script disabled", "Script exceeded its memory limit", "hawck",
+                   Urgency::CRITICAL);
+            syslog(LOG_ERR, "Disabled script, it exceeded its memory limit of %d KiB",
+                   (int) script_memory_limit_kb);
+        }
         std::string report = e.fmtReport();
         if (notify_on_err)
-            notify("Lua error", report, "hawck", NOTIFY_URGENCY_CRITICAL);
+            notify("Lua error", report, "hawck", Urgency::CRITICAL);
         syslog(LOG_ERR, "LUA:%s", report.c_str());
         repeat = true;
     }
 
+    uint64_t took = monotonicNS() - start;
+    HAWCK_PROBE(script_return, sc->name.c_str(), !repeat, took);
+    if (sc->run_time)
+        sc->run_time->record(took);
     return repeat;
 }
 
 void MacroDaemon::reloadAll() {
-    // Disabled due to restructuring of the script load process
-    #if 0
-    lock_guard<mutex> lock(scripts_mtx);
-    auto chdir = xdg.cd(XDG_DATA_HOME, "scripts");
-    for (auto &[_, sc] : scripts) {
-        (void) _;
-        try {
-            sc->setEnabled(true);
-            sc->reset();
-            sc->call("require", "init");
-            sc->open(&remote_udev, "udev");
-            sc->reload();
-        } catch (const LuaError& e) {
-            syslog(LOG_ERR, "Error when reloading script: %s", e.what());
-            sc->setEnabled(false);
-        }
-    }
-    #endif
+    // The prepared scripts were set up with the old configuration.
+    script_pool.invalidate();
+    loadScripts(scriptPaths(xdg.path(XDG_CONFIG_HOME, "scripts")));
 }
 
 void MacroDaemon::startScriptWatcher() {
     fsw.setWatchDirs(true);
     fsw.setAutoAdd(true);
-    // TODO: Display desktop notifications for these syslogs.
-    //       You'll have to evaluate the thread-safety of doing that, and you
-    //       might have to push onto a shared notification queue rather than
-    //       just sending the messages directly from here.
     fsw.asyncWatch([this](FSEvent &ev) {
-        lock_guard<mutex> lock(scripts_mtx);
+        // Scripts are built in the background and swapped in once they are
+        // ready, the main loop keeps running the old version until then.
         try {
             // Don't react to the directory itself.
             if (ev.path == xdg.path(XDG_CONFIG_HOME, "scripts"))
@@ -266,6 +438,7 @@ void MacroDaemon::startScriptWatcher() {
 
             if (ev.mask & IN_DELETE) {
                 syslog(LOG_INFO, "Deleting script: %s", ev.path.c_str());
+                lock_guard<mutex> lock(publish_mtx);
                 unloadScript(ev.name);
             } else if (ev.mask & IN_MODIFY) {
                 syslog(LOG_INFO, "Reloading script: %s", ev.path.c_str());
@@ -278,17 +451,111 @@ void MacroDaemon::startScriptWatcher() {
                 if (ev.stbuf.st_mode & S_IXUSR) {
                     loadScript(ev.path);
                 } else {
+                    lock_guard<mutex> lock(publish_mtx);
                     unloadScript(ev.path);
                 }
             }
         } catch (exception &e) {
-            notify("Script Error", e.what(), "hawck", NOTIFY_URGENCY_CRITICAL);
+            notify("Script Error", e.what(), "hawck", Urgency::CRITICAL);
             syslog(LOG_ERR, "Error while loading %s: %s", ev.path.c_str(), e.what());
         }
         return true;
     });
 }
 
+void MacroDaemon::deliverSpawnResults(const ScriptSet &set) {
+    for (auto &[name, sc] : set.scripts) {
+        if (!sc->spawner.hasResults())
+            continue;
+        for (auto &res : sc->spawner.takeResults()) {
+            // InputD isn't waiting for output between events.
+            remote_udev.setDiscarding(true);
+            try {
+                sc->call("__spawn_done", res.id, res.out, res.status);
+            } catch (const LuaError &e) {
+                std::string report = e.fmtReport();
+                if (notify_on_err)
+                    notify("Lua error", report, "hawck", Urgency::CRITICAL);
+                syslog(LOG_ERR, "LUA:%s: %s", name.c_str(), report.c_str());
+            }
+            remote_udev.setDiscarding(false);
+            if (remote_udev.getDiscarded())
+                syslog(LOG_WARNING, "%s: Discarded %zu key events sent from a spawn "
+                       "callback, keys can only be sent while handling a key",
+                       name.c_str(), remote_udev.getDiscarded());
+        }
+    }
+}
+
+void MacroDaemon::logStats(const ScriptSet &set) {
+    syslog(LOG_INFO, "GC: %s", gc.getStats().format().c_str());
+    const NotifierStats &ns = notifier.getStats();
+    syslog(LOG_INFO, "Notifications: %lu queued, %lu sent, %lu failed, %lu dropped, "
+           "%lu duplicates, %lu coalesced",
+           (unsigned long) ns.queued, (unsigned long) ns.sent, (unsigned long) ns.failed,
+           (unsigned long) ns.dropped, (unsigned long) ns.duplicates,
+           (unsigned long) ns.coalesced);
+    syslog(LOG_INFO, "Scripts: version %lu, %zu old versions pending",
+           (unsigned long) set.version, scripts.pending());
+    const ScriptPoolStats &ps = script_pool.getStats();
+    syslog(LOG_INFO, "Script pool: %lu hits, %lu misses, %lu discarded, %lu failed",
+           (unsigned long) ps.hits, (unsigned long) ps.misses,
+           (unsigned long) ps.discarded, (unsigned long) ps.failed);
+    for (auto &[name, sc] : set.scripts) {
+        const MemoryAccount &mem = sc->memory();
+        syslog(LOG_INFO, "Memory: %s: %zu KiB in use, %zu KiB peak, %lu allocations, %lu frees",
+               name.c_str(), mem.bytes / 1024, mem.peak / 1024,
+               (unsigned long) mem.allocs, (unsigned long) mem.frees);
+    }
+}
+
+void MacroDaemon::takePatternStats(const ScriptSet &set, bool flush) {
+    auto now = chrono::steady_clock::now();
+    if (!patterns_stale || (!flush && now - patterns_taken < 1s))
+        return;
+    patterns_taken = now;
+    patterns_stale = false;
+    for (auto &[name, sc] : set.scripts) {
+        Profile *prof = sc->getProfile();
+        if (!prof)
+            continue;
+        try {
+            auto [stats] = sc->call<string>("__pattern_stats");
+            prof->setPatterns(std::move(stats));
+        } catch (const LuaError &e) {
+            syslog(LOG_ERR, "Unable to get pattern statistics of %s: %s",
+                   name.c_str(), e.what());
+        }
+    }
+}
+
+void MacroDaemon::reportStats(StatsReport &rep) {
+    const NotifierStats &ns = notifier.getStats();
+    rep.counter("macrod.notifications.queued", ns.queued);
+    rep.counter("macrod.notifications.sent", ns.sent);
+    rep.counter("macrod.notifications.failed", ns.failed);
+    rep.counter("macrod.notifications.dropped", ns.dropped);
+    rep.counter("macrod.notifications.duplicates", ns.duplicates);
+    rep.counter("macrod.notifications.coalesced", ns.coalesced);
+
+    const ScriptPoolStats &ps = script_pool.getStats();
+    rep.counter("macrod.script_pool.hits", ps.hits);
+    rep.counter("macrod.script_pool.misses", ps.misses);
+    rep.counter("macrod.script_pool.discarded", ps.discarded);
+    rep.counter("macrod.script_pool.failed", ps.failed);
+
+    auto reader = scripts.reader();
+    auto set = reader.lock();
+    rep.gauge("macrod.scripts.version", set->version);
+    rep.gauge("macrod.scripts.pending", scripts.pending());
+    for (const auto &[name, sc] : set->scripts) {
+        const MemoryAccount &mem = sc->memory();
+        rep.gauge("macrod.script." + name + ".memory_kb", mem.bytes / 1024.0);
+        rep.gauge("macrod.script." + name + ".peak_kb", mem.peak / 1024.0);
+        rep.counter("macrod.script." + name + ".allocs", mem.allocs);
+    }
+}
+
 void MacroDaemon::run() {
     syslog(LOG_INFO, "Setting up MacroDaemon ...");
 
@@ -296,6 +563,7 @@ void MacroDaemon::run() {
     //signal(SIGTERM, handleSigTerm);
 
     signal(SIGPIPE, handleSigPipe);
+    signal(SIGUSR1, handleSigUsr1);
 
 
     // Setup/start LuaConfig
@@ -312,45 +580,124 @@ void MacroDaemon::run() {
     conf.addOption("eval_repeat", &eval_repeat);
     conf.addOption("disabled", &disabled);
     conf.addOption<string>("keymap", [this](string) {reloadAll();});
+    conf.addOption<int>("gc_slice_us", [this](int us) {gc.setSliceDuration(us);});
+    conf.addOption<int>("gc_ceiling_kb", [this](int kb) {gc.setCeiling(kb);});
+    conf.addOption<int>("notify_burst", [this](int n) {notifier.setBurst(n);});
+    conf.addOption<int>("notify_rate_per_min", [this](int n) {notifier.setRate(n);});
+    conf.addOption<int>("notify_dedup_ms", [this](int ms) {notifier.setDedupWindow(ms);});
+    conf.addOption<int>("script_pool_size", [this](int n) {
+        script_pool.setSize(max(n, 0));
+    });
+    conf.addOption<int>("script_memory_limit_kb", [this](int kb) {
+        // The current set can't be replaced while publish_mtx is held.
+        lock_guard<mutex> lock(publish_mtx);
+        script_memory_limit_kb = kb;
+        for (auto &[_, sc] : scripts.current()->scripts) {
+            (void) _;
+            sc->setMemoryLimit(size_t(kb) * 1024);
+        }
+    });
+    conf.addOption<int>("profile_sample_us", [this](int us) {
+        bool was_enabled = Profiler::get().enabled();
+        Profiler::get().setInterval(chrono::microseconds(max(us, 0)));
+        // Profiles are attached to scripts, and patterns told to count
+        // themselves, when the scripts are built.
+        if (Profiler::get().enabled() != was_enabled)
+            reloadAll();
+    });
     conf.start();
 
     startScriptWatcher();
 
     KBDAction action;
     struct input_event &ev = action.ev;
-    KBDB kbdb;
 
     getConnection();
 
+    auto reader = scripts.reader();
+
     syslog(LOG_INFO, "Starting main loop");
 
     while (macrod_main_loop_running) {
         try {
             bool repeat = true;
 
+            // Collect garbage while waiting for the next event, and block
+            // once there is nothing left to collect. While processes started
+            // by scripts are running the wait is bounded, so that their output
+            // is delivered without waiting for a key press.
+            for (bool work = true;
+                 !kbd_com->poll(work ? 0ms : (Spawner::inFlight() ? SPAWN_POLL : -1ms));)
+            {
+                // Scripts that were replaced are freed while idle.
+                scripts.reclaim();
+                auto set = reader.lock();
+                if (macrod_stats_requested.exchange(false))
+                    logStats(*set);
+                deliverSpawnResults(*set);
+                work = gc.idle(*set);
+                // Before blocking, so that the counts of the last events
+                // aren't held back until the next one arrives.
+                takePatternStats(*set, !work);
+            }
+
             kbd_com->recv(&action);
-            string kbd_hid = kbdb.getID(&action.dev_id);
+            uint64_t recv_ns = monotonicNS();
+            event_num = event_count.fetch_add(1, memory_order_relaxed) + 1;
+            if (action.monotonic)
+                kernel_to_recv.record(eventAgeNS(ev.time));
+            int kbd_handle = action.kbd_handle;
+            flight.record(FlightRecord::RECV, event_num, ev.code, ev.value, kbd_handle);
+
+            // The set of scripts stays the same for the whole event, even
+            // if a new one is published in the meantime.
+            auto set = reader.lock();
 
             if (!( (!eval_keydown && ev.value == 1) ||
                    (!eval_keyup && ev.value == 0) ) && !disabled)
             {
-                lock_guard<mutex> lock(scripts_mtx);
+                // Sysfs is only consulted the first time a keyboard is seen.
+                if (kbd_handle && !kbdb.get(kbd_handle)) {
+                    lock_guard<mutex> lock(publish_mtx);
+                    addKeyboard(kbd_handle, &action.dev_id);
+                }
+                patterns_stale = true;
                 // Look for a script match.
-                for (auto &[_, sc] : scripts) {
-                    (void) _;
-                    if (sc->isEnabled() && !(repeat = runScript(sc, ev, kbd_hid)))
+                for (auto &[name, sc] : set->scripts) {
+                    if (sc->isEnabled() && !(repeat = runScript(sc.get(), ev, kbd_handle))) {
+                        flight.record(FlightRecord::MATCH, event_num, ev.code, ev.value, 0,
+                                      name.c_str());
                         break;
+                    }
                 }
             }
 
-            if (repeat)
+            if (repeat) {
                 remote_udev.emit(&ev);
+                flight.record(FlightRecord::PASSED, event_num, ev.code, ev.value);
+            }
 
             remote_udev.done();
+            uint64_t done_ns = monotonicNS();
+            dispatch.record(done_ns - recv_ns);
+            flight.record(FlightRecord::WRITTEN, event_num, 0, 0, (done_ns - recv_ns) / 1000);
+
+            // Only scripts that have grown past the ceiling are collected
+            // before the next event.
+            uint64_t forced = gc.getStats().forced_slices;
+            for (auto &[_, sc] : set->scripts) {
+                (void) _;
+                gc.enforce(sc.get());
+            }
+            if (gc.getStats().forced_slices != forced)
+                flight.record(FlightRecord::GC_FORCED, event_num, 0, 0,
+                              (monotonicNS() - done_ns) / 1000);
         } catch (const SocketError& e) {
             // Reset connection
             syslog(LOG_ERR, "Socket error: %s", e.what());
-            notify("Socket error", "Connection to InputD timed out, reconnecting ...", "hawck", NOTIFY_URGENCY_NORMAL);
+            reconnects.fetch_add(1, memory_order_relaxed);
+            flight.record(FlightRecord::RECONNECT, event_num);
+            notify("Socket error", "Connection to InputD timed out, reconnecting ...", "hawck", Urgency::NORMAL);
             getConnection();
         }
     }
@@ -36,6 +36,7 @@
 #include <vector>
 #include <string>
 #include <chrono>
+#include <memory>
 
 #include "UNIXSocket.hpp"
 #include "KBDAction.hpp"
@@ -44,10 +45,16 @@
 #include "FSWatcher.hpp"
 #include "FIFOWatcher.hpp"
 #include "XDG.hpp"
-
-extern "C" {
-    #include <libnotify/notification.h>
-}
+#include "KBDB.hpp"
+#include "MacroScript.hpp"
+#include "GCScheduler.hpp"
+#include "Notifier.hpp"
+#include "HWK2Lua.hpp"
+#include "EpochPtr.hpp"
+#include "ScriptPool.hpp"
+#include "Stats.hpp"
+#include "LuaProfiler.hpp"
+#include "FlightRecorder.hpp"
 
 /** Macro daemon.
  *
@@ -56,13 +63,51 @@ extern "C" {
  */
 class MacroDaemon {
 private:
-    UNIXServer kbd_srv;
-    UNIXSocket<KBDAction> *kbd_com = nullptr;
-    std::mutex scripts_mtx;
-    std::unordered_map<std::string, Lua::Script *> scripts;
+    /** Where InputD connects, unless it runs in this process. */
+    std::unique_ptr<UNIXServer> kbd_srv;
+    std::unique_ptr<IPacketChannel<KBDAction>> kbd_com;
+    /** Whether kbd_com has been used, so that it has to be reset before it
+     *  is used again. Only used for channels that were given to us. */
+    bool had_connection = false;
+    /** Serializes changes to the loaded scripts, and protects changes to
+     *  kbdb. The main loop only takes it when a keyboard is added. */
+    std::mutex publish_mtx;
+    /** The loaded scripts, read by the main loop without locking. Sets that
+     *  were replaced are freed by the main loop, not by the watcher threads
+     *  that publish new ones. */
+    EpochPtr<ScriptSet> scripts;
     RemoteUDevice remote_udev;
+    /** Keyboards seen on the current connection, only changed by the main
+     *  loop, with publish_mtx held. */
+    KBDB kbdb;
     FSWatcher fsw;
     XDG xdg;
+    Lua::BytecodeCache bytecode_cache;
+    /** Transpiled .hwk scripts, for when the bytecode cache misses. */
+    HWK2LuaCache hwk_cache;
+    /** Collects garbage in the scripts between events, only used by the
+     *  main loop. */
+    GCScheduler gc;
+    /** Sends desktop notifications from its own thread. */
+    Notifier notifier;
+    /** Scripts with the runtime loaded, ready for user code. Declared after
+     *  everything that preparing a script uses, so that its thread is
+     *  stopped first. */
+    ScriptPool script_pool;
+
+    /** Time spent in each stage of handling an event, see Stats.hpp. */
+    Histogram &kernel_to_recv = Stats::get().histogram("macrod.kernel_to_recv");
+    Histogram &dispatch = Stats::get().histogram("macrod.dispatch");
+    std::atomic<uint64_t> &event_count = Stats::get().counter("macrod.events");
+    std::atomic<uint64_t> &script_errors = Stats::get().counter("macrod.script_errors");
+    std::atomic<uint64_t> &reconnects = Stats::get().counter("macrod.reconnects");
+    /** Number of the event that is being handled, see FlightRecorder.hpp. */
+    uint64_t event_num = 0;
+    FlightRecorder &flight = FlightRecorder::get();
+
+    /** Add the statistics that are not kept in the Stats registry to a
+     *  report, called from the stats socket thread. */
+    void reportStats(StatsReport &rep);
 
     std::atomic<bool> notify_on_err;
     std::atomic<bool> stop_on_err;
@@ -70,35 +115,78 @@ private:
     std::atomic<bool> eval_keyup;
     std::atomic<bool> eval_repeat;
     std::atomic<bool> disabled;
-
-    std::mutex last_notification_mtx;
-    std::tuple<std::string, std::string> last_notification;
-
-    /** Display freedesktop DBus notification. */
+    /** Memory limit for each script in KiB, 0 for no limit. */
+    std::atomic<int> script_memory_limit_kb;
+    /** When the pattern statistics were last taken from the scripts. */
+    std::chrono::steady_clock::time_point patterns_taken;
+    /** Whether scripts have handled events since then. */
+    bool patterns_stale = false;
+
+    /** Serves the statistics, declared last so that it is stopped before
+     *  anything that it reports on is destroyed. */
+    std::unique_ptr<StatsServer> stats_srv;
+
+    /** Queue a freedesktop DBus notification. */
     void notify(std::string title,
                 std::string msg);
 
-    /** Display freedesktop DBus notification. */
+    /** Queue a freedesktop DBus notification. */
     void notify(std::string title,
                 std::string msg,
                 std::string icon,
-                NotifyUrgency urgency);
+                Urgency urgency);
 
     /** Run a script match on an input event.
      *
      * @param sc Script to be executed.
      * @param ev Event to pass on to the script.
-     * @param kbd_hid Human readable keyboard ID.
+     * @param kbd_handle Interned keyboard handle, see KBDAction::kbd_handle
      * @return True if the key event should be repeated.
      */
-    bool runScript(Lua::Script *sc, const struct input_event &ev, std::string kbd_hid);
+    bool runScript(MacroScript *sc, const struct input_event &ev, int kbd_handle);
+
+    /** Push information about a keyboard into a script, this is done once
+     *  per keyboard so that scripts can refer to it by handle. */
+    void registerKeyboard(MacroScript *sc, uint16_t handle, const KBDInfo &info) noexcept;
+
+    /** Forget the keyboards, in kbdb and in the scripts, when the handles
+     *  are about to be reused. publish_mtx must be held. */
+    void clearKeyboards() noexcept;
+
+    /** Look up a keyboard handle that hasn't been seen before and register
+     *  it with all scripts, publish_mtx must be held. */
+    void addKeyboard(uint16_t handle, const struct input_id *id);
+
+    /** Create a script with the Hawck runtime loaded, but no user code. */
+    std::unique_ptr<MacroScript> prepareScript();
+
+    /** Create a script and run it, without touching the loaded scripts, so
+     *  that several can be built at the same time.
+     *
+     * @return The script, or nullptr if the file should not be loaded.
+     */
+    std::unique_ptr<MacroScript> buildScript(const std::string &path);
+
+    /** Publish a new set of scripts in which built scripts replace the
+     *  scripts of the same name, publish_mtx must be held.
+     *
+     * @param built Paths and scripts built from them.
+     */
+    void publish(std::vector<std::pair<std::string, std::unique_ptr<MacroScript>>> built);
+
+    /** Replace the current set of scripts, publish_mtx must be held. */
+    void swapScripts(std::unique_ptr<ScriptSet> next);
 
-    /** Load a Lua script. */
+    /** Load a Lua script, publish_mtx must not be held. */
     void loadScript(const std::string &path);
 
+    /** Build scripts in parallel and publish all of them at once,
+     *  publish_mtx must not be held. */
+    void loadScripts(std::vector<std::string> paths);
+
     void loadHawckScript(const std::string &path);
 
-    /** Unload a Lua script */
+    /** Unload a Lua script, publish_mtx must be held. */
     void unloadScript(const std::string &path) noexcept;
 
     /** Initialize a script directory. */
@@ -113,8 +201,40 @@ private:
 
     void startScriptWatcher();
 
+    /** Hand the output of processes that have finished to the scripts that
+     *  started them, only called by the main loop. */
+    void deliverSpawnResults(const ScriptSet &set);
+
+    /** Log garbage collection and memory statistics, only called by the
+     *  main loop. */
+    void logStats(const ScriptSet &set);
+
+    /** Copy the pattern statistics of the profiled scripts to their
+     *  profiles if they have changed, at most once a second unless flush is
+     *  set, only called by the main loop. */
+    void takePatternStats(const ScriptSet &set, bool flush);
+
 public:
-    MacroDaemon();
+    /**
+     * @param socket_path The socket that InputD connects to. The default
+     *                    socket is shared with the hawck-input-share group,
+     *                    other sockets are only accessible to the user.
+     * @param stats_path Where to serve the statistics, empty to not serve
+     *                   them.
+     */
+    explicit MacroDaemon(const std::string &socket_path = "/var/lib/hawck-input/kbd.sock",
+                         const std::string &stats_path = "");
+
+    /**
+     * Daemon that gets its events from an InputD that runs in the same
+     * process, see LocalChannel.
+     *
+     * @param channel Connection to InputD.
+     * @param stats_path Where to serve the statistics, empty to not serve
+     *                   them.
+     */
+    MacroDaemon(std::unique_ptr<IPacketChannel<KBDAction>> channel,
+                const std::string &stats_path);
     ~MacroDaemon();
 
     /** Run the mainloop. */
@@ -0,0 +1,27 @@
+/** @file MacroScript.cpp
+ *
+ * @brief User scripts as loaded by MacroD.
+ */
+
+#include "MacroScript.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+void MacroScript::loadRuntime(const string &lib_dir) {
+    // Modules are looked up by absolute path, the working directory is
+    // shared by all threads.
+    addRequirePath({lib_dir, lib_dir + "/LLib"});
+    call("require", "init");
+}
+
+void MacroScript::loadUserCode(const string &path, Lua::BytecodeCache &cache,
+                               HWK2LuaCache &hwk_cache) {
+    bool is_hwk = stringEndsWith(path, ".hwk");
+    string source = readFile(path);
+    execCached(cache, path, source, [&]() {
+        return is_hwk ? hwk_cache.get(source) : source;
+    });
+    call("__compile");
+    bindEntryPoints();
+}
@@ -0,0 +1,75 @@
+/** @file MacroScript.hpp
+ *
+ * @brief User scripts as loaded by MacroD.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "LuaUtils.hpp"
+#include "LuaBytecodeCache.hpp"
+#include "GCScheduler.hpp"
+#include "HWK2Lua.hpp"
+#include "Histogram.hpp"
+#include "Spawner.hpp"
+
+/**
+ * A user script, with the entry points that MacroD calls on every event
+ * resolved ahead of time.
+ */
+class MacroScript : public Lua::Script {
+public:
+    /** __match(value, code, type, kbd_handle) -> matched */
+    Lua::Function<bool(int, int, int, int)> match;
+
+    /** Collector bookkeeping, owned by the GCScheduler. */
+    GCAccount gc;
+
+    /** Processes started by the script, exposed to it as __spawner. */
+    Spawner spawner;
+
+    /** File name of the script, set by MacroD when it is loaded. */
+    std::string name;
+
+    /** Time spent handling events, kept in the Stats registry so that it
+     *  carries over when the script is reloaded. */
+    Histogram *run_time = nullptr;
+
+    inline MacroScript() : Lua::Script() {}
+
+    /** Load the Hawck runtime from lib_dir. The ScriptPool does this ahead
+     *  of time, so that loading a user script only runs the user's code. */
+    void loadRuntime(const std::string &lib_dir);
+
+    /**
+     * Run a user script on top of the runtime, and bind the entry points.
+     *
+     * @param path A .lua file, or a .hwk file which is transpiled first.
+     * @param cache Bytecode cache, keyed on the contents of the file, so
+     *              that a hit skips hwk2lua as well.
+     * @param hwk_cache Transpiled .hwk files.
+     */
+    void loadUserCode(const std::string &path, Lua::BytecodeCache &cache,
+                      HWK2LuaCache &hwk_cache);
+
+    /** Resolve the entry points, must be done after the script has been
+     *  loaded. */
+    inline void bindEntryPoints() {
+        match = bind<bool(int, int, int, int)>("__match");
+    }
+};
+
+/**
+ * The scripts that are loaded at some point in time. A set is never changed
+ * after it has been published, loading or unloading a script creates a new
+ * set, which shares the scripts that didn't change with the old one.
+ */
+struct ScriptSet {
+    /** Incremented for every set that is published. */
+    uint64_t version = 0;
+    /** Scripts by file name, events are passed to them in this order. */
+    std::map<std::string, std::shared_ptr<MacroScript>> scripts;
+};
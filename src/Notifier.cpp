@@ -0,0 +1,216 @@
+/** @file Notifier.cpp
+ *
+ * @brief Desktop notifications sent from a dedicated thread.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+    #include <syslog.h>
+    #include <time.h>
+}
+
+#include "Notifier.hpp"
+#include "SystemError.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+using Clock = steady_clock;
+
+/** Maximum number of distinct titles held back by the rate limit. */
+static constexpr size_t MAX_PENDING = 16;
+
+/** Notifications with the same title, waiting to be shown as one. */
+struct Pending {
+    Notification n;
+    vector<string> lines;
+    /** Messages that did not fit in MAX_LINES. */
+    size_t extra = 0;
+};
+
+static string formatBody(const Pending &p) {
+    string body;
+    for (const auto &line : p.lines) {
+        if (!body.empty())
+            body += "\n";
+        body += line;
+    }
+    if (p.extra)
+        body += "\n(and " + to_string(p.extra) + " more)";
+    return body;
+}
+
+/** Wait on a semaphore for at most the given duration, or indefinitely if it
+ *  is negative. */
+static void waitFor(sem_t *sem, nanoseconds timeout) noexcept {
+    if (timeout < 0ns) {
+        while (sem_wait(sem) == -1 && errno == EINTR);
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    auto ns = ts.tv_nsec + timeout.count();
+    ts.tv_sec += ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (sem_timedwait(sem, &ts) == -1 && errno == EINTR);
+}
+
+Notifier::Notifier(Sender send, size_t capacity)
+    : LuaIface(this, Notifier_lua_methods),
+      send(send),
+      queue(capacity)
+{
+    if (sem_init(&wakeup, 0, 0) == -1)
+        throw SystemError("Unable to initialize semaphore: ", errno);
+}
+
+Notifier::~Notifier() {
+    stop();
+    sem_destroy(&wakeup);
+}
+
+void Notifier::start() {
+    if (running.exchange(true))
+        return;
+    sender = thread([this]() { run(); });
+}
+
+void Notifier::stop() noexcept {
+    if (!running.exchange(false))
+        return;
+    sem_post(&wakeup);
+    sender.join();
+}
+
+bool Notifier::push(Notification n) noexcept {
+    if (!queue.push(std::move(n))) {
+        stats.dropped++;
+        return false;
+    }
+    stats.queued++;
+    sem_post(&wakeup);
+    return true;
+}
+
+bool Notifier::notify(string title, string msg) {
+    Notification n;
+    n.title = std::move(title);
+    n.msg = std::move(msg);
+    return push(std::move(n));
+}
+
+void Notifier::run() noexcept {
+    vector<Pending> pending;
+    // Time at which a notification was last accepted, by title and message.
+    unordered_map<string, Clock::time_point> recent;
+    double tokens = burst;
+    auto refilled = Clock::now();
+    bool had_failure = false;
+
+    auto take = [&](Notification &n) {
+        auto now = Clock::now();
+        string key = n.title + '\0' + n.msg;
+        auto it = recent.find(key);
+        if (it != recent.end() && now - it->second < milliseconds(dedup_ms)) {
+            stats.duplicates++;
+            return;
+        }
+
+        auto p = find_if(pending.begin(), pending.end(), [&](const Pending &q) {
+            return q.n.title == n.title;
+        });
+        if (p != pending.end()) {
+            if (p->lines.size() < MAX_LINES)
+                p->lines.push_back(n.msg);
+            else
+                p->extra++;
+            p->n.urgency = max(p->n.urgency, n.urgency);
+            stats.coalesced++;
+        } else if (pending.size() < MAX_PENDING) {
+            pending.push_back(Pending());
+            pending.back().lines.push_back(n.msg);
+            pending.back().n = std::move(n);
+        } else {
+            stats.dropped++;
+            return;
+        }
+        recent[key] = now;
+    };
+
+    auto drain = [&]() {
+        // Posts for notifications that are about to be popped are consumed
+        // first, so that a push racing with the drain always causes another
+        // wakeup.
+        while (sem_trywait(&wakeup) == 0);
+        bool got = false;
+        Notification n;
+        while (queue.pop(n)) {
+            take(n);
+            got = true;
+        }
+        return got;
+    };
+
+    while (running) {
+        nanoseconds timeout(-1);
+        if (!pending.empty() && rate_per_min > 0) {
+            // Wake up when the next token becomes available.
+            double per_token_ns = 60e9 / rate_per_min;
+            timeout = nanoseconds(int64_t((1.0 - tokens) * per_token_ns) + 1);
+        }
+        waitFor(&wakeup, timeout);
+        if (!running)
+            break;
+
+        if (drain() && coalesce_ms > 0) {
+            this_thread::sleep_for(milliseconds(coalesce_ms));
+            drain();
+        }
+
+        auto now = Clock::now();
+        if (rate_per_min > 0) {
+            double elapsed_min = duration<double>(now - refilled).count() / 60.0;
+            tokens = min(double(burst), tokens + elapsed_min * rate_per_min);
+        } else {
+            tokens = burst;
+        }
+        refilled = now;
+
+        while (!pending.empty() && (tokens >= 1.0 || rate_per_min <= 0)) {
+            Pending &p = pending.front();
+            p.n.msg = formatBody(p);
+            bool ok = false;
+            try {
+                ok = send(p.n);
+            } catch (const exception &e) {
+                syslog(LOG_ERR, "Unable to send notification: %s", e.what());
+            }
+            if (ok) {
+                stats.sent++;
+                had_failure = false;
+            } else {
+                stats.failed++;
+                // Only log the first of a series of failures.
+                if (!had_failure)
+                    syslog(LOG_INFO, "Notifications cannot be shown.");
+                had_failure = true;
+            }
+            pending.erase(pending.begin());
+            tokens -= 1.0;
+        }
+
+        for (auto it = recent.begin(); it != recent.end();) {
+            if (now - it->second >= milliseconds(dedup_ms))
+                it = recent.erase(it);
+            else
+                ++it;
+        }
+    }
+}
+
+LUA_CREATE_BINDINGS(Notifier_lua_methods)
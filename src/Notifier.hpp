@@ -0,0 +1,139 @@
+/** @file Notifier.hpp
+ *
+ * @brief Desktop notifications sent from a dedicated thread.
+ *
+ * Showing a notification is a D-Bus round trip, so MacroD never does it on
+ * the thread that handles events. Notifications are pushed onto a bounded
+ * lock-free queue, and a sender thread takes them off the queue and passes
+ * them on to the desktop. On the way the sender thread:
+ *
+ *  - Drops notifications that are identical to one shown within the
+ *    deduplication window.
+ *  - Coalesces notifications with the same title that arrive close together,
+ *    or while rate limited, into a single notification.
+ *  - Limits the rate of notifications with a token bucket, so a script that
+ *    fails on every key press cannot flood the desktop.
+ *
+ * When the queue is full notifications are dropped rather than blocking the
+ * caller.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+extern "C" {
+    #include <semaphore.h>
+}
+
+#include "BoundedQueue.hpp"
+#include "LuaUtils.hpp"
+
+/** Has the same values as NotifyUrgency in libnotify. */
+enum class Urgency {
+    LOW = 0,
+    NORMAL = 1,
+    CRITICAL = 2,
+};
+
+struct Notification {
+    std::string title;
+    std::string msg;
+    std::string icon = "hawck";
+    Urgency urgency = Urgency::NORMAL;
+};
+
+/** Counters kept by a Notifier, these can be read from any thread. */
+struct NotifierStats {
+    /** Notifications accepted onto the queue. */
+    std::atomic<uint64_t> queued{0};
+    /** Notifications dropped because the queue, or the backlog of the
+     *  sender, was full. */
+    std::atomic<uint64_t> dropped{0};
+    /** Notifications dropped as duplicates. */
+    std::atomic<uint64_t> duplicates{0};
+    /** Notifications merged into another one with the same title. */
+    std::atomic<uint64_t> coalesced{0};
+    /** Notifications handed to the desktop. */
+    std::atomic<uint64_t> sent{0};
+    /** Notifications that the desktop did not accept. */
+    std::atomic<uint64_t> failed{0};
+};
+
+// (ClassName, methodName, type0(), type1()...)
+#define Notifier_lua_methods(M, _)                      \
+    M(Notifier, notify, std::string(), std::string())
+
+LUA_DECLARE(Notifier_lua_methods)
+
+class Notifier : public Lua::LuaIface<Notifier> {
+public:
+    /** Shows a notification, returns false if it could not be shown. Only
+     *  ever called from the sender thread. */
+    using Sender = std::function<bool(const Notification &)>;
+
+    /** Maximum number of messages listed in a coalesced notification. */
+    static constexpr size_t MAX_LINES = 5;
+
+private:
+    Sender send;
+    BoundedQueue<Notification> queue;
+    sem_t wakeup;
+    std::thread sender;
+    std::atomic<bool> running{false};
+    NotifierStats stats;
+
+    std::atomic<int> coalesce_ms{100};
+    std::atomic<int> dedup_ms{10000};
+    std::atomic<int> burst{4};
+    std::atomic<int> rate_per_min{12};
+
+    /** Body of the sender thread. */
+    void run() noexcept;
+
+public:
+    /**
+     * @param send Function that shows notifications.
+     * @param capacity Size of the queue.
+     */
+    explicit Notifier(Sender send, size_t capacity = 64);
+
+    ~Notifier();
+
+    /** Start the sender thread. */
+    void start();
+
+    /** Stop the sender thread, notifications that are still waiting are
+     *  discarded. */
+    void stop() noexcept;
+
+    /** Queue a notification, this never blocks.
+     *
+     * @return False if the queue was full and the notification was dropped.
+     */
+    bool push(Notification n) noexcept;
+
+    /** Queue a notification with normal urgency, exposed to Lua. */
+    bool notify(std::string title, std::string msg);
+
+    /** How long to wait for more notifications before sending, so that a
+     *  burst ends up coalesced. */
+    inline void setCoalesceWindow(int ms) noexcept { coalesce_ms = ms; }
+
+    /** How long an identical notification is suppressed after being
+     *  shown. */
+    inline void setDedupWindow(int ms) noexcept { dedup_ms = ms; }
+
+    /** Number of notifications that may be shown in quick succession. */
+    inline void setBurst(int n) noexcept { burst = n; }
+
+    /** Sustained number of notifications per minute. */
+    inline void setRate(int per_min) noexcept { rate_per_min = per_min; }
+
+    inline const NotifierStats &getStats() const noexcept { return stats; }
+
+    LUA_CLASS_INIT(Notifier_lua_methods)
+};
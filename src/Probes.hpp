@@ -0,0 +1,32 @@
+/** @file Probes.hpp
+ *
+ * @brief Static tracepoints on the event path.
+ *
+ * When Hawck is built with -Dusdt=true, HAWCK_PROBE() expands to a USDT
+ * probe in the "hawck" provider, which is a single nop in the binary until
+ * a tracer such as bpftrace, perf or systemtap attaches to it. Arguments
+ * are only evaluated into registers, so they should be cheap: integers and
+ * pointers to strings that already exist. Without the option the probes
+ * compile to nothing.
+ *
+ * The probes and their arguments are listed in docs/tracing.md, keep the
+ * list up to date when adding one.
+ */
+
+#pragma once
+
+#if MESON_COMPILE
+#include <hawck_config.h>
+#endif
+
+#if HAWCK_USDT
+#include <sys/sdt.h>
+
+/** Fire probe hawck:name with up to 12 arguments. */
+#define HAWCK_PROBE(name, ...) STAP_PROBEV(hawck, name, ##__VA_ARGS__)
+
+#else
+
+#define HAWCK_PROBE(name, ...) do {} while (0)
+
+#endif
@@ -0,0 +1,279 @@
+/** @file RealTime.cpp
+ *
+ * @brief Real-time scheduling for the threads that handle events.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+extern "C" {
+    #include <alloca.h>
+    #include <malloc.h>
+    #include <pthread.h>
+    #include <signal.h>
+    #include <sys/mman.h>
+    #include <sys/resource.h>
+    #include <sys/syscall.h>
+    #include <syslog.h>
+    #include <time.h>
+    #include <unistd.h>
+}
+
+#include "RealTime.hpp"
+#include "Stats.hpp"
+#include "SystemError.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace RealTime {
+    /** Threads that enterThread() made real-time, for the SIGXCPU handler. */
+    static constexpr int MAX_THREADS = 8;
+    static atomic<pid_t> rt_threads[MAX_THREADS];
+    static atomic<uint64_t> demoted{0};
+
+    static void onSIGXCPU(int) {
+        static const char msg[] =
+            "hawck: An event thread used too much CPU time without blocking, "
+            "switching to normal scheduling\n";
+        int saved_errno = errno;
+        struct sched_param param;
+        memset(&param, '\0', sizeof(param));
+        for (auto &tid : rt_threads) {
+            pid_t t = tid.exchange(0);
+            if (t)
+                sched_setscheduler(t, SCHED_OTHER, &param);
+        }
+        demoted.fetch_add(1, memory_order_relaxed);
+        ssize_t r = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        (void) r;
+        errno = saved_errno;
+    }
+
+    int Config::parsePolicy(const string &name) {
+        if (name == "fifo")
+            return SCHED_FIFO;
+        if (name == "rr")
+            return SCHED_RR;
+        throw invalid_argument("Scheduling policy must be fifo or rr, not: " + name);
+    }
+
+    vector<int> Config::parseCPUs(const string &list) {
+        vector<int> cpus;
+        auto cpu = [&](const string &s) {
+            size_t end;
+            int n = -1;
+            try {
+                n = stoi(s, &end);
+            } catch (const exception &) {
+                end = 0;
+            }
+            if (end == 0 || end != s.size() || n < 0 || n >= CPU_SETSIZE)
+                throw invalid_argument("Not a CPU: " + s);
+            return n;
+        };
+        for (size_t start = 0; start <= list.size();) {
+            size_t comma = min(list.find(',', start), list.size());
+            string item = list.substr(start, comma - start);
+            start = comma + 1;
+            size_t dash = item.find('-');
+            if (dash == string::npos) {
+                cpus.push_back(cpu(item));
+                continue;
+            }
+            int first = cpu(item.substr(0, dash)), last = cpu(item.substr(dash + 1));
+            if (first > last)
+                throw invalid_argument("Empty range of CPUs: " + item);
+            for (int n = first; n <= last; n++)
+                cpus.push_back(n);
+        }
+        return cpus;
+    }
+
+    void Config::validate() const {
+        if (priority < 0 || priority > 99)
+            throw invalid_argument("Real-time priority must be between 1 and 99");
+        if (policy != SCHED_FIFO && policy != SCHED_RR)
+            throw invalid_argument("Scheduling policy must be SCHED_FIFO or SCHED_RR");
+        if (cpu_limit_ms <= 0)
+            throw invalid_argument("CPU time limit must be positive");
+    }
+
+    void lockMemory(size_t heap_reserve) {
+        struct rlimit lim;
+        bool unlimited = geteuid() == 0 ||
+                         (getrlimit(RLIMIT_MEMLOCK, &lim) == 0 && lim.rlim_cur == RLIM_INFINITY);
+        if (mlockall(MCL_CURRENT | (unlimited ? MCL_FUTURE : 0)) == -1)
+            throw SystemError("Unable to lock memory: ", errno);
+
+        // Keep freed memory, and the reserve below, in the heap.
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+
+        if (!unlimited) {
+            // A reserve faulted in now would not be locked.
+            syslog(LOG_WARNING, "RLIMIT_MEMLOCK is limited, only memory that is mapped now "
+                                "is locked");
+            return;
+        }
+
+        // Every page of a locked stack is resident, keep them small.
+        pthread_attr_t attr;
+        if (pthread_getattr_default_np(&attr) == 0) {
+            if (pthread_attr_setstacksize(&attr, THREAD_STACK) == 0)
+                pthread_setattr_default_np(&attr);
+            pthread_attr_destroy(&attr);
+        }
+
+        if (heap_reserve) {
+            char *reserve = (char *) malloc(heap_reserve);
+            if (reserve) {
+                long page = sysconf(_SC_PAGESIZE);
+                for (size_t i = 0; i < heap_reserve; i += page)
+                    ((volatile char *) reserve)[i] = 0;
+                free(reserve);
+            }
+        }
+    }
+
+    void limitCPUTime(int ms) {
+        struct rlimit lim;
+        if (getrlimit(RLIMIT_RTTIME, &lim) == -1)
+            throw SystemError("Unable to get RLIMIT_RTTIME: ", errno);
+        rlim_t soft = (rlim_t) ms * 1000;
+        // The hard limit can't be raised without privileges.
+        if (lim.rlim_max != RLIM_INFINITY)
+            soft = min(soft, lim.rlim_max);
+        lim.rlim_cur = soft;
+        if (lim.rlim_max == RLIM_INFINITY || lim.rlim_max > 2 * soft)
+            lim.rlim_max = 2 * soft;
+
+        struct sigaction act;
+        memset(&act, '\0', sizeof(act));
+        act.sa_handler = onSIGXCPU;
+        sigemptyset(&act.sa_mask);
+        act.sa_flags = SA_RESTART;
+        if (sigaction(SIGXCPU, &act, nullptr) == -1)
+            throw SystemError("Unable to handle SIGXCPU: ", errno);
+        if (setrlimit(RLIMIT_RTTIME, &lim) == -1)
+            throw SystemError("Unable to set RLIMIT_RTTIME: ", errno);
+    }
+
+    void prefaultStack(size_t bytes) noexcept {
+        // Touch every page below the current frame.
+        volatile char *buf = (volatile char *) alloca(bytes);
+        long page = sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < bytes; i += page)
+            buf[i] = 0;
+    }
+
+    void setAffinity(const vector<int> &cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+            CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1)
+            throw SystemError("Unable to set CPU affinity: ", errno);
+    }
+
+    void setScheduler(int policy, int priority) {
+        struct sched_param param;
+        memset(&param, '\0', sizeof(param));
+        param.sched_priority = priority;
+        if (sched_setscheduler(0, policy | SCHED_RESET_ON_FORK, &param) == -1)
+            throw SystemError("Unable to switch to real-time scheduling: ", errno);
+    }
+
+    void setupProcess(const Config &cfg) noexcept {
+        static once_flag registered;
+        call_once(registered, []() {
+            Stats::get().addSource("realtime", [](StatsReport &report) {
+                report.counter("realtime.demotions", demotions());
+            });
+        });
+        if (!cfg.enabled())
+            return;
+
+        try {
+            lockMemory();
+        } catch (const exception &e) {
+            syslog(LOG_WARNING, "%s, raise RLIMIT_MEMLOCK to lock memory", e.what());
+        }
+        try {
+            limitCPUTime(cfg.cpu_limit_ms);
+        } catch (const exception &e) {
+            syslog(LOG_WARNING, "%s", e.what());
+        }
+    }
+
+    void enterThread(const Config &cfg, const char *name) noexcept {
+        if (!cfg.cpus.empty()) {
+            try {
+                setAffinity(cfg.cpus);
+            } catch (const exception &e) {
+                syslog(LOG_WARNING, "%s: %s", name, e.what());
+            }
+        }
+        if (!cfg.enabled())
+            return;
+
+        prefaultStack();
+        try {
+            setScheduler(cfg.policy, cfg.priority);
+        } catch (const exception &e) {
+            syslog(LOG_WARNING, "%s: %s, raise RLIMIT_RTPRIO to use --rt-priority",
+                   name, e.what());
+            return;
+        }
+
+        pid_t tid = syscall(SYS_gettid);
+        for (auto &slot : rt_threads) {
+            pid_t empty = 0;
+            if (slot.compare_exchange_strong(empty, tid))
+                break;
+        }
+        syslog(LOG_INFO, "%s: Running with %s priority %d", name,
+               cfg.policy == SCHED_RR ? "SCHED_RR" : "SCHED_FIFO", cfg.priority);
+    }
+
+    uint64_t demotions() noexcept {
+        return demoted.load(memory_order_relaxed);
+    }
+
+    JitterProbe::JitterProbe(const Config &cfg, const string &prefix)
+        : hist(Stats::get().histogram(prefix + ".wakeup_jitter"))
+    {
+        thread = std::thread([this, cfg]() { run(cfg); });
+    }
+
+    JitterProbe::~JitterProbe() {
+        stopped.store(true);
+        thread.join();
+    }
+
+    void JitterProbe::run(Config cfg) noexcept {
+        enterThread(cfg, "jitter probe");
+        const uint64_t period_ns = duration_cast<nanoseconds>(PERIOD).count();
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        while (!stopped.load(memory_order_relaxed)) {
+            next.tv_nsec += period_ns;
+            while (next.tv_nsec >= 1000000000) {
+                next.tv_nsec -= 1000000000;
+                next.tv_sec++;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) == EINTR)
+                ;
+            uint64_t due = (uint64_t) next.tv_sec * 1000000000 + next.tv_nsec;
+            uint64_t now = monotonicNS();
+            hist.record(now > due ? now - due : 0);
+            // Don't try to catch up on wakeups that were missed.
+            if (now > due + period_ns) {
+                next.tv_sec = now / 1000000000;
+                next.tv_nsec = now % 1000000000;
+            }
+        }
+    }
+}
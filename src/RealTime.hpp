@@ -0,0 +1,168 @@
+/** @file RealTime.hpp
+ *
+ * @brief Real-time scheduling for the threads that handle events.
+ *
+ * Only the thread that reads events and writes the output is made real-time,
+ * the Lua watchdog, file watchers, the notifier and the stats server keep
+ * running as normal threads. Real-time threads are switched with
+ * SCHED_RESET_ON_FORK, so threads that they start later go back to normal
+ * scheduling, their CPU affinity is inherited though.
+ *
+ * A script that never returns would keep a real-time thread on its CPU
+ * forever, and the watchdog that is supposed to stop it might never get to
+ * run. RLIMIT_RTTIME is set so that the kernel raises SIGXCPU once a thread
+ * has used cpu_limit_ms of CPU time without blocking, the handler then moves
+ * all real-time threads back to normal scheduling for the rest of the run.
+ * The hard limit is twice that, and kills the process if the handler failed.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <sched.h>
+}
+
+#include "Histogram.hpp"
+
+namespace RealTime {
+    struct Config {
+        /** Real-time priority, between 1 and 99, 0 leaves the scheduling
+         *  alone. */
+        int priority = 0;
+        /** SCHED_FIFO or SCHED_RR. */
+        int policy = SCHED_FIFO;
+        /** CPUs that the event threads may run on, empty for all of them. */
+        std::vector<int> cpus;
+        /** Milliseconds of CPU time that a real-time thread may use without
+         *  blocking before it is demoted. */
+        int cpu_limit_ms = 200;
+
+        inline bool enabled() const noexcept {
+            return priority > 0;
+        }
+
+        /**
+         * Parse "fifo" or "rr".
+         *
+         * @throws std::invalid_argument For anything else.
+         */
+        static int parsePolicy(const std::string &name);
+
+        /**
+         * Parse a list of CPUs like "2,4-7".
+         *
+         * @throws std::invalid_argument If the list is malformed.
+         */
+        static std::vector<int> parseCPUs(const std::string &list);
+
+        /**
+         * Check that the numbers make sense.
+         *
+         * @throws std::invalid_argument If they don't.
+         */
+        void validate() const;
+    };
+
+    /** Bytes of heap that are faulted in by lockMemory(). */
+    constexpr size_t HEAP_RESERVE = 8 << 20;
+    /** Bytes of stack that are faulted in by enterThread(). */
+    constexpr size_t STACK_RESERVE = 256 << 10;
+    /** Stack size of threads started after lockMemory() locked future
+     *  mappings. */
+    constexpr size_t THREAD_STACK = 1 << 20;
+
+    /**
+     * Lock the memory of the process and fault in some heap, so that handling
+     * an event never waits for a page to be read in. Memory that is freed
+     * is kept by malloc instead of being given back to the kernel.
+     *
+     * Memory mapped later is only locked as well if RLIMIT_MEMLOCK allows it
+     * to be, otherwise allocations would start failing once the limit is
+     * reached. The heap reserve is only faulted in when it will be locked.
+     *
+     * Locked stacks are resident in full, so threads started afterwards get
+     * THREAD_STACK bytes of stack instead of the default of RLIMIT_STACK,
+     * usually 8 MiB. That covers the thread pool, the notifier, the spawner
+     * and the stats server as well as the event threads.
+     *
+     * @throws SystemError If mlockall() failed.
+     */
+    void lockMemory(size_t heap_reserve = HEAP_RESERVE);
+
+    /**
+     * Set RLIMIT_RTTIME, and demote the real-time threads on SIGXCPU.
+     *
+     * @throws SystemError If the limit could not be set.
+     */
+    void limitCPUTime(int ms);
+
+    /** Fault in the stack of the calling thread. */
+    void prefaultStack(size_t bytes = STACK_RESERVE) noexcept;
+
+    /**
+     * Pin the calling thread to cpus.
+     *
+     * @throws SystemError If sched_setaffinity() failed.
+     */
+    void setAffinity(const std::vector<int> &cpus);
+
+    /**
+     * Switch the calling thread to a real-time policy.
+     *
+     * @throws SystemError If sched_setscheduler() failed, usually because
+     *                     RLIMIT_RTPRIO is too low.
+     */
+    void setScheduler(int policy, int priority);
+
+    /**
+     * Lock memory and limit CPU time as configured, if real-time scheduling
+     * is enabled. Call once, after daemonizing. Failures are logged, the
+     * daemon keeps running without them.
+     */
+    void setupProcess(const Config &cfg) noexcept;
+
+    /**
+     * Make the calling thread an event thread: pin it, fault in its stack
+     * and switch it to real-time scheduling, as configured. Failures are
+     * logged.
+     *
+     * @param name Name of the thread, for the log.
+     */
+    void enterThread(const Config &cfg, const char *name) noexcept;
+
+    /** Times the real-time threads were demoted because of SIGXCPU. */
+    uint64_t demotions() noexcept;
+
+    /**
+     * Measures how late a thread with the same scheduling as the event
+     * threads wakes up, like cyclictest. Wakes up every PERIOD and records
+     * how late it was in the histogram <prefix>.wakeup_jitter.
+     */
+    class JitterProbe {
+    private:
+        std::atomic<bool> stopped{false};
+        Histogram &hist;
+        std::thread thread;
+
+        void run(Config cfg) noexcept;
+
+    public:
+        static constexpr std::chrono::microseconds PERIOD{1000};
+
+        JitterProbe(const Config &cfg, const std::string &prefix);
+        ~JitterProbe();
+
+        JitterProbe(const JitterProbe &) = delete;
+        JitterProbe &operator=(const JitterProbe &) = delete;
+
+        inline const Histogram &histogram() const noexcept {
+            return hist;
+        }
+    };
+}
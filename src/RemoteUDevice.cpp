@@ -27,8 +27,9 @@
  */
 
 #include "RemoteUDevice.hpp"
+#include "Probes.hpp"
 
-RemoteUDevice::RemoteUDevice(UNIXSocket<KBDAction> *conn)
+RemoteUDevice::RemoteUDevice(IPacketChannel<KBDAction> *conn)
     : LuaIface(this, RemoteUDevice_lua_methods) {
     this->conn = conn;
 }
@@ -39,6 +40,10 @@ RemoteUDevice::RemoteUDevice()
 RemoteUDevice::~RemoteUDevice() {}
 
 void RemoteUDevice::emit(int type, int code, int val) {
+    if (discarding) {
+        discarded++;
+        return;
+    }
     KBDAction ac;
     memset(&ac, 0, sizeof(ac));
     ac.ev.type = type;
@@ -48,6 +53,10 @@ void RemoteUDevice::emit(int type, int code, int val) {
 }
 
 void RemoteUDevice::emit(const input_event *send_event) {
+    if (discarding) {
+        discarded++;
+        return;
+    }
     KBDAction ac;
     memset(&ac, 0, sizeof(ac));
     memcpy(&ac.ev, send_event, sizeof(*send_event));
@@ -55,8 +64,34 @@ void RemoteUDevice::emit(const input_event *send_event) {
     evbuf.push_back(ac);
 }
 
+bool RemoteUDevice::emitBatch(std::string packed, bool syn) {
+    if (packed.size() % PACKED_EVENT_SIZE != 0)
+        return false;
+    if (discarding) {
+        discarded += packed.size() / PACKED_EVENT_SIZE;
+        return true;
+    }
+
+    KBDAction ac;
+    memset(&ac, 0, sizeof(ac));
+    KBDAction syn_ac = ac;
+    syn_ac.ev.type = EV_SYN;
+    syn_ac.ev.code = SYN_REPORT;
+    for (size_t i = 0; i < packed.size(); i += PACKED_EVENT_SIZE) {
+        int ev[3];
+        unpackEvent(&packed[i], ev);
+        ac.ev.type = ev[0];
+        ac.ev.code = ev[1];
+        ac.ev.value = ev[2];
+        evbuf.push_back(ac);
+        if (syn)
+            evbuf.push_back(syn_ac);
+    }
+    return true;
+}
+
 void RemoteUDevice::flush() {
-    if (!conn)
+    if (!conn || discarding)
         return;
     if (evbuf.size()) {
         conn->send(evbuf);
@@ -64,9 +99,20 @@ void RemoteUDevice::flush() {
     }
 }
 
+int RemoteUDevice::type(std::string text) {
+    int missing = typing.type(*this, text);
+    flush();
+    return missing;
+}
+
+bool RemoteUDevice::setTypingTable(std::string packed) {
+    return typing.load(packed);
+}
+
 void RemoteUDevice::done() {
     if (!conn)
         return;
+    HAWCK_PROBE(macrod_done, evbuf.size());
     flush();
     KBDAction ac;
     memset(&ac, 0, sizeof(ac));
@@ -51,12 +51,16 @@ extern "C" {
 #include "UNIXSocket.hpp"
 #include "IUDevice.hpp"
 #include "KBDAction.hpp"
+#include "TypingTable.hpp"
 
 // Methods to export to Lua
 // (ClassName, methodName, type0(), type1()...)
 #define RemoteUDevice_lua_methods(M, _)                 \
     M(RemoteUDevice, emit, int(), int(), int()) _       \
-    M(RemoteUDevice, flush)
+    M(RemoteUDevice, emitBatch, std::string(), bool()) _ \
+    M(RemoteUDevice, flush) _                           \
+    M(RemoteUDevice, type, std::string()) _             \
+    M(RemoteUDevice, setTypingTable, std::string())
 
 LUA_DECLARE(RemoteUDevice_lua_methods)
 
@@ -67,11 +71,14 @@ LUA_DECLARE(RemoteUDevice_lua_methods)
 class RemoteUDevice : public IUDevice,
                       public Lua::LuaIface<RemoteUDevice> {
 private:
-    UNIXSocket<KBDAction> *conn = nullptr;
+    IPacketChannel<KBDAction> *conn = nullptr;
     std::vector<KBDAction> evbuf;
+    TypingTable typing;
+    bool discarding = false;
+    size_t discarded = 0;
 
 public:
-    explicit RemoteUDevice(UNIXSocket<KBDAction> *conn);
+    explicit RemoteUDevice(IPacketChannel<KBDAction> *conn);
 
     RemoteUDevice();
 
@@ -81,13 +88,39 @@ public:
 
     virtual void emit(int type, int code, int val) override;
 
+    virtual bool emitBatch(std::string packed, bool syn) override;
+
     virtual void done() override;
 
     virtual void flush() override;
 
-    inline void setConnection(UNIXSocket<KBDAction> *conn) {
+    /** Type out a UTF-8 string, see TypingTable::type.
+     *
+     * @return The number of characters that could not be typed.
+     */
+    int type(std::string text);
+
+    /** Replace the table used by type(), see TypingTable::load. */
+    bool setTypingTable(std::string packed);
+
+    inline void setConnection(IPacketChannel<KBDAction> *conn) {
         this->conn = conn;
     }
 
+    /** Throw away events instead of sending them, while MacroD runs script
+     *  code outside of handling an event. InputD only reads the output for
+     *  an event before it gets the reply, so anything sent at another time
+     *  would be written at the wrong time or lost. */
+    inline void setDiscarding(bool on) noexcept {
+        discarding = on;
+        if (on)
+            discarded = 0;
+    }
+
+    /** Events thrown away since setDiscarding(true). */
+    inline size_t getDiscarded() const noexcept {
+        return discarded;
+    }
+
     LUA_CLASS_INIT(RemoteUDevice_lua_methods)
 };
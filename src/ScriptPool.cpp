@@ -0,0 +1,119 @@
+/** @file ScriptPool.cpp
+ *
+ * @brief Scripts with the Hawck runtime already loaded, kept ready for when
+ *        a user script is loaded.
+ */
+
+extern "C" {
+    #include <syslog.h>
+}
+
+#include "ScriptPool.hpp"
+
+using namespace std;
+
+ScriptPool::ScriptPool(Factory make, size_t size)
+    : make(std::move(make)),
+      size(size)
+{}
+
+ScriptPool::~ScriptPool() {
+    stop();
+}
+
+void ScriptPool::start() {
+    lock_guard<mutex> lock(mtx);
+    if (worker.joinable())
+        return;
+    stopping = false;
+    worker = thread([this]() { run(); });
+}
+
+void ScriptPool::stop() noexcept {
+    deque<unique_ptr<MacroScript>> dead;
+    {
+        lock_guard<mutex> lock(mtx);
+        if (!worker.joinable())
+            return;
+        stopping = true;
+        dead.swap(ready);
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+void ScriptPool::run() noexcept {
+    unique_lock<mutex> lock(mtx);
+    while (!stopping) {
+        if (broken || ready.size() >= size) {
+            cv.wait(lock);
+            continue;
+        }
+
+        uint64_t gen = generation;
+        lock.unlock();
+        unique_ptr<MacroScript> sc;
+        try {
+            sc = make();
+        } catch (const exception &e) {
+            // The error is reported when the script is loaded without the
+            // pool.
+            syslog(LOG_WARNING, "Unable to prepare script: %s", e.what());
+            stats.failed++;
+        }
+        lock.lock();
+
+        if (!sc) {
+            broken = generation == gen;
+        } else if (generation == gen && !stopping && ready.size() < size) {
+            ready.push_back(std::move(sc));
+        } else {
+            stats.discarded++;
+            // Not destroyed while holding the lock.
+            lock.unlock();
+            sc.reset();
+            lock.lock();
+        }
+    }
+}
+
+unique_ptr<MacroScript> ScriptPool::take() {
+    unique_ptr<MacroScript> sc;
+    {
+        lock_guard<mutex> lock(mtx);
+        if (ready.empty()) {
+            stats.misses++;
+            return nullptr;
+        }
+        sc = std::move(ready.front());
+        ready.pop_front();
+        stats.hits++;
+    }
+    cv.notify_all();
+    return sc;
+}
+
+void ScriptPool::invalidate() {
+    deque<unique_ptr<MacroScript>> dead;
+    {
+        lock_guard<mutex> lock(mtx);
+        generation++;
+        broken = false;
+        stats.discarded += ready.size();
+        dead.swap(ready);
+    }
+    cv.notify_all();
+}
+
+void ScriptPool::setSize(size_t n) {
+    deque<unique_ptr<MacroScript>> dead;
+    {
+        lock_guard<mutex> lock(mtx);
+        size = n;
+        while (ready.size() > size) {
+            dead.push_back(std::move(ready.back()));
+            ready.pop_back();
+        }
+    }
+    cv.notify_all();
+}
@@ -0,0 +1,91 @@
+/** @file ScriptPool.hpp
+ *
+ * @brief Scripts with the Hawck runtime already loaded, kept ready for when
+ *        a user script is loaded.
+ *
+ * Most of the time it takes to load a script is spent creating the Lua
+ * state, loading the Hawck runtime and parsing the keymap, before any user
+ * code runs. The pool does that ahead of time on its own thread, so that
+ * loading a script only has to run the user's code.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "MacroScript.hpp"
+
+/** Counters kept by a ScriptPool, these can be read from any thread. */
+struct ScriptPoolStats {
+    /** Scripts that were taken from the pool. */
+    std::atomic<uint64_t> hits{0};
+    /** Requests for a script while the pool was empty. */
+    std::atomic<uint64_t> misses{0};
+    /** Scripts that were thrown away because the pool was invalidated. */
+    std::atomic<uint64_t> discarded{0};
+    /** Scripts that could not be prepared. */
+    std::atomic<uint64_t> failed{0};
+};
+
+class ScriptPool {
+public:
+    /** Creates a script with the runtime loaded, only ever called from the
+     *  pool thread. */
+    using Factory = std::function<std::unique_ptr<MacroScript>()>;
+
+private:
+    Factory make;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<MacroScript>> ready;
+    size_t size;
+    /** Incremented by invalidate(), scripts prepared for an older
+     *  generation are thrown away. */
+    uint64_t generation = 0;
+    /** Set when preparing a script fails, nothing is prepared until the
+     *  pool is invalidated. */
+    bool broken = false;
+    bool stopping = false;
+    std::thread worker;
+    ScriptPoolStats stats;
+
+    /** Body of the pool thread. */
+    void run() noexcept;
+
+public:
+    /**
+     * @param make Function that prepares scripts.
+     * @param size Number of scripts to keep ready.
+     */
+    explicit ScriptPool(Factory make, size_t size = 2);
+    ~ScriptPool();
+
+    /** Start the pool thread. */
+    void start();
+
+    /** Stop the pool thread, and throw away the scripts that are ready. */
+    void stop() noexcept;
+
+    /** Take a script out of the pool, this never blocks.
+     *
+     * @return The script, or nullptr if none are ready.
+     */
+    std::unique_ptr<MacroScript> take();
+
+    /** Throw away the scripts that are ready and prepare new ones, this
+     *  must be done when something that the runtime depends on, like the
+     *  keymap, changes. */
+    void invalidate();
+
+    /** Set the number of scripts to keep ready, 0 disables the pool. */
+    void setSize(size_t n);
+
+    inline const ScriptPoolStats &getStats() const noexcept { return stats; }
+};
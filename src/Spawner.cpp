@@ -0,0 +1,284 @@
+/** @file Spawner.cpp
+ *
+ * @brief Launch processes from scripts without blocking MacroD.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+extern "C" {
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <spawn.h>
+    #include <sys/eventfd.h>
+    #include <sys/syscall.h>
+    #include <sys/wait.h>
+    #include <syslog.h>
+    #include <unistd.h>
+}
+
+#include "Spawner.hpp"
+
+extern char **environ;
+
+using namespace std;
+
+/** How often children are checked with waitpid() when pidfds are not
+ *  available. */
+static constexpr int POLL_INTERVAL_MS = 100;
+
+static atomic<int> spawn_in_flight(0);
+
+struct ProcessReaper::Child {
+    pid_t pid;
+    int pidfd = -1;
+    int out_fd = -1;
+    string out;
+    bool exited = false;
+    int status = 0;
+    Callback done;
+};
+
+static int pidfdOpen(pid_t pid) noexcept {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/** Read what is available from a child's output, closing it at EOF. */
+static void readOutput(string &out, int &fd) noexcept {
+    char buf[4096];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            size_t room = ProcessReaper::MAX_CAPTURE - out.size();
+            try {
+                out.append(buf, min(size_t(n), room));
+            } catch (const bad_alloc &) {}
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN)
+            return;
+        close(fd);
+        fd = -1;
+        return;
+    }
+}
+
+ProcessReaper::ProcessReaper() noexcept {
+    if ((wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+        syslog(LOG_ERR, "Unable to create eventfd for process reaper: %s", strerror(errno));
+}
+
+ProcessReaper &ProcessReaper::get() noexcept {
+    // Never destroyed, the thread may outlive static destructors.
+    static ProcessReaper *reaper = new ProcessReaper();
+    return *reaper;
+}
+
+void ProcessReaper::watch(pid_t pid, int out_fd, Callback done) {
+    call_once(started, [this]() {
+        thread([this]() { run(); }).detach();
+    });
+
+    auto child = make_unique<Child>();
+    child->pid = pid;
+    child->pidfd = pidfdOpen(pid);
+    child->out_fd = out_fd;
+    child->done = std::move(done);
+    if (out_fd != -1)
+        fcntl(out_fd, F_SETFL, fcntl(out_fd, F_GETFL) | O_NONBLOCK);
+
+    {
+        lock_guard<mutex> lock(new_mtx);
+        new_children.push_back(std::move(child));
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        syslog(LOG_ERR, "Unable to wake process reaper: %s", strerror(errno));
+}
+
+void ProcessReaper::run() noexcept {
+    vector<unique_ptr<Child>> children;
+    vector<struct pollfd> fds;
+
+    for (;;) {
+        fds.clear();
+        fds.push_back({wake_fd, POLLIN, 0});
+        bool need_polling = wake_fd == -1;
+        for (auto &c : children) {
+            if (c->out_fd != -1)
+                fds.push_back({c->out_fd, POLLIN, 0});
+            if (c->exited)
+                continue;
+            if (c->pidfd != -1)
+                fds.push_back({c->pidfd, POLLIN, 0});
+            else
+                need_polling = true;
+        }
+
+        if (poll(fds.data(), fds.size(), need_polling ? POLL_INTERVAL_MS : -1) == -1
+            && errno != EINTR)
+        {
+            syslog(LOG_ERR, "Error in poll() in process reaper: %s", strerror(errno));
+            this_thread::sleep_for(chrono::milliseconds(POLL_INTERVAL_MS));
+        }
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t n;
+            (void) !read(wake_fd, &n, sizeof(n));
+        }
+        {
+            lock_guard<mutex> lock(new_mtx);
+            for (auto &c : new_children)
+                children.push_back(std::move(c));
+            new_children.clear();
+        }
+
+        // There are only ever a few children, so all of them are checked
+        // rather than mapping the poll results back.
+        for (auto it = children.begin(); it != children.end();) {
+            Child &c = **it;
+            if (c.out_fd != -1)
+                readOutput(c.out, c.out_fd);
+            if (!c.exited) {
+                int status;
+                pid_t ret = waitpid(c.pid, &status, WNOHANG);
+                if (ret == c.pid) {
+                    c.exited = true;
+                    c.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                                   : WEXITSTATUS(status);
+                } else if (ret == -1 && errno != EINTR) {
+                    syslog(LOG_ERR, "Unable to wait for process %d: %s",
+                           (int) c.pid, strerror(errno));
+                    c.exited = true;
+                    c.status = -1;
+                }
+            }
+
+            // A process may leave its output open to its own children, so
+            // the output is only waited for if it is captured.
+            if (c.exited && (c.out_fd == -1 || !c.done)) {
+                if (c.out_fd != -1)
+                    close(c.out_fd);
+                if (c.pidfd != -1)
+                    close(c.pidfd);
+                if (c.done) {
+                    try {
+                        c.done(std::move(c.out), c.status);
+                    } catch (const exception &e) {
+                        syslog(LOG_ERR, "Error in process callback: %s", e.what());
+                    }
+                }
+                it = children.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+Spawner::Spawner()
+    : LuaIface(this, Spawner_lua_methods),
+      inbox(make_shared<Inbox>())
+{}
+
+Spawner::~Spawner() {
+    // Processes that are still running are left alone, their results are
+    // thrown away when they finish.
+    lock_guard<mutex> lock(inbox->mtx);
+    spawn_in_flight -= (int) inbox->results.size();
+    inbox->results.clear();
+    inbox->alive = false;
+}
+
+int Spawner::spawn(string cmd, bool capture) {
+    spawned++;
+    if (dry_run)
+        return next_id++;
+
+    int pipefd[2] = {-1, -1};
+    if (capture && pipe2(pipefd, O_CLOEXEC) == -1) {
+        syslog(LOG_ERR, "Unable to create pipe for '%s': %s", cmd.c_str(), strerror(errno));
+        return 0;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (capture)
+        posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    else
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    // Don't pass on the signal dispositions and mask of MacroD.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t mask, def;
+    sigemptyset(&mask);
+    sigemptyset(&def);
+    sigaddset(&def, SIGPIPE);
+    sigaddset(&def, SIGUSR1);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &def);
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_SETSID
+    // Applications that are launched should not go down with MacroD.
+    flags |= POSIX_SPAWN_SETSID;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    const char *argv[] = {"sh", "-c", cmd.c_str(), nullptr};
+    pid_t pid;
+    int err = posix_spawn(&pid, "/bin/sh", &actions, &attr, (char *const *) argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (capture)
+        close(pipefd[1]);
+    if (err != 0) {
+        syslog(LOG_ERR, "Unable to spawn '%s': %s", cmd.c_str(), strerror(err));
+        if (capture)
+            close(pipefd[0]);
+        return 0;
+    }
+
+    int id = next_id++;
+    ProcessReaper::Callback done;
+    if (capture) {
+        spawn_in_flight++;
+        done = [inbox = inbox, id](string out, int status) {
+            lock_guard<mutex> lock(inbox->mtx);
+            if (!inbox->alive) {
+                spawn_in_flight--;
+                return;
+            }
+            inbox->results.push_back({id, std::move(out), status});
+            inbox->ready.store(true, memory_order_release);
+        };
+    }
+    ProcessReaper::get().watch(pid, capture ? pipefd[0] : -1, std::move(done));
+    return id;
+}
+
+vector<SpawnResult> Spawner::takeResults() {
+    vector<SpawnResult> results;
+    lock_guard<mutex> lock(inbox->mtx);
+    results.swap(inbox->results);
+    inbox->ready.store(false, memory_order_relaxed);
+    spawn_in_flight -= (int) results.size();
+    return results;
+}
+
+int Spawner::inFlight() noexcept {
+    return spawn_in_flight.load(memory_order_relaxed);
+}
+
+LUA_CREATE_BINDINGS(Spawner_lua_methods)
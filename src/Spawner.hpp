@@ -0,0 +1,145 @@
+/** @file Spawner.hpp
+ *
+ * @brief Launch processes from scripts without blocking MacroD.
+ *
+ * Processes are started with posix_spawn(), which uses vfork semantics on
+ * Linux, so the address space of MacroD is never copied. A single reaper
+ * thread waits for them to exit, and collects their output when it is
+ * captured. It uses a pidfd per child where the kernel supports them, and
+ * falls back to polling waitpid() otherwise. Only the pids that were started
+ * here are waited for, so this does not interfere with Popen.
+ *
+ * Each script has its own Spawner, captured output is left there by the reaper
+ * thread and handed to the script by MacroD on a later turn of its main loop,
+ * through the __spawn_done(id, output, status) Lua function.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include <sys/types.h>
+}
+
+#include "LuaUtils.hpp"
+
+/** Output and exit status of a process whose output was captured. */
+struct SpawnResult {
+    int id;
+    std::string out;
+    /** Exit status, or 128 + the signal number if it was killed. */
+    int status;
+};
+
+/** Waits for processes started by Spawners, see Spawner.hpp. */
+class ProcessReaper {
+public:
+    /** Called on the reaper thread once a process has exited and all of its
+     *  output has been read. */
+    using Callback = std::function<void(std::string out, int status)>;
+
+    /** Output beyond this is read and discarded. */
+    static constexpr size_t MAX_CAPTURE = 1 << 20;
+
+private:
+    struct Child;
+
+    std::mutex new_mtx;
+    std::vector<std::unique_ptr<Child>> new_children;
+    /** eventfd used to wake the reaper thread for new children. */
+    int wake_fd = -1;
+    std::once_flag started;
+
+    ProcessReaper() noexcept;
+
+    void run() noexcept;
+
+public:
+    /** Get the reaper, its thread is started the first time a process is
+     *  handed to it and runs until the process exits. */
+    static ProcessReaper &get() noexcept;
+
+    /** Wait for a process.
+     *
+     * @param pid The process.
+     * @param out_fd Read end of a pipe connected to its standard output, -1
+     *               if the output is not captured. Ownership is transferred.
+     * @param done Called when the process is done, may be empty.
+     */
+    void watch(pid_t pid, int out_fd, Callback done);
+};
+
+// (ClassName, methodName, type0(), type1()...)
+#define Spawner_lua_methods(M, _)                       \
+    M(Spawner, spawn, std::string(), bool())
+
+LUA_DECLARE(Spawner_lua_methods)
+
+class Spawner : public Lua::LuaIface<Spawner> {
+private:
+    /** Results of processes that have finished, shared with the callbacks
+     *  given to the reaper so that it may outlive the Spawner. */
+    struct Inbox {
+        std::mutex mtx;
+        std::vector<SpawnResult> results;
+        std::atomic<bool> ready{false};
+        /** Cleared when the Spawner is destroyed. */
+        bool alive = true;
+    };
+
+    std::shared_ptr<Inbox> inbox;
+    int next_id = 1;
+    /** See setDryRun(). */
+    bool dry_run = false;
+    /** Calls to spawn(), see spawnCount(). */
+    int spawned = 0;
+
+public:
+    Spawner();
+
+    ~Spawner();
+
+    /** Run a shell command, exposed to Lua.
+     *
+     * The command runs with /bin/sh -c in a new session, with standard input
+     * from /dev/null, and standard output going to /dev/null unless it is
+     * captured.
+     *
+     * @param cmd Shell command.
+     * @param capture Capture standard output, and deliver it with the exit
+     *                status through takeResults().
+     * @return An identifier for the process, or 0 if it could not be
+     *         started.
+     */
+    int spawn(std::string cmd, bool capture);
+
+    /** Count commands instead of running them, processes that would have
+     *  their output captured never finish. Used by hawck-eval, so that
+     *  scripts can be run against a corpus without side effects. */
+    inline void setDryRun(bool dry) noexcept { dry_run = dry; }
+
+    /** Number of processes that the script asked to start, including the
+     *  ones that could not be started. */
+    inline int spawnCount() const noexcept { return spawned; }
+
+    /** Check whether takeResults() has anything to return, this does not
+     *  lock. */
+    inline bool hasResults() const noexcept {
+        return inbox->ready.load(std::memory_order_acquire);
+    }
+
+    /** Take the results of captured processes that have finished. */
+    std::vector<SpawnResult> takeResults();
+
+    /** Number of captured processes, across all Spawners, whose results have
+     *  not been taken yet. */
+    static int inFlight() noexcept;
+
+    LUA_CLASS_INIT(Spawner_lua_methods)
+};
@@ -0,0 +1,268 @@
+/** @file Stats.cpp
+ *
+ * @brief Latency histograms and counters, and the socket that serves them.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+extern "C" {
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/time.h>
+    #include <syslog.h>
+    #include <unistd.h>
+}
+
+#include "Stats.hpp"
+#include "Permissions.hpp"
+#include "utils.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+/** Numbers with one decimal, JSON has no representation of inf or nan. */
+static string fmtNum(double v) {
+    if (!isfinite(v))
+        return "0";
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f", v);
+    return buf;
+}
+
+void StatsReport::counter(const string &name, uint64_t total) {
+    counters.push_back({name, total, 0});
+}
+
+void StatsReport::gauge(const string &name, double value) {
+    gauges.push_back({name, value});
+}
+
+void StatsReport::histogram(const string &name, const Histogram &hist) {
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    histograms.push_back({name, hist.count(), hist.mean() / 1000.0,
+                          us(hist.percentile(0.50)), us(hist.percentile(0.90)),
+                          us(hist.percentile(0.99)), us(hist.percentile(0.999)),
+                          us(hist.max())});
+}
+
+string StatsReport::text() const {
+    stringstream out;
+    out << "uptime " << fmtNum(uptime_s) << " s\n";
+    for (const auto &c : counters)
+        out << "counter   " << c.name << " " << c.total << " (" << fmtNum(c.per_s) << "/s)\n";
+    for (const auto &g : gauges)
+        out << "gauge     " << g.name << " " << fmtNum(g.value) << "\n";
+    for (const auto &h : histograms)
+        out << "histogram " << h.name << " n=" << h.count
+            << " mean=" << fmtNum(h.mean_us) << "us p50=" << fmtNum(h.p50_us)
+            << "us p90=" << fmtNum(h.p90_us) << "us p99=" << fmtNum(h.p99_us)
+            << "us p99.9=" << fmtNum(h.p999_us) << "us max=" << fmtNum(h.max_us)
+            << "us\n";
+    return out.str();
+}
+
+string StatsReport::json() const {
+    stringstream out;
+    out << "{\"uptime_s\":" << fmtNum(uptime_s) << ",\"counters\":{";
+    for (size_t i = 0; i < counters.size(); i++)
+        out << (i ? "," : "") << jsonString(counters[i].name)
+            << ":{\"total\":" << counters[i].total
+            << ",\"per_s\":" << fmtNum(counters[i].per_s) << "}";
+    out << "},\"gauges\":{";
+    for (size_t i = 0; i < gauges.size(); i++)
+        out << (i ? "," : "") << jsonString(gauges[i].name) << ":" << fmtNum(gauges[i].value);
+    out << "},\"histograms\":{";
+    for (size_t i = 0; i < histograms.size(); i++) {
+        const auto &h = histograms[i];
+        out << (i ? "," : "") << jsonString(h.name)
+            << ":{\"count\":" << h.count
+            << ",\"mean_us\":" << fmtNum(h.mean_us)
+            << ",\"p50_us\":" << fmtNum(h.p50_us)
+            << ",\"p90_us\":" << fmtNum(h.p90_us)
+            << ",\"p99_us\":" << fmtNum(h.p99_us)
+            << ",\"p999_us\":" << fmtNum(h.p999_us)
+            << ",\"max_us\":" << fmtNum(h.max_us) << "}";
+    }
+    out << "}}\n";
+    return out.str();
+}
+
+Stats::Stats()
+    : started(steady_clock::now()),
+      last_report(started)
+{}
+
+Stats &Stats::get() noexcept {
+    // Never destroyed, references to the histograms are kept by threads
+    // that may outlive static destructors.
+    static Stats *stats = new Stats();
+    return *stats;
+}
+
+Histogram &Stats::histogram(const string &name) {
+    lock_guard<mutex> lock(mtx);
+    auto &hist = histograms[name];
+    if (!hist)
+        hist = make_unique<Histogram>();
+    return *hist;
+}
+
+atomic<uint64_t> &Stats::counter(const string &name) {
+    lock_guard<mutex> lock(mtx);
+    auto &cnt = counters[name];
+    if (!cnt)
+        cnt = make_unique<atomic<uint64_t>>(0);
+    return *cnt;
+}
+
+void Stats::addSource(const string &name, Source src) {
+    lock_guard<mutex> lock(mtx);
+    sources[name] = std::move(src);
+}
+
+void Stats::removeSource(const string &name) {
+    lock_guard<mutex> calls_lock(calls_mtx);
+    lock_guard<mutex> lock(mtx);
+    sources.erase(name);
+}
+
+void Stats::addDump(const string &name, Dump dump) {
+    lock_guard<mutex> lock(mtx);
+    dumps[name] = std::move(dump);
+}
+
+void Stats::removeDump(const string &name) {
+    lock_guard<mutex> calls_lock(calls_mtx);
+    lock_guard<mutex> lock(mtx);
+    dumps.erase(name);
+}
+
+bool Stats::dump(const string &name, string &out) {
+    lock_guard<mutex> calls_lock(calls_mtx);
+    Dump fn;
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = dumps.find(name);
+        if (it == dumps.end())
+            return false;
+        fn = it->second;
+    }
+    out = fn();
+    return true;
+}
+
+StatsReport Stats::report() {
+    StatsReport rep;
+    lock_guard<mutex> calls_lock(calls_mtx);
+
+    vector<pair<string, Source>> srcs;
+    auto now = steady_clock::now();
+    {
+        lock_guard<mutex> lock(mtx);
+        rep.uptime_s = duration<double>(now - started).count();
+        for (const auto &[name, cnt] : counters)
+            rep.counter(name, cnt->load(memory_order_relaxed));
+        for (const auto &[name, hist] : histograms)
+            rep.histogram(name, *hist);
+        srcs.assign(sources.begin(), sources.end());
+    }
+    for (const auto &[name, src] : srcs) {
+        try {
+            src(rep);
+        } catch (const exception &e) {
+            syslog(LOG_ERR, "Stats source %s failed: %s", name.c_str(), e.what());
+        }
+    }
+
+    lock_guard<mutex> lock(mtx);
+    double dt = duration<double>(now - last_report).count();
+    for (auto &c : rep.counters) {
+        uint64_t last = last_totals[c.name];
+        c.per_s = dt > 0 && c.total >= last ? (c.total - last) / dt : 0;
+        last_totals[c.name] = c.total;
+    }
+    last_report = now;
+
+    return rep;
+}
+
+StatsServer::StatsServer(const string &path, mode_t mode, const string &group)
+    : path(path),
+      srv(path)
+{
+    if (!group.empty()) {
+        auto [grp, grpbuf] = Permissions::getgroup(group);
+        (void) grpbuf;
+        if (chown(path.c_str(), getuid(), grp->gr_gid) == -1)
+            throw SystemError("Unable to chown " + path + ": ", errno);
+    }
+    if (chmod(path.c_str(), mode) == -1)
+        throw SystemError("Unable to chmod " + path + ": ", errno);
+    thread = std::thread([this]() { run(); });
+}
+
+StatsServer::~StatsServer() {
+    stopping = true;
+    // Wakes up the accept() in the server thread.
+    ::shutdown(srv.getFD(), SHUT_RDWR);
+    thread.join();
+    unlink(path.c_str());
+}
+
+void StatsServer::run() noexcept {
+    while (!stopping) {
+        int fd;
+        try {
+            fd = srv.accept();
+        } catch (const SocketError &e) {
+            if (stopping)
+                break;
+            syslog(LOG_ERR, "Stats socket: %s", e.what());
+            this_thread::sleep_for(100ms);
+            continue;
+        }
+        serve(fd);
+        close(fd);
+    }
+}
+
+void StatsServer::serve(int fd) noexcept {
+    // A client that doesn't read the response would otherwise block the
+    // server thread, and the destructor that joins it.
+    struct timeval timeout = {SEND_TIMEOUT_S, 0};
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1)
+        return;
+
+    // The request is optional, clients that just connect get text.
+    char req[64] = {0};
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 100) == 1) {
+        ssize_t n = read(fd, req, sizeof(req) - 1);
+        if (n < 0)
+            n = 0;
+        req[n] = '\0';
+    }
+
+    string name(req);
+    name.erase(name.find_last_not_of(" \t\r\n") + 1);
+
+    string resp;
+    try {
+        if (!Stats::get().dump(name, resp)) {
+            auto rep = Stats::get().report();
+            resp = name == "json" ? rep.json() : rep.text();
+        }
+    } catch (const exception &e) {
+        resp = string("error: ") + e.what() + "\n";
+    }
+
+    for (size_t off = 0; off < resp.size();) {
+        ssize_t n = ::send(fd, resp.data() + off, resp.size() - off, MSG_NOSIGNAL);
+        if (n <= 0)
+            return;
+        off += n;
+    }
+}
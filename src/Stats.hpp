@@ -0,0 +1,188 @@
+/** @file Stats.hpp
+ *
+ * @brief Latency histograms and counters, and the socket that serves them.
+ *
+ * Both daemons time every stage an event passes through, from the time the
+ * kernel stamped it to the time it was written to the virtual keyboard. The
+ * measurements are kept in a registry, and can be read over a UNIX socket
+ * with e.g.
+ *
+ *     echo json | socat - UNIX-CONNECT:/var/lib/hawck-input/stats.sock
+ *
+ * Anything other than "json", or the name of a dump (see Stats::addDump),
+ * gets the text format.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <sys/time.h>
+    #include <sys/types.h>
+    #include <time.h>
+}
+
+#include "Histogram.hpp"
+#include "UNIXSocket.hpp"
+
+/** Nanoseconds on CLOCK_MONOTONIC, the clock that keyboards are told to
+ *  stamp their events with. */
+inline uint64_t monotonicNS() noexcept {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Nanoseconds since an event was stamped by the kernel, 0 if the stamp is
+ *  in the future. */
+inline uint64_t eventAgeNS(const struct timeval &tv) noexcept {
+    uint64_t stamp = (uint64_t) tv.tv_sec * 1000000000 + (uint64_t) tv.tv_usec * 1000;
+    uint64_t now = monotonicNS();
+    return now > stamp ? now - stamp : 0;
+}
+
+/** A snapshot of the statistics, formatted as text or JSON. */
+class StatsReport {
+private:
+    struct Counter {
+        std::string name;
+        uint64_t total;
+        double per_s;
+    };
+    struct Gauge {
+        std::string name;
+        double value;
+    };
+    struct Summary {
+        std::string name;
+        uint64_t count;
+        double mean_us, p50_us, p90_us, p99_us, p999_us, max_us;
+    };
+
+    double uptime_s = 0;
+    std::vector<Counter> counters;
+    std::vector<Gauge> gauges;
+    std::vector<Summary> histograms;
+
+    friend class Stats;
+
+public:
+    /** Add a counter, the rate is filled in by Stats::report(). */
+    void counter(const std::string &name, uint64_t total);
+
+    /** Add a value that can go up and down. */
+    void gauge(const std::string &name, double value);
+
+    /** Add a histogram of durations in nanoseconds, reported in µs. */
+    void histogram(const std::string &name, const Histogram &hist);
+
+    std::string text() const;
+    std::string json() const;
+};
+
+/**
+ * Registry of the histograms and counters in the process.
+ *
+ * Looking up a histogram or counter takes a lock, so the hot path should
+ * look them up once and keep the reference, they are never freed.
+ */
+class Stats {
+public:
+    /** Adds statistics that are not kept in the registry to a report,
+     *  called from the thread that serves the stats socket. The registry
+     *  isn't locked, so sources may look up histograms and counters. */
+    using Source = std::function<void(StatsReport &)>;
+
+    /** Produces text that is served instead of the report when a client
+     *  asks for it by name, called like a Source. */
+    using Dump = std::function<std::string()>;
+
+private:
+    std::mutex mtx;
+    /** Held while sources and dumps are called, without mtx, so that
+     *  removing one waits for calls that are in progress. */
+    std::mutex calls_mtx;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    std::map<std::string, std::unique_ptr<std::atomic<uint64_t>>> counters;
+    std::map<std::string, Source> sources;
+    std::map<std::string, Dump> dumps;
+    std::chrono::steady_clock::time_point started;
+    /** Counter totals at the time of the last report, for the rates. */
+    std::map<std::string, uint64_t> last_totals;
+    std::chrono::steady_clock::time_point last_report;
+
+    Stats();
+
+public:
+    /** Get the registry, it is never destroyed. */
+    static Stats &get() noexcept;
+
+    /** Get a histogram, creating it if it doesn't exist. */
+    Histogram &histogram(const std::string &name);
+
+    /** Get a counter, creating it if it doesn't exist. */
+    std::atomic<uint64_t> &counter(const std::string &name);
+
+    /** Add a source, replacing any source with the same name. */
+    void addSource(const std::string &name, Source src);
+
+    /** Remove a source, it won't be called once this returns. */
+    void removeSource(const std::string &name);
+
+    /** Add a dump, replacing any dump with the same name. */
+    void addDump(const std::string &name, Dump dump);
+
+    /** Remove a dump, it won't be called once this returns. */
+    void removeDump(const std::string &name);
+
+    /**
+     * Produce a dump.
+     *
+     * @param name Name of the dump.
+     * @param out Set to the dump.
+     * @return False if there is no dump with that name.
+     */
+    bool dump(const std::string &name, std::string &out);
+
+    /** Take a snapshot, counter rates are per second since the previous
+     *  snapshot. */
+    StatsReport report();
+};
+
+/** Serves Stats::get().report() on a UNIX socket from its own thread. */
+class StatsServer {
+private:
+    std::string path;
+    UNIXServer srv;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    /** How long a response may wait on a client that doesn't read it. */
+    static constexpr int SEND_TIMEOUT_S = 1;
+
+    void run() noexcept;
+    void serve(int fd) noexcept;
+
+public:
+    /**
+     * @param path Where to create the socket.
+     * @param mode Permissions of the socket.
+     * @param group Group that the socket is given to, or empty to keep the
+     *              group of the process.
+     * @throws SocketError If the socket can't be created.
+     * @throws SystemError If the permissions can't be set.
+     */
+    StatsServer(const std::string &path, mode_t mode, const std::string &group = "");
+
+    /** Stop serving and remove the socket. */
+    ~StatsServer();
+};
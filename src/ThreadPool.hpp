@@ -0,0 +1,94 @@
+/** @file ThreadPool.hpp
+ *
+ * @brief Fixed size pool of worker threads.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Runs tasks on a fixed number of threads, in the order that they were
+ * submitted. The destructor finishes all queued tasks before it returns.
+ */
+class ThreadPool {
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    void work() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    /**
+     * @param nthreads Number of worker threads, 0 means one per core.
+     */
+    explicit ThreadPool(size_t nthreads = 0) {
+        if (nthreads == 0)
+            nthreads = std::max(1u, std::thread::hardware_concurrency());
+        workers.reserve(nthreads);
+        for (size_t i = 0; i < nthreads; i++)
+            workers.emplace_back([this]() { work(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &t : workers)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * Queue a task.
+     *
+     * @return Future for the result of the task, exceptions thrown by the
+     *         task are rethrown by get().
+     */
+    template <class F>
+    auto submit(F &&fn) -> std::future<std::invoke_result_t<F>> {
+        using R = std::invoke_result_t<F>;
+        // std::function must be copyable, the task is not.
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+        auto result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            tasks.emplace_back([task]() { (*task)(); });
+        }
+        cv.notify_one();
+        return result;
+    }
+
+    inline size_t size() const noexcept {
+        return workers.size();
+    }
+};
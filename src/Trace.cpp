@@ -0,0 +1,180 @@
+/** @file Trace.cpp
+ *
+ * @brief Recordings of the events that pass through InputD.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+    #include <fcntl.h>
+    #include <unistd.h>
+}
+
+#include "Trace.hpp"
+#include "SystemError.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+static constexpr char MAGIC[8] = {'H', 'W', 'K', 'T', 'R', 'A', 'C', 'E'};
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t HEADER_SIZE = 16;
+static constexpr size_t RECORD_SIZE = 16;
+
+static void put16(unsigned char *p, uint16_t v) noexcept {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v) noexcept {
+    for (int i = 0; i < 4; i++)
+        p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static uint16_t get16(const unsigned char *p) noexcept {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p) noexcept {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+struct input_id TraceRecord::deviceID() const noexcept {
+    struct input_id id;
+    id.bustype = type;
+    id.vendor = code;
+    id.product = (uint32_t) value & 0xffff;
+    id.version = (uint32_t) value >> 16;
+    return id;
+}
+
+TraceWriter::TraceWriter(const string &path)
+    : start(steady_clock::now())
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        throw SystemError("Unable to create " + path + ": ", errno);
+    if (!(file = fdopen(fd, "wb"))) {
+        close(fd);
+        throw SystemError("Unable to open " + path + ": ", errno);
+    }
+
+    unsigned char header[HEADER_SIZE] = {0};
+    memcpy(header, MAGIC, sizeof(MAGIC));
+    put32(header + 8, VERSION);
+    if (fwrite(header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        throw SystemError("Unable to write " + path + ": ", errno);
+    }
+}
+
+TraceWriter::~TraceWriter() {
+    fclose(file);
+}
+
+uint64_t TraceWriter::now() const noexcept {
+    return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+void TraceWriter::write(const TraceRecord &rec) {
+    // Gaps too long for the delta are shortened, the timing of a trace is
+    // only interesting over short periods.
+    uint64_t dt = rec.time_us > last_us ? rec.time_us - last_us : 0;
+    last_us = max(last_us, rec.time_us);
+    unsigned char buf[RECORD_SIZE];
+    put32(buf, dt > UINT32_MAX ? UINT32_MAX : (uint32_t) dt);
+    put16(buf + 4, rec.kind);
+    put16(buf + 6, rec.handle);
+    put16(buf + 8, rec.type);
+    put16(buf + 10, rec.code);
+    put32(buf + 12, (uint32_t) rec.value);
+    if (fwrite(buf, sizeof(buf), 1, file) != 1)
+        throw SystemError("Unable to write trace: ", errno);
+}
+
+void TraceWriter::input(const KBDAction &action) {
+    TraceRecord rec;
+    rec.time_us = now();
+    rec.handle = action.kbd_handle;
+
+    if (rec.handle && (rec.handle >= known.size() || !known[rec.handle])) {
+        if (rec.handle >= known.size())
+            known.resize(rec.handle + 1);
+        known[rec.handle] = true;
+        TraceRecord dev = rec;
+        dev.kind = TraceRecord::DEVICE;
+        dev.type = action.dev_id.bustype;
+        dev.code = action.dev_id.vendor;
+        dev.value = (int32_t) (action.dev_id.product | ((uint32_t) action.dev_id.version << 16));
+        write(dev);
+    }
+
+    rec.kind = TraceRecord::INPUT;
+    rec.type = action.ev.type;
+    rec.code = action.ev.code;
+    rec.value = action.ev.value;
+    write(rec);
+}
+
+void TraceWriter::output(const struct input_event &ev) {
+    TraceRecord rec;
+    rec.time_us = now();
+    rec.kind = TraceRecord::OUTPUT;
+    rec.type = ev.type;
+    rec.code = ev.code;
+    rec.value = ev.value;
+    write(rec);
+}
+
+void TraceWriter::flush() {
+    if (fflush(file) != 0)
+        throw SystemError("Unable to write trace: ", errno);
+}
+
+TraceReader::TraceReader(const string &path) {
+    if (!(file = fopen(path.c_str(), "rbe")))
+        throw SystemError("Unable to open " + path + ": ", errno);
+    unsigned char header[HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, file) != 1 || memcmp(header, MAGIC, sizeof(MAGIC))) {
+        fclose(file);
+        throw TraceError(path + " is not a Hawck trace");
+    }
+    if (get32(header + 8) != VERSION) {
+        fclose(file);
+        throw TraceError(path + " has an unsupported trace version: " +
+                         to_string(get32(header + 8)));
+    }
+}
+
+TraceReader::~TraceReader() {
+    fclose(file);
+}
+
+bool TraceReader::next(TraceRecord &rec) {
+    unsigned char buf[RECORD_SIZE];
+    size_t n = fread(buf, 1, sizeof(buf), file);
+    if (n == 0)
+        return false;
+    if (n != sizeof(buf))
+        throw TraceError("Trace ends in a partial record");
+    time_us += get32(buf);
+    rec.time_us = time_us;
+    uint16_t kind = get16(buf + 4);
+    if (kind > TraceRecord::DEVICE)
+        throw TraceError("Unknown record kind in trace: " + to_string(kind));
+    rec.kind = (TraceRecord::Kind) kind;
+    rec.handle = get16(buf + 6);
+    rec.type = get16(buf + 8);
+    rec.code = get16(buf + 10);
+    rec.value = (int32_t) get32(buf + 12);
+    return true;
+}
+
+vector<TraceRecord> TraceReader::readAll() {
+    vector<TraceRecord> records;
+    TraceRecord rec;
+    while (next(rec))
+        records.push_back(rec);
+    return records;
+}
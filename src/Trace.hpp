@@ -0,0 +1,112 @@
+/** @file Trace.hpp
+ *
+ * @brief Recordings of the events that pass through InputD.
+ *
+ * A trace starts with a 16 byte header, the magic "HWKTRACE" followed by
+ * the format version and a reserved word, and is followed by 16 byte
+ * records. All integers are little endian.
+ *
+ *     u32 dt_us   Microseconds since the previous record.
+ *     u16 kind    TraceRecord::Kind
+ *     u16 handle  Keyboard handle, see KBDAction::kbd_handle
+ *     u16 type    Event type, or the bus type for DEVICE records.
+ *     u16 code    Event code, or the vendor for DEVICE records.
+ *     i32 value   Event value, or the product in the low and the version in
+ *                 the high 16 bits for DEVICE records.
+ *
+ * A DEVICE record is written before the first event from a keyboard, so
+ * that the keyboard can be identified when the trace is replayed.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "KBDAction.hpp"
+
+class TraceError : public std::runtime_error {
+public:
+    explicit inline TraceError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+struct TraceRecord {
+    enum Kind : uint16_t {
+        /** Event read from a keyboard. */
+        INPUT = 0,
+        /** Event written to the virtual keyboard. */
+        OUTPUT = 1,
+        /** Identity of a keyboard. */
+        DEVICE = 2,
+    };
+
+    /** Microseconds since the start of the trace. */
+    uint64_t time_us = 0;
+    Kind kind = INPUT;
+    uint16_t handle = 0;
+    uint16_t type = 0;
+    uint16_t code = 0;
+    int32_t value = 0;
+
+    /** The device identity stored in a DEVICE record. */
+    struct input_id deviceID() const noexcept;
+};
+
+/** Writes a trace, the file is created with permissions that only allow the
+ *  owner to read it, as it will usually contain everything that was
+ *  typed. */
+class TraceWriter {
+private:
+    FILE *file;
+    std::chrono::steady_clock::time_point start;
+    uint64_t last_us = 0;
+    /** Handles that a DEVICE record has been written for. */
+    std::vector<bool> known;
+
+    uint64_t now() const noexcept;
+
+public:
+    /** @throws SystemError If the file can't be created. */
+    explicit TraceWriter(const std::string &path);
+    ~TraceWriter();
+
+    /** Record an event that was read from a keyboard. */
+    void input(const KBDAction &action);
+
+    /** Record an event that was written to the virtual keyboard. */
+    void output(const struct input_event &ev);
+
+    /** Write a record as is, records must be written in the order of
+     *  their time_us. */
+    void write(const TraceRecord &rec);
+
+    /** Write buffered records to the file. */
+    void flush();
+};
+
+/** Reads a trace. */
+class TraceReader {
+private:
+    FILE *file;
+    uint64_t time_us = 0;
+
+public:
+    /** @throws SystemError If the file can't be opened.
+     *  @throws TraceError If the file is not a trace. */
+    explicit TraceReader(const std::string &path);
+    ~TraceReader();
+
+    /** Read the next record.
+     *
+     * @return False at the end of the trace.
+     * @throws TraceError If the trace ends in a partial record.
+     */
+    bool next(TraceRecord &rec);
+
+    /** Read all the remaining records. */
+    std::vector<TraceRecord> readAll();
+};
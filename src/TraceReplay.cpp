@@ -0,0 +1,80 @@
+/** @file TraceReplay.cpp
+ *
+ * @brief Replaying traces through KBDDaemon.
+ */
+
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+#include "TraceReplay.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+TraceInputSource::TraceInputSource(const vector<TraceRecord> &records, double speed)
+    : speed(speed)
+{
+    unordered_map<uint16_t, struct input_id> devices;
+    for (const auto &rec : records) {
+        if (rec.kind == TraceRecord::DEVICE) {
+            devices[rec.handle] = rec.deviceID();
+            continue;
+        }
+        if (rec.kind != TraceRecord::INPUT)
+            continue;
+
+        Event ev;
+        memset(&ev.action, '\0', sizeof(ev.action));
+        ev.time_us = rec.time_us;
+        ev.action.kbd_handle = rec.handle;
+        auto dev = devices.find(rec.handle);
+        if (dev != devices.end())
+            ev.action.dev_id = dev->second;
+        ev.action.ev.type = rec.type;
+        ev.action.ev.code = rec.code;
+        ev.action.ev.value = rec.value;
+        events.push_back(ev);
+    }
+    latencies.reserve(events.size());
+}
+
+void TraceInputSource::start() {
+    started = Clock::now();
+}
+
+bool TraceInputSource::getEvent(KBDAction *action) {
+    if (finished())
+        return false;
+    const Event &ev = events[pos++];
+
+    if (speed > 0) {
+        uint64_t offset_us = ev.time_us - events[0].time_us;
+        this_thread::sleep_until(started + microseconds((uint64_t) (offset_us / speed)));
+    }
+
+    *action = ev.action;
+    handed_out = Clock::now();
+    return true;
+}
+
+void TraceInputSource::done() {
+    latencies.push_back(duration_cast<microseconds>(Clock::now() - handed_out).count());
+}
+
+bool TraceInputSource::finished() const noexcept {
+    return pos >= events.size();
+}
+
+void CaptureUDevice::emit(const input_event *send_event) {
+    events.push_back(*send_event);
+}
+
+void CaptureUDevice::emit(int type, int code, int val) {
+    input_event ev;
+    memset(&ev, '\0', sizeof(ev));
+    ev.type = type;
+    ev.code = code;
+    ev.value = val;
+    events.push_back(ev);
+}
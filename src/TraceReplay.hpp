@@ -0,0 +1,72 @@
+/** @file TraceReplay.hpp
+ *
+ * @brief Replaying traces through KBDDaemon.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include "IInputSource.hpp"
+#include "IUDevice.hpp"
+#include "Trace.hpp"
+
+/**
+ * Input source that reads the INPUT records of a trace, and measures how long
+ * KBDDaemon takes to handle each of them.
+ */
+class TraceInputSource : public IInputSource {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        uint64_t time_us;
+        KBDAction action;
+    };
+
+    std::vector<Event> events;
+    size_t pos = 0;
+    double speed;
+    Clock::time_point started;
+    Clock::time_point handed_out;
+    std::vector<uint64_t> latencies;
+
+public:
+    /**
+     * @param records The trace.
+     * @param speed Replay the trace this many times faster than it was
+     *              recorded, 0 replays it as fast as possible.
+     */
+    TraceInputSource(const std::vector<TraceRecord> &records, double speed);
+
+    virtual void start() override;
+    virtual bool getEvent(KBDAction *action) override;
+    virtual void done() override;
+    virtual bool finished() const noexcept override;
+
+    /** Number of INPUT records in the trace. */
+    inline size_t size() const noexcept { return events.size(); }
+
+    /** Microseconds from an event being handed to KBDDaemon, until its
+     *  output was flushed, in the order of the events. */
+    inline const std::vector<uint64_t> &getLatencies() const noexcept {
+        return latencies;
+    }
+};
+
+/** Virtual device that keeps the events written to it. */
+class CaptureUDevice : public IUDevice {
+private:
+    std::vector<input_event> events;
+
+public:
+    virtual void emit(const input_event *send_event) override;
+    virtual void emit(int type, int code, int val) override;
+    virtual void done() override {}
+    virtual void flush() override {}
+
+    inline const std::vector<input_event> &getEvents() const noexcept {
+        return events;
+    }
+};
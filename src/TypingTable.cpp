@@ -0,0 +1,99 @@
+/** @file TypingTable.cpp
+ *
+ * @brief Turn text into key events.
+ */
+
+extern "C" {
+    #include <syslog.h>
+}
+
+#include "TypingTable.hpp"
+
+using namespace std;
+
+/** Decode the code point at text[i] and advance i past it, invalid
+ *  sequences decode to U+FFFD one byte at a time. */
+static uint32_t nextCodePoint(const string &text, size_t &i) noexcept {
+    static constexpr uint32_t INVALID = 0xFFFD;
+    unsigned char c = text[i++];
+    if (c < 0x80)
+        return c;
+
+    int len;
+    uint32_t cp;
+    if ((c & 0xE0) == 0xC0) {
+        len = 1;
+        cp = c & 0x1F;
+    } else if ((c & 0xF0) == 0xE0) {
+        len = 2;
+        cp = c & 0x0F;
+    } else if ((c & 0xF8) == 0xF0) {
+        len = 3;
+        cp = c & 0x07;
+    } else {
+        return INVALID;
+    }
+
+    if (i + len > text.size())
+        return INVALID;
+    for (int n = 0; n < len; n++) {
+        unsigned char cc = text[i + n];
+        if ((cc & 0xC0) != 0x80)
+            return INVALID;
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+    i += len;
+    return cp;
+}
+
+bool TypingTable::load(const string &packed) {
+    if (packed.size() % ENTRY_SIZE != 0)
+        return false;
+
+    unordered_map<uint32_t, Keystroke> table;
+    table.reserve(packed.size() / ENTRY_SIZE);
+    for (size_t i = 0; i < packed.size(); i += ENTRY_SIZE) {
+        const unsigned char *p = (const unsigned char *) &packed[i];
+        uint32_t cp = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+        Keystroke ks;
+        ks.code = p[4] | (p[5] << 8);
+        ks.mod = p[6] | (p[7] << 8);
+        table[cp] = ks;
+    }
+    keys = move(table);
+    return true;
+}
+
+int TypingTable::type(IUDevice &udev, const string &text) const {
+    auto key = [&](int code, int value) {
+        udev.emit(EV_KEY, code, value);
+        udev.emit(EV_SYN, SYN_REPORT, 0);
+    };
+
+    int missing = 0;
+    uint16_t held = 0;
+    for (size_t i = 0; i < text.size();) {
+        size_t start = i;
+        auto it = keys.find(nextCodePoint(text, i));
+        if (it == keys.end()) {
+            syslog(LOG_WARNING, "No such key: %s", text.substr(start, i - start).c_str());
+            missing++;
+            continue;
+        }
+
+        const Keystroke &ks = it->second;
+        if (ks.mod != held) {
+            if (held)
+                key(held, 0);
+            if (ks.mod)
+                key(ks.mod, 1);
+            held = ks.mod;
+        }
+        key(ks.code, 1);
+        key(ks.code, 0);
+    }
+    if (held)
+        key(held, 0);
+
+    return missing;
+}
@@ -0,0 +1,55 @@
+/** @file TypingTable.hpp
+ *
+ * @brief Turn text into key events.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "IUDevice.hpp"
+
+/** How to type a single character. */
+struct Keystroke {
+    /** Key to press. */
+    uint16_t code;
+    /** Modifier key to hold down while pressing it, 0 for none. */
+    uint16_t mod;
+};
+
+/**
+ * Table from Unicode code points to keystrokes, built by the Lua side from
+ * the active keymap so that whole strings can be typed in a single call.
+ */
+class TypingTable {
+private:
+    std::unordered_map<uint32_t, Keystroke> keys;
+
+public:
+    /** Size of a single entry in the packed format. */
+    static constexpr size_t ENTRY_SIZE = 8;
+
+    /** Replace the table.
+     *
+     * @param packed Entries as produced by string.pack("<I4I2I2", code_point,
+     *               key_code, mod_code) in Lua, concatenated.
+     * @return False if the size is not a multiple of ENTRY_SIZE, in which
+     *         case the table is left as it was.
+     */
+    bool load(const std::string &packed);
+
+    inline bool empty() const noexcept {
+        return keys.empty();
+    }
+
+    /** Emit the key events needed to type a UTF-8 string.
+     *
+     * Each key event is followed by a SYN event. Consecutive characters that
+     * need the same modifier share a single press of that modifier.
+     *
+     * @return The number of characters that could not be typed.
+     */
+    int type(IUDevice &udev, const std::string &text) const;
+};
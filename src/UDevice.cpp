@@ -14,6 +14,7 @@ extern "C" {
 #include "SystemError.hpp"
 #include "UDevice.hpp"
 #include "utils.hpp"
+#include "Probes.hpp"
 #include <filesystem>
 #include <regex>
 #include <Version.hpp>
@@ -107,10 +108,20 @@ UDevice::UDevice()
     }
 }    
 
+UDevice::UDevice(int fd)
+    : LuaIface(this, UDevice_lua_methods),
+      fd(fd),
+      dfd(-1)
+{
+    memset(&usetup, 0, sizeof(usetup));
+}
+
 UDevice::~UDevice() {
-    ioctl(fd, UI_DEV_DESTROY);
+    if (dfd != -1) {
+        ioctl(fd, UI_DEV_DESTROY);
+        close(dfd);
+    }
     close(fd);
-    close(dfd);
 }
 
 void UDevice::emit(const input_event *send_event) {
@@ -127,6 +138,7 @@ void UDevice::emit(int type, int code, int val) {
 }
 
 void UDevice::flush() {
+    HAWCK_PROBE(udev_flush, events.size());
     for (struct input_event& ev : this->events) {
         if (write(fd, &ev, sizeof(ev)) != sizeof(ev))
             throw SystemError("Error in write(): ", errno);
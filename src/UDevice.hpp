@@ -531,6 +531,7 @@ static const std::vector<int> ALL_KEYS = {
 // (ClassName, methodName, type0(), type1()...)
 #define UDevice_lua_methods(M, _)               \
     M(UDevice, emit, int(), int(), int()) _     \
+    M(UDevice, emitBatch, std::string(), bool()) _ \
     M(UDevice, flush)
 
 // Declare extern "C" Lua bindings
@@ -551,6 +552,11 @@ private:
 public:
     UDevice();
 
+    /** Write events to an already open file descriptor instead of a uinput
+     *  device, the descriptor is closed on destruction. Used to measure the
+     *  cost of flush() without a virtual keyboard. */
+    explicit UDevice(int fd);
+
     ~UDevice();
 
     virtual void emit(const struct input_event *send_event) override;
@@ -572,7 +578,7 @@ public:
 
     /** Generate key up events for all held keys.
      */
-    void upAll();
+    virtual void upAll() override;
 
     LUA_EXTRACT(UDevice_lua_methods)
 };
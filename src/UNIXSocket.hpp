@@ -51,6 +51,8 @@ extern "C" {
 #include <chrono>
 
 #include "SystemError.hpp"
+#include "IPacketChannel.hpp"
+#include "Probes.hpp"
 
 class SocketError : public std::exception {
 private:
@@ -154,7 +156,7 @@ inline void recvAll(int fd, T *obj, std::chrono::milliseconds timeout) {
  * UNIX socket connection for sending discrete packets.
  */
 template <class Packet>
-class UNIXSocket {
+class UNIXSocket : public IPacketChannel<Packet> {
 private:
     int fd;
     std::string addr = "";
@@ -206,7 +208,7 @@ public:
 
     /** Reconnect to the server, this only works for UNIXSockets
      *  that have addr set. */
-    void recon() {
+    void recon() override {
         close();
         fd = connectTo(addr);
     }
@@ -214,17 +216,41 @@ public:
     /**
      * Closes the connection.
      */
-    ~UNIXSocket() noexcept {
+    ~UNIXSocket() noexcept override {
         close();
     }
 
     /**
      * Closes the connection.
      */
-    void close() noexcept {
+    void close() noexcept override {
         ::close(fd);
     }
 
+    /**
+     * Wait for a packet to arrive, without receiving it.
+     *
+     * @param timeout Maximum time to wait, negative to wait indefinitely.
+     * @return True if there is data to be read, or the connection was
+     *         closed. False on a timeout, or if the wait was interrupted by
+     *         a signal.
+     */
+    bool poll(std::chrono::milliseconds timeout) override {
+        struct pollfd pfd;
+        pfd.events = POLLIN;
+        pfd.fd = fd;
+        switch (::poll(&pfd, 1, timeout.count())) {
+            case -1:
+                if (errno == EINTR)
+                    return false;
+                throw SystemError("Error in poll(): ", errno);
+            case 0:
+                return false;
+            default:
+                return true;
+        }
+    }
+
     /**
      * Receive a packet.
      *
@@ -233,8 +259,9 @@ public:
      *
      * @param p The buffer to insert the packet into.
      */
-    void recv(Packet *p) {
+    void recv(Packet *p) override {
         recvAll(fd, p);
+        HAWCK_PROBE(socket_recv, fd, sizeof(*p));
     }
 
     /**
@@ -245,8 +272,9 @@ public:
      *
      * @param p The buffer to insert the packet into.
      */
-    void recv(Packet *p, std::chrono::milliseconds timeout) {
+    void recv(Packet *p, std::chrono::milliseconds timeout) override {
         recvAll(fd, p, timeout);
+        HAWCK_PROBE(socket_recv, fd, sizeof(*p));
     }
 
     /**
@@ -254,10 +282,11 @@ public:
      *
      * @param action The buffer to send.
      */
-    void send(const Packet *action) {
+    void send(const Packet *action) override {
         if (::send(fd, action, sizeof(*action), 0) != sizeof(*action)) {
             throw SocketError("Unable to send the packet.");
         }
+        HAWCK_PROBE(socket_send, fd, sizeof(*action));
     }
 
     /**
@@ -265,13 +294,14 @@ public:
      *
      * @param packets Vector holding all the packages.
      */
-    void send(const std::vector<Packet> &packets) {
+    void send(const std::vector<Packet> &packets) override {
         if (packets.size() == 0)
             return;
         ssize_t len = sizeof(packets[0])*packets.size();
         if (::send(fd, &packets[0], len, 0) != len) {
             throw SocketError("Unable to send packet");
         }
+        HAWCK_PROBE(socket_send, fd, len);
     }
 };
 
@@ -329,4 +359,9 @@ public:
         }
         return ns;
     }
+
+    /** File descriptor of the listening socket. */
+    inline int getFD() const noexcept {
+        return fd;
+    }
 };
@@ -0,0 +1,628 @@
+/** @file hawck-bench.cpp
+ *
+ * @brief Micro-benchmarks of the components that an event passes through.
+ *
+ * Each benchmark runs an operation in a loop until a sample takes at least
+ * --min-time-ms, and then takes --samples samples of that many iterations.
+ * The median time per operation is the number to compare, min and max show
+ * how noisy the machine was. With --json the results are written as a
+ * single JSON object, so that they can be compared across releases.
+ *
+ * Benchmarks that need something the machine doesn't have, e.g. the Lua
+ * runtime or a keymap, are reported as skipped along with the reason.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <getopt.h>
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/utsname.h>
+    #include <syslog.h>
+    #include <time.h>
+    #include <unistd.h>
+}
+
+#include "CSV.hpp"
+#include "HWK2Lua.hpp"
+#include "KBDAction.hpp"
+#include "KBDB.hpp"
+#include "Keyboard.hpp"
+#include "MacroScript.hpp"
+#include "RemoteUDevice.hpp"
+#include "UDevice.hpp"
+#include "UNIXSocket.hpp"
+#include "LocalChannel.hpp"
+#include "utils.hpp"
+
+#if MESON_COMPILE
+#include <hawck_config.h>
+#else
+#define VERSION "unknown"
+#endif
+
+#ifndef HAWCK_SOURCE_DIR
+#define HAWCK_SOURCE_DIR "."
+#endif
+
+using namespace std;
+using namespace std::chrono;
+namespace fs = std::filesystem;
+
+/** Keep the compiler from optimizing away a value that is never used. */
+template <class T>
+static inline void keep(const T &v) noexcept {
+    asm volatile("" : : "r"(&v) : "memory");
+}
+
+struct BenchResult {
+    string name;
+    /** Why the benchmark didn't run, empty if it did. */
+    string skipped;
+    /** Iterations in each sample. */
+    uint64_t iterations = 0;
+    /** Nanoseconds per iteration, one for each sample. */
+    vector<double> samples;
+
+    inline double median() const {
+        auto s = samples;
+        sort(s.begin(), s.end());
+        return s.size() % 2 ? s[s.size() / 2]
+                            : (s[s.size() / 2 - 1] + s[s.size() / 2]) / 2;
+    }
+};
+
+/** Passed to a benchmark, which does its setup and then calls run(). */
+class Bench {
+private:
+    BenchResult &res;
+    int num_samples;
+    nanoseconds min_time;
+
+public:
+    inline Bench(BenchResult &res, int num_samples, milliseconds min_time)
+        : res(res), num_samples(num_samples), min_time(min_time) {}
+
+    /** Time op(), which should do one operation per call. */
+    template <class F>
+    void run(F op) {
+        auto time = [&](uint64_t n) {
+            auto start = steady_clock::now();
+            for (uint64_t i = 0; i < n; i++)
+                op();
+            return duration_cast<nanoseconds>(steady_clock::now() - start);
+        };
+
+        // Also serves as a warm-up.
+        uint64_t n = 1;
+        for (nanoseconds t; (t = time(n)) < min_time;) {
+            uint64_t scale = t.count() ? min_time / t : 100;
+            n *= clamp<uint64_t>(scale + 1, 2, 100);
+        }
+
+        res.iterations = n;
+        for (int i = 0; i < num_samples; i++)
+            res.samples.push_back((double) time(n).count() / n);
+    }
+};
+
+/** Temporary directory that is removed when the benchmarks are done. */
+class TempDir {
+private:
+    string path;
+
+public:
+    inline TempDir() {
+        char tmpl[] = "/tmp/hawck-bench.XXXXXX";
+        if (!mkdtemp(tmpl))
+            throw SystemError("Unable to create temporary directory: ", errno);
+        path = tmpl;
+    }
+
+    inline ~TempDir() {
+        std::error_code ec;
+        fs::remove_all(path, ec);
+    }
+
+    inline string file(const string &name) const {
+        return pathJoin(path, name);
+    }
+};
+
+/** File descriptors that are closed when it goes out of scope. */
+struct FDList : public vector<int> {
+    inline ~FDList() {
+        for (int fd : *this)
+            close(fd);
+    }
+};
+
+/** Reads everything that is written to a file descriptor on a thread, until
+ *  the other end is closed. */
+class Drain {
+private:
+    int fd;
+    std::thread thread;
+
+public:
+    explicit inline Drain(int fd) : fd(fd) {
+        thread = std::thread([fd]() {
+            char buf[4096];
+            while (read(fd, buf, sizeof(buf)) > 0)
+                ;
+        });
+    }
+
+    /** The writing end must have been closed. */
+    inline ~Drain() {
+        thread.join();
+        close(fd);
+    }
+};
+
+static string source_dir = HAWCK_SOURCE_DIR;
+static string keymap_lang = "us";
+
+/** A script with the runtime loaded, the way MacroDaemon::prepareScript()
+ *  does it, but from the source tree. */
+static unique_ptr<MacroScript> runtimeScript(RemoteUDevice *udev) {
+    auto sc = make_unique<MacroScript>();
+    sc->addRequirePath({source_dir, pathJoin(source_dir, "src", "Lua")});
+    sc->call("require", "init");
+    sc->open(udev, "udev");
+    sc->open(&sc->spawner, "__spawner");
+    return sc;
+}
+
+static void benchLuaCall(Bench &b) {
+    Lua::Script sc;
+    sc.exec("bench", "function id(x) return x end");
+    int i = 0;
+    b.run([&]() { keep(get<0>(sc.call<int>("id", i++))); });
+}
+
+static void benchLuaBound(Bench &b) {
+    Lua::Script sc;
+    sc.exec("bench", "function id(x) return x end");
+    auto id = sc.bind<int(int)>("id");
+    int i = 0;
+    b.run([&]() { keep(id(i++)); });
+}
+
+/** Dispatch a key press through a script, like MacroD does for every event:
+ *  __match and then sending the output to InputD. */
+static void benchMatch(Bench &b, const string &hwk) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        throw SystemError("Unable to create socket pair: ", errno);
+    Drain drain(sv[1]);
+    UNIXSocket<KBDAction> conn(sv[0]);
+    RemoteUDevice udev(&conn);
+
+    auto sc = runtimeScript(&udev);
+    sc->exec("bench.hwk", hwk2lua(hwk));
+    sc->call("__compile");
+    sc->bindEntryPoints();
+
+    b.run([&]() {
+        keep(sc->match(1, KEY_A, EV_KEY, 0));
+        udev.done();
+    });
+}
+
+/** A script with many rules, none of which match KEY_A. */
+static string manyRules() {
+    stringstream hwk;
+    hwk << "require \"init\"\n";
+    for (char c = 'b'; c <= 'z'; c++) {
+        hwk << "ctrl + alt + key \"" << c << "\" => insert \"" << c << "\"\n";
+        hwk << "down + shift + key \"" << c << "\" => insert \"" << (char) toupper(c) << "\"\n";
+    }
+    return hwk.str();
+}
+
+static void benchSocketRoundtrip(Bench &b, const TempDir &tmp) {
+    string path = tmp.file("roundtrip.sock");
+    UNIXServer srv(path);
+    std::thread echo([&]() {
+        try {
+            UNIXSocket<KBDAction> conn(srv.accept());
+            KBDAction ac;
+            for (;;) {
+                conn.recv(&ac);
+                conn.send(&ac);
+            }
+        } catch (const SocketError &) {
+            // Disconnected.
+        }
+    });
+
+    // The echo thread stops when the connection is closed, so it can only be
+    // joined after that.
+    exception_ptr err;
+    {
+        UNIXSocket<KBDAction> conn(path);
+        KBDAction ac;
+        memset(&ac, 0, sizeof(ac));
+        ac.ev.type = EV_KEY;
+        ac.ev.code = KEY_A;
+        ac.ev.value = 1;
+        try {
+            b.run([&]() {
+                conn.send(&ac);
+                conn.recv(&ac);
+            });
+        } catch (...) {
+            err = current_exception();
+        }
+    }
+    echo.join();
+    if (err)
+        rethrow_exception(err);
+}
+
+/** The same round trip over the channel used by --embedded-inputd. */
+static void benchChannelRoundtrip(Bench &b) {
+    auto [conn, echo_conn] = LocalChannel<KBDAction>::pair();
+    std::thread echo([&echo_conn = echo_conn]() {
+        try {
+            KBDAction ac;
+            for (;;) {
+                echo_conn->recv(&ac);
+                echo_conn->send(&ac);
+            }
+        } catch (const SocketError &) {
+            // Closed.
+        }
+    });
+
+    exception_ptr err;
+    KBDAction ac;
+    memset(&ac, 0, sizeof(ac));
+    ac.ev.type = EV_KEY;
+    ac.ev.code = KEY_A;
+    ac.ev.value = 1;
+    try {
+        b.run([&]() {
+            conn->send(&ac);
+            conn->recv(&ac);
+        });
+    } catch (...) {
+        err = current_exception();
+    }
+    conn->close();
+    echo.join();
+    if (err)
+        rethrow_exception(err);
+}
+
+static void benchUDeviceFlush(Bench &b) {
+    int fds[2];
+    if (pipe(fds) == -1)
+        throw SystemError("Unable to create pipe: ", errno);
+    Drain drain(fds[0]);
+    UDevice udev(fds[1]);
+    // The delay is a workaround for dropped keys in GNOME Wayland, and
+    // would be all that is measured.
+    udev.setEventDelay(0);
+    b.run([&]() {
+        udev.emit(EV_KEY, KEY_A, 1);
+        udev.emit(EV_SYN, SYN_REPORT, 0);
+        udev.emit(EV_KEY, KEY_A, 0);
+        udev.emit(EV_SYN, SYN_REPORT, 0);
+        udev.flush();
+    });
+}
+
+static void benchKBDBAdd(Bench &b) {
+    KBDB db;
+    struct input_id id = {BUS_USB, 0x1, 0x1, 0x1};
+    b.run([&]() { keep(db.add(0, &id)); });
+}
+
+static void benchKBDBGetID(Bench &b) {
+    KBDB db;
+    for (uint16_t h = 0; h < 8; h++) {
+        struct input_id id = {BUS_USB, 0x1, h, 0x1};
+        db.add(h, &id);
+    }
+    uint16_t h = 0;
+    b.run([&]() { keep(db.get(h++ & 7)->getID().size()); });
+}
+
+/** Multiplex over n keyboards, of which only the last one has input. */
+static void benchKBDMultiplex(Bench &b, int n) {
+    FDList write_fds;
+    vector<unique_ptr<Keyboard>> kbds;
+    vector<Keyboard *> kbd_ptrs;
+    for (int i = 0; i < n; i++) {
+        int fds[2];
+        if (pipe(fds) == -1)
+            throw SystemError("Unable to create pipe: ", errno);
+        write_fds.push_back(fds[1]);
+        // Keyboard opens its own descriptor.
+        string path = "/proc/self/fd/" + to_string(fds[0]);
+        try {
+            kbds.push_back(make_unique<Keyboard>(path.c_str()));
+        } catch (...) {
+            close(fds[0]);
+            throw;
+        }
+        close(fds[0]);
+        kbd_ptrs.push_back(kbds.back().get());
+    }
+    if (write(write_fds.back(), "x", 1) != 1)
+        throw SystemError("Unable to write to pipe: ", errno);
+    b.run([&]() { keep(kbdMultiplex(kbd_ptrs, 0)); });
+}
+
+static void benchCSVPassthrough(Bench &b, const TempDir &tmp) {
+    string path = tmp.file("passthrough.csv");
+    {
+        ofstream out(path);
+        out << "key_name,key_code\n";
+        for (int code = 0; code < 256; code++)
+            out << "key_" << code << "," << code << "\n";
+    }
+    b.run([&]() {
+        // Same as KBDDaemon::loadPassthrough()
+        CSV csv(path);
+        auto cells = mkuniq(csv.getColCells("key_code"));
+        vector<int> codes;
+        for (auto *code_s : *cells) {
+            try {
+                codes.push_back(stoi(*code_s));
+            } catch (const std::exception &e) {
+                continue;
+            }
+        }
+        keep(codes.size());
+    });
+}
+
+static void benchKeymapLoad(Bench &b) {
+    RemoteUDevice udev;
+    auto sc = runtimeScript(&udev);
+    sc->exec("bench", "local kbmap = require \"Keymap\"\n"
+                      "function __bench_keymap(lang) return kbmap.new(lang) ~= nil end");
+    auto load = sc->bind<bool(string)>("__bench_keymap");
+    b.run([&]() { keep(load(keymap_lang)); });
+}
+
+static void benchRuntimeInit(Bench &b) {
+    RemoteUDevice udev;
+    b.run([&]() { keep(runtimeScript(&udev)); });
+}
+
+static const char remap_hwk[] =
+    "require \"init\"\n"
+    "key \"a\" => insert \"b\"\n";
+
+static const char modes_hwk[] =
+    "require \"init\"\n"
+    "down => {\n"
+    "  ctrl + alt + key \"h\" => insert \"hello\"\n"
+    "  key \"a\" => insert \"b\"\n"
+    "}\n"
+    "down + key \"c\" => {\n"
+    "  key \"d\" => insert \"e\"\n"
+    "}\n";
+
+static void printHeader() {
+    cout << left << setw(24) << "benchmark" << right << setw(14) << "median ns/op"
+         << setw(14) << "min" << setw(14) << "max" << setw(12) << "iterations" << endl;
+}
+
+static void printText(const BenchResult &r) {
+    cout << fixed << setprecision(1) << left << setw(24) << r.name << right;
+    if (!r.skipped.empty()) {
+        cout << "  skipped: " << r.skipped.substr(0, r.skipped.find('\n')) << endl;
+        return;
+    }
+    auto [mn, mx] = minmax_element(r.samples.begin(), r.samples.end());
+    cout << setw(14) << r.median() << setw(14) << *mn << setw(14) << *mx
+         << setw(12) << r.iterations << endl;
+}
+
+static void printJSON(const vector<BenchResult> &results, int num_samples) {
+    struct utsname un;
+    string kernel = uname(&un) == 0 ? un.release : "unknown";
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    cout << fixed << setprecision(1)
+         << "{\"version\":" << jsonString(VERSION)
+         << ",\"kernel\":" << jsonString(kernel)
+         << ",\"compiler\":" << jsonString(__VERSION__)
+         << ",\"date\":" << jsonString(date)
+         << ",\"samples\":" << num_samples
+         << ",\"benchmarks\":{";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto &r = results[i];
+        cout << (i ? "," : "") << jsonString(r.name) << ":{";
+        if (!r.skipped.empty()) {
+            cout << "\"skipped\":" << jsonString(r.skipped) << "}";
+            continue;
+        }
+        auto [mn, mx] = minmax_element(r.samples.begin(), r.samples.end());
+        cout << "\"iterations\":" << r.iterations
+             << ",\"median_ns\":" << r.median()
+             << ",\"min_ns\":" << *mn
+             << ",\"max_ns\":" << *mx << "}";
+    }
+    cout << "}}" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+
+    string HELP =
+        "Usage: hawck-bench [--filter <regex>] [--samples <n>] [--min-time-ms <ms>]\n"
+        "                   [--json] [--list] [--source-dir <dir>] [--keymap <lang>]\n"
+        "\n"
+        "Run micro-benchmarks of the components of Hawck.\n"
+        "\n"
+        "Options:\n"
+        "  --filter       Only run the benchmarks with names that match.\n"
+        "  --samples      Number of samples to take of each benchmark (default 10.)\n"
+        "  --min-time-ms  Minimum duration of a sample (default 20.)\n"
+        "  --json         Write the results as JSON.\n"
+        "  --list         List the benchmarks and exit.\n"
+        "  --source-dir   Hawck source directory, the Lua runtime is loaded from\n"
+        "                 there.\n"
+        "  --keymap       Keymap to load in keymap.load (default us.)\n"
+        "  -h, --help     Display this help information.\n"
+        "  --version      Display version and exit.\n"
+    ;
+
+    static int json, list;
+    static struct option long_options[] =
+        {
+            {"json", no_argument, &json, 1},
+            {"list", no_argument, &list, 1},
+            {"filter", required_argument, 0, 0},
+            {"samples", required_argument, 0, 0},
+            {"min-time-ms", required_argument, 0, 0},
+            {"source-dir", required_argument, 0, 0},
+            {"keymap", required_argument, 0, 0},
+            {"version", no_argument, 0, 0},
+            {"help", no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+    int option_index = 0;
+
+    string filter = "";
+    int num_samples = 10;
+    int min_time_ms = 20;
+    auto positive = [](const string &name, const string &opt) {
+        try {
+            int n = stoi(opt);
+            if (n > 0)
+                return n;
+        } catch (const exception &e) {}
+        cout << "--" << name << ": Require a positive integer" << endl;
+        exit(1);
+    };
+    unordered_map<string, function<void(const string& opt)>> long_handlers = {
+        {"version", [&](const string&) {
+                        cout << "hawck-bench v" VERSION << endl;
+                        exit(0);
+                    }},
+        {"filter", [&](const string& opt) { filter = opt; }},
+        {"samples", [&](const string& opt) { num_samples = positive("samples", opt); }},
+        {"min-time-ms", [&](const string& opt) { min_time_ms = positive("min-time-ms", opt); }},
+        {"source-dir", [&](const string& opt) { source_dir = opt; }},
+        {"keymap", [&](const string& opt) { keymap_lang = opt; }},
+    };
+
+    do {
+        int c = getopt_long(argc, argv, "h", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 0: {
+                if (long_options[option_index].flag != 0)
+                    break;
+                string name(long_options[option_index].name);
+                string arg(optarg ? optarg : "");
+                if (long_handlers.find(name) != long_handlers.end())
+                    long_handlers[name](arg);
+                break;
+            }
+
+            case 'h':
+                cout << HELP;
+                exit(0);
+
+            default:
+                cout << HELP;
+                exit(1);
+        }
+    } while (true);
+
+    // Warnings, e.g. from keyboards without ioctls, are expected here, and
+    // would otherwise be timed along with the components.
+    openlog("hawck-bench", 0, LOG_USER);
+    setlogmask(LOG_UPTO(LOG_ERR));
+    source_dir = realpath_safe(source_dir);
+
+    try {
+        TempDir tmp;
+        // The runtime reads its configuration from the home directory, use
+        // the default one so that results don't depend on the user's.
+        string home = tmp.file("home"),
+               cfg_dir = pathJoin(home, ".local", "share", "hawck"),
+               cfg = pathJoin(source_dir, "bin", "cfg.lua");
+        fs::create_directories(cfg_dir);
+        if (fs::exists(cfg))
+            fs::copy_file(cfg, pathJoin(cfg_dir, "cfg.lua"));
+        setenv("HOME", home.c_str(), 1);
+        vector<pair<string, function<void(Bench &)>>> benchmarks = {
+            {"lua.call", benchLuaCall},
+            {"lua.bound_call", benchLuaBound},
+            {"match.remap", [](Bench &b) { benchMatch(b, remap_hwk); }},
+            {"match.modes", [](Bench &b) { benchMatch(b, modes_hwk); }},
+            {"match.many_rules", [](Bench &b) { benchMatch(b, manyRules()); }},
+            {"match.example", [](Bench &b) {
+                 benchMatch(b, readFile(pathJoin(source_dir, "src", "macro-scripts", "example.hwk")));
+             }},
+            {"socket.roundtrip", [&](Bench &b) { benchSocketRoundtrip(b, tmp); }},
+            {"channel.roundtrip", benchChannelRoundtrip},
+            {"udevice.flush", benchUDeviceFlush},
+            {"kbdb.add", benchKBDBAdd},
+            {"kbdb.get_id", benchKBDBGetID},
+            {"kbd_multiplex.1", [](Bench &b) { benchKBDMultiplex(b, 1); }},
+            {"kbd_multiplex.8", [](Bench &b) { benchKBDMultiplex(b, 8); }},
+            {"kbd_multiplex.64", [](Bench &b) { benchKBDMultiplex(b, 64); }},
+            {"csv.passthrough", [&](Bench &b) { benchCSVPassthrough(b, tmp); }},
+            {"keymap.load", benchKeymapLoad},
+            {"runtime.init", benchRuntimeInit},
+        };
+
+        regex rx(filter);
+        vector<BenchResult> results;
+        if (!json && !list)
+            printHeader();
+        for (const auto &[name, fn] : benchmarks) {
+            if (!regex_search(name, rx))
+                continue;
+            if (list) {
+                cout << name << endl;
+                continue;
+            }
+            BenchResult res;
+            res.name = name;
+            Bench b(res, num_samples, milliseconds(min_time_ms));
+            try {
+                fn(b);
+                if (res.samples.empty())
+                    res.skipped = "did not run";
+            } catch (const exception &e) {
+                res.samples.clear();
+                res.skipped = e.what();
+            }
+            if (!json)
+                printText(res);
+            results.push_back(res);
+        }
+
+        if (json && !list)
+            printJSON(results, num_samples);
+    } catch (const exception &e) {
+        cout << "Error: " << e.what() << endl;
+        return 1;
+    }
+}
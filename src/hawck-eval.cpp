@@ -0,0 +1,634 @@
+/** @file hawck-eval.cpp
+ *
+ * @brief Measure what scripts cost per event, without running MacroD.
+ *
+ * Scripts are loaded the way MacroD loads them, with MacroScript::loadRuntime()
+ * and MacroScript::loadUserCode(), and are then fed a corpus of key events.
+ * Every event goes through the same steps as in the main loop of MacroD: the
+ * scripts are tried in order until one of them matches, the event is passed
+ * through if none did, the output is sent, and garbage is collected by a
+ * GCScheduler. The output goes over a socket to a thread that counts it, in
+ * place of InputD.
+ *
+ * Nothing leaves the process, processes that scripts start are counted
+ * instead of being run (see Spawner::setDryRun()) and notifications are
+ * counted instead of shown.
+ *
+ * Corpora are either built in, see the *Corpus() functions, or traces
+ * recorded with hawck-inputd --record.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+    #include <getopt.h>
+    #include <linux/input-event-codes.h>
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <syslog.h>
+    #include <unistd.h>
+}
+
+#include "GCScheduler.hpp"
+#include "KBDAction.hpp"
+#include "MacroScript.hpp"
+#include "Notifier.hpp"
+#include "RemoteUDevice.hpp"
+#include "Stats.hpp"
+#include "Trace.hpp"
+#include "UNIXSocket.hpp"
+#include "XDG.hpp"
+#include "utils.hpp"
+
+#if MESON_COMPILE
+#include <hawck_config.h>
+#else
+#define VERSION "unknown"
+#endif
+
+using namespace std;
+using namespace std::chrono;
+namespace fs = std::filesystem;
+
+/** An event as MacroD receives it from InputD. */
+struct KeyEvent {
+    int code;
+    int value;
+};
+
+using Corpus = vector<KeyEvent>;
+
+static void tap(Corpus &c, int code) {
+    c.push_back({code, 1});
+    c.push_back({code, 0});
+}
+
+/** Press the keys in order, and release them in reverse. */
+static void chord(Corpus &c, const vector<int> &keys) {
+    for (int key : keys)
+        c.push_back({key, 1});
+    for (auto it = keys.rbegin(); it != keys.rend(); it++)
+        c.push_back({*it, 0});
+}
+
+/** Key presses that type `text` on a US layout, characters that are not on
+ *  it are skipped. */
+static Corpus typeText(const string &text) {
+    static const string lower = "abcdefghijklmnopqrstuvwxyz";
+    static const int letters[] = {
+        KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I,
+        KEY_J, KEY_K, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R,
+        KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+    };
+    static const map<char, pair<int, bool>> other = {
+        {' ', {KEY_SPACE, false}}, {'\n', {KEY_ENTER, false}},
+        {'.', {KEY_DOT, false}}, {',', {KEY_COMMA, false}},
+        {'\'', {KEY_APOSTROPHE, false}}, {'-', {KEY_MINUS, false}},
+        {';', {KEY_SEMICOLON, false}}, {':', {KEY_SEMICOLON, true}},
+        {'?', {KEY_SLASH, true}}, {'!', {KEY_1, true}},
+        {'(', {KEY_9, true}}, {')', {KEY_0, true}},
+    };
+
+    Corpus c;
+    for (char ch : text) {
+        int code;
+        bool shift;
+        size_t idx = lower.find(tolower(ch));
+        if (idx != string::npos) {
+            code = letters[idx];
+            shift = isupper(ch);
+        } else if (other.count(ch)) {
+            tie(code, shift) = other.at(ch);
+        } else {
+            continue;
+        }
+        if (shift)
+            chord(c, {KEY_LEFTSHIFT, code});
+        else
+            tap(c, code);
+    }
+    return c;
+}
+
+/** Ordinary typing, a few sentences with capitals, punctuation and line
+ *  breaks. */
+static Corpus proseCorpus() {
+    return typeText(
+        "It was a bright cold day in April, and the clocks were striking "
+        "thirteen. The quick brown fox jumps over the lazy dog; pack my box "
+        "with five dozen liquor jugs.\n"
+        "Most of what gets typed is like this: lower case letters, spaces, "
+        "and now and then a capital, a comma or a full stop. Scripts see "
+        "every one of these keys, so the cost of the patterns that don't "
+        "match is what matters here.\n"
+        "Why? Because (as it turns out) nobody types shortcuts all day!\n");
+}
+
+/** Editor and window manager shortcuts, with some navigation in between. */
+static Corpus shortcutCorpus() {
+    Corpus c;
+    vector<vector<int>> chords = {
+        {KEY_LEFTCTRL, KEY_C}, {KEY_LEFTCTRL, KEY_V}, {KEY_LEFTCTRL, KEY_S},
+        {KEY_LEFTCTRL, KEY_Z}, {KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_T},
+        {KEY_LEFTALT, KEY_TAB}, {KEY_LEFTALT, KEY_F4}, {KEY_LEFTMETA, KEY_1},
+        {KEY_LEFTMETA, KEY_ENTER}, {KEY_LEFTCTRL, KEY_LEFTALT, KEY_T},
+        {KEY_RIGHTALT, KEY_E}, {KEY_LEFTCTRL, KEY_W}, {KEY_ESC},
+        {KEY_LEFT}, {KEY_DOWN}, {KEY_HOME}, {KEY_F5}, {KEY_CAPSLOCK},
+    };
+    for (const auto &keys : chords)
+        chord(c, keys);
+    return c;
+}
+
+/** Keys that are held down until they repeat, the way arrows and backspace
+ *  usually are. */
+static Corpus repeatCorpus() {
+    Corpus c;
+    for (int key : {KEY_BACKSPACE, KEY_RIGHT, KEY_DOWN, KEY_J, KEY_SPACE}) {
+        c.push_back({key, 1});
+        for (int i = 0; i < 30; i++)
+            c.push_back({key, 2});
+        c.push_back({key, 0});
+    }
+    return c;
+}
+
+/** The key events in a trace recorded with hawck-inputd --record, which are
+ *  the ones that InputD passes on to MacroD. */
+static Corpus traceCorpus(const string &path) {
+    Corpus c;
+    TraceReader reader(path);
+    for (TraceRecord rec; reader.next(rec);)
+        if (rec.kind == TraceRecord::INPUT && rec.type == EV_KEY)
+            c.push_back({rec.code, rec.value});
+    if (c.empty())
+        throw runtime_error("No key events in trace: " + path);
+    return c;
+}
+
+/** Reads the output of the scripts in place of InputD, and counts it. */
+class OutputCounter {
+private:
+    UNIXSocket<KBDAction> conn;
+    thread reader;
+
+public:
+    /** Key events written, not counting SYN_REPORTs and such. */
+    atomic<uint64_t> keys{0};
+    /** Events that MacroD is done with. */
+    atomic<uint64_t> done{0};
+
+    explicit inline OutputCounter(int fd) : conn(fd) {
+        reader = thread([this]() {
+            KBDAction action;
+            try {
+                for (;;) {
+                    conn.recv(&action);
+                    if (action.done)
+                        done.fetch_add(1, memory_order_release);
+                    else if (action.ev.type == EV_KEY)
+                        keys.fetch_add(1, memory_order_relaxed);
+                }
+            } catch (const SocketError &) {
+                // The writing end was closed.
+            }
+        });
+    }
+
+    /** The writing end must have been closed. */
+    inline ~OutputCounter() {
+        reader.join();
+    }
+
+    /** Wait until n events are done, and get the number of keys written
+     *  so far. */
+    inline uint64_t waitFor(uint64_t n) {
+        while (done.load(memory_order_acquire) < n)
+            this_thread::sleep_for(100us);
+        return keys.load(memory_order_relaxed);
+    }
+};
+
+struct EvalResult {
+    string corpus;
+    /** Events in the corpus, it is repeated to make up the measured
+     *  events. */
+    size_t corpus_size = 0;
+    /** Nanoseconds that each measured event took, sorted. */
+    vector<uint64_t> dispatch_ns;
+    uint64_t passed = 0;
+    uint64_t output_keys = 0;
+    uint64_t allocs = 0;
+    size_t peak_bytes = 0;
+    GCStats gc;
+    uint64_t errors = 0;
+    string first_error;
+    uint64_t spawns = 0;
+    uint64_t notifications = 0;
+
+    inline uint64_t events() const { return dispatch_ns.size(); }
+
+    inline double perEvent(double v) const {
+        return events() ? v / events() : 0;
+    }
+
+    inline uint64_t percentile(double p) const {
+        if (dispatch_ns.empty())
+            return 0;
+        return dispatch_ns[min(dispatch_ns.size() - 1, size_t(p * dispatch_ns.size()))];
+    }
+
+    inline double mean() const {
+        uint64_t sum = 0;
+        for (auto ns : dispatch_ns)
+            sum += ns;
+        return perEvent(sum);
+    }
+};
+
+struct EvalOptions {
+    vector<string> scripts;
+    string lib_dir;
+    uint64_t events = 20000;
+    uint64_t warmup = 1000;
+    int gc_slice_us = 250;
+    int gc_ceiling_kb = 4096;
+    /** Collect garbage between events until there is nothing left to do,
+     *  as MacroD does when keys are typed by a person. */
+    bool idle_gc = true;
+};
+
+/** Runs scripts against corpora, each corpus gets freshly loaded scripts so
+ *  that state left behind by one doesn't affect the next. */
+class Evaluator {
+private:
+    const EvalOptions &opts;
+    /** Bytecode is not shared with MacroD, loads are always cold. */
+    string cache_dir;
+    Lua::BytecodeCache bytecode_cache;
+    HWK2LuaCache hwk_cache;
+    Notifier notifier;
+
+    unique_ptr<ScriptSet> load(RemoteUDevice &udev) {
+        auto set = make_unique<ScriptSet>();
+        for (const auto &path : opts.scripts) {
+            auto sc = make_shared<MacroScript>();
+            sc->loadRuntime(opts.lib_dir);
+            sc->open(&udev, "udev");
+            sc->open(&notifier, "__notifier");
+            sc->spawner.setDryRun(true);
+            sc->open(&sc->spawner, "__spawner");
+            sc->loadUserCode(path, bytecode_cache, hwk_cache);
+            set->scripts[pathBasename(path)] = std::move(sc);
+        }
+        return set;
+    }
+
+    /** Pass an event to the scripts, as MacroDaemon::run() does. */
+    bool dispatch(ScriptSet &set, const KeyEvent &e, EvalResult &res) {
+        bool repeat = true;
+        for (auto &[_, sc] : set.scripts) {
+            (void) _;
+            if (!sc->isEnabled())
+                continue;
+            try {
+                repeat = !sc->match(e.value, e.code, EV_KEY, 0);
+                lua_settop(sc->getL(), 0);
+            } catch (const Lua::LuaError &err) {
+                if (res.errors++ == 0)
+                    res.first_error = err.fmtReport();
+                repeat = true;
+            }
+            if (!repeat)
+                break;
+        }
+        return repeat;
+    }
+
+public:
+    inline Evaluator(const EvalOptions &opts, const string &cache_dir)
+        : opts(opts),
+          cache_dir(cache_dir),
+          bytecode_cache(cache_dir),
+          notifier([](const Notification &) { return true; })
+    {}
+
+    EvalResult run(const string &name, const Corpus &corpus) {
+        EvalResult res;
+        res.corpus = name;
+        res.corpus_size = corpus.size();
+
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+            throw SystemError("Unable to create socket pair: ", errno);
+        OutputCounter out(sv[1]);
+        UNIXSocket<KBDAction> conn(sv[0]);
+        RemoteUDevice udev(&conn);
+
+        auto set = load(udev);
+        GCScheduler gc(opts.gc_slice_us, opts.gc_ceiling_kb);
+        for (auto &[_, sc] : set->scripts) {
+            (void) _;
+            gc.adopt(sc.get());
+        }
+
+        auto notifications = [&]() {
+            const auto &st = notifier.getStats();
+            return st.queued.load() + st.dropped.load();
+        };
+        auto countSpawns = [&]() {
+            uint64_t n = 0;
+            for (auto &[_, sc] : set->scripts) {
+                (void) _;
+                n += sc->spawner.spawnCount();
+            }
+            return n;
+        };
+
+        uint64_t total = opts.warmup + opts.events, keys_before = 0,
+                 allocs_before = 0, spawns_before = 0, notes_before = 0;
+        GCStats gc_before;
+        res.dispatch_ns.reserve(opts.events);
+        for (uint64_t i = 0; i < total; i++) {
+            if (i == opts.warmup) {
+                keys_before = out.waitFor(i);
+                for (auto &[_, sc] : set->scripts) {
+                    (void) _;
+                    allocs_before += sc->memory().allocs.load();
+                }
+                spawns_before = countSpawns();
+                notes_before = notifications();
+                gc_before = gc.getStats();
+                // The first error is kept, even if it was in the warm-up.
+                res.errors = 0;
+            }
+            bool measured = i >= opts.warmup;
+
+            const KeyEvent &e = corpus[i % corpus.size()];
+            uint64_t start = monotonicNS();
+            bool repeat = dispatch(*set, e, res);
+            if (repeat) {
+                udev.emit(EV_KEY, e.code, e.value);
+                res.passed += measured;
+            }
+            udev.done();
+            if (measured)
+                res.dispatch_ns.push_back(monotonicNS() - start);
+
+            for (auto &[_, sc] : set->scripts) {
+                (void) _;
+                gc.enforce(sc.get());
+            }
+            while (opts.idle_gc && gc.idle(*set))
+                ;
+        }
+
+        res.output_keys = out.waitFor(total) - keys_before;
+        for (auto &[_, sc] : set->scripts) {
+            (void) _;
+            res.allocs += sc->memory().allocs.load();
+            res.peak_bytes += sc->memory().peak.load();
+        }
+        res.allocs -= allocs_before;
+        res.spawns = countSpawns() - spawns_before;
+        res.notifications = notifications() - notes_before;
+
+        const GCStats &st = gc.getStats();
+        res.gc = st;
+        res.gc.idle_slices -= gc_before.idle_slices;
+        res.gc.forced_slices -= gc_before.forced_slices;
+        res.gc.cycles -= gc_before.cycles;
+        res.gc.total_us -= gc_before.total_us;
+        for (size_t i = 0; i < st.pauses.size(); i++)
+            res.gc.pauses[i] -= gc_before.pauses[i];
+
+        // The scripts go before the connection, and closing it stops the
+        // counter.
+        set.reset();
+        ::shutdown(sv[0], SHUT_RDWR);
+        sort(res.dispatch_ns.begin(), res.dispatch_ns.end());
+        return res;
+    }
+};
+
+static void printText(const EvalResult &r) {
+    cout << fixed << setprecision(1)
+         << r.corpus << ": " << r.events() << " events, corpus of "
+         << r.corpus_size << " events\n"
+         << "  dispatch     mean " << r.mean() << " ns, p50 " << r.percentile(0.50)
+         << " ns, p99 " << r.percentile(0.99) << " ns, max " << r.percentile(1.0)
+         << " ns\n"
+         << setprecision(2)
+         << "  allocations  " << r.perEvent(r.allocs) << " per event, peak "
+         << r.peak_bytes / 1024 << " KiB\n"
+         << setprecision(1)
+         << "  gc           " << r.perEvent(r.gc.total_us * 1000.0) << " ns per event, "
+         << r.gc.format() << "\n"
+         << setprecision(2)
+         << "  output       " << r.perEvent(r.output_keys) << " keys per event, "
+         << r.passed << " events passed through\n"
+         << "  side effects " << r.spawns << " processes, " << r.notifications
+         << " notifications\n"
+         << "  errors       " << r.errors << "\n";
+    if (!r.first_error.empty())
+        cout << "  first error  " << r.first_error.substr(0, r.first_error.find('\n')) << "\n";
+    cout << endl;
+}
+
+static void printJSON(const vector<EvalResult> &results, const EvalOptions &opts) {
+    cout << fixed << setprecision(1)
+         << "{\"version\":" << jsonString(VERSION) << ",\"scripts\":[";
+    for (size_t i = 0; i < opts.scripts.size(); i++)
+        cout << (i ? "," : "") << jsonString(opts.scripts[i]);
+    cout << "],\"corpora\":{";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto &r = results[i];
+        cout << (i ? "," : "") << jsonString(r.corpus) << ":{"
+             << "\"events\":" << r.events()
+             << ",\"corpus_events\":" << r.corpus_size
+             << ",\"mean_ns\":" << r.mean()
+             << ",\"p50_ns\":" << r.percentile(0.50)
+             << ",\"p99_ns\":" << r.percentile(0.99)
+             << ",\"max_ns\":" << r.percentile(1.0)
+             << setprecision(3)
+             << ",\"allocs_per_event\":" << r.perEvent(r.allocs)
+             << ",\"peak_bytes\":" << r.peak_bytes
+             << ",\"gc_ns_per_event\":" << r.perEvent(r.gc.total_us * 1000.0)
+             << ",\"gc_idle_slices\":" << r.gc.idle_slices
+             << ",\"gc_forced_slices\":" << r.gc.forced_slices
+             << ",\"gc_cycles\":" << r.gc.cycles
+             << ",\"gc_max_pause_us\":" << r.gc.max_us
+             << ",\"output_keys_per_event\":" << r.perEvent(r.output_keys)
+             << ",\"passed\":" << r.passed
+             << ",\"spawns\":" << r.spawns
+             << ",\"notifications\":" << r.notifications
+             << ",\"errors\":" << r.errors;
+        if (!r.first_error.empty())
+            cout << ",\"first_error\":" << jsonString(r.first_error);
+        cout << setprecision(1) << "}";
+    }
+    cout << "}}" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+
+    string HELP =
+        "Usage: hawck-eval [--corpus <name>]... [--events <n>] [--warmup <n>]\n"
+        "                  [--no-idle-gc] [--gc-slice-us <us>] [--gc-ceiling-kb <kb>]\n"
+        "                  [--lib-dir <dir>] [--json] <script>...\n"
+        "\n"
+        "Measure the cost per event of .lua and .hwk scripts, by running them\n"
+        "against a corpus of key events the way MacroD would.\n"
+        "\n"
+        "Options:\n"
+        "  --corpus         prose, shortcuts, repeats, or the path to a trace\n"
+        "                   recorded with hawck-inputd --record. May be given\n"
+        "                   more than once (default prose, shortcuts and repeats.)\n"
+        "  --events         Events to measure for each corpus, the corpus is\n"
+        "                   repeated as needed (default 20000.)\n"
+        "  --warmup         Events to run before measuring (default 1000.)\n"
+        "  --no-idle-gc     Don't collect garbage between events, as when keys\n"
+        "                   arrive faster than the collector can keep up.\n"
+        "  --gc-slice-us    Same as gc_slice_us in cfg.lua (default 250.)\n"
+        "  --gc-ceiling-kb  Same as gc_ceiling_kb in cfg.lua (default 4096.)\n"
+        "  --lib-dir        Hawck runtime (default $XDG_DATA_HOME/hawck/scripts.)\n"
+        "  --json           Write the results as JSON.\n"
+        "  -h, --help       Display this help information.\n"
+        "  --version        Display version and exit.\n"
+    ;
+
+    static int json, no_idle_gc;
+    static struct option long_options[] =
+        {
+            {"json", no_argument, &json, 1},
+            {"no-idle-gc", no_argument, &no_idle_gc, 1},
+            {"corpus", required_argument, 0, 0},
+            {"events", required_argument, 0, 0},
+            {"warmup", required_argument, 0, 0},
+            {"gc-slice-us", required_argument, 0, 0},
+            {"gc-ceiling-kb", required_argument, 0, 0},
+            {"lib-dir", required_argument, 0, 0},
+            {"version", no_argument, 0, 0},
+            {"help", no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+    int option_index = 0;
+
+    EvalOptions opts;
+    vector<string> corpora;
+    auto number = [](const string &name, const string &opt, int min) {
+        try {
+            int n = stoi(opt);
+            if (n >= min)
+                return n;
+        } catch (const exception &e) {}
+        cout << "--" << name << ": Require an integer of at least " << min << endl;
+        exit(1);
+    };
+    unordered_map<string, function<void(const string& opt)>> long_handlers = {
+        {"version", [&](const string&) {
+                        cout << "hawck-eval v" VERSION << endl;
+                        exit(0);
+                    }},
+        {"corpus", [&](const string& opt) { corpora.push_back(opt); }},
+        {"events", [&](const string& opt) { opts.events = number("events", opt, 1); }},
+        {"warmup", [&](const string& opt) { opts.warmup = number("warmup", opt, 0); }},
+        {"gc-slice-us", [&](const string& opt) { opts.gc_slice_us = number("gc-slice-us", opt, 1); }},
+        {"gc-ceiling-kb", [&](const string& opt) { opts.gc_ceiling_kb = number("gc-ceiling-kb", opt, 0); }},
+        {"lib-dir", [&](const string& opt) { opts.lib_dir = opt; }},
+    };
+
+    do {
+        int c = getopt_long(argc, argv, "h", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 0: {
+                if (long_options[option_index].flag != 0)
+                    break;
+                string name(long_options[option_index].name);
+                string arg(optarg ? optarg : "");
+                if (long_handlers.find(name) != long_handlers.end())
+                    long_handlers[name](arg);
+                break;
+            }
+
+            case 'h':
+                cout << HELP;
+                exit(0);
+
+            default:
+                cout << HELP;
+                exit(1);
+        }
+    } while (true);
+
+    for (int i = optind; i < argc; i++)
+        opts.scripts.push_back(argv[i]);
+    if (opts.scripts.empty()) {
+        cout << HELP;
+        return 1;
+    }
+    // Run in the order that MacroD would run them in.
+    sort(opts.scripts.begin(), opts.scripts.end(), [](const string &a, const string &b) {
+        return pathBasename(a) < pathBasename(b);
+    });
+    if (corpora.empty())
+        corpora = {"prose", "shortcuts", "repeats"};
+    opts.idle_gc = !no_idle_gc;
+
+    // Errors in scripts are reported with the results.
+    openlog("hawck-eval", 0, LOG_USER);
+    setlogmask(LOG_UPTO(LOG_ERR));
+
+    char tmpl[] = "/tmp/hawck-eval.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        cout << "Error: Unable to create temporary directory: " << strerror(errno) << endl;
+        return 1;
+    }
+    string tmp_dir = tmpl;
+
+    int status = 0;
+    try {
+        if (opts.lib_dir.empty())
+            opts.lib_dir = XDG("hawck").path(XDG_DATA_HOME, "scripts");
+        opts.lib_dir = realpath_safe(opts.lib_dir);
+        for (auto &path : opts.scripts)
+            path = realpath_safe(path);
+
+        Evaluator eval(opts, tmp_dir);
+        vector<EvalResult> results;
+        for (const auto &name : corpora) {
+            Corpus corpus = name == "prose"     ? proseCorpus()
+                          : name == "shortcuts" ? shortcutCorpus()
+                          : name == "repeats"   ? repeatCorpus()
+                          : traceCorpus(name);
+            results.push_back(eval.run(name, corpus));
+            if (!json)
+                printText(results.back());
+        }
+        if (json)
+            printJSON(results, opts);
+    } catch (const exception &e) {
+        cout << "Error: " << e.what() << endl;
+        status = 1;
+    }
+
+    std::error_code ec;
+    fs::remove_all(tmp_dir, ec);
+    return status;
+}
@@ -0,0 +1,309 @@
+/** @file hawck-flight.cpp
+ *
+ * @brief Dump the flight recorder rings of the daemons.
+ *
+ * The rings of both daemons are merged on their timestamps, which come from
+ * the same clock, so that an event can be followed from InputD to MacroD and
+ * back. See FlightRecorder.hpp.
+ */
+
+#include <algorithm>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+    #include <getopt.h>
+    #include <linux/input-event-codes.h>
+    #include <unistd.h>
+}
+
+#include "FlightRecorder.hpp"
+#include "utils.hpp"
+
+#if MESON_COMPILE
+#include <hawck_config.h>
+#else
+#define VERSION "unknown"
+#endif
+
+using namespace std;
+
+struct Line {
+    const FlightReader *ring;
+    FlightRecord rec;
+};
+
+static const map<int, const char *> modifier_names = {
+    {KEY_LEFTCTRL, "leftctrl"}, {KEY_RIGHTCTRL, "rightctrl"},
+    {KEY_LEFTSHIFT, "leftshift"}, {KEY_RIGHTSHIFT, "rightshift"},
+    {KEY_LEFTALT, "leftalt"}, {KEY_RIGHTALT, "rightalt"},
+    {KEY_LEFTMETA, "leftmeta"}, {KEY_RIGHTMETA, "rightmeta"},
+    {KEY_CAPSLOCK, "capslock"},
+};
+
+/** Whether records of a kind are about a key. */
+static bool hasKey(FlightRecord::Kind kind) {
+    switch (kind) {
+        case FlightRecord::INPUT: case FlightRecord::TO_MACROD:
+        case FlightRecord::PASSTHROUGH: case FlightRecord::TIMEOUT:
+        case FlightRecord::RECV: case FlightRecord::MATCH:
+        case FlightRecord::PASSED: case FlightRecord::SCRIPT_ERROR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static string keyName(int code) {
+    if (code == 0)
+        return "?";
+    auto it = modifier_names.find(code);
+    return it != modifier_names.end() ? it->second : to_string(code);
+}
+
+static const char *valueName(int value) {
+    switch (value) {
+        case 0: return "up";
+        case 1: return "down";
+        case 2: return "repeat";
+        default: return "?";
+    }
+}
+
+static string details(const FlightRecord &rec) {
+    string out;
+    auto add = [&](const string &s) { out += (out.empty() ? "" : " ") + s; };
+    if (hasKey(rec.kind))
+        add("key=" + keyName(rec.code) + " " + valueName(rec.value));
+    switch (rec.kind) {
+        case FlightRecord::INPUT: case FlightRecord::RECV:
+            add("kbd=" + to_string(rec.arg));
+            break;
+        case FlightRecord::FROM_MACROD:
+            add("events=" + to_string(rec.arg));
+            break;
+        case FlightRecord::WRITTEN: case FlightRecord::GC_FORCED:
+            add("took=" + to_string(rec.arg) + "us");
+            break;
+        default:
+            break;
+    }
+    if (rec.name[0])
+        add(string("script=") + rec.name);
+    return out;
+}
+
+static string formatTime(uint64_t realtime_ns) {
+    time_t secs = realtime_ns / 1000000000;
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+    char frac[16];
+    snprintf(frac, sizeof(frac), ".%06u", (unsigned) (realtime_ns % 1000000000 / 1000));
+    return string(buf) + frac;
+}
+
+static void printHeader(const string &path, const FlightReader &ring) {
+    const auto &info = ring.getInfo();
+    time_t started = info.realtime_ns / 1000000000;
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&started));
+    cout << "# " << path << ": " << info.daemon << " pid " << info.pid
+         << ", started " << date << ", " << info.written << " records written, "
+         << ring.records().size() << " kept, key codes "
+         << (info.keys ? "recorded" : "hidden") << endl;
+}
+
+static void printText(const vector<Line> &lines) {
+    uint64_t prev = 0;
+    for (const auto &l : lines) {
+        double delta_ms = prev ? (l.rec.time_ns - prev) / 1e6 : 0;
+        prev = l.rec.time_ns;
+        cout << formatTime(l.ring->realtimeNS(l.rec)) << "  +" << fixed
+             << setprecision(3) << setw(9) << delta_ms << "ms  " << left
+             << setw(7) << l.ring->getInfo().daemon << " "
+             << setw(9) << (l.rec.event ? "#" + to_string(l.rec.event) : "-") << " "
+             << setw(13) << FlightRecord::kindName(l.rec.kind) << right
+             << details(l.rec) << endl;
+    }
+}
+
+/** Modifiers that were down when the ring ends, which is what a stuck
+ *  modifier looks like. */
+static void printHeld(const vector<Line> &lines) {
+    map<const FlightReader *, set<int>> held;
+    for (const auto &l : lines) {
+        auto kind = l.rec.kind;
+        if ((kind != FlightRecord::INPUT && kind != FlightRecord::RECV) ||
+            !modifier_names.count(l.rec.code))
+            continue;
+        if (l.rec.value == 0)
+            held[l.ring].erase(l.rec.code);
+        else
+            held[l.ring].insert(l.rec.code);
+    }
+    for (const auto &[ring, codes] : held) {
+        if (codes.empty())
+            continue;
+        cout << "# " << ring->getInfo().daemon << ": held down at the end:";
+        for (int code : codes)
+            cout << " " << keyName(code);
+        cout << endl;
+    }
+}
+
+static void printJSON(const vector<Line> &lines) {
+    cout << "[";
+    for (size_t i = 0; i < lines.size(); i++) {
+        const auto &l = lines[i];
+        cout << (i ? "," : "") << "\n{\"daemon\":" << jsonString(l.ring->getInfo().daemon)
+             << ",\"time_ns\":" << l.ring->realtimeNS(l.rec)
+             << ",\"monotonic_ns\":" << l.rec.time_ns
+             << ",\"event\":" << l.rec.event
+             << ",\"kind\":" << jsonString(FlightRecord::kindName(l.rec.kind))
+             << ",\"code\":" << l.rec.code
+             << ",\"value\":" << l.rec.value
+             << ",\"arg\":" << l.rec.arg
+             << ",\"script\":" << jsonString(l.rec.name) << "}";
+    }
+    cout << "\n]" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    string HELP =
+        "Usage: hawck-flight [--json] [--last <n>] [--slow <us>] [ring]...\n"
+        "\n"
+        "Dump the flight recorders of InputD and MacroD, merged on time. Without\n"
+        "arguments the rings in their default locations are read, add .prev to a\n"
+        "path to read the ring from before the daemon was last restarted.\n"
+        "\n"
+        "Options:\n"
+        "  --json       Write the records as a JSON array.\n"
+        "  --last       Only show the last n records.\n"
+        "  --slow       Only show events that took at least this many\n"
+        "               microseconds to handle.\n"
+        "  -h, --help   Display this help information.\n"
+        "  --version    Display version and exit.\n"
+    ;
+
+    static int json;
+    static struct option long_options[] =
+        {
+            {"json", no_argument, &json, 1},
+            {"last", required_argument, 0, 0},
+            {"slow", required_argument, 0, 0},
+            {"version", no_argument, 0, 0},
+            {"help", no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+    int option_index = 0;
+
+    size_t last = 0;
+    uint32_t slow_us = 0;
+    auto number = [](const string &name, const string &opt) {
+        try {
+            long n = stol(opt);
+            if (n >= 0)
+                return (size_t) n;
+        } catch (const exception &e) {}
+        cout << "--" << name << ": Require a non-negative integer" << endl;
+        exit(1);
+    };
+    unordered_map<string, function<void(const string& opt)>> long_handlers = {
+        {"version", [&](const string&) {
+                        cout << "hawck-flight v" VERSION << endl;
+                        exit(0);
+                    }},
+        {"last", [&](const string& opt) { last = number("last", opt); }},
+        {"slow", [&](const string& opt) { slow_us = number("slow", opt); }},
+    };
+
+    do {
+        int c = getopt_long(argc, argv, "h", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 0: {
+                if (long_options[option_index].flag != 0)
+                    break;
+                string name(long_options[option_index].name);
+                string arg(optarg ? optarg : "");
+                if (long_handlers.find(name) != long_handlers.end())
+                    long_handlers[name](arg);
+                break;
+            }
+
+            case 'h':
+                cout << HELP;
+                exit(0);
+
+            default:
+                cout << HELP;
+                exit(1);
+        }
+    } while (true);
+
+    vector<string> paths(argv + optind, argv + argc);
+    bool defaults = paths.empty();
+    if (defaults) {
+        paths.push_back("/var/lib/hawck-input/flight.ring");
+        if (const char *run = getenv("XDG_RUNTIME_DIR"))
+            paths.push_back(pathJoin(run, "hawck", "flight.ring"));
+    }
+
+    vector<unique_ptr<FlightReader>> rings;
+    for (const auto &path : paths) {
+        if (defaults && access(path.c_str(), F_OK) == -1)
+            continue;
+        try {
+            rings.push_back(make_unique<FlightReader>(path));
+        } catch (const exception &e) {
+            cout << "Error: " << e.what() << endl;
+            return 1;
+        }
+        if (!json)
+            printHeader(path, *rings.back());
+    }
+    if (rings.empty()) {
+        cout << "Error: No flight recorder rings found, are the daemons running?" << endl;
+        return 1;
+    }
+
+    vector<Line> lines;
+    for (const auto &ring : rings)
+        for (const auto &rec : ring->records())
+            lines.push_back({ring.get(), rec});
+    stable_sort(lines.begin(), lines.end(), [](const Line &a, const Line &b) {
+        return a.rec.time_ns < b.rec.time_ns;
+    });
+
+    if (!json)
+        printHeld(lines);
+
+    if (slow_us) {
+        set<pair<const FlightReader *, uint64_t>> slow;
+        for (const auto &l : lines)
+            if (l.rec.kind == FlightRecord::WRITTEN && l.rec.arg >= slow_us)
+                slow.insert({l.ring, l.rec.event});
+        lines.erase(remove_if(lines.begin(), lines.end(), [&](const Line &l) {
+            return !slow.count({l.ring, l.rec.event});
+        }), lines.end());
+    }
+    if (last && lines.size() > last)
+        lines.erase(lines.begin(), lines.end() - last);
+
+    if (json)
+        printJSON(lines);
+    else
+        printText(lines);
+}
@@ -4,6 +4,7 @@
 
 #include "KBDDaemon.hpp"
 #include "Daemon.hpp"
+#include "RealTime.hpp"
 #include "utils.hpp"
 
 #if MESON_COMPILE
@@ -60,7 +61,10 @@ int main(int argc, char *argv[]) {
 
     string HELP =
         "Usage: hawck-inputd [--udev-event-delay <us>] [--no-fork] [--socket-timeout]\n"
-        "                    [--kbd-device <device>] [--no-hotplug]\n"
+        "                    [--kbd-device <device>] [--no-hotplug] [--record <path>]\n"
+        "                    [--stats-socket <path>] [--flight-recorder <path>]\n"
+        "                    [--flight-record-keys] [--rt-priority <1-99>] [--rt-policy <policy>]\n"
+        "                    [--rt-cpu-limit <ms>] [--cpus <list>] [--jitter-probe]\n"
         "\n"
         "Examples:\n"
         "  Listen on a single device:\n"
@@ -77,9 +81,30 @@ int main(int argc, char *argv[]) {
         "  --udev-event-delay  Delay between events sent on the udevice in µs.\n"
         "  --socket-timeout    Time in milliseconds until timeout on sockets.\n"
         "  --no-hotplug        Only listen to devices that were explicitly added with --kbd-device\n"
+        "  --record            Record the events that pass through InputD to a trace file,\n"
+        "                      which can be replayed with hawck-replay. WARNING: The trace\n"
+        "                      will contain everything that is typed, including passwords.\n"
+        "  --stats-socket      Serve latency statistics on this socket, empty to disable.\n"
+        "  --flight-recorder   Keep a record of the last few thousand events in this file,\n"
+        "                      which can be read with hawck-flight. Empty to disable.\n"
+        "  --flight-record-keys\n"
+        "                      Include all key codes in the flight recorder, not just\n"
+        "                      modifiers.\n"
+        "  --rt-priority       Read and write events on a real-time thread with this\n"
+        "                      priority, and lock InputD in memory.\n"
+        "  --rt-policy         Real-time scheduling policy, fifo (default) or rr.\n"
+        "  --rt-cpu-limit      Milliseconds of CPU time the real-time thread may use\n"
+        "                      without blocking before it is switched back to normal\n"
+        "                      scheduling (default: 200.)\n"
+        "  --cpus              Run the event thread on these CPUs, e.g. 2,4-7.\n"
+        "  --jitter-probe      Measure how late a thread that is scheduled like the event\n"
+        "                      thread wakes up, shown as inputd.wakeup_jitter in the\n"
+        "                      statistics.\n"
     ;
 
     int no_hotplug = false;
+    int flight_record_keys = false;
+    int jitter_probe = false;
     static struct option long_options[] =
         {
             /* These options set a flag. */
@@ -88,6 +113,15 @@ int main(int argc, char *argv[]) {
             {"udev-event-delay", required_argument,       0, 0},
             {"socket-timeout", required_argument,       0, 0},
             {"version", no_argument, 0, 0},
+            {"record", required_argument,       0, 0},
+            {"stats-socket", required_argument,       0, 0},
+            {"flight-recorder", required_argument,       0, 0},
+            {"flight-record-keys", no_argument,       &flight_record_keys, 1},
+            {"rt-priority", required_argument,       0, 0},
+            {"rt-policy", required_argument,       0, 0},
+            {"rt-cpu-limit", required_argument,       0, 0},
+            {"cpus", required_argument,       0, 0},
+            {"jitter-probe", no_argument,       &jitter_probe, 1},
             /* These options don’t set a flag.
                We distinguish them by their indices. */
             {"help",         no_argument,       0, 'h'},
@@ -100,6 +134,13 @@ int main(int argc, char *argv[]) {
 
     int udev_event_delay = 3800;
     int socket_timeout = 1024;
+    string record;
+    string stats_socket = "/var/lib/hawck-input/stats.sock";
+    string flight_recorder = "/var/lib/hawck-input/flight.ring";
+    int rt_priority = 0;
+    string rt_policy = "fifo";
+    int rt_cpu_limit = 200;
+    string cpus;
     vector<string> kbd_names;
     vector<string> kbd_devices;
     unordered_map<string, function<void(const string& opt)>> long_handlers = {
@@ -109,6 +150,13 @@ int main(int argc, char *argv[]) {
                     }},
         NUM_OPTION(udev_event_delay)
         NUM_OPTION(socket_timeout)
+        STR_OPTION(record),
+        STR_OPTION(stats_socket),
+        STR_OPTION(flight_recorder),
+        NUM_OPTION(rt_priority)
+        STR_OPTION(rt_policy),
+        NUM_OPTION(rt_cpu_limit)
+        STR_OPTION(cpus),
     };
 
     do {
@@ -154,36 +202,37 @@ int main(int argc, char *argv[]) {
         }
     } while (true);
 
-    // If no devices were specified, we listen to all of them
-    if (kbd_devices.size() == 0) {
-        // FIXME: All the "is this a keyboard" detection done in Hawck is very
-        //        brittle, and I should probably do a deep-dive into whatever
-        //        documentation I can find on this to develop a better method.
-
-        try {
-            for (auto d : fs::directory_iterator("/dev/input/by-id"))
-                if (KBDManager::byIDIsKeyboard(d.path()))
-                    kbd_devices.push_back(realpath_safe(d.path()));
-        } catch (const system_error& err) {
-            syslog(LOG_ERR, "Unable to query by-id: %s", err.what());
-        }
-
-        try {
-            for (auto d : fs::directory_iterator("/dev/input/by-path")) {
-                string rpath = realpath_safe(d.path());
-                bool already_added = find(kbd_devices.begin(), kbd_devices.end(), rpath) != kbd_devices.end();
-                if (!already_added && stringStartsWith(pathBasename(d.path()), "platform-i8042") && stringEndsWith(d.path(), "-event-kbd"))
-                    kbd_devices.push_back(rpath);
-            }
-        } catch (const system_error& err) {
-            syslog(LOG_ERR, "Unable to query by-path: %s", err.what());
-        }
+    RealTime::Config rt;
+    try {
+        rt.priority = rt_priority;
+        rt.policy = RealTime::Config::parsePolicy(rt_policy);
+        if (cpus.size())
+            rt.cpus = RealTime::Config::parseCPUs(cpus);
+        rt.cpu_limit_ms = rt_cpu_limit;
+        rt.validate();
+    } catch (const invalid_argument &e) {
+        cout << "Error: " << e.what() << endl;
+        return 1;
     }
 
+    // If no devices were specified, we listen to all of them
+    if (kbd_devices.size() == 0)
+        kbd_devices = KBDManager::findKeyboards();
+
     cout << "Starting Hawck InputD v" INPUTD_VERSION " on:" << endl;
     for (const auto& dev : kbd_devices)
         cout << "  - <" << dev << ">" << endl;
 
+    if (stats_socket.size())
+        stats_socket = fs::absolute(stats_socket);
+    if (flight_recorder.size())
+        flight_recorder = fs::absolute(flight_recorder);
+
+    if (record.size()) {
+        record = fs::absolute(record);
+        cout << "Recording to " << record << endl;
+    }
+
     if (!no_fork) {
         cout << "forking ..." << endl;
         daemonize("/tmp/hawck-inputd.log");
@@ -192,6 +241,25 @@ int main(int argc, char *argv[]) {
     const string pid_file = "/var/lib/hawck-input/pid";
     killPretender(pid_file);
 
+    if (flight_recorder.size()) {
+        try {
+            // Without key codes the ring can be read by the desktop user,
+            // like the stats socket.
+            if (flight_record_keys)
+                FlightRecorder::get().open(flight_recorder, "inputd", true);
+            else
+                FlightRecorder::get().open(flight_recorder, "inputd", false, 0640,
+                                           "hawck-input-share");
+        } catch (const exception &e) {
+            syslog(LOG_ERR, "Unable to open flight recorder %s: %s",
+                   flight_recorder.c_str(), e.what());
+        }
+    }
+
+    // Memory locks are not inherited by the child, so this has to come after
+    // daemonize().
+    RealTime::setupProcess(rt);
+
     try {
         KBDDaemon daemon;
         daemon.kbman.setHotplug(!no_hotplug);
@@ -199,7 +267,27 @@ int main(int argc, char *argv[]) {
             daemon.kbman.addDevice(dev);
         daemon.setEventDelay(udev_event_delay);
         daemon.setSocketTimeout(socket_timeout);
+        unique_ptr<TraceWriter> recorder;
+        if (record.size()) {
+            recorder = make_unique<TraceWriter>(record);
+            daemon.setRecorder(recorder.get());
+            syslog(LOG_WARNING, "Recording all input to %s", record.c_str());
+        }
+        unique_ptr<StatsServer> stats_srv;
+        if (stats_socket.size()) {
+            try {
+                // Readable by the desktop user, like kbd.sock.
+                stats_srv = make_unique<StatsServer>(stats_socket, 0660, "hawck-input-share");
+            } catch (const exception &e) {
+                syslog(LOG_ERR, "Unable to serve statistics on %s: %s",
+                       stats_socket.c_str(), e.what());
+            }
+        }
+        unique_ptr<RealTime::JitterProbe> jitter;
+        if (jitter_probe)
+            jitter = make_unique<RealTime::JitterProbe>(rt, "inputd");
         syslog(LOG_INFO, "Running Hawck InputD ...");
+        RealTime::enterThread(rt, "inputd");
         daemon.run();
     } catch (const SystemError &e) {
         syslog(LOG_CRIT, "Abort due to exception: %s", e.what());
@@ -0,0 +1,298 @@
+/** @file hawck-loadgen.cpp
+ *
+ * @brief Drive a running MacroD with synthetic load at a given rate, or at
+ *        increasing rates until it can't keep up.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "KBDDaemon.hpp"
+#include "LoadGen.hpp"
+
+#if MESON_COMPILE
+#include <hawck_config.h>
+#else
+#define VERSION "unknown"
+#endif
+
+extern "C" {
+    #include <getopt.h>
+    #include <signal.h>
+    #include <syslog.h>
+}
+
+using namespace std;
+
+static int show_stats;
+static int as_json;
+
+static vector<double> parseRates(const string &list) {
+    vector<double> rates;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ',')) {
+        double rate = stod(item);
+        if (!(rate > 0))
+            throw invalid_argument("Rates must be positive");
+        rates.push_back(rate);
+    }
+    if (rates.empty())
+        throw invalid_argument("No rates given");
+    sort(rates.begin(), rates.end());
+    return rates;
+}
+
+static LoadResult runLoad(const LoadPattern &pattern, const string &socket_path,
+                          size_t queue_size, int ev_delay_us)
+{
+    LoadInputSource source(generateLoad(pattern), queue_size);
+    LoadUDevice sink(ev_delay_us);
+    {
+        KBDDaemon daemon(&source, &sink, socket_path);
+        sink.start();
+        daemon.run();
+    }
+    return analyzeLoad(source, sink, pattern);
+}
+
+static void printHeader() {
+    cout << setw(8) << "rate" << setw(10) << "achieved"
+         << setw(10) << "q p50" << setw(10) << "q p99" << setw(10) << "lat p99"
+         << setw(9) << "dropped" << setw(6) << "lost" << setw(10) << "reordered"
+         << setw(7) << "stuck" << endl;
+}
+
+static void printRow(const LoadResult &res) {
+    auto q = LoadResult::quantile;
+    cout << fixed << setprecision(0)
+         << setw(8) << res.offered_rate << setw(10) << res.achieved_rate
+         << setw(10) << q(res.queue_us, 0.50) << setw(10) << q(res.queue_us, 0.99)
+         << setw(10) << q(res.latency_us, 0.99)
+         << setw(9) << res.dropped << setw(6) << res.lost << setw(10) << res.reordered
+         << setw(7) << res.stuck.size() << endl;
+}
+
+static string toJSON(const LoadResult &res) {
+    auto q = LoadResult::quantile;
+    stringstream ss;
+    ss << fixed << setprecision(1)
+       << "{\"offered_rate\": " << res.offered_rate
+       << ", \"achieved_rate\": " << res.achieved_rate
+       << ", \"key_events\": " << res.key_events
+       << ", \"handled\": " << res.handled
+       << ", \"written\": " << res.written
+       << ", \"macro_expected\": " << res.macro_expected
+       << ", \"macro_missing\": " << res.macro_missing
+       << ", \"dropped\": " << res.dropped
+       << ", \"lost\": " << res.lost
+       << ", \"reordered\": " << res.reordered
+       << ", \"queue_us\": {\"p50\": " << q(res.queue_us, 0.5)
+       << ", \"p99\": " << q(res.queue_us, 0.99) << "}"
+       << ", \"service_us\": {\"p50\": " << q(res.service_us, 0.5)
+       << ", \"p99\": " << q(res.service_us, 0.99) << "}"
+       << ", \"latency_us\": {\"p50\": " << q(res.latency_us, 0.5)
+       << ", \"p99\": " << q(res.latency_us, 0.99) << "}"
+       << ", \"kept_up\": " << (res.keptUp() ? "true" : "false")
+       << ", \"stuck\": [";
+    for (size_t i = 0; i < res.stuck.size(); i++)
+        ss << (i ? ", " : "") << res.stuck[i];
+    ss << "]}";
+    return ss.str();
+}
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+
+    string HELP =
+        "Usage: hawck-loadgen [--socket <path>] [--pattern <name>] [--rate <n>]\n"
+        "                     [--duration <s>] [--devices <n>] [--sweep] [--json]\n"
+        "\n"
+        "Send synthetic key events to a MacroD that was started with --socket, at\n"
+        "a fixed rate, and report the queueing delay, events that were dropped, lost\n"
+        "or reordered, and keys that were left down.\n"
+        "\n"
+        "Options:\n"
+        "  --socket       Socket that MacroD listens on.\n"
+        "  --pattern      typing, chords, holds or macro (default: typing.)\n"
+        "  --rate         Key events per second (default: 100.)\n"
+        "  --duration     Seconds to run each load for (default: 5.)\n"
+        "  --devices      Keyboards typing at the same time (default: 1.)\n"
+        "  --hold-ms      How long the holds pattern holds each key (default: 500.)\n"
+        "  --trigger      Key code that the macro pattern presses (default: F12.)\n"
+        "  --macro-events Key events the script writes for each press of the\n"
+        "                 trigger, missing ones are lost (default: 0, unchecked.)\n"
+        "  --queue        Events each keyboard can buffer before the kernel drops\n"
+        "                 them, 0 for no limit (default: 64.)\n"
+        "  --event-delay  Microseconds to wait after each event written, like\n"
+        "                 hawck-inputd --udev-event-delay (default: 3800.)\n"
+        "  --sweep        Run the load at each of --rates, and report the first\n"
+        "                 rate that could not be kept up with.\n"
+        "  --rates        Comma separated rates for --sweep\n"
+        "                 (default: 20,50,100,200,500,1000,2000.)\n"
+        "  --json         Print one JSON object per load.\n"
+        "  --stats        Show the time spent in each stage of InputD.\n"
+        "  -h, --help     Display this help information.\n"
+        "  --version      Display version and exit.\n"
+    ;
+
+    static struct option long_options[] =
+        {
+            {"stats", no_argument, &show_stats, 1},
+            {"json", no_argument, &as_json, 1},
+            {"sweep", no_argument, 0, 0},
+            {"socket", required_argument, 0, 0},
+            {"pattern", required_argument, 0, 0},
+            {"rate", required_argument, 0, 0},
+            {"rates", required_argument, 0, 0},
+            {"duration", required_argument, 0, 0},
+            {"devices", required_argument, 0, 0},
+            {"hold-ms", required_argument, 0, 0},
+            {"trigger", required_argument, 0, 0},
+            {"macro-events", required_argument, 0, 0},
+            {"queue", required_argument, 0, 0},
+            {"event-delay", required_argument, 0, 0},
+            {"version", no_argument, 0, 0},
+            {"help", no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+    int option_index = 0;
+
+    string socket_path = "/var/lib/hawck-input/kbd.sock";
+    LoadPattern pattern;
+    bool sweep = false;
+    string rates = "20,50,100,200,500,1000,2000";
+    int queue_size = LoadInputSource::DEFAULT_QUEUE_SIZE;
+    int ev_delay_us = 3800;
+
+    auto number = [](const string &name, const string &opt) {
+        try {
+            return stod(opt);
+        } catch (const exception &e) {
+            cout << "--" << name << ": Require a number" << endl;
+            exit(1);
+        }
+    };
+    auto integer = [](const string &name, const string &opt) {
+        try {
+            return stoi(opt);
+        } catch (const exception &e) {
+            cout << "--" << name << ": Require an integer" << endl;
+            exit(1);
+        }
+    };
+
+    unordered_map<string, function<void(const string& opt)>> long_handlers = {
+        {"version", [&](const string&) {
+                        cout << "hawck-loadgen v" VERSION << endl;
+                        exit(0);
+                    }},
+        {"socket", [&](const string& opt) { socket_path = opt; }},
+        {"sweep", [&](const string&) { sweep = true; }},
+        {"pattern", [&](const string& opt) { pattern.name = opt; }},
+        {"rates", [&](const string& opt) { rates = opt; }},
+        {"rate", [&](const string& opt) { pattern.rate = number("rate", opt); }},
+        {"duration", [&](const string& opt) {
+                         pattern.duration_s = number("duration", opt);
+                     }},
+        {"devices", [&](const string& opt) { pattern.devices = integer("devices", opt); }},
+        {"hold-ms", [&](const string& opt) { pattern.hold_ms = integer("hold-ms", opt); }},
+        {"trigger", [&](const string& opt) { pattern.trigger = integer("trigger", opt); }},
+        {"macro-events", [&](const string& opt) {
+                             pattern.macro_events = integer("macro-events", opt);
+                         }},
+        {"queue", [&](const string& opt) { queue_size = integer("queue", opt); }},
+        {"event-delay", [&](const string& opt) {
+                            ev_delay_us = integer("event-delay", opt);
+                        }},
+    };
+
+    do {
+        int c = getopt_long(argc, argv, "h", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 0: {
+                if (long_options[option_index].flag != 0)
+                    break;
+                string name(long_options[option_index].name);
+                string arg(optarg ? optarg : "");
+                if (long_handlers.find(name) != long_handlers.end())
+                    long_handlers[name](arg);
+                break;
+            }
+
+            case 'h':
+                cout << HELP;
+                exit(0);
+
+            default:
+                cout << HELP;
+                exit(1);
+        }
+    } while (true);
+
+    if (optind != argc || queue_size < 0 || ev_delay_us < 0) {
+        cout << HELP;
+        return 1;
+    }
+
+    openlog("hawck-loadgen", LOG_PERROR, LOG_USER);
+
+    try {
+        vector<double> sweep_rates = sweep ? parseRates(rates) : vector<double>{pattern.rate};
+        // Catch mistakes in the pattern before connecting.
+        generateLoad(pattern);
+
+        if (!as_json) {
+            cout << pattern.name << ", " << pattern.devices << " device(s), "
+                 << pattern.duration_s << "s per load, times in µs" << endl;
+            printHeader();
+        }
+
+        bool any_stuck = false, macro_short = false;
+        double saturation = 0;
+        for (double rate : sweep_rates) {
+            pattern.rate = rate;
+            LoadResult res = runLoad(pattern, socket_path, queue_size, ev_delay_us);
+            if (as_json)
+                cout << toJSON(res) << endl;
+            else
+                printRow(res);
+            // Dropping the release of a key leaves it down, so that is only a
+            // bug when nothing was dropped.
+            any_stuck = any_stuck || (!res.stuck.empty() && !res.dropped);
+            macro_short = macro_short || res.macro_missing;
+            if (!res.keptUp()) {
+                saturation = rate;
+                break;
+            }
+        }
+
+        if (!as_json && sweep) {
+            if (saturation)
+                cout << "saturated at " << saturation << " key events/s" << endl;
+            else
+                cout << "kept up with every rate" << endl;
+        }
+        if (show_stats)
+            cout << Stats::get().report().text();
+        if (any_stuck) {
+            cout << "Keys were left down on the virtual keyboard, without any events being dropped"
+                 << endl;
+            return 1;
+        }
+        if (macro_short) {
+            cout << "The script wrote fewer than --macro-events for a press of the trigger"
+                 << endl;
+            return 1;
+        }
+    } catch (const exception &e) {
+        cout << "Error: " << e.what() << endl;
+        return 1;
+    }
+}
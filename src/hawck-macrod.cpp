@@ -1,8 +1,13 @@
 #include "MacroDaemon.hpp"
+#include "KBDDaemon.hpp"
+#include "LocalChannel.hpp"
+#include "RealTime.hpp"
 #include "Daemon.hpp"
 #include "XDG.hpp"
 #include <iostream>
 #include <fstream>
+#include <filesystem>
+#include <thread>
 #include "utils.hpp"
 #if MESON_COMPILE
 #include <hawck_config.h>
@@ -20,13 +25,84 @@ extern "C" {
 using namespace std;
 
 static int no_fork;
+static int flight_record_keys;
+static int embedded_inputd;
+static int no_hotplug;
+static int jitter_probe;
+
+/**
+ * Run InputD on a thread of its own, connected to MacroD through a
+ * LocalChannel. It is never stopped, and the process exits if it fails.
+ */
+static void startEmbeddedInputD(unique_ptr<IPacketChannel<KBDAction>> channel,
+                                vector<string> kbd_devices, const RealTime::Config &rt)
+{
+    if (kbd_devices.size() == 0)
+        kbd_devices = KBDManager::findKeyboards();
+    syslog(LOG_INFO, "Starting embedded InputD on %zu keyboards", kbd_devices.size());
+
+    // Never destroyed, the thread runs until the process exits.
+    KBDDaemon *inputd = new KBDDaemon(std::move(channel));
+    inputd->kbman.setHotplug(!no_hotplug);
+    for (const auto& dev : kbd_devices)
+        inputd->kbman.addDevice(dev);
+    inputd->setSocketTimeout(1024);
+
+    thread([inputd, rt]() {
+        RealTime::enterThread(rt, "embedded inputd");
+        try {
+            inputd->run();
+        } catch (const exception &e) {
+            syslog(LOG_CRIT, "Embedded InputD stopped: %s", e.what());
+        }
+        exit(1);
+    }).detach();
+}
 
 int main(int argc, char *argv[]) {
     string HELP =
-        "Usage: hawck-macrod [--no-fork]\n"
+        "Usage: hawck-macrod [--no-fork] [--socket <path>] [--stats-socket <path>]\n"
+        "                    [--flight-recorder <path>] [--flight-record-keys]\n"
+        "                    [--embedded-inputd [--kbd-device <device>]... [--no-hotplug]]\n"
+        "                    [--rt-priority <1-99>] [--rt-policy <policy>] [--rt-cpu-limit <ms>]\n"
+        "                    [--cpus <list>] [--jitter-probe]\n"
         "\n"
         "Options:\n"
         "  --no-fork   Don't daemonize/fork.\n"
+        "  --socket    Listen for InputD on another socket, used with hawck-replay.\n"
+        "  --stats-socket\n"
+        "              Serve latency statistics on this socket, defaults to\n"
+        "              $XDG_RUNTIME_DIR/hawck/stats.sock, empty to disable.\n"
+        "  --flight-recorder\n"
+        "              Keep a record of the last few thousand events in this file,\n"
+        "              defaults to $XDG_RUNTIME_DIR/hawck/flight.ring, empty to\n"
+        "              disable. Read it with hawck-flight.\n"
+        "  --flight-record-keys\n"
+        "              Include all key codes in the flight recorder, not just\n"
+        "              modifiers.\n"
+        "  --embedded-inputd\n"
+        "              Read the keyboards in this process instead of getting the\n"
+        "              keys from hawck-inputd, the user needs access to the\n"
+        "              keyboards and /dev/uinput. Only for single-user machines.\n"
+        "  -k, --kbd-device\n"
+        "              With --embedded-inputd, add a keyboard to listen to instead\n"
+        "              of all of them.\n"
+        "  --no-hotplug\n"
+        "              With --embedded-inputd, only listen to the keyboards given\n"
+        "              with --kbd-device.\n"
+        "  --rt-priority\n"
+        "              Handle events on a real-time thread with this priority, and\n"
+        "              lock MacroD in memory.\n"
+        "  --rt-policy Real-time scheduling policy, fifo (default) or rr.\n"
+        "  --rt-cpu-limit\n"
+        "              Milliseconds of CPU time the real-time thread may use without\n"
+        "              blocking before it is switched back to normal scheduling\n"
+        "              (default: 200.)\n"
+        "  --cpus      Run the event thread on these CPUs, e.g. 2,4-7.\n"
+        "  --jitter-probe\n"
+        "              Measure how late a thread that is scheduled like the event\n"
+        "              thread wakes up, shown as macrod.wakeup_jitter in the\n"
+        "              statistics.\n"
         "  -h, --help  Display this help information.\n"
         "  --version   Display version and exit.\n"
     ;
@@ -38,6 +114,18 @@ int main(int argc, char *argv[]) {
             /* These options set a flag. */
             {"no-fork", no_argument,       &no_fork, 1},
             {"version", no_argument, 0, 0},
+            {"socket", required_argument, 0, 0},
+            {"stats-socket", required_argument, 0, 0},
+            {"flight-recorder", required_argument, 0, 0},
+            {"flight-record-keys", no_argument, &flight_record_keys, 1},
+            {"embedded-inputd", no_argument, &embedded_inputd, 1},
+            {"no-hotplug", no_argument, &no_hotplug, 1},
+            {"kbd-device", required_argument, 0, 'k'},
+            {"rt-priority", required_argument, 0, 0},
+            {"rt-policy", required_argument, 0, 0},
+            {"rt-cpu-limit", required_argument, 0, 0},
+            {"cpus", required_argument, 0, 0},
+            {"jitter-probe", no_argument, &jitter_probe, 1},
             /* These options don’t set a flag.
                We distinguish them by their indices. */
             {"help",         no_argument,       0, 'h'},
@@ -46,15 +134,46 @@ int main(int argc, char *argv[]) {
     /* getopt_long stores the option index here. */
     int option_index = 0;
 
+    string socket_path = "/var/lib/hawck-input/kbd.sock";
+    string stats_path = xdg.path(XDG_RUNTIME_DIR, "stats.sock");
+    string flight_path = xdg.path(XDG_RUNTIME_DIR, "flight.ring");
+    vector<string> kbd_devices;
+    RealTime::Config rt;
+    auto integer = [](const string &name, const string &opt) {
+        try {
+            return stoi(opt);
+        } catch (const exception &e) {
+            cout << "--" << name << ": Require an integer" << endl;
+            exit(1);
+        }
+    };
+    string rt_policy = "fifo";
+    string cpus;
     unordered_map<string, function<void(const string& opt)>> long_handlers = {
         {"version", [&](const string&) {
                         cout << "hawck-macrod v" MACROD_VERSION << endl;
                         exit(0);
                     }},
+        {"socket", [&](const string& path) {
+                       // Relative to the directory we were started in.
+                       socket_path = std::filesystem::absolute(path);
+                   }},
+        {"stats-socket", [&](const string& path) {
+                             stats_path = path.empty() ? path : string(std::filesystem::absolute(path));
+                         }},
+        {"flight-recorder", [&](const string& path) {
+                                flight_path = path.empty() ? path : string(std::filesystem::absolute(path));
+                            }},
+        {"rt-priority", [&](const string& opt) { rt.priority = integer("rt-priority", opt); }},
+        {"rt-cpu-limit", [&](const string& opt) {
+                             rt.cpu_limit_ms = integer("rt-cpu-limit", opt);
+                         }},
+        {"rt-policy", [&](const string& opt) { rt_policy = opt; }},
+        {"cpus", [&](const string& opt) { cpus = opt; }},
     };
 
     do {
-        int c = getopt_long(argc, argv, "h",
+        int c = getopt_long(argc, argv, "hk:",
                             long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -73,6 +192,10 @@ int main(int argc, char *argv[]) {
                 break;
             }
 
+            case 'k':
+                kbd_devices.push_back(string(optarg));
+                break;
+
             case 'h':
                 cout << HELP;
                 exit(0);
@@ -87,6 +210,16 @@ int main(int argc, char *argv[]) {
         }
     } while (true);
 
+    try {
+        rt.policy = RealTime::Config::parsePolicy(rt_policy);
+        if (cpus.size())
+            rt.cpus = RealTime::Config::parseCPUs(cpus);
+        rt.validate();
+    } catch (const invalid_argument &e) {
+        cout << "Error: " << e.what() << endl;
+        return 1;
+    }
+
     umask(0022);
 
     if (!no_fork) {
@@ -100,9 +233,33 @@ int main(int argc, char *argv[]) {
     string pid_file = xdg.path(XDG_RUNTIME_DIR, "macrod.pid");
     killPretender(pid_file);
 
-    MacroDaemon daemon;
+    if (!flight_path.empty()) {
+        try {
+            FlightRecorder::get().open(flight_path, "macrod", flight_record_keys);
+        } catch (const exception &e) {
+            syslog(LOG_ERR, "Unable to open flight recorder %s: %s",
+                   flight_path.c_str(), e.what());
+        }
+    }
+
+    // Memory locks are not inherited by the child, so this has to come after
+    // daemonize().
+    RealTime::setupProcess(rt);
+
+    unique_ptr<MacroDaemon> daemon;
+    if (embedded_inputd) {
+        auto [macrod_end, inputd_end] = LocalChannel<KBDAction>::pair();
+        daemon = make_unique<MacroDaemon>(std::move(macrod_end), stats_path);
+        startEmbeddedInputD(std::move(inputd_end), kbd_devices, rt);
+    } else {
+        daemon = make_unique<MacroDaemon>(socket_path, stats_path);
+    }
+    unique_ptr<RealTime::JitterProbe> jitter;
+    if (jitter_probe)
+        jitter = make_unique<RealTime::JitterProbe>(rt, "macrod");
     try {
-        daemon.run();
+        RealTime::enterThread(rt, "macrod");
+        daemon->run();
     } catch (exception &e) {
         cout << e.what() << endl;
         syslog(LOG_CRIT, "macrod: %s", e.what());
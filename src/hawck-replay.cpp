@@ -0,0 +1,288 @@
+/** @file hawck-replay.cpp
+ *
+ * @brief Replay a trace recorded with hawck-inputd --record against a running
+ *        MacroD, and report the latency of each event.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+
+#include "KBDDaemon.hpp"
+#include "Trace.hpp"
+#include "TraceReplay.hpp"
+
+#if MESON_COMPILE
+#include <hawck_config.h>
+#else
+#define VERSION "unknown"
+#endif
+
+extern "C" {
+    #include <getopt.h>
+    #include <signal.h>
+    #include <syslog.h>
+}
+
+using namespace std;
+
+static int no_check;
+static int show_stats;
+
+/** Write the OUTPUT records for a key event and its SYN_REPORT in a
+ *  generated trace, as written with the script from hawck-replay-bench.sh
+ *  loaded: a is replaced by a tap of b, for both the press and the release,
+ *  everything else passes through. */
+static void expectOutput(TraceWriter &writer, uint64_t time_us, int code, int value) {
+    TraceRecord rec;
+    rec.time_us = time_us;
+    rec.kind = TraceRecord::OUTPUT;
+    auto out = [&](int type, int code, int value) {
+        rec.type = type;
+        rec.code = code;
+        rec.value = value;
+        writer.write(rec);
+    };
+    if (code == KEY_A) {
+        for (int v : {1, 0}) {
+            out(EV_KEY, KEY_B, v);
+            out(EV_SYN, SYN_REPORT, 0);
+        }
+    } else {
+        out(EV_KEY, code, value);
+    }
+    out(EV_SYN, SYN_REPORT, 0);
+}
+
+/** Write a trace that types the alphabet n times, 10ms between each event. */
+static void generateTrace(const string &path, int n) {
+    TraceWriter writer(path);
+    TraceRecord rec;
+    rec.handle = 1;
+    rec.kind = TraceRecord::DEVICE;
+    rec.type = BUS_USB;
+    rec.code = 0x1;
+    rec.value = 0x1;
+    writer.write(rec);
+
+    static const int keys[] = {
+        KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I,
+        KEY_J, KEY_K, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R,
+        KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+    };
+    rec.kind = TraceRecord::INPUT;
+    for (int i = 0; i < n; i++) {
+        for (int key : keys) {
+            for (int value : {1, 0}) {
+                rec.time_us += 10000;
+                rec.type = EV_KEY;
+                rec.code = key;
+                rec.value = value;
+                writer.write(rec);
+                rec.type = EV_SYN;
+                rec.code = SYN_REPORT;
+                rec.value = 0;
+                writer.write(rec);
+                expectOutput(writer, rec.time_us, key, value);
+            }
+        }
+    }
+    writer.flush();
+}
+
+/** Compare the output of the replay to the output in the trace.
+ *
+ * @return Number of events that differed.
+ */
+static size_t compareOutput(const vector<TraceRecord> &records,
+                            const vector<input_event> &captured)
+{
+    vector<const TraceRecord *> expected;
+    for (const auto &rec : records)
+        if (rec.kind == TraceRecord::OUTPUT)
+            expected.push_back(&rec);
+
+    size_t mismatches = 0;
+    size_t n = max(expected.size(), captured.size());
+    for (size_t i = 0; i < n; i++) {
+        if (i < expected.size() && i < captured.size() &&
+            expected[i]->type == captured[i].type &&
+            expected[i]->code == captured[i].code &&
+            expected[i]->value == captured[i].value)
+            continue;
+        if (mismatches++ < 10) {
+            cout << "Output " << i << " differs: expected ";
+            if (i < expected.size())
+                cout << "(" << expected[i]->type << ", " << expected[i]->code << ", "
+                     << expected[i]->value << ")";
+            else
+                cout << "nothing";
+            cout << ", got ";
+            if (i < captured.size())
+                cout << "(" << captured[i].type << ", " << captured[i].code << ", "
+                     << captured[i].value << ")";
+            else
+                cout << "nothing";
+            cout << endl;
+        }
+    }
+    return mismatches;
+}
+
+static void report(vector<uint64_t> lat) {
+    cout << "events: " << lat.size() << endl;
+    if (lat.empty())
+        return;
+    sort(lat.begin(), lat.end());
+    auto pct = [&](double q) {
+        return lat[min(lat.size() - 1, (size_t) (q * lat.size()))];
+    };
+    double mean = accumulate(lat.begin(), lat.end(), 0.0) / lat.size();
+    cout << fixed << setprecision(1)
+         << "mean:   " << mean << " µs" << endl
+         << "p50:    " << pct(0.50) << " µs" << endl
+         << "p90:    " << pct(0.90) << " µs" << endl
+         << "p99:    " << pct(0.99) << " µs" << endl
+         << "max:    " << lat.back() << " µs" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+
+    string HELP =
+        "Usage: hawck-replay [--socket <path>] [--speed <factor>] [--no-check] [--stats]\n"
+        "                    <trace>\n"
+        "       hawck-replay --generate <n> <trace>\n"
+        "\n"
+        "Replay a trace recorded with hawck-inputd --record against a MacroD that\n"
+        "was started with --socket, and report the time it took to handle each\n"
+        "event.\n"
+        "\n"
+        "Options:\n"
+        "  --socket      Socket that MacroD listens on.\n"
+        "  --speed       Replay the trace this many times faster than it was\n"
+        "                recorded, 0 replays it as fast as possible (default.)\n"
+        "  --no-check    Don't compare the output to the output in the trace.\n"
+        "  --stats       Show the time spent in each stage of InputD.\n"
+        "  --generate    Write a trace that types the alphabet n times, with the\n"
+        "                output expected from the script in hawck-replay-bench.sh.\n"
+        "  -h, --help    Display this help information.\n"
+        "  --version     Display version and exit.\n"
+    ;
+
+    static struct option long_options[] =
+        {
+            {"no-check", no_argument, &no_check, 1},
+            {"stats", no_argument, &show_stats, 1},
+            {"socket", required_argument, 0, 0},
+            {"speed", required_argument, 0, 0},
+            {"generate", required_argument, 0, 0},
+            {"version", no_argument, 0, 0},
+            {"help", no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+    int option_index = 0;
+
+    string socket_path = "/var/lib/hawck-input/kbd.sock";
+    double speed = 0;
+    int generate = 0;
+    unordered_map<string, function<void(const string& opt)>> long_handlers = {
+        {"version", [&](const string&) {
+                        cout << "hawck-replay v" VERSION << endl;
+                        exit(0);
+                    }},
+        {"socket", [&](const string& opt) { socket_path = opt; }},
+        {"speed", [&](const string& opt) {
+                      try {
+                          speed = stod(opt);
+                      } catch (const exception &e) {
+                          cout << "--speed: Require a number" << endl;
+                          exit(1);
+                      }
+                  }},
+        {"generate", [&](const string& opt) {
+                         try {
+                             generate = stoi(opt);
+                         } catch (const exception &e) {
+                             cout << "--generate: Require an integer" << endl;
+                             exit(1);
+                         }
+                     }},
+    };
+
+    do {
+        int c = getopt_long(argc, argv, "h", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 0: {
+                if (long_options[option_index].flag != 0)
+                    break;
+                string name(long_options[option_index].name);
+                string arg(optarg ? optarg : "");
+                if (long_handlers.find(name) != long_handlers.end())
+                    long_handlers[name](arg);
+                break;
+            }
+
+            case 'h':
+                cout << HELP;
+                exit(0);
+
+            default:
+                cout << HELP;
+                exit(1);
+        }
+    } while (true);
+
+    if (optind != argc - 1) {
+        cout << HELP;
+        return 1;
+    }
+    string trace_path = argv[optind];
+
+    openlog("hawck-replay", LOG_PERROR, LOG_USER);
+
+    try {
+        if (generate > 0) {
+            generateTrace(trace_path, generate);
+            return 0;
+        }
+
+        auto records = TraceReader(trace_path).readAll();
+        TraceInputSource source(records, speed);
+        CaptureUDevice sink;
+        {
+            KBDDaemon daemon(&source, &sink, socket_path);
+            daemon.run();
+        }
+
+        report(source.getLatencies());
+        cout << "output: " << sink.getEvents().size() << " events" << endl;
+        if (show_stats)
+            cout << Stats::get().report().text();
+
+        bool has_output = any_of(records.begin(), records.end(), [](const auto &rec) {
+            return rec.kind == TraceRecord::OUTPUT;
+        });
+        if (!no_check && !has_output) {
+            cout << "The trace has no output to compare with, use --no-check to replay it "
+                    "without checking" << endl;
+            return 1;
+        }
+        if (!no_check) {
+            size_t mismatches = compareOutput(records, sink.getEvents());
+            if (mismatches) {
+                cout << mismatches << " output events differ from the trace" << endl;
+                return 1;
+            }
+            cout << "output matches the trace" << endl;
+        }
+    } catch (const exception &e) {
+        cout << "Error: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,70 @@
+-- Programming mode is activated by pressing down the f7 key.
+-- It is only run when a key is not being released (-up)
+__match[mode("Programming mode", down + key "f7") + -up] = MatchScope.new(function (__match)
+    -- When caps-lock is pressed, substitute with escape
+    __match[key "caps"] = insert "escape"
+    __match[shift] = MatchScope.new(function (__match)
+        __match[key "f"] = function ()
+            local obj = {
+               a = {
+                 1
+               }
+            }
+            u.puts(obj)
+        end
+        -- When shift is held, turn ø/æ into [/]
+        __match[key "ø"] = insert "["
+        __match[key "æ"] = insert "]"
+    end)
+    -- Turn ø/æ into {/}
+    __match[key "ø"] = insert "{"
+    __match[key "æ"] = insert "}"
+    __match[key "v"] = write "key \"a\" => replace \"b\""
+end)
+
+s = [===[
+  string
+[[ [[ ]] [[ ]]
+[====[
+[=]
+]=]
+[========[
+mode("Programming mode", down + key "f7") + -up => {
+    -- When caps-lock is pressed, substitute with escape
+    key "caps" => insert "escape"
+    shift => {
+        key "f" => function ()
+            local obj = {
+               a = {
+                 1
+               }
+            }
+            u.puts(obj)
+        end
+        -- When shift is held, turn ø/æ into [/]
+        key "ø" => insert "["
+        key "æ" => insert "]"
+    }
+    -- Turn ø/æ into {/}
+    key "ø" => insert "{"
+    key "æ" => insert "}"
+}
+]===]
+
+--[[
+  comment => b
+--]]
+
+--[=[
+  this => that
+--]=]
+
+__match[key "f2"] = insert "s"
+--key "f2" => insert "s"
+
+__match[down + key "f3"] = MatchScope.new(function (__match)
+    insert "s"
+end)
+-- down + key "f3" => {
+--    insert "s"
+-- }
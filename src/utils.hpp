@@ -5,8 +5,10 @@
  * @brief Miscellaneous utilities used throughout hawck.
  */
 
+#include <cstdio>
 #include <memory>
 #include <sstream>
+#include <fstream>
 #include <regex>
 
 extern "C" {
@@ -214,6 +216,33 @@ inline std::string realpath_safe(const std::string& path) {
     return std::string(rpath_chars.get());
 }
 
+/**
+ * Read the contents of a file.
+ *
+ * @throws SystemError if the file cannot be read.
+ */
+inline std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.is_open())
+        throw SystemError("Unable to open file: " + path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+/**
+ * 64-bit FNV-1a hash, used for content addressing. Unlike std::hash it is
+ * stable across builds, so it can be stored on disk.
+ */
+inline uint64_t hashFNV1a(const std::string& data,
+                          uint64_t h = 0xcbf29ce484222325ULL) noexcept {
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
 inline std::string readlink(const std::string& path) {
     char link_path[PATH_MAX];
     if (readlink(path.c_str(), link_path, sizeof(link_path)) == -1) {
@@ -273,6 +302,28 @@ static inline bool stringStartsWith(const std::string& a, const std::string& b)
     return a.size() > b.size() && a.substr(0, b.size()) == b;
 }
 
+/**
+ * Quote a string as a JSON string literal.
+ */
+inline std::string jsonString(const std::string &str) {
+    std::string out = "\"";
+    for (char c : str) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
 
 template <int num> constexpr int countT() {
     return num;
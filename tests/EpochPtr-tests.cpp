@@ -0,0 +1,104 @@
+#include "EpochPtr.hpp"
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/** Counts live instances, and checks that it is still alive when read. */
+struct Version {
+    static atomic<int> live;
+    int n;
+    atomic<bool> alive{true};
+    explicit Version(int n) : n(n) { live++; }
+    ~Version() {
+        alive = false;
+        live--;
+    }
+};
+
+atomic<int> Version::live(0);
+
+TEST_CASE("Publish", "[EpochPtr]") {
+    {
+        EpochPtr<Version> ptr(make_unique<Version>(0));
+        auto reader = ptr.reader();
+        REQUIRE(reader.lock()->n == 0);
+        ptr.publish(make_unique<Version>(1));
+        REQUIRE(reader.lock()->n == 1);
+        REQUIRE(ptr.current()->n == 1);
+        // The old version is only freed by reclaim().
+        REQUIRE(ptr.pending() == 1);
+        REQUIRE(Version::live == 2);
+        // Nobody was reading the old version.
+        ptr.reclaim();
+        REQUIRE(ptr.pending() == 0);
+        REQUIRE(Version::live == 1);
+    }
+    REQUIRE(Version::live == 0);
+}
+
+TEST_CASE("Readers keep old versions alive", "[EpochPtr]") {
+    {
+        EpochPtr<Version> ptr(make_unique<Version>(0));
+        auto reader = ptr.reader();
+        {
+            auto guard = reader.lock();
+            ptr.publish(make_unique<Version>(1));
+            ptr.publish(make_unique<Version>(2));
+            REQUIRE(guard->n == 0);
+            REQUIRE(guard->alive);
+            REQUIRE(ptr.pending() == 2);
+        }
+        ptr.reclaim();
+        REQUIRE(ptr.pending() == 0);
+        REQUIRE(Version::live == 1);
+
+        // A reader that started after a version was replaced does not keep
+        // it alive.
+        auto guard = reader.lock();
+        ptr.publish(make_unique<Version>(3));
+        REQUIRE(ptr.pending() == 1);
+        auto other = ptr.reader();
+        {
+            auto other_guard = other.lock();
+            REQUIRE(other_guard->n == 3);
+        }
+    }
+    REQUIRE(Version::live == 0);
+}
+
+TEST_CASE("Concurrent readers and writers", "[EpochPtr]") {
+    {
+        EpochPtr<Version> ptr(make_unique<Version>(0));
+        atomic<bool> stop(false);
+        atomic<bool> ok(true);
+        vector<thread> readers;
+        for (int i = 0; i < 4; i++) {
+            readers.emplace_back([&]() {
+                auto reader = ptr.reader();
+                int last = 0;
+                while (!stop) {
+                    auto guard = reader.lock();
+                    if (!guard->alive || guard->n < last)
+                        ok = false;
+                    last = guard->n;
+                }
+            });
+        }
+        for (int i = 1; i <= 20000; i++) {
+            ptr.publish(make_unique<Version>(i));
+            if (i % 16 == 0)
+                ptr.reclaim();
+        }
+        stop = true;
+        for (auto &t : readers)
+            t.join();
+        REQUIRE(ok);
+        ptr.reclaim();
+        REQUIRE(ptr.pending() == 0);
+        REQUIRE(Version::live == 1);
+    }
+    REQUIRE(Version::live == 0);
+}
@@ -0,0 +1,118 @@
+#include "FlightRecorder.hpp"
+#include <catch2/catch.hpp>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <linux/input-event-codes.h>
+    #include <stdlib.h>
+}
+
+using namespace std;
+namespace fs = std::filesystem;
+
+/** A directory that is removed at the end of the test. */
+struct RingDir {
+    string path;
+
+    RingDir() {
+        char tmpl[] = "/tmp/hawck-flight.XXXXXX";
+        REQUIRE(mkdtemp(tmpl) != nullptr);
+        path = tmpl;
+    }
+
+    ~RingDir() {
+        fs::remove_all(path);
+    }
+};
+
+TEST_CASE("Records are read back", "[FlightRecorder]") {
+    RingDir dir;
+    string path = dir.path + "/flight.ring";
+    {
+        FlightRecorder rec;
+        REQUIRE(!rec.enabled());
+        rec.record(FlightRecord::INPUT, 1, KEY_A, 1);
+        rec.open(path, "inputd", false);
+        REQUIRE(rec.enabled());
+        rec.record(FlightRecord::INPUT, 1, KEY_A, 1, 3);
+        rec.record(FlightRecord::INPUT, 2, KEY_LEFTSHIFT, 1, 3);
+        rec.record(FlightRecord::MATCH, 2, KEY_LEFTSHIFT, 1, 0, "a-very-long-script-name-that-is-cut.hwk");
+    }
+
+    // Still there after the recorder is gone, as after a crash.
+    FlightReader ring(path);
+    REQUIRE(ring.getInfo().daemon == "inputd");
+    REQUIRE(!ring.getInfo().keys);
+    REQUIRE(ring.getInfo().written == 3);
+    const auto &recs = ring.records();
+    REQUIRE(recs.size() == 3);
+    REQUIRE(recs[0].kind == FlightRecord::INPUT);
+    REQUIRE(recs[0].arg == 3);
+    // Only modifiers are kept when keys are not recorded.
+    REQUIRE(recs[0].code == 0);
+    REQUIRE(recs[0].value == 1);
+    REQUIRE(recs[1].code == KEY_LEFTSHIFT);
+    REQUIRE(string(recs[2].name) == "a-very-long-script-name-tha");
+    REQUIRE(recs[0].time_ns <= recs[2].time_ns);
+}
+
+TEST_CASE("Wraps around", "[FlightRecorder]") {
+    RingDir dir;
+    string path = dir.path + "/flight.ring";
+    FlightRecorder rec;
+    rec.open(path, "macrod", true, 0600, "", 10);
+    for (int i = 1; i <= 100; i++)
+        rec.record(FlightRecord::RECV, i, KEY_A, 0);
+
+    FlightReader ring(path);
+    REQUIRE(ring.getInfo().keys);
+    // Rounded up to a power of two.
+    REQUIRE(ring.getInfo().capacity == 16);
+    const auto &recs = ring.records();
+    REQUIRE(recs.size() == 16);
+    REQUIRE(recs.front().event == 85);
+    REQUIRE(recs.back().event == 100);
+    REQUIRE(recs.back().code == KEY_A);
+}
+
+TEST_CASE("Concurrent writers", "[FlightRecorder]") {
+    RingDir dir;
+    string path = dir.path + "/flight.ring";
+    FlightRecorder rec;
+    rec.open(path, "inputd", true, 0600, "", 1 << 16);
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back([&rec, t]() {
+            for (int i = 0; i < 1000; i++)
+                rec.record(FlightRecord::INPUT, t * 1000 + i, KEY_A + t, 1);
+        });
+    for (auto &t : threads)
+        t.join();
+
+    FlightReader ring(path);
+    REQUIRE(ring.records().size() == 4000);
+    for (const auto &r : ring.records())
+        REQUIRE(r.code == KEY_A + r.event / 1000);
+}
+
+TEST_CASE("Previous ring is kept", "[FlightRecorder]") {
+    RingDir dir;
+    string path = dir.path + "/flight.ring";
+    {
+        FlightRecorder rec;
+        rec.open(path, "macrod", false);
+        rec.record(FlightRecord::RECONNECT, 7);
+    }
+    FlightRecorder rec;
+    rec.open(path, "macrod", false);
+
+    REQUIRE(FlightReader(path).records().empty());
+    FlightReader prev(path + ".prev");
+    REQUIRE(prev.records().size() == 1);
+    REQUIRE(prev.records()[0].kind == FlightRecord::RECONNECT);
+    REQUIRE(prev.records()[0].event == 7);
+    REQUIRE_THROWS(FlightReader(dir.path + "/missing.ring"));
+}
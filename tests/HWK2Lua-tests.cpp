@@ -0,0 +1,55 @@
+#include "HWK2Lua.hpp"
+#include "utils.hpp"
+#include <catch2/catch.hpp>
+#include <string>
+
+using namespace std;
+
+// Output of hwk2lua.py for the same input.
+const char programming_mode_hwk[] = "../src/hwk2lua/tests/programming_mode.hwk";
+const char programming_mode_lua[] = "../src/hwk2lua/tests/programming_mode.lua";
+
+TEST_CASE("Same output as hwk2lua.py", "[HWK2Lua]") {
+    REQUIRE(hwk2lua(readFile(programming_mode_hwk)) == readFile(programming_mode_lua));
+}
+
+TEST_CASE("Patterns", "[HWK2Lua]") {
+    REQUIRE(hwk2lua("key \"a\" => insert \"b\"\n") ==
+            "__match[key \"a\"] = insert \"b\"\n");
+    REQUIRE(hwk2lua("  down + key \"a\" => {\n  key \"b\" => say \"c\"\n}\n") ==
+            "  __match[down + key \"a\"] = MatchScope.new(function (__match)\n"
+            "  __match[key \"b\"] = say \"c\"\n"
+            "end)\n");
+    // Tables are left alone.
+    REQUIRE(hwk2lua("t = {1, {2}}\n") == "t = {1, {2}}\n");
+    // Python reads files with universal newlines.
+    REQUIRE(hwk2lua("key \"a\" => f\r\nkey \"b\" => g\r") ==
+            "__match[key \"a\"] = f\n__match[key \"b\"] = g\n");
+}
+
+TEST_CASE("Comments and strings", "[HWK2Lua]") {
+    REQUIRE(hwk2lua("-- a => b {\n") == "-- a => b {\n");
+    REQUIRE(hwk2lua("x = \"a => {\"\n") == "x = \"a => {\"\n");
+    REQUIRE(hwk2lua("--[[\na => b\n--]]\n") == "--[[\na => b\n--]]\n");
+    // Like hwk2lua.py, a long comment only ends with a matching --]]
+    REQUIRE(hwk2lua("--[[ ]] a => b\n") == "--[[ ]] a => b\n");
+}
+
+TEST_CASE("Unbalanced braces", "[HWK2Lua]") {
+    REQUIRE_THROWS_AS(hwk2lua("a => {\n"), HWKParseError);
+    REQUIRE_THROWS_AS(hwk2lua("}\n"), HWKParseError);
+}
+
+TEST_CASE("Cache", "[HWK2Lua]") {
+    HWK2LuaCache cache(2);
+    string a = "key \"a\" => f\n", b = "key \"b\" => g\n", c = "key \"c\" => h\n";
+    REQUIRE(cache.get(a) == hwk2lua(a));
+    REQUIRE(cache.get(b) == hwk2lua(b));
+    REQUIRE(cache.get(a) == hwk2lua(a));
+    REQUIRE(cache.size() == 2);
+    // b is the least recently used.
+    REQUIRE(cache.get(c) == hwk2lua(c));
+    REQUIRE(cache.size() == 2);
+    REQUIRE_THROWS_AS(cache.get("{"), HWKParseError);
+    REQUIRE(cache.size() == 2);
+}
@@ -0,0 +1,177 @@
+#include "LoadGen.hpp"
+#include <catch2/catch.hpp>
+#include <map>
+#include <set>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+static size_t countKeys(const vector<ScheduledEvent> &load) {
+    size_t n = 0;
+    for (const auto &ev : load)
+        n += ev.action.ev.type == EV_KEY;
+    return n;
+}
+
+/** Run a load through a loop that echoes every event, calling mangle() on
+ *  the events before they are written. */
+template <class F>
+static LoadResult echo(LoadInputSource &src, const LoadPattern &pattern, F mangle) {
+    LoadUDevice sink;
+    src.start();
+    KBDAction action;
+    while (!src.finished()) {
+        if (!src.getEvent(&action))
+            continue;
+        mangle(action.ev, sink);
+        sink.flush();
+        src.done();
+    }
+    return analyzeLoad(src, sink, pattern);
+}
+
+TEST_CASE("Generated loads", "[LoadGen]") {
+    for (const auto &name : LoadPattern::names()) {
+        LoadPattern pattern;
+        pattern.name = name;
+        pattern.rate = 200;
+        pattern.duration_s = 2;
+        pattern.devices = 3;
+        pattern.hold_ms = 100;
+        auto load = generateLoad(pattern);
+        INFO(name);
+
+        // Close to the rate, and in order.
+        double rate = countKeys(load) / pattern.duration_s;
+        REQUIRE(rate > 0.9 * pattern.rate);
+        REQUIRE(rate < 1.1 * pattern.rate);
+        for (size_t i = 1; i < load.size(); i++)
+            REQUIRE(load[i - 1].at_ns <= load[i].at_ns);
+
+        // Every key that goes down comes back up, on the same device.
+        map<pair<int, int>, bool> down;
+        set<int> handles;
+        for (const auto &ev : load) {
+            if (ev.action.ev.type != EV_KEY)
+                continue;
+            handles.insert(ev.action.kbd_handle);
+            down[{ev.action.kbd_handle, ev.action.ev.code}] = ev.action.ev.value != 0;
+        }
+        for (const auto &[key, is_down] : down)
+            REQUIRE(!is_down);
+        REQUIRE(handles.size() == (name == "macro" ? 1 : 3));
+    }
+
+    LoadPattern bad;
+    bad.name = "nope";
+    REQUIRE_THROWS_AS(generateLoad(bad), invalid_argument);
+    bad.name = "typing";
+    bad.rate = 0;
+    REQUIRE_THROWS_AS(generateLoad(bad), invalid_argument);
+}
+
+TEST_CASE("A clean load", "[LoadGen]") {
+    LoadPattern pattern;
+    pattern.rate = 2000;
+    pattern.duration_s = 0.05;
+    LoadInputSource src(generateLoad(pattern));
+    auto res = echo(src, pattern, [](const input_event &ev, LoadUDevice &sink) {
+        sink.emit(&ev);
+    });
+
+    REQUIRE(res.key_events == 100);
+    REQUIRE(res.handled == 100);
+    REQUIRE(res.written == 100);
+    REQUIRE(res.dropped == 0);
+    REQUIRE(res.lost == 0);
+    REQUIRE(res.reordered == 0);
+    REQUIRE(res.stuck.empty());
+    REQUIRE(res.queue_us.size() == 100);
+}
+
+TEST_CASE("Lost, reordered and stuck keys", "[LoadGen]") {
+    LoadPattern pattern;
+    pattern.rate = 2000;
+    pattern.duration_s = 0.05;
+    LoadInputSource src(generateLoad(pattern));
+
+    // Hold back the first release, and write it after the next press, and
+    // never release the last key.
+    bool held = false, sent = false;
+    input_event first_up;
+    auto res = echo(src, pattern, [&](const input_event &ev, LoadUDevice &sink) {
+        if (ev.type == EV_KEY && ev.value == 0 && !held) {
+            first_up = ev;
+            held = true;
+            return;
+        }
+        if (ev.type == EV_KEY && ev.code == KEY_X && ev.value == 0)
+            return;
+        sink.emit(&ev);
+        if (held && !sent && ev.type == EV_KEY && ev.value == 1) {
+            sink.emit(&first_up);
+            sent = true;
+        }
+    });
+
+    REQUIRE(res.reordered == 1);
+    REQUIRE(res.lost == 1);
+    REQUIRE(res.stuck == vector<int>{KEY_X});
+}
+
+TEST_CASE("Overflowing the queue", "[LoadGen]") {
+    LoadPattern pattern;
+    pattern.rate = 2000;
+    pattern.duration_s = 0.1;
+    LoadInputSource src(generateLoad(pattern), 4);
+    auto res = echo(src, pattern, [](const input_event &ev, LoadUDevice &sink) {
+        // Far slower than the load.
+        this_thread::sleep_for(5ms);
+        sink.emit(&ev);
+    });
+
+    REQUIRE(res.dropped > 0);
+    REQUIRE(res.dropped <= src.getDropped());
+    REQUIRE(res.handled + res.dropped == res.key_events);
+    REQUIRE(!res.keptUp());
+}
+
+TEST_CASE("Macro output", "[LoadGen]") {
+    LoadPattern pattern;
+    pattern.name = "macro";
+    pattern.rate = 200;
+    pattern.duration_s = 0.05;
+    pattern.macro_events = 4;
+
+    // A script that types "ab" on each press, and the release passes.
+    auto type = [&](size_t letters) {
+        return [&pattern, letters](const input_event &ev, LoadUDevice &sink) {
+            if (ev.type == EV_KEY && ev.code == pattern.trigger && ev.value == 1) {
+                for (size_t i = 0; i < letters; i++) {
+                    sink.emit(EV_KEY, KEY_A + i, 1);
+                    sink.emit(EV_KEY, KEY_A + i, 0);
+                }
+                return;
+            }
+            sink.emit(&ev);
+        };
+    };
+
+    LoadInputSource full(generateLoad(pattern));
+    auto res = echo(full, pattern, type(2));
+    REQUIRE(res.macro_expected == 5 * 4);
+    REQUIRE(res.macro_missing == 0);
+    REQUIRE(res.lost == 0);
+
+    LoadInputSource truncated(generateLoad(pattern));
+    res = echo(truncated, pattern, type(1));
+    REQUIRE(res.macro_missing == 5 * 2);
+    REQUIRE(res.lost == 5 * 2);
+
+    // Nothing written at all.
+    LoadInputSource missing(generateLoad(pattern));
+    res = echo(missing, pattern, type(0));
+    REQUIRE(res.macro_missing == 5 * 4);
+    REQUIRE(res.lost == 5 * 4);
+}
@@ -0,0 +1,93 @@
+#include "LocalChannel.hpp"
+#include <catch2/catch.hpp>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+struct Packet {
+    int n;
+};
+
+TEST_CASE("Packets arrive in order", "[LocalChannel]") {
+    auto [a, b] = LocalChannel<Packet>::pair(8);
+
+    // More than fits in the ring, so the sender has to wait for room.
+    vector<Packet> packets;
+    for (int i = 0; i < 1000; i++)
+        packets.push_back({i});
+    thread sender([&a = a, &packets]() { a->send(packets); });
+
+    for (int i = 0; i < 1000; i++) {
+        Packet p;
+        b->recv(&p, 1000ms);
+        REQUIRE(p.n == i);
+    }
+    sender.join();
+
+    // And back again.
+    Packet p = {-1};
+    b->send(&p);
+    REQUIRE(a->poll(0ms));
+    a->recv(&p);
+    REQUIRE(p.n == -1);
+    REQUIRE(!a->poll(0ms));
+}
+
+TEST_CASE("Timeouts", "[LocalChannel]") {
+    auto [a, b] = LocalChannel<Packet>::pair();
+    Packet p;
+    REQUIRE(!b->poll(10ms));
+    REQUIRE_THROWS_AS(b->recv(&p, 10ms), SocketTimeout);
+    (void) a;
+}
+
+TEST_CASE("Closing", "[LocalChannel]") {
+    auto [a, b] = LocalChannel<Packet>::pair();
+    Packet p = {1};
+    a->send(&p);
+
+    // Wakes up a thread that is waiting.
+    thread closer([&a = a]() {
+        this_thread::sleep_for(10ms);
+        a.reset();
+    });
+    // What was sent before the channel was closed can still be received.
+    b->recv(&p);
+    REQUIRE(p.n == 1);
+    try {
+        b->recv(&p, 10000ms);
+        FAIL("recv() did not throw");
+    } catch (const SocketTimeout &) {
+        FAIL("recv() timed out");
+    } catch (const SocketError &) {}
+    closer.join();
+
+    REQUIRE(b->poll(-1ms));
+    REQUIRE_THROWS_AS(b->send(&p), SocketError);
+}
+
+TEST_CASE("Reconnecting", "[LocalChannel]") {
+    auto [a, b] = LocalChannel<Packet>::pair();
+    Packet p = {1};
+    a->send(&p);
+
+    // a gives up on the reply and resets the channel, b notices when it
+    // replies, and resets it as well.
+    thread resetter([&a = a]() { a->recon(); });
+    b->recv(&p);
+    // Returns once the channel is closed.
+    REQUIRE(b->poll(1000ms));
+    p.n = 2;
+    REQUIRE_THROWS_AS(b->send(&p), SocketError);
+    b->recon();
+    resetter.join();
+
+    // The reply that didn't get through is gone.
+    REQUIRE(!a->poll(0ms));
+    p.n = 3;
+    b->send(&p);
+    a->recv(&p, 1000ms);
+    REQUIRE(p.n == 3);
+}
@@ -0,0 +1,118 @@
+#include "LuaAllocator.hpp"
+#include "LuaUtils.hpp"
+#include <catch2/catch.hpp>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <lauxlib.h>
+    #include <lualib.h>
+}
+
+using namespace std;
+using namespace Lua;
+
+static const char *churn = R"(
+    local t = {}
+    for i = 1, 100000 do
+        t[i % 100 + 1] = {i, tostring(i), function () return i end}
+    end
+    local s = ""
+    for i = 1, 1000 do s = s .. "x" end
+    return #s
+)";
+
+TEST_CASE("Accounting", "[LuaAllocator]") {
+    MemoryAccount acc;
+    lua_State *L = newState(&acc);
+    REQUIRE(L != nullptr);
+    luaL_openlibs(L);
+    REQUIRE(luaL_dostring(L, churn) == LUA_OK);
+    REQUIRE(lua_tointeger(L, -1) == 1000);
+    lua_pop(L, 1);
+
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    REQUIRE(acc.bytes / 1024 == size_t(lua_gc(L, LUA_GCCOUNT, 0)));
+    REQUIRE(acc.peak >= acc.bytes);
+    REQUIRE(acc.allocs > 100000);
+    REQUIRE(acc.allocs > acc.frees);
+
+    lua_close(L);
+    REQUIRE(acc.bytes == 0);
+    REQUIRE(acc.allocs == acc.frees);
+}
+
+TEST_CASE("Limit", "[LuaAllocator]") {
+    MemoryAccount acc;
+    lua_State *L = newState(&acc);
+    luaL_openlibs(L);
+    acc.limit = 1024 * 1024;
+
+    REQUIRE(luaL_loadstring(L, "local t = {} for i = 1, 1e7 do t[i] = i end") == LUA_OK);
+    REQUIRE(lua_pcall(L, 0, 0, 0) == LUA_ERRMEM);
+    REQUIRE(acc.exceeded);
+    REQUIRE(acc.bytes <= acc.limit);
+    lua_pop(L, 1);
+
+    // The state is still usable after running into the limit, refused
+    // allocations of garbage are retried after an emergency collection.
+    REQUIRE(luaL_dostring(L, churn) == LUA_OK);
+
+    lua_close(L);
+    REQUIRE(acc.bytes == 0);
+}
+
+TEST_CASE("Recovering from the limit", "[LuaAllocator]") {
+    Lua::Script sc;
+    const size_t limit = 2 * 1024 * 1024;
+    sc.setMemoryLimit(limit);
+    REQUIRE(luaL_dostring(sc.getL(), R"(
+        function garbage()
+            collectgarbage("stop")
+            for i = 1, 1e6 do local t = {i} end
+            collectgarbage("restart")
+        end
+        function fail() local t = nil; return t.x end
+        function hog() local t = {} for i = 1, 1e8 do t[i] = i end end
+    )") == LUA_OK);
+
+    // Runs into the limit, and recovers after an emergency collection.
+    sc.call("garbage");
+    REQUIRE(sc.memory().peak + 4096 > limit);
+    REQUIRE(!sc.memory().exceeded);
+
+    // So an unrelated error afterwards is not blamed on the limit.
+    try {
+        sc.call("fail");
+        FAIL("fail() did not raise an error");
+    } catch (const LuaError &e) {
+        REQUIRE(e.status == LUA_ERRRUN);
+        REQUIRE(!sc.memoryLimitExceeded(e));
+    }
+
+    try {
+        sc.call("hog");
+        FAIL("hog() did not run out of memory");
+    } catch (const LuaError &e) {
+        REQUIRE(e.status == LUA_ERRMEM);
+        REQUIRE(sc.memoryLimitExceeded(e));
+    }
+}
+
+TEST_CASE("Threads", "[LuaAllocator]") {
+    vector<thread> threads;
+    vector<int> results(4, -1);
+    for (size_t i = 0; i < results.size(); i++) {
+        threads.emplace_back([&results, i]() {
+            MemoryAccount acc;
+            lua_State *L = newState(&acc);
+            luaL_openlibs(L);
+            results[i] = luaL_dostring(L, churn);
+            lua_close(L);
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    for (int r : results)
+        REQUIRE(r == LUA_OK);
+}
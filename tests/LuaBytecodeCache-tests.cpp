@@ -0,0 +1,83 @@
+#include "LuaBytecodeCache.hpp"
+#include <catch2/catch.hpp>
+#include <filesystem>
+#include <string>
+
+extern "C" {
+    #include <lauxlib.h>
+    #include <lualib.h>
+    #include <sys/stat.h>
+}
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static const string source = "return 40 + 2";
+
+/** Compile and store source in the cache. */
+static void store(Lua::BytecodeCache &cache, lua_State *L, const string &src) {
+    REQUIRE(luaL_loadbufferx(L, src.data(), src.size(), "=test", "t") == LUA_OK);
+    cache.store(L, "=test", src);
+    lua_pop(L, 1);
+}
+
+/** Load source from the cache and run it, 0 on a miss. */
+static lua_Integer load(Lua::BytecodeCache &cache, lua_State *L, const string &src) {
+    if (!cache.load(L, "=test", src))
+        return 0;
+    REQUIRE(lua_pcall(L, 0, 1, 0) == LUA_OK);
+    lua_Integer n = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return n;
+}
+
+TEST_CASE("Bytecode cache", "[LuaBytecodeCache]") {
+    char tmpl[] = "/tmp/hawck-bytecode.XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    string dir = tmpl;
+    Lua::BytecodeCache cache(dir);
+    lua_State *L = luaL_newstate();
+    luaL_openlibs(L);
+
+    SECTION("Miss") {
+        REQUIRE(load(cache, L, source) == 0);
+    }
+
+    SECTION("Hit") {
+        store(cache, L, source);
+        REQUIRE(load(cache, L, source) == 42);
+    }
+
+    SECTION("Stale source") {
+        store(cache, L, source);
+        REQUIRE(load(cache, L, "return 41 + 2") == 0);
+        // Overwritten by the next store.
+        store(cache, L, "return 41 + 2");
+        REQUIRE(load(cache, L, "return 41 + 2") == 43);
+        REQUIRE(load(cache, L, source) == 0);
+    }
+
+    SECTION("Entry writable by others") {
+        store(cache, L, source);
+        for (auto &ent : fs::directory_iterator(dir))
+            REQUIRE(chmod(ent.path().c_str(), 0666) == 0);
+        REQUIRE(load(cache, L, source) == 0);
+        for (auto &ent : fs::directory_iterator(dir))
+            REQUIRE(chmod(ent.path().c_str(), 0620) == 0);
+        REQUIRE(load(cache, L, source) == 0);
+        for (auto &ent : fs::directory_iterator(dir))
+            REQUIRE(chmod(ent.path().c_str(), 0644) == 0);
+        REQUIRE(load(cache, L, source) == 42);
+    }
+
+    SECTION("Directory writable by others") {
+        store(cache, L, source);
+        REQUIRE(chmod(dir.c_str(), 0777) == 0);
+        REQUIRE(load(cache, L, source) == 0);
+        REQUIRE(chmod(dir.c_str(), 0700) == 0);
+        REQUIRE(load(cache, L, source) == 42);
+    }
+
+    lua_close(L);
+    fs::remove_all(dir);
+}
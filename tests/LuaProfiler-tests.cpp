@@ -0,0 +1,135 @@
+#include "LuaProfiler.hpp"
+#include "LuaUtils.hpp"
+#include <catch2/catch.hpp>
+#include <filesystem>
+#include <fstream>
+#include <regex>
+
+extern "C" {
+    #include <stdlib.h>
+}
+
+using namespace std;
+using namespace std::chrono;
+namespace fs = std::filesystem;
+
+/** Load code from a file called prof.lua, so that frames are named after
+ *  it. */
+static void loadFile(Lua::Script &sc, const string &code) {
+    char tmpl[] = "/tmp/hawck-prof.XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    string path = string(tmpl) + "/prof.lua";
+    ofstream(path) << code;
+    sc.from(path);
+    fs::remove_all(tmpl);
+}
+
+/** Samples of a profile, or 0 if there are none. */
+static uint64_t samples(const string &folded, const string &stack) {
+    smatch m;
+    regex rx("^" + stack + " ([0-9]+)$");
+    stringstream in(folded);
+    uint64_t n = 0;
+    for (string line; getline(in, line);)
+        if (regex_match(line, m, rx))
+            n += stoull(m[1]);
+    return n;
+}
+
+TEST_CASE("Samples running scripts", "[LuaProfiler]") {
+    Lua::Script sc;
+    loadFile(sc, "function spin(ms)\n"
+                 "  local stop = os.clock() + ms / 1000\n"
+                 "  while os.clock() < stop do end\n"
+                 "end\n");
+
+    sc.setProfile(&Lua::Profiler::get().profile("spinner"));
+    Lua::Profiler::get().setInterval(1ms);
+    sc.call("spin", 200);
+    Lua::Profiler::get().setInterval(0us);
+    sc.setProfile(nullptr);
+
+    string folded = Lua::Profiler::get().folded();
+    INFO(folded);
+    REQUIRE(samples(folded, "spinner;prof\\.lua:3") > 10);
+    // Idle states are not sampled.
+    REQUIRE(samples(folded, "spinner;.*") == samples(folded, "spinner;prof\\.lua:3"));
+}
+
+TEST_CASE("Pattern statistics", "[LuaProfiler]") {
+    Lua::Script sc;
+    sc.addRequirePath({"../src/Lua"});
+    loadFile(sc, "require \"match\"\n"
+                 "scope = MatchScope.new()\n"
+                 "scope[function () return true end] = function () end\n"
+                 "scope[function () return false end] = function () end\n"
+                 "function run()\n"
+                 "  return scope()\n"
+                 "end\n");
+
+    // Not counted until profiling is switched on.
+    sc.call("run");
+    sc.exec("prof", "MatchScope.setProfiling(true)");
+    for (int i = 0; i < 3; i++)
+        sc.call("run");
+
+    // The first pattern matches, so the second one is never tested.
+    sc.exec("prof", "stats = MatchScope.patternStats(scope)");
+    lua_getglobal(sc.getL(), "stats");
+    string stats = lua_tostring(sc.getL(), -1);
+    lua_pop(sc.getL(), 1);
+    REQUIRE(stats == "prof.lua:3\t3\t3\nprof.lua:4\t0\t0");
+}
+
+TEST_CASE("Pattern frames", "[LuaProfiler]") {
+    Lua::Script sc;
+    sc.addRequirePath({"../src/Lua"});
+    loadFile(sc, "require \"match\"\n"
+                 "local function spin(ms)\n"
+                 "  local stop = os.clock() + ms / 1000\n"
+                 "  while os.clock() < stop do end\n"
+                 "end\n"
+                 "scope = MatchScope.new()\n"
+                 "scope[function () spin(200) return false end] = function () end\n"
+                 "function run()\n"
+                 "  return scope()\n"
+                 "end\n");
+
+    sc.setProfile(&Lua::Profiler::get().profile("patterns"));
+    Lua::Profiler::get().setInterval(1ms);
+    sc.call("run");
+    Lua::Profiler::get().setInterval(0us);
+    sc.setProfile(nullptr);
+
+    // Samples in the condition are attributed to the line of the pattern,
+    // run() is gone from the stack because it makes a tail call.
+    string folded = Lua::Profiler::get().folded();
+    INFO(folded);
+    REQUIRE(samples(folded, "patterns;match\\.lua:[0-9]+;"
+                            "pattern@prof\\.lua:7;prof\\.lua:7;prof\\.lua:4") > 10);
+}
+
+TEST_CASE("Deep stacks are cut short", "[LuaProfiler]") {
+    Lua::Script sc;
+    loadFile(sc, "function deep(n)\n"
+                 "  if n == 0 then\n"
+                 "    local stop = os.clock() + 0.2\n"
+                 "    while os.clock() < stop do end\n"
+                 "    return 0\n"
+                 "  end\n"
+                 "  return 1 + deep(n - 1)\n"
+                 "end\n");
+
+    sc.setProfile(&Lua::Profiler::get().profile("deep"));
+    Lua::Profiler::get().setInterval(1ms);
+    sc.call("deep", 1000);
+    Lua::Profiler::get().setInterval(0us);
+    sc.setProfile(nullptr);
+
+    // The innermost frames are kept, the outer ones that don't fit are not.
+    string folded = Lua::Profiler::get().folded();
+    REQUIRE(samples(folded, "deep;(?:prof\\.lua:7;)+prof\\.lua:4") > 10);
+    stringstream in(folded);
+    for (string line; getline(in, line);)
+        REQUIRE(line.size() < Lua::Profile::MAX_STACK_LEN + 32);
+}
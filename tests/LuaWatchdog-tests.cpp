@@ -0,0 +1,66 @@
+#include "LuaWatchdog.hpp"
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <string>
+
+extern "C" {
+    #include <lauxlib.h>
+    #include <lualib.h>
+}
+
+using namespace std;
+using namespace std::chrono;
+using namespace Lua;
+
+static int isHooked(lua_State *L) {
+    lua_pushboolean(L, lua_gethook(L) != nullptr);
+    return 1;
+}
+
+TEST_CASE("Timeout", "[LuaWatchdog]") {
+    lua_State *L = luaL_newstate();
+    WatchdogSlot *slot = Watchdog::get().add(L);
+    auto start = steady_clock::now();
+    {
+        WatchdogGuard guard(slot, Watchdog::ticks(100ms));
+        REQUIRE(luaL_dostring(L, "while true do end") != LUA_OK);
+        REQUIRE(string(lua_tostring(L, -1)).find("Timeout Error") != string::npos);
+        lua_pop(L, 1);
+    }
+    REQUIRE(steady_clock::now() - start < 1s);
+    REQUIRE(lua_gethook(L) == nullptr);
+
+    // The state can be used after a timeout.
+    {
+        WatchdogGuard guard(slot, Watchdog::ticks(100ms));
+        REQUIRE(luaL_dostring(L, "return 1 + 1") == LUA_OK);
+        lua_pop(L, 1);
+    }
+    Watchdog::get().remove(slot);
+    lua_close(L);
+}
+
+TEST_CASE("Stale hook", "[LuaWatchdog]") {
+    lua_State *L = luaL_newstate();
+    WatchdogSlot *slot = Watchdog::get().add(L);
+    lua_register(L, "hooked", isHooked);
+
+    // The watchdog installed its hook after the call it was meant for had
+    // returned and disarmed the slot, with the flag already cleared by a
+    // hook that ran in between.
+    lua_sethook(L, hwk_lua_watchdog_hook, LUA_MASKCOUNT, 1);
+    REQUIRE(!slot->preempt);
+
+    // The next call removes it as soon as it runs, instead of running every
+    // instruction through the hook.
+    {
+        WatchdogGuard guard(slot, Watchdog::ticks(2000ms));
+        REQUIRE(luaL_dostring(L, "local x = 0 for i = 1, 10 do x = x + i end "
+                                 "return hooked()") == LUA_OK);
+        REQUIRE(!lua_toboolean(L, -1));
+        lua_pop(L, 1);
+    }
+    REQUIRE(lua_gethook(L) == nullptr);
+    Watchdog::get().remove(slot);
+    lua_close(L);
+}
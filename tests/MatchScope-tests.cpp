@@ -0,0 +1,125 @@
+#include "LuaUtils.hpp"
+#include <catch2/catch.hpp>
+
+using namespace std;
+
+/** Conditions like the ones in Hawck.lua, on an event that the test sets,
+ *  and a scope that uses every kind of them. */
+static const char *scope_code = R"(
+require "match"
+
+ev = {}
+local function key(c)
+  return Cond.pure(function () return ev.code == c end, {codes = {[c] = true}})
+end
+local down = Cond.pure(function () return ev.value == 1 end, {values = {[1] = true}})
+local up = Cond.pure(function () return ev.value == 0 end, {values = {[0] = true}})
+local any = Cond.pure(function () return true end)
+
+local fired
+function fire(name)
+  return function () fired = name end
+end
+
+scope = MatchScope.new()
+scope[down + key(30)] = fire("down a")
+scope[function () return ev.code == 99 and ev.value == 2 end] = fire("opaque")
+nested = MatchScope.new(function (s)
+  s[down] = fire("nested down")
+  s[key(34)] = fire("never")
+  s[up] = fire("nested up")
+end)
+scope[key(33)] = nested
+scope[key(35) + -down] = MatchScope.new(function (s)
+  s[key(36)] = fire("never")
+  s[Cond.new(function () return true end)] = fire("nested catch-all")
+end)
+scope[key(31) / key(32)] = fire("b or c")
+scope[-key(30) + down] = fire("down not a")
+scope[up + key(30)] = fire("up a")
+scope[any] = fire("catch-all")
+
+local events = {}
+for _, code in ipairs({1, 30, 31, 32, 33, 34, 35, 36, 99}) do
+  for value = 0, 2 do
+    table.insert(events, {code = code, value = value, is_key = true})
+  end
+  table.insert(events, {code = code, value = 1, is_key = false})
+end
+
+--- Handler that fires for each event, "none" if no pattern matches.
+local function run(dispatch)
+  local result = {}
+  for i, e in ipairs(events) do
+    ev = e
+    if dispatch then
+      MatchScope.setEvent(e.code, e.value, e.is_key)
+    end
+    fired = "none"
+    scope()
+    result[i] = fired
+  end
+  return result
+end
+
+--- Events that the linear scan and the dispatch tables disagree on, only
+--  valid before the first event has been set.
+function compare()
+  local linear = run(false)
+  MatchScope.compile(scope)
+  local dispatched = run(true)
+  local diff = {}
+  for i, e in ipairs(events) do
+    if linear[i] ~= dispatched[i] then
+      table.insert(diff, ("%d/%d: %s ~= %s"):format(e.code, e.value, linear[i], dispatched[i]))
+    end
+  end
+  return table.concat(diff, "\n")
+end
+
+--- Handler that fires for a single event, with the dispatch tables.
+function handler(code, value)
+  ev = {code = code, value = value}
+  MatchScope.setEvent(code, value, true)
+  fired = "none"
+  scope()
+  return fired
+end
+)";
+
+TEST_CASE("Dispatch tables select the same handlers as a linear scan", "[MatchScope]") {
+    Lua::Script sc;
+    sc.addRequirePath({"../src/Lua"});
+    sc.exec("match-tests", scope_code);
+
+    auto [diff] = sc.call<string>("compare");
+    REQUIRE(diff == "");
+
+    auto handler = [&](int code, int value) {
+        auto [name] = sc.call<string>("handler", code, value);
+        return name;
+    };
+    REQUIRE(handler(30, 1) == "down a");
+    REQUIRE(handler(30, 0) == "up a");
+    REQUIRE(handler(99, 2) == "opaque");
+    REQUIRE(handler(33, 1) == "nested down");
+    REQUIRE(handler(33, 0) == "nested up");
+    // Nothing in the nested scope matches, so the outer one carries on.
+    REQUIRE(handler(33, 2) == "catch-all");
+    REQUIRE(handler(35, 0) == "nested catch-all");
+    REQUIRE(handler(35, 1) == "down not a");
+    REQUIRE(handler(32, 2) == "b or c");
+    REQUIRE(handler(1, 0) == "catch-all");
+}
+
+TEST_CASE("Dispatch tables are rebuilt when a scope changes", "[MatchScope]") {
+    Lua::Script sc;
+    sc.addRequirePath({"../src/Lua"});
+    sc.exec("match-tests", scope_code);
+    REQUIRE(std::get<0>(sc.call<string>("compare")) == "");
+    REQUIRE(std::get<0>(sc.call<string>("handler", 33, 2)) == "catch-all");
+
+    // The tables of the nested scope were built without this pattern.
+    sc.exec("match-tests", "nested[Cond.new(function () return true end)] = fire(\"added\")");
+    REQUIRE(std::get<0>(sc.call<string>("handler", 33, 2)) == "added");
+}
@@ -0,0 +1,158 @@
+#include "Notifier.hpp"
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+/** Records what would have been shown. */
+struct Recorder {
+    mutex mtx;
+    vector<Notification> shown;
+
+    Notifier::Sender sender() {
+        return [this](const Notification &n) {
+            lock_guard<mutex> lock(mtx);
+            shown.push_back(n);
+            return true;
+        };
+    }
+
+    size_t count() {
+        lock_guard<mutex> lock(mtx);
+        return shown.size();
+    }
+
+    /** Wait until at least n notifications have been shown. */
+    bool waitFor(size_t n, milliseconds timeout = 2000ms) {
+        auto end = steady_clock::now() + timeout;
+        while (count() < n && steady_clock::now() < end)
+            this_thread::sleep_for(1ms);
+        return count() >= n;
+    }
+};
+
+static Notification mk(string title, string msg) {
+    Notification n;
+    n.title = title;
+    n.msg = msg;
+    return n;
+}
+
+TEST_CASE("Queue", "[Notifier]") {
+    BoundedQueue<int> q(5);
+    REQUIRE(q.capacity() == 8);
+    for (int i = 0; i < 8; i++)
+        REQUIRE(q.push(int(i)));
+    REQUIRE(!q.push(8));
+    int v;
+    for (int i = 0; i < 8; i++) {
+        REQUIRE(q.pop(v));
+        REQUIRE(v == i);
+    }
+    REQUIRE(!q.pop(v));
+}
+
+TEST_CASE("Queue with many producers", "[Notifier]") {
+    static constexpr int PER_THREAD = 100000;
+    static constexpr int THREADS = 4;
+    BoundedQueue<int> q(64);
+    vector<thread> producers;
+    for (int t = 0; t < THREADS; t++)
+        producers.emplace_back([&q, t]() {
+            for (int i = 0; i < PER_THREAD; i++)
+                while (!q.push(t * PER_THREAD + i))
+                    this_thread::yield();
+        });
+
+    // Elements from a single producer must come out in order.
+    vector<int> last(THREADS, -1);
+    bool ordered = true;
+    int v;
+    for (int n = 0; n < THREADS * PER_THREAD;) {
+        if (!q.pop(v)) {
+            this_thread::yield();
+            continue;
+        }
+        ordered = ordered && v % PER_THREAD > last[v / PER_THREAD];
+        last[v / PER_THREAD] = v % PER_THREAD;
+        n++;
+    }
+    for (auto &p : producers)
+        p.join();
+    REQUIRE(ordered);
+    REQUIRE(!q.pop(v));
+}
+
+TEST_CASE("Deduplication", "[Notifier]") {
+    Recorder rec;
+    Notifier notifier(rec.sender());
+    notifier.setCoalesceWindow(0);
+    notifier.setRate(0);
+    notifier.start();
+
+    REQUIRE(notifier.push(mk("Lua error", "init.lua:1: boom")));
+    REQUIRE(rec.waitFor(1));
+    for (int i = 0; i < 10; i++)
+        REQUIRE(notifier.push(mk("Lua error", "init.lua:1: boom")));
+    REQUIRE(notifier.push(mk("Loaded", "a.lua")));
+    REQUIRE(rec.waitFor(2));
+    notifier.stop();
+
+    REQUIRE(rec.shown.size() == 2);
+    REQUIRE(rec.shown[1].title == "Loaded");
+    REQUIRE(notifier.getStats().duplicates == 10);
+}
+
+TEST_CASE("Coalescing", "[Notifier]") {
+    Recorder rec;
+    Notifier notifier(rec.sender());
+    notifier.setCoalesceWindow(50);
+    notifier.setRate(0);
+    for (int i = 0; i < 8; i++)
+        REQUIRE(notifier.push(mk("Lua error", "error " + to_string(i))));
+    notifier.push(mk("Loaded", "a.lua"));
+    notifier.start();
+
+    REQUIRE(rec.waitFor(2));
+    this_thread::sleep_for(100ms);
+    notifier.stop();
+
+    REQUIRE(rec.shown.size() == 2);
+    REQUIRE(rec.shown[0].title == "Lua error");
+    REQUIRE(rec.shown[0].msg == "error 0\nerror 1\nerror 2\nerror 3\nerror 4\n(and 3 more)");
+    REQUIRE(rec.shown[1].msg == "a.lua");
+    REQUIRE(notifier.getStats().coalesced == 7);
+}
+
+TEST_CASE("Rate limit", "[Notifier]") {
+    Recorder rec;
+    Notifier notifier(rec.sender());
+    notifier.setCoalesceWindow(0);
+    notifier.setBurst(2);
+    // One token every 200ms.
+    notifier.setRate(300);
+    notifier.start();
+
+    for (int i = 0; i < 4; i++)
+        REQUIRE(notifier.push(mk("Title " + to_string(i), "msg")));
+    REQUIRE(rec.waitFor(2));
+    REQUIRE(rec.count() == 2);
+    // The rest are held back rather than dropped.
+    REQUIRE(rec.waitFor(4));
+    notifier.stop();
+    REQUIRE(rec.shown[3].title == "Title 3");
+}
+
+TEST_CASE("Full queue", "[Notifier]") {
+    Recorder rec;
+    Notifier notifier(rec.sender(), 4);
+    for (int i = 0; i < 4; i++)
+        REQUIRE(notifier.push(mk("Title", to_string(i))));
+    REQUIRE(!notifier.push(mk("Title", "dropped")));
+    REQUIRE(notifier.getStats().dropped == 1);
+    REQUIRE(notifier.getStats().queued == 4);
+}
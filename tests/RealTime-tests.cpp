@@ -0,0 +1,66 @@
+#include "RealTime.hpp"
+#include "Stats.hpp"
+#include <catch2/catch.hpp>
+#include <thread>
+
+using namespace std;
+
+TEST_CASE("Parsing real-time options", "[RealTime]") {
+    using RealTime::Config;
+    REQUIRE(Config::parsePolicy("fifo") == SCHED_FIFO);
+    REQUIRE(Config::parsePolicy("rr") == SCHED_RR);
+    REQUIRE_THROWS_AS(Config::parsePolicy("other"), invalid_argument);
+
+    REQUIRE(Config::parseCPUs("3") == vector<int>{3});
+    REQUIRE(Config::parseCPUs("0,2-4,7") == vector<int>{0, 2, 3, 4, 7});
+    for (auto bad : {"", "a", "1,", "-1", "3-1", "1-", "2x"})
+        REQUIRE_THROWS_AS(Config::parseCPUs(bad), invalid_argument);
+
+    Config cfg;
+    REQUIRE(!cfg.enabled());
+    cfg.validate();
+    cfg.priority = 100;
+    REQUIRE_THROWS_AS(cfg.validate(), invalid_argument);
+    cfg.priority = 10;
+    REQUIRE(cfg.enabled());
+    cfg.cpu_limit_ms = 0;
+    REQUIRE_THROWS_AS(cfg.validate(), invalid_argument);
+}
+
+TEST_CASE("Pinning a thread", "[RealTime]") {
+    // Catch2 assertions aren't thread safe, so the results are checked on
+    // this thread.
+    int affinity = -1, policy = -1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    thread t([&]() {
+        RealTime::Config cfg;
+        cfg.cpus = {0};
+        RealTime::enterThread(cfg, "test");
+        affinity = sched_getaffinity(0, sizeof(set), &set);
+        policy = sched_getscheduler(0);
+    });
+    t.join();
+    REQUIRE(affinity == 0);
+    REQUIRE(CPU_COUNT(&set) == 1);
+    REQUIRE(CPU_ISSET(0, &set));
+    // Not switched without a priority.
+    REQUIRE(policy == SCHED_OTHER);
+}
+
+TEST_CASE("Jitter probe", "[RealTime]") {
+    RealTime::Config cfg;
+    RealTime::prefaultStack();
+    const Histogram &hist = Stats::get().histogram("test.wakeup_jitter");
+    uint64_t before = hist.count();
+    {
+        RealTime::JitterProbe probe(cfg, "test");
+        REQUIRE(&probe.histogram() == &hist);
+        this_thread::sleep_for(50ms);
+        REQUIRE(hist.count() > before);
+    }
+    // Stopped by the destructor.
+    uint64_t stopped = hist.count();
+    this_thread::sleep_for(20ms);
+    REQUIRE(hist.count() == stopped);
+}
@@ -0,0 +1,34 @@
+#include "RemoteUDevice.hpp"
+#include "LocalChannel.hpp"
+#include <catch2/catch.hpp>
+
+using namespace std;
+using namespace std::chrono;
+
+TEST_CASE("Discarding output", "[RemoteUDevice]") {
+    auto [macrod, inputd] = LocalChannel<KBDAction>::pair();
+    RemoteUDevice udev(macrod.get());
+    KBDAction ac;
+
+    // Output sent outside of handling an event, like from a spawn callback.
+    udev.setDiscarding(true);
+    udev.emit(EV_KEY, KEY_A, 1);
+    udev.emitBatch(string(2 * IUDevice::PACKED_EVENT_SIZE, '\0'), true);
+    udev.flush();
+    REQUIRE(udev.getDiscarded() == 3);
+    udev.setDiscarding(false);
+    REQUIRE(!inputd->poll(0ms));
+
+    // The reply to the next event only carries its own output.
+    udev.emit(EV_KEY, KEY_B, 1);
+    udev.done();
+    inputd->recv(&ac, 100ms);
+    REQUIRE(!ac.done);
+    REQUIRE(ac.ev.code == KEY_B);
+    inputd->recv(&ac, 100ms);
+    REQUIRE(ac.done);
+    REQUIRE(!inputd->poll(0ms));
+
+    udev.setDiscarding(true);
+    REQUIRE(udev.getDiscarded() == 0);
+}
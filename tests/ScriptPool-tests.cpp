@@ -0,0 +1,113 @@
+#include "ScriptPool.hpp"
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+/** Prepare a script that remembers the number of scripts prepared before
+ *  it, in the global n. */
+static ScriptPool::Factory counter(atomic<int> &made) {
+    return [&made]() {
+        auto sc = make_unique<MacroScript>();
+        string code = "n = " + to_string(made++);
+        sc->exec("prepare", code);
+        return sc;
+    };
+}
+
+static int getN(MacroScript &sc) {
+    lua_State *L = sc.getL();
+    lua_getglobal(L, "n");
+    int n = (int) lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return n;
+}
+
+/** Wait for cond to hold, false if it didn't before the timeout. */
+template <class F>
+static bool waitFor(F cond, milliseconds timeout = 5000ms) {
+    auto end = steady_clock::now() + timeout;
+    while (!cond()) {
+        if (steady_clock::now() >= end)
+            return false;
+        this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+/** Wait for the pool to have a script ready. */
+static unique_ptr<MacroScript> takeReady(ScriptPool &pool, milliseconds timeout = 5000ms) {
+    auto end = steady_clock::now() + timeout;
+    while (steady_clock::now() < end) {
+        if (auto sc = pool.take())
+            return sc;
+        this_thread::sleep_for(1ms);
+    }
+    return nullptr;
+}
+
+TEST_CASE("Refill", "[ScriptPool]") {
+    atomic<int> made(0);
+    ScriptPool pool(counter(made), 2);
+    REQUIRE(pool.take() == nullptr);
+    REQUIRE(pool.getStats().misses == 1);
+    pool.start();
+    for (int i = 0; i < 5; i++) {
+        auto sc = takeReady(pool);
+        REQUIRE(sc != nullptr);
+        REQUIRE(getN(*sc) == i);
+    }
+    REQUIRE(pool.getStats().hits == 5);
+    // The pool is refilled up to its size, and no further.
+    REQUIRE(waitFor([&]() { return made >= 7; }));
+    this_thread::sleep_for(50ms);
+    REQUIRE(made == 7);
+}
+
+TEST_CASE("Invalidate", "[ScriptPool]") {
+    atomic<int> made(0);
+    ScriptPool pool(counter(made), 2);
+    pool.start();
+    REQUIRE(waitFor([&]() { return made >= 2; }));
+    this_thread::sleep_for(10ms);
+    pool.invalidate();
+    auto sc = takeReady(pool);
+    REQUIRE(sc != nullptr);
+    REQUIRE(getN(*sc) >= 2);
+    REQUIRE(pool.getStats().discarded == 2);
+}
+
+TEST_CASE("Failure", "[ScriptPool]") {
+    atomic<int> calls(0);
+    atomic<bool> fail(true);
+    ScriptPool pool([&]() {
+        calls++;
+        if (fail)
+            throw runtime_error("no keymap");
+        return make_unique<MacroScript>();
+    }, 2);
+    pool.start();
+    this_thread::sleep_for(50ms);
+    // It does not keep trying until something changes.
+    REQUIRE(calls == 1);
+    REQUIRE(pool.getStats().failed == 1);
+    REQUIRE(pool.take() == nullptr);
+    fail = false;
+    pool.invalidate();
+    REQUIRE(takeReady(pool) != nullptr);
+}
+
+TEST_CASE("Disabled", "[ScriptPool]") {
+    atomic<int> made(0);
+    ScriptPool pool(counter(made), 1);
+    pool.start();
+    REQUIRE(takeReady(pool) != nullptr);
+    pool.setSize(0);
+    this_thread::sleep_for(50ms);
+    REQUIRE(pool.take() == nullptr);
+    REQUIRE(made <= 2);
+}
@@ -0,0 +1,110 @@
+#include "Spawner.hpp"
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <stdlib.h>
+    #include <unistd.h>
+}
+
+using namespace std;
+using namespace std::chrono;
+
+/** Wait until n results have been collected. */
+static vector<SpawnResult> collect(Spawner &sp, size_t n, milliseconds timeout = 5000ms) {
+    vector<SpawnResult> results;
+    auto end = steady_clock::now() + timeout;
+    while (results.size() < n && steady_clock::now() < end) {
+        if (!sp.hasResults()) {
+            this_thread::sleep_for(1ms);
+            continue;
+        }
+        for (auto &r : sp.takeResults())
+            results.push_back(std::move(r));
+    }
+    return results;
+}
+
+TEST_CASE("Capture", "[Spawner]") {
+    Spawner sp;
+    int id = sp.spawn("printf 'a b c'; exit 3", true);
+    REQUIRE(id != 0);
+    REQUIRE(Spawner::inFlight() == 1);
+    auto results = collect(sp, 1);
+    REQUIRE(results.size() == 1);
+    REQUIRE(results[0].id == id);
+    REQUIRE(results[0].out == "a b c");
+    REQUIRE(results[0].status == 3);
+    REQUIRE(Spawner::inFlight() == 0);
+}
+
+TEST_CASE("Killed", "[Spawner]") {
+    Spawner sp;
+    REQUIRE(sp.spawn("kill -TERM $$", true) != 0);
+    auto results = collect(sp, 1);
+    REQUIRE(results.size() == 1);
+    REQUIRE(results[0].status == 128 + 15);
+}
+
+TEST_CASE("Large output", "[Spawner]") {
+    Spawner sp;
+    REQUIRE(sp.spawn("head -c 3000000 /dev/zero", true) != 0);
+    auto results = collect(sp, 1);
+    REQUIRE(results.size() == 1);
+    REQUIRE(results[0].out.size() == ProcessReaper::MAX_CAPTURE);
+    REQUIRE(results[0].status == 0);
+}
+
+TEST_CASE("Does not block", "[Spawner]") {
+    Spawner sp;
+    auto start = steady_clock::now();
+    REQUIRE(sp.spawn("sleep 0.3", false) != 0);
+    int id = sp.spawn("sleep 0.2; echo done", true);
+    REQUIRE(steady_clock::now() - start < 200ms);
+    REQUIRE(!sp.hasResults());
+    auto results = collect(sp, 1);
+    REQUIRE(results.size() == 1);
+    REQUIRE(results[0].id == id);
+    REQUIRE(results[0].out == "done\n");
+}
+
+TEST_CASE("Many processes", "[Spawner]") {
+    Spawner sp;
+    for (int i = 0; i < 50; i++)
+        REQUIRE(sp.spawn("echo " + to_string(i), true) != 0);
+    auto results = collect(sp, 50);
+    REQUIRE(results.size() == 50);
+    for (auto &r : results)
+        REQUIRE(r.out == to_string(r.id - 1) + "\n");
+}
+
+TEST_CASE("Destroyed while running", "[Spawner]") {
+    {
+        Spawner sp;
+        REQUIRE(sp.spawn("sleep 0.1", true) != 0);
+    }
+    auto end = steady_clock::now() + 5000ms;
+    while (Spawner::inFlight() != 0 && steady_clock::now() < end)
+        this_thread::sleep_for(1ms);
+    REQUIRE(Spawner::inFlight() == 0);
+}
+
+TEST_CASE("Dry run", "[Spawner]") {
+    char tmpl[] = "/tmp/hawck-spawn.XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    string path = string(tmpl) + "/ran";
+
+    Spawner sp;
+    sp.setDryRun(true);
+    int a = sp.spawn("touch " + path, false),
+        b = sp.spawn("touch " + path, true);
+    REQUIRE(a != 0);
+    REQUIRE(b != a);
+    REQUIRE(sp.spawnCount() == 2);
+    REQUIRE(Spawner::inFlight() == 0);
+    this_thread::sleep_for(100ms);
+    REQUIRE(access(path.c_str(), F_OK) == -1);
+    rmdir(tmpl);
+}
@@ -0,0 +1,149 @@
+#include "Stats.hpp"
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+}
+
+using namespace std;
+
+TEST_CASE("Histogram buckets", "[Stats]") {
+    // Buckets are contiguous, and every value is within its bucket.
+    uint64_t bad = 0;
+    for (uint64_t v = 0; v < 100000; v++) {
+        int idx = Histogram::index(v);
+        if (v > Histogram::upperBound(idx) || (idx > 0 && v <= Histogram::upperBound(idx - 1)))
+            bad++;
+    }
+    REQUIRE(bad == 0);
+    REQUIRE(Histogram::index(UINT64_MAX) == Histogram::BUCKETS - 1);
+    REQUIRE(Histogram::upperBound(Histogram::BUCKETS - 1) == UINT64_MAX);
+}
+
+TEST_CASE("Histogram percentiles", "[Stats]") {
+    Histogram hist;
+    REQUIRE(hist.percentile(0.5) == 0);
+
+    for (uint64_t v = 1; v <= 10000; v++)
+        hist.record(v);
+    REQUIRE(hist.count() == 10000);
+    REQUIRE(hist.max() == 10000);
+    REQUIRE(hist.mean() == Approx(5000.5));
+
+    // Within the resolution of the buckets.
+    for (double q : {0.5, 0.9, 0.99}) {
+        double expect = q * 10000;
+        REQUIRE(hist.percentile(q) >= expect);
+        REQUIRE(hist.percentile(q) <= expect * (1 + 1.0 / Histogram::SUB_BUCKETS));
+    }
+    REQUIRE(hist.percentile(1.0) == 10000);
+}
+
+TEST_CASE("Histogram percentiles of a few values", "[Stats]") {
+    // Small values have buckets of their own, so these are exact.
+    Histogram hist;
+    hist.record(1);
+    hist.record(2);
+    REQUIRE(hist.percentile(0.0) == 1);
+    REQUIRE(hist.percentile(0.5) == 1);
+    REQUIRE(hist.percentile(0.9) == 2);
+    REQUIRE(hist.percentile(0.99) == 2);
+
+    for (uint64_t v = 3; v <= 10; v++)
+        hist.record(v);
+    REQUIRE(hist.percentile(0.5) == 5);
+    REQUIRE(hist.percentile(0.7) == 7);
+    REQUIRE(hist.percentile(0.75) == 8);
+    REQUIRE(hist.percentile(0.99) == 10);
+}
+
+TEST_CASE("Histogram is thread safe", "[Stats]") {
+    Histogram hist;
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back([&hist, t]() {
+            for (uint64_t i = 0; i < 10000; i++)
+                hist.record(i * (t + 1));
+        });
+    for (auto &t : threads)
+        t.join();
+    REQUIRE(hist.count() == 40000);
+    REQUIRE(hist.max() == 9999 * 4);
+}
+
+TEST_CASE("Stats report", "[Stats]") {
+    auto &stats = Stats::get();
+    stats.histogram("test.stage").record(2500);
+    stats.counter("test.events") += 3;
+    stats.addSource("test", [](StatsReport &rep) {
+        rep.gauge("test.\"quoted\"", 1.5);
+    });
+
+    auto rep = stats.report();
+    string text = rep.text();
+    REQUIRE(text.find("counter   test.events 3") != string::npos);
+    REQUIRE(text.find("histogram test.stage n=1 mean=2.5us") != string::npos);
+
+    string json = rep.json();
+    REQUIRE(json.find("\"test.events\":{\"total\":3,") != string::npos);
+    REQUIRE(json.find("\"test.\\\"quoted\\\"\":1.5") != string::npos);
+
+    stats.removeSource("test");
+    REQUIRE(stats.report().json().find("quoted") == string::npos);
+}
+
+TEST_CASE("Stats socket", "[Stats]") {
+    string path = "/tmp/hawck-stats-test.sock";
+    Stats::get().counter("test.socket") += 1;
+    {
+        StatsServer srv(path, 0600);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        REQUIRE(fd != -1);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        REQUIRE(connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0);
+        REQUIRE(write(fd, "json\n", 5) == 5);
+
+        string resp;
+        char buf[512];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            resp.append(buf, n);
+        close(fd);
+        REQUIRE(resp.substr(0, 12) == "{\"uptime_s\":");
+        REQUIRE(resp.find("\"test.socket\"") != string::npos);
+    }
+    // The socket is removed when the server stops.
+    REQUIRE(access(path.c_str(), F_OK) == -1);
+}
+
+TEST_CASE("Stats socket with a client that doesn't read", "[Stats]") {
+    string path = "/tmp/hawck-stats-test.sock";
+    // Larger than the socket buffers, so that sending it blocks.
+    Stats::get().addDump("test.big", []() { return string(16 << 20, 'x'); });
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(fd != -1);
+    auto start = chrono::steady_clock::now();
+    {
+        StatsServer srv(path, 0600);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        REQUIRE(connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0);
+        REQUIRE(write(fd, "test.big\n", 9) == 9);
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+    // The server gives up on the client instead of hanging.
+    REQUIRE(chrono::steady_clock::now() - start < chrono::seconds(5));
+    close(fd);
+    Stats::get().removeDump("test.big");
+}
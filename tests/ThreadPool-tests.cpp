@@ -0,0 +1,51 @@
+#include "ThreadPool.hpp"
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+TEST_CASE("Results", "[ThreadPool]") {
+    ThreadPool pool(4);
+    REQUIRE(pool.size() == 4);
+    vector<future<int>> results;
+    for (int i = 0; i < 100; i++)
+        results.push_back(pool.submit([i]() { return i * i; }));
+    for (int i = 0; i < 100; i++)
+        REQUIRE(results[i].get() == i * i);
+}
+
+TEST_CASE("Exceptions", "[ThreadPool]") {
+    ThreadPool pool(2);
+    auto fail = pool.submit([]() -> int { throw runtime_error("fail"); });
+    auto ok = pool.submit([]() { return 1; });
+    REQUIRE_THROWS_AS(fail.get(), runtime_error);
+    REQUIRE(ok.get() == 1);
+}
+
+TEST_CASE("Parallel", "[ThreadPool]") {
+    ThreadPool pool(4);
+    auto start = steady_clock::now();
+    vector<future<void>> results;
+    for (int i = 0; i < 4; i++)
+        results.push_back(pool.submit([]() { this_thread::sleep_for(100ms); }));
+    for (auto &r : results)
+        r.get();
+    REQUIRE(steady_clock::now() - start < 300ms);
+}
+
+TEST_CASE("Drains on destruction", "[ThreadPool]") {
+    atomic<int> done(0);
+    {
+        ThreadPool pool(2);
+        for (int i = 0; i < 20; i++)
+            pool.submit([&]() {
+                this_thread::sleep_for(1ms);
+                done++;
+            });
+    }
+    REQUIRE(done == 20);
+}
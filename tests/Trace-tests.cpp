@@ -0,0 +1,114 @@
+#include "Trace.hpp"
+#include "TraceReplay.hpp"
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+    #include <sys/stat.h>
+    #include <unistd.h>
+}
+
+using namespace std;
+
+static string tracePath() {
+    char path[] = "/tmp/hawck-trace-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd != -1);
+    close(fd);
+    return path;
+}
+
+static KBDAction keyAction(uint16_t handle, int code, int value) {
+    KBDAction action;
+    memset(&action, '\0', sizeof(action));
+    action.kbd_handle = handle;
+    action.dev_id.bustype = BUS_USB;
+    action.dev_id.vendor = 0x046d;
+    action.dev_id.product = 0xc31c;
+    action.dev_id.version = 0x0110;
+    action.ev.type = EV_KEY;
+    action.ev.code = code;
+    action.ev.value = value;
+    return action;
+}
+
+TEST_CASE("Trace round trip", "[Trace]") {
+    string path = tracePath();
+    {
+        TraceWriter writer(path);
+        writer.input(keyAction(3, KEY_A, 1));
+        input_event out;
+        memset(&out, '\0', sizeof(out));
+        out.type = EV_KEY;
+        out.code = KEY_B;
+        out.value = 1;
+        writer.output(out);
+        writer.input(keyAction(3, KEY_A, 0));
+        writer.flush();
+    }
+
+    struct stat st;
+    REQUIRE(stat(path.c_str(), &st) == 0);
+    REQUIRE((st.st_mode & 0777) == 0600);
+
+    auto records = TraceReader(path).readAll();
+    REQUIRE(records.size() == 4);
+
+    // The device is only recorded before its first event.
+    REQUIRE(records[0].kind == TraceRecord::DEVICE);
+    REQUIRE(records[0].handle == 3);
+    auto id = records[0].deviceID();
+    REQUIRE(id.bustype == BUS_USB);
+    REQUIRE(id.vendor == 0x046d);
+    REQUIRE(id.product == 0xc31c);
+    REQUIRE(id.version == 0x0110);
+
+    REQUIRE(records[1].kind == TraceRecord::INPUT);
+    REQUIRE(records[1].code == KEY_A);
+    REQUIRE(records[1].value == 1);
+    REQUIRE(records[2].kind == TraceRecord::OUTPUT);
+    REQUIRE(records[2].code == KEY_B);
+    REQUIRE(records[3].kind == TraceRecord::INPUT);
+    REQUIRE(records[3].value == 0);
+    for (size_t i = 1; i < records.size(); i++)
+        REQUIRE(records[i].time_us >= records[i-1].time_us);
+
+    // Replaying hands out the input events with their devices.
+    TraceInputSource source(records, 0);
+    REQUIRE(source.size() == 2);
+    source.start();
+    KBDAction action;
+    REQUIRE(source.getEvent(&action));
+    REQUIRE(action.kbd_handle == 3);
+    REQUIRE(action.dev_id.vendor == 0x046d);
+    REQUIRE(action.ev.code == KEY_A);
+    source.done();
+    REQUIRE(source.getEvent(&action));
+    source.done();
+    REQUIRE(source.finished());
+    REQUIRE(source.getLatencies().size() == 2);
+
+    unlink(path.c_str());
+}
+
+TEST_CASE("Trace rejects other files", "[Trace]") {
+    string path = tracePath();
+    FILE *f = fopen(path.c_str(), "w");
+    fputs("not a trace, but long enough", f);
+    fclose(f);
+    REQUIRE_THROWS_AS(TraceReader(path), TraceError);
+
+    {
+        TraceWriter writer(path);
+        writer.input(keyAction(1, KEY_A, 1));
+    }
+    // Cut the last record short.
+    REQUIRE(truncate(path.c_str(), 16 + 16 + 8) == 0);
+    TraceReader reader(path);
+    TraceRecord rec;
+    REQUIRE(reader.next(rec));
+    REQUIRE_THROWS_AS(reader.next(rec), TraceError);
+
+    unlink(path.c_str());
+}